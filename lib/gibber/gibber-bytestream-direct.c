@@ -410,11 +410,14 @@ transport_buffer_empty_cb (GibberTransport *transport,
       DEBUG ("buffer is now empty. Bytestream can be closed");
       bytestream_closed (self);
     }
-  else if (priv->write_blocked)
-    {
-      DEBUG ("buffer is empty, unblock write to the bytestream");
-      change_write_blocked_state (self, FALSE);
-    }
+}
+
+static void
+transport_writable_cb (GibberTransport *transport,
+                       GibberBytestreamDirect *self)
+{
+  DEBUG ("transport is writable again, unblock write to the bytestream");
+  change_write_blocked_state (self, FALSE);
 }
 
 static void
@@ -429,6 +432,11 @@ set_transport (GibberBytestreamDirect *self,
   priv->transport = g_object_ref (transport);
   gibber_transport_set_handler (transport, transport_handler, self);
 
+  /* Bytestreams carry bulk data, read as much as we can per wakeup */
+  if (GIBBER_IS_FD_TRANSPORT (transport))
+    gibber_fd_transport_set_read_mode (GIBBER_FD_TRANSPORT (transport),
+        GIBBER_FD_TRANSPORT_READ_MODE_BATCHED);
+
   /* The transport will already be connected if it is created from
    * GibberListener. In this case, set the bytestream to open, otherwise
    * it will be done in transport_connected_cb. */
@@ -444,6 +452,8 @@ set_transport (GibberBytestreamDirect *self,
       G_CALLBACK (transport_disconnected_cb), self);
   g_signal_connect (priv->transport, "buffer-empty",
       G_CALLBACK (transport_buffer_empty_cb), self);
+  g_signal_connect (priv->transport, "writable",
+      G_CALLBACK (transport_writable_cb), self);
 }
 
 gboolean
@@ -466,6 +476,17 @@ gibber_bytestream_direct_accept_socket (GibberBytestreamIface *bytestream,
   return TRUE;
 }
 
+/* Returns the transport carrying the bytestream, if it has one yet. The
+ * caller doesn't get a reference */
+GibberTransport *
+gibber_bytestream_direct_get_transport (GibberBytestreamDirect *self)
+{
+  GibberBytestreamDirectPrivate *priv =
+    GIBBER_BYTESTREAM_DIRECT_GET_PRIVATE (self);
+
+  return priv->transport;
+}
+
 static void
 gibber_bytestream_direct_block_reading (GibberBytestreamIface *bytestream,
                                         gboolean block)
@@ -521,10 +542,10 @@ gibber_bytestream_direct_send (GibberBytestreamIface *bytestream,
       return FALSE;
     }
 
-  if (!gibber_transport_buffer_is_empty (priv->transport))
+  if (gibber_transport_is_congested (priv->transport))
     {
-      /* We >don't want to send more data while the buffer isn't empty */
-      DEBUG ("buffer isn't empty. Block write to the bytestream");
+      /* Stop sending until the transport drained below its low watermark */
+      DEBUG ("transport is congested. Block write to the bytestream");
       change_write_blocked_state (self, TRUE);
     }
 
@@ -70,6 +70,9 @@ void gibber_bytestream_direct_set_check_addr_func (
 gboolean gibber_bytestream_direct_accept_socket (
     GibberBytestreamIface *bytestream, GibberTransport *transport);
 
+GibberTransport *gibber_bytestream_direct_get_transport (
+    GibberBytestreamDirect *bytestream);
+
 G_END_DECLS
 
 #endif /* #ifndef __GIBBER_BYTESTREAM_DIRECT_H__ */
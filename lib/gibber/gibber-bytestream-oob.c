@@ -199,11 +199,14 @@ transport_buffer_empty_cb (GibberTransport *transport,
       DEBUG ("buffer is now empty. Bytestream can be closed");
       bytestream_closed (self);
     }
-  else if (priv->write_blocked)
-    {
-      DEBUG ("buffer is empty, unblock write to the bytestream");
-      change_write_blocked_state (self, FALSE);
-    }
+}
+
+static void
+transport_writable_cb (GibberTransport *transport,
+                       GibberBytestreamOOB *self)
+{
+  DEBUG ("transport is writable again, unblock write to the bytestream");
+  change_write_blocked_state (self, FALSE);
 }
 
 static void
@@ -232,6 +235,8 @@ set_transport (GibberBytestreamOOB *self,
       G_CALLBACK (transport_disconnected_cb), self);
   g_signal_connect (transport, "buffer-empty",
       G_CALLBACK (transport_buffer_empty_cb), self);
+  g_signal_connect (transport, "writable",
+      G_CALLBACK (transport_writable_cb), self);
 }
 
 static void
@@ -773,10 +778,10 @@ gibber_bytestream_oob_send (GibberBytestreamIface *bytestream,
       return FALSE;
     }
 
-  if (!gibber_transport_buffer_is_empty (priv->transport))
+  if (gibber_transport_is_congested (priv->transport))
     {
-      /* We >don't want to send more data while the buffer isn't empty */
-      DEBUG ("buffer isn't empty. Block write to the bytestream");
+      /* Stop sending until the transport drained below its low watermark */
+      DEBUG ("transport is congested. Block write to the bytestream");
       change_write_blocked_state (self, TRUE);
     }
 
@@ -0,0 +1,566 @@
+/*
+ * gibber-fd-relay.c - Source for GibberFdRelay
+ * Copyright (C) 2009 Collabora Ltd.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+/* needed for splice */
+#define _GNU_SOURCE
+
+#include "config.h"
+#include "gibber-fd-relay.h"
+
+#include <errno.h>
+#include <string.h>
+
+#ifdef HAVE_FCNTL_H
+# include <fcntl.h>
+#endif
+
+#ifdef HAVE_UNISTD_H
+# include <unistd.h>
+#endif
+
+#define DEBUG_FLAG DEBUG_TRANSPORT
+#include "gibber-debug.h"
+
+/* GibberFdRelay moves data between the fds of two GibberFdTransports with
+ * splice(), through a pipe per direction, so it never gets copied to
+ * userspace. While running the transports don't receive anything themselves.
+ * When either side hits EOF or an error the relay hands both transports back
+ * and emits stopped; the transports then notice the EOF or error on their
+ * own, so the usual close semantics apply. */
+
+G_DEFINE_TYPE (GibberFdRelay, gibber_fd_relay, G_TYPE_OBJECT)
+
+/* signal enum */
+enum
+{
+  STOPPED,
+  LAST_SIGNAL
+};
+
+static guint signals[LAST_SIGNAL] = {0};
+
+/* Bytes spliced into a pipe at once, the default pipe capacity on Linux */
+#define CHUNK_SIZE (64 * 1024)
+/* Bytes moved in one direction per wakeup, so one busy direction can't
+ * starve the other one */
+#define BUDGET (1024 * 1024)
+
+typedef struct {
+  GibberFdRelay *relay;
+  GibberFdTransport *from;
+  GibberFdTransport *to;
+  /* pipe[0] is the end to read from */
+  int pipe[2];
+  /* Bytes currently sitting in the pipe */
+  gsize in_pipe;
+  gboolean eof;
+  GIOChannel *from_channel;
+  GIOChannel *to_channel;
+  /* Watches either from_channel for input or to_channel for output */
+  guint watch;
+  gboolean waiting_out;
+} Direction;
+
+typedef enum {
+  PUMP_WAIT_IN,
+  PUMP_WAIT_OUT,
+  PUMP_EOF,
+  PUMP_ERROR,
+} PumpResult;
+
+/* private structure */
+typedef struct _GibberFdRelayPrivate GibberFdRelayPrivate;
+
+struct _GibberFdRelayPrivate
+{
+  GibberFdTransport *transports[2];
+  Direction directions[2];
+  gboolean running;
+
+  gboolean dispose_has_run;
+};
+
+#define GIBBER_FD_RELAY_GET_PRIVATE(o) \
+  ((GibberFdRelayPrivate *) ((GibberFdRelay *) o)->priv)
+
+GQuark
+gibber_fd_relay_error_quark (void)
+{
+  static GQuark quark = 0;
+
+  if (!quark)
+    quark = g_quark_from_static_string ("gibber_fd_relay_error");
+
+  return quark;
+}
+
+static void
+gibber_fd_relay_init (GibberFdRelay *self)
+{
+  GibberFdRelayPrivate *priv = G_TYPE_INSTANCE_GET_PRIVATE (self,
+      GIBBER_TYPE_FD_RELAY, GibberFdRelayPrivate);
+  guint i;
+
+  self->priv = priv;
+
+  for (i = 0; i < 2; i++)
+    {
+      priv->directions[i].relay = self;
+      priv->directions[i].pipe[0] = -1;
+      priv->directions[i].pipe[1] = -1;
+    }
+}
+
+static void stop_relay (GibberFdRelay *self, gboolean emit);
+
+static void
+gibber_fd_relay_dispose (GObject *object)
+{
+  GibberFdRelay *self = GIBBER_FD_RELAY (object);
+  GibberFdRelayPrivate *priv = GIBBER_FD_RELAY_GET_PRIVATE (self);
+  guint i;
+
+  if (priv->dispose_has_run)
+    return;
+
+  priv->dispose_has_run = TRUE;
+
+  stop_relay (self, FALSE);
+
+  for (i = 0; i < 2; i++)
+    {
+      if (priv->transports[i] == NULL)
+        continue;
+
+      g_signal_handlers_disconnect_matched (priv->transports[i],
+          G_SIGNAL_MATCH_DATA, 0, 0, NULL, NULL, self);
+      g_object_unref (priv->transports[i]);
+      priv->transports[i] = NULL;
+    }
+
+  if (G_OBJECT_CLASS (gibber_fd_relay_parent_class)->dispose)
+    G_OBJECT_CLASS (gibber_fd_relay_parent_class)->dispose (object);
+}
+
+static void
+gibber_fd_relay_class_init (GibberFdRelayClass *gibber_fd_relay_class)
+{
+  GObjectClass *object_class = G_OBJECT_CLASS (gibber_fd_relay_class);
+
+  g_type_class_add_private (gibber_fd_relay_class,
+      sizeof (GibberFdRelayPrivate));
+
+  object_class->dispose = gibber_fd_relay_dispose;
+
+  signals[STOPPED] =
+    g_signal_new ("stopped",
+                  G_OBJECT_CLASS_TYPE (gibber_fd_relay_class),
+                  G_SIGNAL_RUN_LAST | G_SIGNAL_DETAILED,
+                  0,
+                  NULL, NULL,
+                  g_cclosure_marshal_VOID__VOID,
+                  G_TYPE_NONE, 0);
+}
+
+static void
+transport_disconnected_cb (GibberTransport *transport,
+    GibberFdRelay *self)
+{
+  DEBUG ("transport disconnected, stop relaying");
+  stop_relay (self, TRUE);
+}
+
+/**
+ * gibber_fd_relay_new:
+ * @a: a connected #GibberFdTransport
+ * @b: a connected #GibberFdTransport
+ *
+ * Returns: a new relay moving data between @a and @b once started
+ */
+GibberFdRelay *
+gibber_fd_relay_new (GibberFdTransport *a,
+    GibberFdTransport *b)
+{
+  GibberFdRelay *self = g_object_new (GIBBER_TYPE_FD_RELAY, NULL);
+  GibberFdRelayPrivate *priv = GIBBER_FD_RELAY_GET_PRIVATE (self);
+  guint i;
+
+  priv->transports[0] = g_object_ref (a);
+  priv->transports[1] = g_object_ref (b);
+
+  for (i = 0; i < 2; i++)
+    {
+      priv->directions[i].from = priv->transports[i];
+      priv->directions[i].to = priv->transports[1 - i];
+
+      g_signal_connect (priv->transports[i], "disconnected",
+          G_CALLBACK (transport_disconnected_cb), self);
+    }
+
+  return self;
+}
+
+gboolean
+gibber_fd_relay_is_supported (void)
+{
+#ifdef HAVE_SPLICE
+  return TRUE;
+#else
+  return FALSE;
+#endif
+}
+
+gboolean
+gibber_fd_relay_is_running (GibberFdRelay *self)
+{
+  GibberFdRelayPrivate *priv = GIBBER_FD_RELAY_GET_PRIVATE (self);
+
+  return priv->running;
+}
+
+#ifdef HAVE_SPLICE
+
+static PumpResult
+pump (Direction *dir)
+{
+  gsize moved = 0;
+  ssize_t n;
+
+  while (moved < BUDGET)
+    {
+      if (dir->in_pipe > 0)
+        {
+          n = splice (dir->pipe[0], NULL, dir->to->fd, NULL, dir->in_pipe,
+              SPLICE_F_MOVE | SPLICE_F_NONBLOCK);
+
+          if (n < 0)
+            {
+              if (errno == EINTR)
+                continue;
+
+              if (errno == EAGAIN)
+                return PUMP_WAIT_OUT;
+
+              DEBUG ("splice to fd %d failed: %s", dir->to->fd,
+                  g_strerror (errno));
+              return PUMP_ERROR;
+            }
+
+          dir->in_pipe -= n;
+          moved += n;
+          continue;
+        }
+
+      if (dir->eof)
+        return PUMP_EOF;
+
+      n = splice (dir->from->fd, NULL, dir->pipe[1], NULL, CHUNK_SIZE,
+          SPLICE_F_MOVE | SPLICE_F_NONBLOCK);
+
+      if (n < 0)
+        {
+          if (errno == EINTR)
+            continue;
+
+          if (errno == EAGAIN)
+            return PUMP_WAIT_IN;
+
+          DEBUG ("splice from fd %d failed: %s", dir->from->fd,
+              g_strerror (errno));
+          return PUMP_ERROR;
+        }
+
+      if (n == 0)
+        dir->eof = TRUE;
+
+      dir->in_pipe += n;
+    }
+
+  /* Budget used up, come back once the main loop had a go at other
+   * sources */
+  return dir->in_pipe > 0 ? PUMP_WAIT_OUT : PUMP_WAIT_IN;
+}
+
+static gboolean direction_io_cb (GIOChannel *source, GIOCondition condition,
+    gpointer data);
+
+static void
+direction_watch (Direction *dir,
+    gboolean out)
+{
+  dir->waiting_out = out;
+
+  if (out)
+    dir->watch = g_io_add_watch (dir->to_channel, G_IO_OUT,
+        direction_io_cb, dir);
+  else
+    dir->watch = g_io_add_watch (dir->from_channel, G_IO_IN,
+        direction_io_cb, dir);
+}
+
+static gboolean
+direction_io_cb (GIOChannel *source,
+    GIOCondition condition,
+    gpointer data)
+{
+  Direction *dir = data;
+  GibberFdRelay *self = dir->relay;
+  gboolean out;
+
+  switch (pump (dir))
+    {
+      case PUMP_WAIT_IN:
+        out = FALSE;
+        break;
+      case PUMP_WAIT_OUT:
+        out = TRUE;
+        break;
+      case PUMP_EOF:
+      case PUMP_ERROR:
+      default:
+        /* Returning FALSE removes this watch */
+        dir->watch = 0;
+
+        g_object_ref (self);
+        stop_relay (self, TRUE);
+        g_object_unref (self);
+        return FALSE;
+    }
+
+  if (out == dir->waiting_out)
+    return TRUE;
+
+  direction_watch (dir, out);
+  return FALSE;
+}
+
+static gboolean
+open_pipe (Direction *dir,
+    GError **error)
+{
+  if (pipe (dir->pipe) != 0)
+    {
+      g_set_error (error, GIBBER_FD_RELAY_ERROR, GIBBER_FD_RELAY_ERROR_FAILED,
+          "pipe failed: %s", g_strerror (errno));
+      return FALSE;
+    }
+
+  fcntl (dir->pipe[0], F_SETFL, O_NONBLOCK);
+  fcntl (dir->pipe[1], F_SETFL, O_NONBLOCK);
+
+  return TRUE;
+}
+
+/* Hand whatever is still in the pipe to the receiving transport, it will be
+ * sent before anything else it gets from now on */
+static void
+flush_pipe (Direction *dir)
+{
+  guint8 *data;
+  gsize len = 0;
+
+  if (dir->in_pipe == 0)
+    return;
+
+  data = g_malloc (dir->in_pipe);
+
+  while (len < dir->in_pipe)
+    {
+      ssize_t n = read (dir->pipe[0], data + len, dir->in_pipe - len);
+
+      if (n < 0 && errno == EINTR)
+        continue;
+
+      if (n <= 0)
+        break;
+
+      len += n;
+    }
+
+  dir->in_pipe = 0;
+
+  if (len > 0 && gibber_transport_get_state (GIBBER_TRANSPORT (dir->to))
+      == GIBBER_TRANSPORT_CONNECTED)
+    {
+      DEBUG ("flushing %" G_GSIZE_FORMAT " relayed bytes", len);
+      gibber_transport_send (GIBBER_TRANSPORT (dir->to), data, len, NULL);
+    }
+
+  g_free (data);
+}
+
+#endif /* HAVE_SPLICE */
+
+static void
+close_direction (Direction *dir)
+{
+  guint i;
+
+  if (dir->watch != 0)
+    {
+      g_source_remove (dir->watch);
+      dir->watch = 0;
+    }
+
+  if (dir->from_channel != NULL)
+    {
+      g_io_channel_unref (dir->from_channel);
+      dir->from_channel = NULL;
+    }
+
+  if (dir->to_channel != NULL)
+    {
+      g_io_channel_unref (dir->to_channel);
+      dir->to_channel = NULL;
+    }
+
+  for (i = 0; i < 2; i++)
+    {
+      if (dir->pipe[i] != -1)
+        {
+          close (dir->pipe[i]);
+          dir->pipe[i] = -1;
+        }
+    }
+
+  dir->in_pipe = 0;
+  dir->eof = FALSE;
+}
+
+static void
+stop_relay (GibberFdRelay *self,
+    gboolean emit)
+{
+  GibberFdRelayPrivate *priv = GIBBER_FD_RELAY_GET_PRIVATE (self);
+  guint i;
+
+  if (!priv->running)
+    return;
+
+  priv->running = FALSE;
+
+  for (i = 0; i < 2; i++)
+    {
+#ifdef HAVE_SPLICE
+      flush_pipe (priv->directions + i);
+#endif
+      close_direction (priv->directions + i);
+    }
+
+  for (i = 0; i < 2; i++)
+    {
+      if (gibber_transport_get_state (GIBBER_TRANSPORT (priv->transports[i]))
+          == GIBBER_TRANSPORT_CONNECTED)
+        gibber_transport_block_receiving (
+            GIBBER_TRANSPORT (priv->transports[i]), FALSE);
+    }
+
+  DEBUG ("relay stopped");
+
+  if (emit)
+    g_signal_emit (self, signals[STOPPED], 0);
+}
+
+/**
+ * gibber_fd_relay_start:
+ * @relay: a #GibberFdRelay
+ * @error: a #GError to fill in on failure
+ *
+ * Starts relaying, which is only possible when both transports are connected
+ * and have nothing left to send. Both transports stop receiving data until
+ * the relay is stopped.
+ *
+ * Returns: %TRUE if the relay started
+ */
+gboolean
+gibber_fd_relay_start (GibberFdRelay *self,
+    GError **error)
+{
+#ifdef HAVE_SPLICE
+  GibberFdRelayPrivate *priv = GIBBER_FD_RELAY_GET_PRIVATE (self);
+  guint i;
+
+  g_return_val_if_fail (!priv->running, FALSE);
+
+  for (i = 0; i < 2; i++)
+    {
+      GibberTransport *transport = GIBBER_TRANSPORT (priv->transports[i]);
+
+      if (gibber_transport_get_state (transport) !=
+          GIBBER_TRANSPORT_CONNECTED || priv->transports[i]->fd < 0)
+        {
+          g_set_error (error, GIBBER_FD_RELAY_ERROR,
+              GIBBER_FD_RELAY_ERROR_FAILED, "transport isn't connected");
+          return FALSE;
+        }
+
+      /* Queued data would end up behind the relayed data */
+      if (!gibber_transport_buffer_is_empty (transport))
+        {
+          g_set_error (error, GIBBER_FD_RELAY_ERROR,
+              GIBBER_FD_RELAY_ERROR_BUSY, "transport has data queued");
+          return FALSE;
+        }
+    }
+
+  for (i = 0; i < 2; i++)
+    {
+      if (!open_pipe (priv->directions + i, error))
+        {
+          close_direction (priv->directions);
+          close_direction (priv->directions + 1);
+          return FALSE;
+        }
+    }
+
+  for (i = 0; i < 2; i++)
+    {
+      Direction *dir = priv->directions + i;
+
+      gibber_transport_block_receiving (GIBBER_TRANSPORT (dir->from), TRUE);
+
+      dir->from_channel = g_io_channel_unix_new (dir->from->fd);
+      dir->to_channel = g_io_channel_unix_new (dir->to->fd);
+      direction_watch (dir, FALSE);
+    }
+
+  priv->running = TRUE;
+  DEBUG ("relaying between fd %d and fd %d", priv->transports[0]->fd,
+      priv->transports[1]->fd);
+
+  return TRUE;
+#else
+  g_set_error (error, GIBBER_FD_RELAY_ERROR,
+      GIBBER_FD_RELAY_ERROR_NOT_SUPPORTED, "splice() isn't available");
+  return FALSE;
+#endif
+}
+
+/**
+ * gibber_fd_relay_stop:
+ * @relay: a #GibberFdRelay
+ *
+ * Stops relaying. Data already moved out of one transport is queued on the
+ * other one, and both transports receive again.
+ */
+void
+gibber_fd_relay_stop (GibberFdRelay *self)
+{
+  stop_relay (self, FALSE);
+}
@@ -0,0 +1,84 @@
+/*
+ * gibber-fd-relay.h - Header for GibberFdRelay
+ * Copyright (C) 2009 Collabora Ltd.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+#ifndef __GIBBER_FD_RELAY_H__
+#define __GIBBER_FD_RELAY_H__
+
+#include <glib-object.h>
+
+#include "gibber-fd-transport.h"
+
+G_BEGIN_DECLS
+
+GQuark gibber_fd_relay_error_quark (void);
+#define GIBBER_FD_RELAY_ERROR gibber_fd_relay_error_quark ()
+
+typedef enum
+{
+  GIBBER_FD_RELAY_ERROR_NOT_SUPPORTED,
+  GIBBER_FD_RELAY_ERROR_BUSY,
+  GIBBER_FD_RELAY_ERROR_FAILED,
+} GibberFdRelayError;
+
+typedef struct _GibberFdRelay GibberFdRelay;
+typedef struct _GibberFdRelayClass GibberFdRelayClass;
+
+struct _GibberFdRelayClass {
+  GObjectClass parent_class;
+};
+
+struct _GibberFdRelay {
+  GObject parent;
+
+  gpointer priv;
+};
+
+GType gibber_fd_relay_get_type (void);
+
+/* TYPE MACROS */
+#define GIBBER_TYPE_FD_RELAY \
+  (gibber_fd_relay_get_type ())
+#define GIBBER_FD_RELAY(obj) \
+  (G_TYPE_CHECK_INSTANCE_CAST((obj), GIBBER_TYPE_FD_RELAY, \
+   GibberFdRelay))
+#define GIBBER_FD_RELAY_CLASS(klass) \
+  (G_TYPE_CHECK_CLASS_CAST((klass), GIBBER_TYPE_FD_RELAY, \
+   GibberFdRelayClass))
+#define GIBBER_IS_FD_RELAY(obj) \
+  (G_TYPE_CHECK_INSTANCE_TYPE((obj), GIBBER_TYPE_FD_RELAY))
+#define GIBBER_IS_FD_RELAY_CLASS(klass) \
+  (G_TYPE_CHECK_CLASS_TYPE((klass), GIBBER_TYPE_FD_RELAY))
+#define GIBBER_FD_RELAY_GET_CLASS(obj) \
+  (G_TYPE_INSTANCE_GET_CLASS ((obj), GIBBER_TYPE_FD_RELAY, \
+   GibberFdRelayClass))
+
+gboolean gibber_fd_relay_is_supported (void);
+
+GibberFdRelay *gibber_fd_relay_new (GibberFdTransport *a,
+    GibberFdTransport *b);
+
+gboolean gibber_fd_relay_start (GibberFdRelay *relay, GError **error);
+
+void gibber_fd_relay_stop (GibberFdRelay *relay);
+
+gboolean gibber_fd_relay_is_running (GibberFdRelay *relay);
+
+G_END_DECLS
+
+#endif /* #ifndef __GIBBER_FD_RELAY_H__*/
@@ -30,6 +30,11 @@
 # include <unistd.h>
 #endif
 
+#ifdef HAVE_SYS_UIO_H
+# include <sys/uio.h>
+#endif
+
+#include "gibber-reactor.h"
 #include "gibber-sockets.h"
 
 #define DEBUG_FLAG DEBUG_NET
@@ -42,6 +47,9 @@ static gboolean _channel_io_out (GIOChannel *source,
 static gboolean gibber_fd_transport_send (GibberTransport *transport,
     const guint8 *data, gsize size, GError **error);
 
+static gboolean gibber_fd_transport_sendv (GibberTransport *transport,
+    const GibberBuffer *buffers, guint n_buffers, GError **error);
+
 static void gibber_fd_transport_disconnect (GibberTransport *transport);
 
 static gboolean gibber_fd_transport_get_peeraddr (GibberTransport *transport,
@@ -56,6 +64,9 @@ static void _do_disconnect (GibberFdTransport *self);
 static gboolean gibber_fd_transport_buffer_is_empty (
     GibberTransport *transport);
 
+static gsize gibber_fd_transport_get_queued_bytes (
+    GibberTransport *transport);
+
 static void gibber_fd_transport_block_receiving (GibberTransport *transport,
     gboolean block);
 
@@ -72,6 +83,43 @@ gibber_fd_transport_error_quark (void)
   return quark;
 }
 
+/* Unsent data is kept as a chain of segments instead of one flat buffer, so
+ * flushing part of the backlog never has to move the rest of it around */
+#define SEGMENT_SIZE 4096
+
+/* Maximum number of buffers handed to a single writev call */
+#define MAX_IOV 64
+
+typedef struct {
+  /* bytes allocated for data */
+  gsize size;
+  /* bytes of data filled in */
+  gsize length;
+  /* bytes of data already written out */
+  gsize offset;
+  guint8 data[1];
+} OutputSegment;
+
+/* Receive buffers of the batched read mode are sized in powers of two between
+ * READ_BUFFER_MIN and READ_BUFFER_MAX, and recycled through a small pool
+ * shared by all transports */
+#define READ_BUFFER_MIN (4 * 1024)
+#define READ_BUFFER_DEFAULT (16 * 1024)
+#define READ_BUFFER_MAX (256 * 1024)
+#define READ_POOL_CLASSES 7
+#define READ_POOL_DEPTH 4
+
+/* Maximum number of bytes read per wakeup in batched mode by default */
+#define READ_BUDGET_DEFAULT (1024 * 1024)
+
+/* Number of consecutive wakeups using less than a quarter of the read buffer
+ * before it gets shrunk */
+#define READ_SHRINK_AFTER 8
+
+/* Free buffers are chained through their first bytes */
+static gpointer read_pool[READ_POOL_CLASSES];
+static guint read_pool_len[READ_POOL_CLASSES];
+
 /* private structure */
 typedef struct _GibberFdTransportPrivate GibberFdTransportPrivate;
 
@@ -82,8 +130,23 @@ struct _GibberFdTransportPrivate
   guint watch_in;
   guint watch_out;
   guint watch_err;
-  GString *output_buffer;
+  /* When set, the fd is registered with the reactor instead of having the
+   * watches above */
+  GibberReactor *reactor;
+  GIOCondition reactor_events;
+  /* queue of OutputSegment */
+  GQueue output_queue;
+  /* total number of unsent bytes in output_queue */
+  gsize output_queued;
   gboolean receiving_blocked;
+
+  GibberFdTransportReadMode read_mode;
+  gsize read_budget;
+  /* Taken from the pool for the duration of a batched read */
+  guint8 *read_buffer;
+  /* Size to take next time, adapted to how much came in per wakeup */
+  gsize read_buffer_size;
+  guint read_quiet_wakeups;
 };
 
 #define GIBBER_FD_TRANSPORT_GET_PRIVATE(o)  \
@@ -97,10 +160,15 @@ gibber_fd_transport_init (GibberFdTransport *self)
   GibberFdTransportPrivate *priv = GIBBER_FD_TRANSPORT_GET_PRIVATE (self);
   self->fd = -1;
   priv->channel = NULL;
-  priv->output_buffer = NULL;
+  g_queue_init (&priv->output_queue);
+  priv->output_queued = 0;
   priv->watch_in = 0;
   priv->watch_out = 0;
   priv->watch_err = 0;
+  priv->read_mode = GIBBER_FD_TRANSPORT_READ_MODE_SINGLE;
+  priv->read_budget = READ_BUDGET_DEFAULT;
+  priv->read_buffer = NULL;
+  priv->read_buffer_size = READ_BUFFER_DEFAULT;
 }
 
 static void gibber_fd_transport_dispose (GObject *object);
@@ -108,6 +176,10 @@ static void gibber_fd_transport_finalize (GObject *object);
 static GibberFdIOResult gibber_fd_transport_write (
    GibberFdTransport *fd_transport, GIOChannel *channel, const guint8 *data,
    int len, gsize *written, GError **error);
+static GibberFdIOResult gibber_fd_transport_writev (
+   GibberFdTransport *fd_transport, GIOChannel *channel,
+   const GibberBuffer *buffers, guint n_buffers, gsize *written,
+   GError **error);
 
 static void
 gibber_fd_transport_class_init (
@@ -124,14 +196,17 @@ gibber_fd_transport_class_init (
   object_class->finalize = gibber_fd_transport_finalize;
 
   transport_class->send = gibber_fd_transport_send;
+  transport_class->sendv = gibber_fd_transport_sendv;
   transport_class->disconnect = gibber_fd_transport_disconnect;
   transport_class->get_peeraddr = gibber_fd_transport_get_peeraddr;
   transport_class->get_sockaddr = gibber_fd_transport_get_sockaddr;
   transport_class->buffer_is_empty = gibber_fd_transport_buffer_is_empty;
+  transport_class->get_queued_bytes = gibber_fd_transport_get_queued_bytes;
   transport_class->block_receiving = gibber_fd_transport_block_receiving;
 
   gibber_fd_transport_class->read = gibber_fd_transport_read;
   gibber_fd_transport_class->write = gibber_fd_transport_write;
+  gibber_fd_transport_class->writev = gibber_fd_transport_writev;
 }
 
 void
@@ -151,9 +226,13 @@ gibber_fd_transport_dispose (GObject *object)
     G_OBJECT_CLASS (gibber_fd_transport_parent_class)->dispose (object);
 }
 
+static void _release_read_buffer (GibberFdTransport *self);
+
 void
 gibber_fd_transport_finalize (GObject *object)
 {
+  _release_read_buffer (GIBBER_FD_TRANSPORT (object));
+
   G_OBJECT_CLASS (gibber_fd_transport_parent_class)->finalize (object);
 }
 
@@ -171,13 +250,23 @@ _do_disconnect (GibberFdTransport *self)
 
   if (priv->channel != NULL)
     {
-      if (priv->watch_in != 0)
-        g_source_remove (priv->watch_in);
+      if (priv->reactor != NULL)
+        {
+          gibber_reactor_remove (priv->reactor, self->fd);
+          gibber_reactor_unref (priv->reactor);
+          priv->reactor = NULL;
+        }
+      else
+        {
+          if (priv->watch_in != 0)
+            g_source_remove (priv->watch_in);
 
-      if (priv->watch_out)
-        g_source_remove (priv->watch_out);
+          if (priv->watch_out)
+            g_source_remove (priv->watch_out);
+
+          g_source_remove (priv->watch_err);
+        }
 
-      g_source_remove (priv->watch_err);
       g_io_channel_shutdown (priv->channel, FALSE, NULL);
       g_io_channel_unref (priv->channel);
       priv->channel = NULL;
@@ -188,11 +277,9 @@ _do_disconnect (GibberFdTransport *self)
     }
   self->fd = -1;
 
-  if (priv->output_buffer)
-    {
-      g_string_free (priv->output_buffer, TRUE);
-      priv->output_buffer = NULL;
-    }
+  while (!g_queue_is_empty (&priv->output_queue))
+    g_free (g_queue_pop_head (&priv->output_queue));
+  priv->output_queued = 0;
 
   if (!priv->dispose_has_run)
     /* If we are disposing we don't care about the state anymore */
@@ -200,16 +287,40 @@ _do_disconnect (GibberFdTransport *self)
         GIBBER_TRANSPORT_DISCONNECTED);
 }
 
+static void
+_update_reactor (GibberFdTransport *self)
+{
+  GibberFdTransportPrivate *priv = GIBBER_FD_TRANSPORT_GET_PRIVATE (self);
+  GIOCondition events = 0;
+
+  if (!priv->receiving_blocked)
+    events |= G_IO_IN;
+
+  if (!g_queue_is_empty (&priv->output_queue))
+    events |= G_IO_OUT;
+
+  if (events == priv->reactor_events)
+    return;
+
+  priv->reactor_events = events;
+  gibber_reactor_modify (priv->reactor, self->fd, events);
+}
+
 static gboolean
-_try_write (GibberFdTransport *self, const guint8 *data, int len,
-    gsize *written, GError **err)
+_try_writev (GibberFdTransport *self, const GibberBuffer *buffers,
+    guint n_buffers, gsize *written, GError **err)
 {
   GibberFdTransportPrivate *priv = GIBBER_FD_TRANSPORT_GET_PRIVATE (self);
   GibberFdTransportClass *cls = GIBBER_FD_TRANSPORT_GET_CLASS (self);
   GibberFdIOResult result;
   GError *error = NULL;
 
-  result = cls->write (self, priv->channel, data, len, written, &error);
+  if (cls->writev != NULL)
+    result = cls->writev (self, priv->channel, buffers, n_buffers, written,
+        &error);
+  else
+    result = cls->write (self, priv->channel, buffers[0].data,
+        buffers[0].length, written, &error);
 
   switch (result)
     {
@@ -231,18 +342,90 @@ _try_write (GibberFdTransport *self, const guint8 *data, int len,
     return TRUE;
 }
 
+static OutputSegment *
+output_segment_new (gsize size)
+{
+  OutputSegment *segment;
+
+  segment = g_malloc (G_STRUCT_OFFSET (OutputSegment, data) + size);
+  segment->size = size;
+  segment->length = 0;
+  segment->offset = 0;
+
+  return segment;
+}
+
+static void
+_queue_output (GibberFdTransport *self, const guint8 *data, gsize len)
+{
+  GibberFdTransportPrivate *priv = GIBBER_FD_TRANSPORT_GET_PRIVATE (self);
+  OutputSegment *tail;
+  gsize n;
+
+  priv->output_queued += len;
+
+  /* Top up the last segment first so lots of small writes don't each end up
+   * in their own segment */
+  tail = g_queue_peek_tail (&priv->output_queue);
+  if (tail != NULL && tail->length < tail->size)
+    {
+      n = MIN (len, tail->size - tail->length);
+      memcpy (tail->data + tail->length, data, n);
+      tail->length += n;
+      data += n;
+      len -= n;
+    }
+
+  if (len == 0)
+    return;
+
+  tail = output_segment_new (MAX (len, SEGMENT_SIZE));
+  memcpy (tail->data, data, len);
+  tail->length = len;
+  g_queue_push_tail (&priv->output_queue, tail);
+}
+
+static void
+_consume_output (GibberFdTransport *self, gsize written)
+{
+  GibberFdTransportPrivate *priv = GIBBER_FD_TRANSPORT_GET_PRIVATE (self);
+
+  g_assert (written <= priv->output_queued);
+  priv->output_queued -= written;
+
+  while (written > 0)
+    {
+      OutputSegment *segment = g_queue_peek_head (&priv->output_queue);
+      gsize left = segment->length - segment->offset;
+
+      if (written < left)
+        {
+          segment->offset += written;
+          break;
+        }
+
+      written -= left;
+      g_free (g_queue_pop_head (&priv->output_queue));
+    }
+}
+
 static gboolean
-_writeout (GibberFdTransport *self, const guint8 *data, gsize len,
-    GError **error)
+_writeout (GibberFdTransport *self, const GibberBuffer *buffers,
+    guint n_buffers, GError **error)
 {
   GibberFdTransportPrivate *priv = GIBBER_FD_TRANSPORT_GET_PRIVATE (self);
   gsize written = 0;
+  gsize len = 0;
+  guint i;
+
+  for (i = 0; i < n_buffers; i++)
+    len += buffers[i].length;
 
   DEBUG ("Writing out %" G_GSIZE_FORMAT " bytes", len);
-  if (priv->output_buffer == NULL || priv->output_buffer->len == 0)
+  if (g_queue_is_empty (&priv->output_queue))
     {
       /* We've got nothing buffer yet so try to write out directly */
-      if (!_try_write (self, data, len, &written, error))
+      if (!_try_writev (self, buffers, n_buffers, &written, error))
         {
           return FALSE;
         }
@@ -250,22 +433,29 @@ _writeout (GibberFdTransport *self, const guint8 *data, gsize len,
 
   if (written == len)
     {
-      gibber_transport_emit_buffer_empty (GIBBER_TRANSPORT (self));
+      if (g_queue_is_empty (&priv->output_queue))
+        gibber_transport_emit_buffer_empty (GIBBER_TRANSPORT (self));
       return TRUE;
     }
 
-  if (priv->output_buffer)
+  for (i = 0; i < n_buffers; i++)
     {
-      g_string_append_len (priv->output_buffer, (gchar *) data + written,
-        len - written);
+      if (written >= buffers[i].length)
+        {
+          written -= buffers[i].length;
+          continue;
+        }
+
+      _queue_output (self, buffers[i].data + written,
+          buffers[i].length - written);
+      written = 0;
     }
-  else
+
+  if (priv->reactor != NULL)
     {
-      priv->output_buffer = g_string_new_len ((gchar *) data + written,
-          len - written);
+      _update_reactor (self);
     }
-
-  if (!priv->watch_out)
+  else if (!priv->watch_out)
     {
       priv->watch_out =
         g_io_add_watch (priv->channel, G_IO_OUT, _channel_io_out, self);
@@ -274,10 +464,9 @@ _writeout (GibberFdTransport *self, const guint8 *data, gsize len,
   return TRUE;
 }
 
-static gboolean
-_channel_io_in (GIOChannel *source, GIOCondition condition, gpointer data)
+static GibberFdIOResult
+_do_read (GibberFdTransport *self)
 {
-  GibberFdTransport *self = GIBBER_FD_TRANSPORT (data);
   GibberFdTransportPrivate *priv =
      GIBBER_FD_TRANSPORT_GET_PRIVATE (self);
   GibberFdIOResult result;
@@ -293,46 +482,127 @@ _channel_io_in (GIOChannel *source, GIOCondition condition, gpointer data)
         break;
       case GIBBER_FD_IO_RESULT_ERROR:
         gibber_transport_emit_error (GIBBER_TRANSPORT(self), error);
-        /* Deliberately falling through */
+        /* Deliberately falling through */
       case GIBBER_FD_IO_RESULT_EOF:
         DEBUG("Failed to read from the transport, closing..");
         _do_disconnect (self);
-        return FALSE;
+        break;
     }
 
-  return TRUE;
+  return result;
 }
 
 static gboolean
-_channel_io_out (GIOChannel *source, GIOCondition condition, gpointer data)
+_channel_io_in (GIOChannel *source, GIOCondition condition, gpointer data)
+{
+  GibberFdIOResult result = _do_read (GIBBER_FD_TRANSPORT (data));
+
+  return result == GIBBER_FD_IO_RESULT_SUCCESS ||
+      result == GIBBER_FD_IO_RESULT_AGAIN;
+}
+
+/* Returns TRUE if there is still data left to write out. full_write, if not
+ * NULL, is set to whether the fd took everything that was offered to it, in
+ * which case it might well take more right away */
+static gboolean
+_flush_output (GibberFdTransport *self, gboolean *full_write)
 {
-  GibberFdTransport *self = GIBBER_FD_TRANSPORT (data);
   GibberFdTransportPrivate *priv =
      GIBBER_FD_TRANSPORT_GET_PRIVATE (self);
-  gsize written;
+  GibberBuffer buffers[MAX_IOV];
+  guint n_buffers = 0;
+  gsize written = 0;
+  gsize len = 0;
+  GList *l;
+
+  if (full_write != NULL)
+    *full_write = FALSE;
+
+  g_assert (!g_queue_is_empty (&priv->output_queue));
 
-  g_assert (priv->output_buffer);
-  if (!_try_write (self, (guint8 *) priv->output_buffer->str,
-                   priv->output_buffer->len, &written, NULL))
+  for (l = priv->output_queue.head; l != NULL && n_buffers < MAX_IOV;
+      l = g_list_next (l))
     {
-      return FALSE;
+      OutputSegment *segment = l->data;
+
+      buffers[n_buffers].data = segment->data + segment->offset;
+      buffers[n_buffers].length = segment->length - segment->offset;
+      len += buffers[n_buffers].length;
+      n_buffers++;
     }
 
-  if (written > 0 )
+  if (!_try_writev (self, buffers, n_buffers, &written, NULL))
     {
-      priv->output_buffer = g_string_erase (priv->output_buffer, 0, written);
+      return FALSE;
     }
 
-  if (priv->output_buffer->len == 0)
+  if (full_write != NULL)
+    *full_write = (written == len);
+
+  _consume_output (self, written);
+
+  if (g_queue_is_empty (&priv->output_queue))
     {
       priv->watch_out = 0;
+      if (priv->reactor != NULL)
+        _update_reactor (self);
       gibber_transport_emit_buffer_empty (GIBBER_TRANSPORT (self));
       return FALSE;
     }
 
+  gibber_transport_check_watermarks (GIBBER_TRANSPORT (self));
+
   return TRUE;
 }
 
+static gboolean
+_channel_io_out (GIOChannel *source, GIOCondition condition, gpointer data)
+{
+  return _flush_output (GIBBER_FD_TRANSPORT (data), NULL);
+}
+
+/* Write out as much of the queued output as the fd takes right now, for
+ * subclasses that have to write to the fd themselves. Returns TRUE if
+ * nothing is queued any more */
+gboolean
+gibber_fd_transport_flush (GibberFdTransport *transport)
+{
+  GibberFdTransportPrivate *priv = GIBBER_FD_TRANSPORT_GET_PRIVATE (
+      transport);
+  gboolean empty;
+
+  g_object_ref (transport);
+
+  /* _flush_output expects to be the watch callback, so take the watch out
+   * of the picture while writing */
+  if (priv->watch_out != 0)
+    {
+      g_source_remove (priv->watch_out);
+      priv->watch_out = 0;
+    }
+
+  while (transport->fd != -1 && !g_queue_is_empty (&priv->output_queue))
+    {
+      gboolean full_write;
+
+      _flush_output (transport, &full_write);
+
+      /* Stop once the fd doesn't take any more */
+      if (!full_write)
+        break;
+    }
+
+  empty = transport->fd != -1 && g_queue_is_empty (&priv->output_queue);
+
+  if (!empty && transport->fd != -1 && priv->reactor == NULL &&
+      priv->watch_out == 0)
+    priv->watch_out = g_io_add_watch (priv->channel, G_IO_OUT,
+        _channel_io_out, transport);
+
+  g_object_unref (transport);
+  return empty;
+}
+
 static gboolean
 _channel_io_err (GIOChannel *source, GIOCondition condition, gpointer data)
 {
@@ -362,6 +632,45 @@ _channel_io_err (GIOChannel *source, GIOCondition condition, gpointer data)
   return FALSE;
 }
 
+static GIOCondition
+_reactor_cb (int fd, GIOCondition condition, gpointer data)
+{
+  GibberFdTransport *self = GIBBER_FD_TRANSPORT (data);
+  GibberFdTransportPrivate *priv = GIBBER_FD_TRANSPORT_GET_PRIVATE (self);
+  GIOCondition again = 0;
+
+  if (condition & G_IO_ERR)
+    {
+      _channel_io_err (priv->channel, G_IO_ERR, self);
+      return 0;
+    }
+
+  /* The handlers might drop the last ref on us */
+  g_object_ref (self);
+
+  /* A partial write means the socket buffer is full, epoll will tell us
+   * when there is room again. Otherwise only the first MAX_IOV segments
+   * went out and no new edge is coming for the rest, so ask to be called
+   * again */
+  if ((condition & G_IO_OUT) && !g_queue_is_empty (&priv->output_queue))
+    {
+      gboolean full_write;
+
+      if (_flush_output (self, &full_write) && full_write &&
+          self->fd != -1)
+        again |= G_IO_OUT;
+    }
+
+  /* A successful read didn't necessarily drain the fd, so ask to be called
+   * again; the next read returns AGAIN if it did */
+  if ((condition & G_IO_IN) && self->fd != -1 &&
+      _do_read (self) == GIBBER_FD_IO_RESULT_SUCCESS && self->fd != -1)
+    again |= G_IO_IN;
+
+  g_object_unref (self);
+  return again;
+}
+
 /* Default read and write implementations */
 static GibberFdIOResult
 gibber_fd_transport_write (GibberFdTransport *fd_transport,
@@ -388,16 +697,209 @@ gibber_fd_transport_write (GibberFdTransport *fd_transport,
     g_assert_not_reached ();
 }
 
+static GibberFdIOResult
+gibber_fd_transport_writev (GibberFdTransport *fd_transport,
+    GIOChannel *channel, const GibberBuffer *buffers, guint n_buffers,
+    gsize *written, GError **error)
+{
+#ifdef HAVE_SYS_UIO_H
+  struct iovec iov[MAX_IOV];
+  ssize_t ret;
+  guint i;
+
+  n_buffers = MIN (n_buffers, MAX_IOV);
+  for (i = 0; i < n_buffers; i++)
+    {
+      iov[i].iov_base = (void *) buffers[i].data;
+      iov[i].iov_len = buffers[i].length;
+    }
+
+  do
+    ret = writev (fd_transport->fd, iov, n_buffers);
+  while (ret == -1 && errno == EINTR);
+
+  if (ret == -1)
+    {
+      int err = errno;
+
+      *written = 0;
+
+      if (err == EAGAIN || err == EWOULDBLOCK)
+        return GIBBER_FD_IO_RESULT_AGAIN;
+
+      g_set_error_literal (error, G_IO_CHANNEL_ERROR,
+          g_io_channel_error_from_errno (err), g_strerror (err));
+      return GIBBER_FD_IO_RESULT_ERROR;
+    }
+
+  *written = ret;
+  return GIBBER_FD_IO_RESULT_SUCCESS;
+#else
+  /* No scatter/gather output on this platform, only write the first buffer;
+   * the caller takes care of queueing whatever wasn't written */
+  return gibber_fd_transport_write (fd_transport, channel, buffers[0].data,
+      buffers[0].length, written, error);
+#endif
+}
+
+static guint
+read_pool_class (gsize size)
+{
+  guint c = 0;
+
+  while (((gsize) READ_BUFFER_MIN << c) < size)
+    c++;
+
+  g_assert (c < READ_POOL_CLASSES);
+  return c;
+}
+
+static guint8 *
+read_buffer_get (gsize size)
+{
+  guint c = read_pool_class (size);
+  gpointer buffer = read_pool[c];
+
+  if (buffer == NULL)
+    return g_malloc (size);
+
+  read_pool[c] = *(gpointer *) buffer;
+  read_pool_len[c]--;
+
+  return buffer;
+}
+
+static void
+read_buffer_put (guint8 *buffer, gsize size)
+{
+  guint c = read_pool_class (size);
+
+  if (read_pool_len[c] >= READ_POOL_DEPTH)
+    {
+      g_free (buffer);
+      return;
+    }
+
+  *(gpointer *) buffer = read_pool[c];
+  read_pool[c] = buffer;
+  read_pool_len[c]++;
+}
+
+static void
+_release_read_buffer (GibberFdTransport *self)
+{
+  GibberFdTransportPrivate *priv = GIBBER_FD_TRANSPORT_GET_PRIVATE (self);
+
+  if (priv->read_buffer == NULL)
+    return;
+
+  read_buffer_put (priv->read_buffer, priv->read_buffer_size);
+  priv->read_buffer = NULL;
+}
+
+static void
+_resize_read_buffer (GibberFdTransport *self, gsize size)
+{
+  GibberFdTransportPrivate *priv = GIBBER_FD_TRANSPORT_GET_PRIVATE (self);
+
+  _release_read_buffer (self);
+  priv->read_buffer_size = size;
+  priv->read_quiet_wakeups = 0;
+}
+
+static GibberFdIOResult
+_read_batched (GibberFdTransport *self, GIOChannel *channel, GError **error)
+{
+  GibberFdTransportPrivate *priv = GIBBER_FD_TRANSPORT_GET_PRIVATE (self);
+  GibberFdIOResult result = GIBBER_FD_IO_RESULT_AGAIN;
+  gsize total = 0;
+
+  /* The handler is free to drop its ref on us while we're still looping */
+  g_object_ref (self);
+
+  while (total < priv->read_budget)
+    {
+      GIOStatus status;
+      gsize bytes_read;
+
+      if (priv->read_buffer == NULL)
+        priv->read_buffer = read_buffer_get (priv->read_buffer_size);
+
+      status = g_io_channel_read_chars (channel, (gchar *) priv->read_buffer,
+          priv->read_buffer_size, &bytes_read, error);
+
+      if (status == G_IO_STATUS_AGAIN)
+        break;
+
+      if (status == G_IO_STATUS_ERROR)
+        {
+          result = GIBBER_FD_IO_RESULT_ERROR;
+          break;
+        }
+
+      if (status == G_IO_STATUS_EOF)
+        {
+          result = GIBBER_FD_IO_RESULT_EOF;
+          break;
+        }
+
+      result = GIBBER_FD_IO_RESULT_SUCCESS;
+      total += bytes_read;
+
+      DEBUG ("Received %" G_GSIZE_FORMAT " bytes", bytes_read);
+      gibber_transport_received_data (GIBBER_TRANSPORT (self),
+          priv->read_buffer, bytes_read);
+
+      /* The handler might have blocked or closed the transport */
+      if (priv->receiving_blocked || self->fd == -1)
+        break;
+
+      /* A short read means the fd is drained, no need to wait for EAGAIN */
+      if (bytes_read < priv->read_buffer_size)
+        break;
+
+      /* Filled the whole buffer, there is probably more to come */
+      if (priv->read_buffer_size < READ_BUFFER_MAX)
+        _resize_read_buffer (self, priv->read_buffer_size * 2);
+    }
+
+  /* Only borrowed for this wakeup, so idle transports don't hold on to large
+   * buffers */
+  _release_read_buffer (self);
+
+  if (total < priv->read_buffer_size / 4)
+    {
+      priv->read_quiet_wakeups++;
+
+      if (priv->read_quiet_wakeups >= READ_SHRINK_AFTER &&
+          priv->read_buffer_size > READ_BUFFER_MIN)
+        _resize_read_buffer (self, priv->read_buffer_size / 2);
+    }
+  else
+    {
+      priv->read_quiet_wakeups = 0;
+    }
+
+  g_object_unref (self);
+
+  return result;
+}
+
 #define BUFSIZE 1024
 
 GibberFdIOResult
 gibber_fd_transport_read (GibberFdTransport *transport,
     GIOChannel *channel, GError **error)
 {
+  GibberFdTransportPrivate *priv = GIBBER_FD_TRANSPORT_GET_PRIVATE (
+      transport);
   guint8  buf[BUFSIZE + 1];
   GIOStatus status;
   gsize bytes_read;
 
+  if (priv->read_mode == GIBBER_FD_TRANSPORT_READ_MODE_BATCHED)
+    return _read_batched (transport, channel, error);
+
   status = g_io_channel_read_chars (channel, (gchar *) buf, BUFSIZE,
     &bytes_read, error);
 
@@ -448,14 +950,27 @@ gibber_fd_transport_set_fd (GibberFdTransport *self, int fd,
   g_io_channel_set_encoding (priv->channel, NULL, NULL);
   g_io_channel_set_buffered (priv->channel, FALSE);
 
-  if (!priv->receiving_blocked)
+  priv->reactor = gibber_reactor_get_default ();
+  priv->reactor_events = priv->receiving_blocked ? 0 : G_IO_IN;
+
+  if (priv->reactor != NULL && gibber_reactor_add (priv->reactor, fd,
+        priv->reactor_events, _reactor_cb, self))
     {
-      priv->watch_in =
-        g_io_add_watch (priv->channel, G_IO_IN, _channel_io_in, self);
+      gibber_reactor_ref (priv->reactor);
     }
+  else
+    {
+      priv->reactor = NULL;
 
-  priv->watch_err =
-    g_io_add_watch (priv->channel, G_IO_ERR, _channel_io_err, self);
+      if (!priv->receiving_blocked)
+        {
+          priv->watch_in =
+            g_io_add_watch (priv->channel, G_IO_IN, _channel_io_in, self);
+        }
+
+      priv->watch_err =
+        g_io_add_watch (priv->channel, G_IO_ERR, _channel_io_err, self);
+    }
 
   gibber_transport_set_state (GIBBER_TRANSPORT(self),
       GIBBER_TRANSPORT_CONNECTED);
@@ -465,7 +980,20 @@ gboolean
 gibber_fd_transport_send (GibberTransport *transport,
     const guint8 *data, gsize size, GError **error)
 {
-  return _writeout (GIBBER_FD_TRANSPORT (transport), data, size, error);
+  GibberBuffer buffer;
+
+  buffer.data = data;
+  buffer.length = size;
+
+  return _writeout (GIBBER_FD_TRANSPORT (transport), &buffer, 1, error);
+}
+
+static gboolean
+gibber_fd_transport_sendv (GibberTransport *transport,
+    const GibberBuffer *buffers, guint n_buffers, GError **error)
+{
+  return _writeout (GIBBER_FD_TRANSPORT (transport), buffers, n_buffers,
+      error);
 }
 
 void
@@ -517,7 +1045,17 @@ gibber_fd_transport_buffer_is_empty (GibberTransport *transport)
   GibberFdTransportPrivate *priv =
      GIBBER_FD_TRANSPORT_GET_PRIVATE (self);
 
-  return (priv->output_buffer == NULL || priv->output_buffer->len == 0);
+  return g_queue_is_empty (&priv->output_queue);
+}
+
+static gsize
+gibber_fd_transport_get_queued_bytes (GibberTransport *transport)
+{
+  GibberFdTransport *self = GIBBER_FD_TRANSPORT (transport);
+  GibberFdTransportPrivate *priv =
+     GIBBER_FD_TRANSPORT_GET_PRIVATE (self);
+
+  return priv->output_queued;
 }
 
 static void
@@ -527,6 +1065,14 @@ gibber_fd_transport_block_receiving (GibberTransport *transport,
   GibberFdTransport *self = GIBBER_FD_TRANSPORT (transport);
   GibberFdTransportPrivate *priv = GIBBER_FD_TRANSPORT_GET_PRIVATE (self);
 
+  if (priv->reactor != NULL)
+    {
+      DEBUG ("%s receiving from the transport", block ? "block" : "unblock");
+      priv->receiving_blocked = block;
+      _update_reactor (self);
+      return;
+    }
+
   if (block && priv->watch_in != 0)
     {
       DEBUG ("block receiving from the transport");
@@ -546,3 +1092,28 @@ gibber_fd_transport_block_receiving (GibberTransport *transport,
 
   priv->receiving_blocked = block;
 }
+
+void
+gibber_fd_transport_set_read_mode (GibberFdTransport *transport,
+    GibberFdTransportReadMode mode)
+{
+  GibberFdTransportPrivate *priv = GIBBER_FD_TRANSPORT_GET_PRIVATE (
+      transport);
+
+  priv->read_mode = mode;
+
+  if (mode == GIBBER_FD_TRANSPORT_READ_MODE_SINGLE)
+    _release_read_buffer (transport);
+}
+
+void
+gibber_fd_transport_set_read_budget (GibberFdTransport *transport,
+    gsize budget)
+{
+  GibberFdTransportPrivate *priv = GIBBER_FD_TRANSPORT_GET_PRIVATE (
+      transport);
+
+  g_return_if_fail (budget > 0);
+
+  priv->read_budget = budget;
+}
@@ -33,6 +33,14 @@ typedef enum {
   GIBBER_FD_IO_RESULT_EOF,
 } GibberFdIOResult;
 
+typedef enum {
+  /* One small read per wakeup; keeps latency low for XMPP like traffic */
+  GIBBER_FD_TRANSPORT_READ_MODE_SINGLE,
+  /* Drain the fd into larger, adaptively sized buffers until it would block
+   * or the per wakeup budget is used up; suits bulk transfers */
+  GIBBER_FD_TRANSPORT_READ_MODE_BATCHED,
+} GibberFdTransportReadMode;
+
 G_BEGIN_DECLS
 
 GQuark gibber_fd_transport_error_quark (void);
@@ -57,6 +65,12 @@ struct _GibberFdTransportClass {
     GibberFdIOResult (*write) (GibberFdTransport *fd_transport,
         GIOChannel *channel, const guint8 *data, int len,
         gsize *written, GError **error);
+    /* Called when several buffers need to be written in one go. Subclasses
+     * overriding write should override this too, or set it to NULL so that
+     * only write is used */
+    GibberFdIOResult (*writev) (GibberFdTransport *fd_transport,
+        GIOChannel *channel, const GibberBuffer *buffers, guint n_buffers,
+        gsize *written, GError **error);
 };
 
 struct _GibberFdTransport {
@@ -91,6 +105,14 @@ GibberFdIOResult gibber_fd_transport_read (GibberFdTransport *transport,
     GIOChannel *channel,
     GError **error);
 
+void gibber_fd_transport_set_read_mode (GibberFdTransport *transport,
+    GibberFdTransportReadMode mode);
+
+void gibber_fd_transport_set_read_budget (GibberFdTransport *transport,
+    gsize budget);
+
+gboolean gibber_fd_transport_flush (GibberFdTransport *transport);
+
 G_END_DECLS
 
 #endif /* #ifndef __GIBBER_FD_TRANSPORT_H__*/
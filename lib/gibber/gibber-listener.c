@@ -17,6 +17,9 @@
  * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
  */
 
+/* needed for accept4 */
+#define _GNU_SOURCE
+
 #include "config.h"
 #include "gibber-listener.h"
 
@@ -54,6 +57,13 @@ enum
 
 static guint signals[LAST_SIGNAL] = {0};
 
+/* Incoming connections are accepted in a loop until the queue is empty, but
+ * only up to this many per wakeup so a flood of them can't starve the rest
+ * of the main loop */
+#define MAX_ACCEPTS_PER_WAKEUP 64
+
+#define DEFAULT_BACKLOG 64
+
 typedef struct {
   GIOChannel *listener;
   guint io_watch_in;
@@ -68,6 +78,9 @@ struct _GibberListenerPrivate
   /* Don't allow to listen again if it is already listening */
   gboolean listening;
   int port;
+  guint backlog;
+
+  GibberListenerStats stats;
 
   gboolean dispose_has_run;
 };
@@ -105,6 +118,7 @@ gibber_listener_init (GibberListener *self)
 
   self->priv = priv;
 
+  priv->backlog = DEFAULT_BACKLOG;
   priv->dispose_has_run = FALSE;
 }
 
@@ -169,31 +183,26 @@ gibber_listener_new (void)
       NULL);
 }
 
-static gboolean
-listener_io_in_cb (GIOChannel *source,
-                   GIOCondition condition,
-                   gpointer user_data)
+static void
+new_connection (GibberListener *self,
+    int nfd,
+    struct sockaddr_storage *addr,
+    socklen_t addrlen)
 {
-  GibberListener *self = GIBBER_LISTENER (user_data);
   GibberFdTransport *transport;
-  int fd, nfd;
   int ret;
   char host[NI_MAXHOST];
   char port[NI_MAXSERV];
-  struct sockaddr_storage addr;
-  socklen_t addrlen = sizeof (struct sockaddr_storage);
 
-  fd = g_io_channel_unix_get_fd (source);
-  nfd = accept (fd, (struct sockaddr *) &addr, &addrlen);
-  gibber_normalize_address (&addr);
+  gibber_normalize_address (addr);
 
 #ifdef GIBBER_TYPE_UNIX_TRANSPORT
-  if (addr.ss_family == AF_UNIX)
+  if (addr->ss_family == AF_UNIX)
     {
       transport = GIBBER_FD_TRANSPORT (gibber_unix_transport_new_from_fd (nfd));
 
       /* UNIX sockets doesn't have port */
-      ret = getnameinfo ((struct sockaddr *) &addr, addrlen,
+      ret = getnameinfo ((struct sockaddr *) addr, addrlen,
           host, NI_MAXHOST, NULL, 0,
           NI_NUMERICHOST);
 
@@ -205,7 +214,7 @@ listener_io_in_cb (GIOChannel *source,
       transport = g_object_new (GIBBER_TYPE_FD_TRANSPORT, NULL);
       gibber_fd_transport_set_fd (transport, nfd, TRUE);
 
-      ret = getnameinfo ((struct sockaddr *) &addr, addrlen,
+      ret = getnameinfo ((struct sockaddr *) addr, addrlen,
           host, NI_MAXHOST, port, NI_MAXSERV,
           NI_NUMERICHOST | NI_NUMERICSERV);
     }
@@ -222,10 +231,104 @@ listener_io_in_cb (GIOChannel *source,
       DEBUG("New connection...");
     }
 
-  g_signal_emit (self, signals[NEW_CONNECTION], 0, transport, &addr,
+  g_signal_emit (self, signals[NEW_CONNECTION], 0, transport, addr,
       (guint) addrlen);
 
   g_object_unref (transport);
+}
+
+static int
+accept_connection (int fd,
+    struct sockaddr_storage *addr,
+    socklen_t *addrlen)
+{
+  int nfd;
+
+  do
+    {
+      *addrlen = sizeof (struct sockaddr_storage);
+#ifdef HAVE_ACCEPT4
+      /* Saves the fcntl calls gibber_fd_transport_set_fd would do */
+      nfd = accept4 (fd, (struct sockaddr *) addr, addrlen,
+          SOCK_NONBLOCK | SOCK_CLOEXEC);
+#else
+      nfd = accept (fd, (struct sockaddr *) addr, addrlen);
+#endif
+    }
+  while (nfd < 0 && gibber_socket_errno () == EINTR);
+
+  return nfd;
+}
+
+static gboolean
+listener_io_in_cb (GIOChannel *source,
+                   GIOCondition condition,
+                   gpointer user_data)
+{
+  GibberListener *self = GIBBER_LISTENER (user_data);
+  GibberListenerPrivate *priv = GIBBER_LISTENER_GET_PRIVATE (self);
+  Listener *l = NULL;
+  GSList *t;
+  gint64 wakeup;
+  guint accepted = 0;
+  int fd;
+
+  for (t = priv->listeners; t != NULL; t = t->next)
+    {
+      if (((Listener *) t->data)->listener == source)
+        l = t->data;
+    }
+
+  g_return_val_if_fail (l != NULL, FALSE);
+
+  fd = g_io_channel_unix_get_fd (source);
+  wakeup = g_get_monotonic_time ();
+  priv->stats.wakeups++;
+
+  /* The new-connection handlers are free to drop the last ref on us or to
+   * stop listening */
+  g_object_ref (self);
+
+  while (accepted < MAX_ACCEPTS_PER_WAKEUP)
+    {
+      struct sockaddr_storage addr;
+      socklen_t addrlen;
+      guint64 latency;
+      int nfd;
+
+      nfd = accept_connection (fd, &addr, &addrlen);
+      if (nfd < 0)
+        {
+          if (!gibber_socket_errno_would_block ())
+            {
+              DEBUG ("accept failed: #%d %s", gibber_socket_errno (),
+                  gibber_socket_strerror ());
+              priv->stats.errors++;
+            }
+
+          break;
+        }
+
+      accepted++;
+      priv->stats.accepted++;
+      priv->stats.max_queue_depth = MAX (priv->stats.max_queue_depth,
+          accepted);
+
+      latency = g_get_monotonic_time () - wakeup;
+      priv->stats.total_latency_us += latency;
+      priv->stats.max_latency_us = MAX (priv->stats.max_latency_us, latency);
+
+      new_connection (self, nfd, &addr, addrlen);
+
+      if (g_slist_find (priv->listeners, l) == NULL)
+        /* The listener was closed by a handler */
+        break;
+    }
+
+  if (accepted > 1)
+    DEBUG ("Accepted %u connections in one go", accepted);
+
+  g_object_unref (self);
   return TRUE;
 }
 
@@ -233,7 +336,6 @@ static gboolean
 add_listener (GibberListener *self, int family, int type, int protocol,
   struct sockaddr *address, socklen_t addrlen, GError **error)
 {
-  #define BACKLOG 5
   int fd = -1, ret, yes = 1;
   Listener *l;
   GibberListenerPrivate *priv = GIBBER_LISTENER_GET_PRIVATE (self);
@@ -288,7 +390,7 @@ add_listener (GibberListener *self, int family, int type, int protocol,
       goto error;
     }
 
-  ret = listen (fd, BACKLOG);
+  ret = listen (fd, priv->backlog);
   if (ret == -1)
     {
       gibber_socket_set_error (error, "listen failed",
@@ -325,6 +427,9 @@ add_listener (GibberListener *self, int family, int type, int protocol,
         break;
     }
 
+  /* Connections are accepted until it would block */
+  gibber_socket_set_nonblocking (fd);
+
   l = g_slice_new (Listener);
 
   l->listener = gibber_io_channel_new_from_socket (fd);
@@ -535,3 +640,49 @@ gibber_listener_get_port (GibberListener *listener)
   GibberListenerPrivate *priv = GIBBER_LISTENER_GET_PRIVATE (listener);
   return priv->port;
 }
+
+/**
+ * gibber_listener_set_backlog:
+ * @listener: a #GibberListener
+ * @backlog: maximum length of the queue of pending connections
+ *
+ * Sets the backlog passed to listen(). Sockets already listening are updated
+ * too, where the platform supports that.
+ */
+void
+gibber_listener_set_backlog (GibberListener *listener,
+    guint backlog)
+{
+  GibberListenerPrivate *priv = GIBBER_LISTENER_GET_PRIVATE (listener);
+  GSList *t;
+
+  g_return_if_fail (backlog > 0);
+
+  priv->backlog = backlog;
+
+  for (t = priv->listeners; t != NULL; t = t->next)
+    {
+      Listener *l = t->data;
+
+      if (listen (g_io_channel_unix_get_fd (l->listener), backlog) == -1)
+        DEBUG ("Failed to update the backlog: #%d %s",
+            gibber_socket_errno (), gibber_socket_strerror ());
+    }
+}
+
+void
+gibber_listener_get_stats (GibberListener *listener,
+    GibberListenerStats *stats)
+{
+  GibberListenerPrivate *priv = GIBBER_LISTENER_GET_PRIVATE (listener);
+
+  *stats = priv->stats;
+}
+
+void
+gibber_listener_reset_stats (GibberListener *listener)
+{
+  GibberListenerPrivate *priv = GIBBER_LISTENER_GET_PRIVATE (listener);
+
+  memset (&priv->stats, 0, sizeof (priv->stats));
+}
@@ -43,6 +43,24 @@ typedef enum
   GIBBER_AF_ANY
 } GibberAddressFamily;
 
+/* Counters about the connections accepted by a listener */
+typedef struct {
+  /* connections accepted */
+  guint accepted;
+  /* wakeups of the listening sockets */
+  guint wakeups;
+  /* most connections accepted in a single wakeup, i.e. the deepest the
+   * accept queue was seen */
+  guint max_queue_depth;
+  /* accept() failures other than the queue being empty */
+  guint errors;
+  /* time between a wakeup and handing out a connection accepted during it,
+   * which grows with the time spent by the new-connection handlers of the
+   * connections before it in the batch */
+  guint64 total_latency_us;
+  guint64 max_latency_us;
+} GibberListenerStats;
+
 typedef struct _GibberListener GibberListener;
 typedef struct _GibberListenerClass GibberListenerClass;
 
@@ -94,6 +112,12 @@ gboolean gibber_listener_listen_socket (GibberListener *listener,
 
 int gibber_listener_get_port (GibberListener *listener);
 
+void gibber_listener_set_backlog (GibberListener *listener, guint backlog);
+
+void gibber_listener_get_stats (GibberListener *listener,
+  GibberListenerStats *stats);
+void gibber_listener_reset_stats (GibberListener *listener);
+
 G_END_DECLS
 
 #endif /* #ifndef _GIBBER_LISTENER_H_ */
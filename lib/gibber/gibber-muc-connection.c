@@ -431,7 +431,6 @@ gibber_muc_connection_new (const gchar *name, const gchar *protocol,
   priv->rmctransport = gibber_r_multicast_causal_transport_new (
         GIBBER_TRANSPORT (priv->mtransport), priv->name);
   priv->rmtransport = gibber_r_multicast_transport_new (priv->rmctransport);
-
   gibber_transport_set_handler (GIBBER_TRANSPORT (priv->rmtransport),
       _connection_received_data, result);
 
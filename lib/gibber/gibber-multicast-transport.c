@@ -17,6 +17,9 @@
  * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
  */
 
+/* needed for recvmmsg and sendmmsg */
+#define _GNU_SOURCE
+
 #include "config.h"
 #include <gibber-multicast-transport.h>
 
@@ -34,6 +37,9 @@
 #define BUFSIZE 1500
 #define MAX_PACKET_SIZE 1440
 
+/* Maximum number of datagrams received or sent with one syscall */
+#define BATCH_SIZE 16
+
 static gboolean gibber_multicast_transport_send (GibberTransport *transport,
     const guint8 *data, gsize size, GError **error);
 
@@ -42,6 +48,15 @@ static void gibber_multicast_transport_disconnect (GibberTransport *transport);
 G_DEFINE_TYPE(GibberMulticastTransport, gibber_multicast_transport,
               GIBBER_TYPE_TRANSPORT);
 
+/* Buffer a datagram is received into and handed out from as a GBytes. If
+ * the GBytes is still referenced after delivery the slot is left to its
+ * holders and freed when they release it */
+typedef struct {
+  gboolean borrowed;
+  gboolean orphaned;
+  guint8 data[BUFSIZE + 1];
+} RecvSlot;
+
 /* Privates */
 typedef struct _GibberMulticastTransportPrivate
   GibberMulticastTransportPrivate;
@@ -55,6 +70,14 @@ struct _GibberMulticastTransportPrivate
   guint watch_err;
   struct sockaddr_storage address;
   socklen_t addrlen;
+
+  GibberMulticastTransportBatchHandlerFunc batch_handler;
+  gpointer batch_handler_data;
+
+  /* Receive slots, allocated on first use */
+  RecvSlot *recv_slots[BATCH_SIZE];
+  /* Set when the kernel turned out not to support recvmmsg/sendmmsg */
+  gboolean no_mmsg;
 };
 
 #define GIBBER_MULTICAST_TRANSPORT_GET_PRIVATE(o) \
@@ -133,40 +156,219 @@ gibber_multicast_transport_dispose (GObject *object)
 void
 gibber_multicast_transport_finalize (GObject *object)
 {
+  GibberMulticastTransport *self = GIBBER_MULTICAST_TRANSPORT (object);
+  GibberMulticastTransportPrivate *priv =
+    GIBBER_MULTICAST_TRANSPORT_GET_PRIVATE (self);
+
+  guint i;
+
   /* free any data held directly by the object here */
+  for (i = 0; i < BATCH_SIZE; i++)
+    {
+      RecvSlot *slot = priv->recv_slots[i];
+
+      if (slot != NULL && slot->borrowed)
+        slot->orphaned = TRUE;
+      else
+        g_free (slot);
+    }
 
   G_OBJECT_CLASS (gibber_multicast_transport_parent_class)->finalize (object);
 }
 
+static void
+recv_slot_release (gpointer data)
+{
+  RecvSlot *slot = data;
+
+  if (slot->orphaned)
+    g_free (slot);
+  else
+    slot->borrowed = FALSE;
+}
+
+static RecvSlot *
+get_recv_slot (GibberMulticastTransportPrivate *priv, guint i)
+{
+  if (priv->recv_slots[i] == NULL)
+    {
+      priv->recv_slots[i] = g_malloc (sizeof (RecvSlot));
+      priv->recv_slots[i]->borrowed = FALSE;
+      priv->recv_slots[i]->orphaned = FALSE;
+    }
+
+  return priv->recv_slots[i];
+}
+
+/* Hand out the datagrams received into the first n_datagrams slots */
+static void
+deliver_datagrams (GibberMulticastTransport *self, const gsize *lengths,
+    guint n_datagrams)
+{
+  GibberMulticastTransportPrivate *priv =
+    GIBBER_MULTICAST_TRANSPORT_GET_PRIVATE (self);
+  GBytes *datagrams[BATCH_SIZE];
+  RecvSlot *slots[BATCH_SIZE];
+  guint i;
+
+  for (i = 0; i < n_datagrams; i++)
+    {
+      slots[i] = priv->recv_slots[i];
+      slots[i]->data[lengths[i]] = '\0';
+      slots[i]->borrowed = TRUE;
+      datagrams[i] = g_bytes_new_with_free_func (slots[i]->data, lengths[i],
+          recv_slot_release, slots[i]);
+    }
+
+  /* The handlers might drop the last ref to us */
+  g_object_ref (self);
+
+  if (priv->batch_handler != NULL)
+    {
+      priv->batch_handler (self, datagrams, n_datagrams,
+          priv->batch_handler_data);
+    }
+  else
+    {
+      for (i = 0; i < n_datagrams && priv->fd >= 0; i++)
+        gibber_transport_received_data (GIBBER_TRANSPORT (self),
+            slots[i]->data, lengths[i]);
+    }
+
+  for (i = 0; i < n_datagrams; i++)
+    {
+      g_bytes_unref (datagrams[i]);
+
+      /* Still referenced, receive into a fresh slot next time */
+      if (slots[i]->borrowed)
+        {
+          slots[i]->orphaned = TRUE;
+          priv->recv_slots[i] = NULL;
+        }
+    }
+
+  g_object_unref (self);
+}
+
+/* Nothing to read after all is no reason to worry, any other error leaves
+ * the socket unusable */
 static gboolean
-_channel_io_in (GIOChannel *source, GIOCondition condition, gpointer data)
+_receive_failed (GibberMulticastTransport *self)
+{
+  int err = errno;
+  GError *error;
+
+  if (err == EAGAIN || err == EWOULDBLOCK || err == EINTR)
+    return TRUE;
+
+  DEBUG ("recv failed: %s", g_strerror (err));
+
+  error = g_error_new (GIBBER_MULTICAST_TRANSPORT_ERROR,
+      GIBBER_MULTICAST_TRANSPORT_ERROR_NETWORK,
+      "Network error: %s", g_strerror (err));
+
+  g_object_ref (self);
+  gibber_transport_emit_error (GIBBER_TRANSPORT (self), error);
+  g_error_free (error);
+
+  if (gibber_transport_get_state (GIBBER_TRANSPORT (self))
+      != GIBBER_TRANSPORT_DISCONNECTED)
+    gibber_transport_disconnect (GIBBER_TRANSPORT (self));
+  g_object_unref (self);
+
+  return FALSE;
+}
+
+static gboolean
+_receive_single (GibberMulticastTransport *self)
 {
-  GibberMulticastTransport *self =
-    GIBBER_MULTICAST_TRANSPORT (data);
   GibberMulticastTransportPrivate *priv =
     GIBBER_MULTICAST_TRANSPORT_GET_PRIVATE (self);
-  guint8 buf[BUFSIZE + 1];
+  RecvSlot *slot = get_recv_slot (priv, 0);
+  gsize length;
 
   struct sockaddr_storage from;
   int ret;
   socklen_t len = sizeof (struct sockaddr_storage);
 
-  ret = recvfrom (priv->fd, (char *) buf, BUFSIZE, 0, (struct sockaddr *) &from, &len);
+  ret = recvfrom (priv->fd, (char *) slot->data, BUFSIZE, 0,
+      (struct sockaddr *) &from, &len);
 
   if (ret < 0)
+    return _receive_failed (self);
+
+  DEBUG ("Received %d bytes", ret);
+
+  length = ret;
+  deliver_datagrams (self, &length, 1);
+
+  return TRUE;
+}
+
+#ifdef HAVE_RECVMMSG
+static gboolean
+_receive_batch (GibberMulticastTransport *self)
+{
+  GibberMulticastTransportPrivate *priv =
+    GIBBER_MULTICAST_TRANSPORT_GET_PRIVATE (self);
+  struct mmsghdr msgs[BATCH_SIZE];
+  struct iovec iovs[BATCH_SIZE];
+  struct sockaddr_storage from[BATCH_SIZE];
+  gsize lengths[BATCH_SIZE];
+  int ret;
+  int i;
+
+  memset (msgs, 0, sizeof (msgs));
+  for (i = 0; i < BATCH_SIZE; i++)
     {
-      DEBUG("recv failed: %s", strerror(errno));
-      /* FIXME should throw error */
-      return TRUE;
+      iovs[i].iov_base = get_recv_slot (priv, i)->data;
+      iovs[i].iov_len = BUFSIZE;
+      msgs[i].msg_hdr.msg_iov = &iovs[i];
+      msgs[i].msg_hdr.msg_iovlen = 1;
+      msgs[i].msg_hdr.msg_name = &from[i];
+      msgs[i].msg_hdr.msg_namelen = sizeof (struct sockaddr_storage);
     }
 
-  buf[ret] = '\0';
-  DEBUG ("Received %d bytes", ret);
+  ret = recvmmsg (priv->fd, msgs, BATCH_SIZE, MSG_DONTWAIT, NULL);
+
+  if (ret < 0)
+    {
+      if (errno == ENOSYS)
+        {
+          DEBUG ("recvmmsg not supported, falling back to recvfrom");
+          priv->no_mmsg = TRUE;
+          return _receive_single (self);
+        }
+
+      return _receive_failed (self);
+    }
 
-  gibber_transport_received_data (GIBBER_TRANSPORT (self), buf, ret);
+  for (i = 0; i < ret; i++)
+    lengths[i] = msgs[i].msg_len;
+
+  DEBUG ("Received %d datagrams", ret);
+
+  deliver_datagrams (self, lengths, ret);
 
   return TRUE;
 }
+#endif
+
+static gboolean
+_channel_io_in (GIOChannel *source, GIOCondition condition, gpointer data)
+{
+  GibberMulticastTransport *self =
+    GIBBER_MULTICAST_TRANSPORT (data);
+#ifdef HAVE_RECVMMSG
+  GibberMulticastTransportPrivate *priv =
+    GIBBER_MULTICAST_TRANSPORT_GET_PRIVATE (self);
+
+  if (!priv->no_mmsg)
+    return _receive_batch (self);
+#endif
+
+  return _receive_single (self);
+}
 
 static gboolean
 _channel_io_err (GIOChannel *source, GIOCondition condition, gpointer data)
@@ -449,14 +651,33 @@ gibber_multicast_transport_disconnect (GibberTransport *transport)
     GIBBER_TRANSPORT_DISCONNECTED);
 }
 
+static void
+_send_one (GibberMulticastTransport *self, const guint8 *data, gsize size,
+    GError **error)
+{
+  GibberMulticastTransportPrivate *priv =
+    GIBBER_MULTICAST_TRANSPORT_GET_PRIVATE (self);
+
+  if (sendto (priv->fd, (const char *) data, size, 0,
+      (struct sockaddr *) &(priv->address),
+      sizeof (struct sockaddr_storage)) < 0)
+    {
+      DEBUG("send failed: %s", strerror (errno));
+      if (error != NULL)
+        {
+          *error = g_error_new (GIBBER_MULTICAST_TRANSPORT_ERROR,
+              GIBBER_MULTICAST_TRANSPORT_ERROR_NETWORK,
+              "Network error: %s", strerror (errno));
+        }
+    }
+}
+
 static gboolean
 gibber_multicast_transport_send (GibberTransport *transport,
     const guint8 *data, gsize size, GError **error)
 {
   GibberMulticastTransport *self =
     GIBBER_MULTICAST_TRANSPORT (transport);
-  GibberMulticastTransportPrivate *priv =
-    GIBBER_MULTICAST_TRANSPORT_GET_PRIVATE (self);
 
   if (size > MAX_PACKET_SIZE)
     {
@@ -467,18 +688,100 @@ gibber_multicast_transport_send (GibberTransport *transport,
       return FALSE;
     }
 
-  if (sendto (priv->fd, (const char *) data, size, 0,
-      (struct sockaddr *) &(priv->address),
-      sizeof (struct sockaddr_storage)) < 0)
+  _send_one (self, data, size, error);
+
+  return TRUE;
+}
+
+void
+gibber_multicast_transport_set_batch_handler (
+    GibberMulticastTransport *mtransport,
+    GibberMulticastTransportBatchHandlerFunc func,
+    gpointer user_data)
+{
+  GibberMulticastTransportPrivate *priv =
+    GIBBER_MULTICAST_TRANSPORT_GET_PRIVATE (mtransport);
+
+  g_assert (priv->batch_handler == NULL || func == NULL);
+
+  priv->batch_handler = func;
+  priv->batch_handler_data = user_data;
+}
+
+/* Send each buffer as a separate datagram, using as few syscalls as
+ * possible. Network errors are only logged, the reliable layer on top takes
+ * care of repairing datagrams that didn't make it */
+gboolean
+gibber_multicast_transport_send_batch (GibberMulticastTransport *mtransport,
+    const GibberBuffer *datagrams, guint n_datagrams, GError **error)
+{
+#ifdef HAVE_SENDMMSG
+  GibberMulticastTransportPrivate *priv =
+    GIBBER_MULTICAST_TRANSPORT_GET_PRIVATE (mtransport);
+#endif
+  guint sent = 0;
+  guint i;
+
+  g_assert (GIBBER_TRANSPORT (mtransport)->state ==
+      GIBBER_TRANSPORT_CONNECTED);
+
+  for (i = 0; i < n_datagrams; i++)
     {
-      DEBUG("send failed: %s", strerror (errno));
-      if (error != NULL)
+      if (datagrams[i].length > MAX_PACKET_SIZE)
         {
-          *error = g_error_new (GIBBER_MULTICAST_TRANSPORT_ERROR,
-              GIBBER_MULTICAST_TRANSPORT_ERROR_NETWORK,
-              "Network error: %s", strerror (errno));
+          DEBUG ("Message too big");
+          g_set_error (error, GIBBER_MULTICAST_TRANSPORT_ERROR,
+              GIBBER_MULTICAST_TRANSPORT_ERROR_MESSAGE_TOO_BIG,
+              "Message too big");
+          return FALSE;
+        }
+    }
+
+#ifdef HAVE_SENDMMSG
+  while (!priv->no_mmsg && sent < n_datagrams)
+    {
+      struct mmsghdr msgs[BATCH_SIZE];
+      struct iovec iovs[BATCH_SIZE];
+      guint n = MIN (n_datagrams - sent, BATCH_SIZE);
+      int ret;
+
+      memset (msgs, 0, sizeof (msgs));
+      for (i = 0; i < n; i++)
+        {
+          iovs[i].iov_base = (void *) datagrams[sent + i].data;
+          iovs[i].iov_len = datagrams[sent + i].length;
+          msgs[i].msg_hdr.msg_iov = &iovs[i];
+          msgs[i].msg_hdr.msg_iovlen = 1;
+          msgs[i].msg_hdr.msg_name = &(priv->address);
+          msgs[i].msg_hdr.msg_namelen = sizeof (struct sockaddr_storage);
+        }
+
+      ret = sendmmsg (priv->fd, msgs, n, 0);
+
+      if (ret < 0)
+        {
+          if (errno == EINTR)
+            continue;
+
+          if (errno == ENOSYS)
+            {
+              DEBUG ("sendmmsg not supported, falling back to sendto");
+              priv->no_mmsg = TRUE;
+              break;
+            }
+
+          /* Skip the datagram that failed and carry on with the rest */
+          DEBUG ("send failed: %s", strerror (errno));
+          ret = 1;
         }
+
+      sent += ret;
     }
+#endif
+
+  for (; sent < n_datagrams; sent++)
+    _send_one (mtransport, datagrams[sent].data, datagrams[sent].length,
+        NULL);
 
   return TRUE;
 }
@@ -50,6 +50,14 @@ struct _GibberMulticastTransport {
     GibberTransport parent;
 };
 
+/* Called with all datagrams received in one go, instead of the transport's
+ * handler being called once per datagram. The datagrams are views of the
+ * transport's receive buffers; keeping a reference keeps the data valid
+ * without copying it */
+typedef void (*GibberMulticastTransportBatchHandlerFunc) (
+    GibberMulticastTransport *transport, GBytes **datagrams,
+    guint n_datagrams, gpointer user_data);
+
 GibberMulticastTransport * gibber_multicast_transport_new (void);
 
 gboolean gibber_multicast_transport_connect (
@@ -60,6 +68,14 @@ gsize
 gibber_multicast_transport_get_max_packet_size (
   GibberMulticastTransport *mtransport);
 
+void gibber_multicast_transport_set_batch_handler (
+  GibberMulticastTransport *mtransport,
+  GibberMulticastTransportBatchHandlerFunc func, gpointer user_data);
+
+gboolean gibber_multicast_transport_send_batch (
+  GibberMulticastTransport *mtransport, const GibberBuffer *datagrams,
+  guint n_datagrams, GError **error);
+
 GType gibber_multicast_transport_get_type (void);
 
 /* TYPE MACROS */
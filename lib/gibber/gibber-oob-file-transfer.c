@@ -20,10 +20,18 @@
 #include "config.h"
 #include "gibber-oob-file-transfer.h"
 
+#include <errno.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 
+#if defined (HAVE_SYS_SENDFILE_H) && defined (HAVE_SENDFILE)
+# define USE_SENDFILE 1
+# include <sys/sendfile.h>
+# include <sys/stat.h>
+# include <unistd.h>
+#endif
+
 #include <libsoup/soup.h>
 #include <libsoup/soup-server.h>
 #include <libsoup/soup-message.h>
@@ -45,6 +53,14 @@ enum {
 G_DEFINE_TYPE(GibberOobFileTransfer, gibber_oob_file_transfer,
     GIBBER_TYPE_FILE_TRANSFER)
 
+#ifdef USE_SENDFILE
+typedef enum {
+  SENDFILE_CHUNK_HEADER,
+  SENDFILE_BODY,
+  SENDFILE_CHUNK_TRAILER,
+} SendfileState;
+#endif
+
 /* private structure */
 struct _GibberOobFileTransferPrivate
 {
@@ -69,6 +85,22 @@ struct _GibberOobFileTransferPrivate
   guint watch_id;
   /* session used to receive the file */
   SoupSession *session;
+  /* socket the response is written to (only when sending files) */
+  SoupSocket *socket;
+  /* number of headers and chunks given to libsoup but not written yet */
+  guint soup_pending;
+#ifdef USE_SENDFILE
+  /* Regular files are written to the socket with sendfile () as a single
+   * HTTP chunk, bypassing libsoup */
+  gboolean use_sendfile;
+  SendfileState sendfile_state;
+  /* chunk header or trailer being written */
+  gchar frame[32];
+  gsize frame_len;
+  gsize frame_written;
+  off_t file_offset;
+  off_t file_end;
+#endif
 };
 
 static void
@@ -129,6 +161,9 @@ gibber_oob_file_transfer_finalize (GObject *object)
   if (self->priv->channel != NULL)
     g_io_channel_unref (self->priv->channel);
 
+  if (self->priv->socket != NULL)
+    g_object_unref (self->priv->socket);
+
   g_free (self->priv->served_name);
   g_free (self->priv->url);
 
@@ -619,6 +654,19 @@ create_transfer_offer (GibberOobFileTransfer *self,
   return stanza;
 }
 
+static void
+finish_http_transfer (GibberOobFileTransfer *self)
+{
+  DEBUG("Closing HTTP chunked transfer");
+  soup_message_body_complete (self->priv->msg->response_body);
+  soup_server_unpause_message (self->priv->server, self->priv->msg);
+
+  g_io_channel_unref (self->priv->channel);
+  self->priv->channel = NULL;
+
+  soup_server_remove_handler (self->priv->server, self->priv->served_name);
+}
+
 /*
  * Data is available from the channel so we can send it.
  */
@@ -664,18 +712,198 @@ input_channel_readable_cb (GIOChannel *source,
 
 #undef BUFF_SIZE
 
-  DEBUG("Closing HTTP chunked transfer");
-  soup_message_body_complete (self->priv->msg->response_body);
-  soup_server_unpause_message (self->priv->server, self->priv->msg);
+  finish_http_transfer (self);
 
-  g_io_channel_unref (self->priv->channel);
-  self->priv->channel = NULL;
+  return FALSE;
+}
 
-  soup_server_remove_handler (self->priv->server, self->priv->served_name);
+#ifdef USE_SENDFILE
+
+static void
+set_frame (GibberOobFileTransfer *self,
+           SendfileState state,
+           const gchar *frame)
+{
+  self->priv->sendfile_state = state;
+  self->priv->frame_len = g_strlcpy (self->priv->frame, frame,
+      sizeof (self->priv->frame));
+  self->priv->frame_written = 0;
+}
+
+/*
+ * The socket can take more data, write the file to it directly.
+ */
+static gboolean
+sendfile_socket_writable_cb (GIOChannel *source,
+                             GIOCondition condition,
+                             gpointer user_data)
+{
+  GibberOobFileTransfer *self = user_data;
+  GibberOobFileTransferPrivate *priv = self->priv;
+  int sock = soup_socket_get_fd (priv->socket);
+  int fd = g_io_channel_unix_get_fd (priv->channel);
+  ssize_t n;
+
+  if (priv->cancelled)
+    {
+      priv->watch_id = 0;
+      return FALSE;
+    }
+
+  if (condition & (G_IO_ERR | G_IO_HUP))
+    {
+      DEBUG ("HTTP client went away");
+      goto failed;
+    }
+
+  while (TRUE)
+    {
+      if (priv->sendfile_state == SENDFILE_BODY)
+        {
+          /* Linux transfers at most 2 GiB per call */
+          n = sendfile (sock, fd, &priv->file_offset,
+              MIN (priv->file_end - priv->file_offset, G_MAXINT32));
+
+          if (n == 0)
+            {
+              DEBUG ("File got truncated while sending it");
+              goto failed;
+            }
+        }
+      else
+        {
+          n = write (sock, priv->frame + priv->frame_written,
+              priv->frame_len - priv->frame_written);
+        }
+
+      if (n < 0)
+        {
+          if (errno == EINTR)
+            continue;
+
+          if (errno == EAGAIN)
+            return TRUE;
+
+          DEBUG ("Writing to the HTTP client failed: %s", g_strerror (errno));
+          goto failed;
+        }
 
+      switch (priv->sendfile_state)
+        {
+          case SENDFILE_BODY:
+            DEBUG ("Sent a %" G_GSSIZE_FORMAT " bytes chunk", n);
+            transferred_chunk (self, (guint64) n);
+
+            if (priv->file_offset == priv->file_end)
+              set_frame (self, SENDFILE_CHUNK_TRAILER, "\r\n");
+            break;
+          case SENDFILE_CHUNK_HEADER:
+          case SENDFILE_CHUNK_TRAILER:
+            priv->frame_written += n;
+            if (priv->frame_written < priv->frame_len)
+              break;
+
+            if (priv->sendfile_state == SENDFILE_CHUNK_HEADER)
+              {
+                priv->sendfile_state = SENDFILE_BODY;
+                break;
+              }
+
+            /* libsoup writes the terminating chunk */
+            priv->watch_id = 0;
+            finish_http_transfer (self);
+            return FALSE;
+        }
+    }
+
+failed:
+  /* The chunked encoding is broken at this point, so the client will notice
+   * the transfer failed */
+  priv->watch_id = 0;
+  soup_socket_disconnect (priv->socket);
+  g_io_channel_unref (priv->channel);
+  priv->channel = NULL;
+  soup_server_remove_handler (priv->server, priv->served_name);
   return FALSE;
 }
 
+static void
+start_sendfile (GibberOobFileTransfer *self)
+{
+  GibberOobFileTransferPrivate *priv = self->priv;
+  gchar header[32];
+  GIOChannel *sock_channel;
+
+  if (!priv->use_sendfile || priv->soup_pending > 0 ||
+      priv->channel == NULL || priv->watch_id != 0 || priv->cancelled)
+    return;
+
+  if (priv->file_offset == priv->file_end)
+    {
+      finish_http_transfer (self);
+      return;
+    }
+
+  DEBUG ("libsoup is idle, sending %" G_GINT64_FORMAT " bytes with sendfile",
+      (gint64) (priv->file_end - priv->file_offset));
+
+  /* The whole file goes in one chunk */
+  g_snprintf (header, sizeof (header), "%" G_GINT64_MODIFIER "x\r\n",
+      (gint64) (priv->file_end - priv->file_offset));
+  set_frame (self, SENDFILE_CHUNK_HEADER, header);
+
+  sock_channel = g_io_channel_unix_new (soup_socket_get_fd (priv->socket));
+  priv->watch_id = g_io_add_watch (sock_channel,
+      G_IO_OUT | G_IO_ERR | G_IO_HUP, sendfile_socket_writable_cb, self);
+  g_io_channel_unref (sock_channel);
+}
+
+/*
+ * Use sendfile () if the source is a regular file and the response is
+ * written to a plain socket.
+ */
+static gboolean
+can_use_sendfile (GibberOobFileTransfer *self,
+                  GIOChannel *src)
+{
+  GibberOobFileTransferPrivate *priv = self->priv;
+  struct stat st;
+  int fd;
+
+  if (priv->socket == NULL || soup_socket_is_ssl (priv->socket))
+    return FALSE;
+
+  fd = g_io_channel_unix_get_fd (src);
+  if (fstat (fd, &st) != 0 || !S_ISREG (st.st_mode))
+    return FALSE;
+
+  priv->file_offset = lseek (fd, 0, SEEK_CUR);
+  if (priv->file_offset < 0)
+    return FALSE;
+
+  priv->file_end = st.st_size;
+  if (priv->file_end < priv->file_offset)
+    priv->file_end = priv->file_offset;
+
+  return TRUE;
+}
+
+#endif /* USE_SENDFILE */
+
+static void
+http_server_wrote_cb (SoupMessage *msg,
+                      gpointer user_data)
+{
+  GibberOobFileTransfer *self = user_data;
+
+  if (self->priv->soup_pending > 0)
+    self->priv->soup_pending--;
+
+#ifdef USE_SENDFILE
+  start_sendfile (self);
+#endif
+}
+
 static void
 http_server_cb (SoupServer *server,
                 SoupMessage *msg,
@@ -720,6 +948,18 @@ http_server_cb (SoupServer *server,
 
   self->priv->msg = msg;
 
+  if (self->priv->socket != NULL)
+    g_object_unref (self->priv->socket);
+  self->priv->socket = g_object_ref (soup_client_context_get_socket (context));
+
+  /* Keep track of what libsoup still has to write, the sendfile path can
+   * only take over once it's done */
+  self->priv->soup_pending = 1;
+  g_signal_connect (msg, "wrote-headers",
+      G_CALLBACK (http_server_wrote_cb), self);
+  g_signal_connect (msg, "wrote-chunk",
+      G_CALLBACK (http_server_wrote_cb), self);
+
   /* iChat accepts only AppleSingle encoding, i.e. file's contents and
    * attributes are stored in the same stream */
   accept_encoding = soup_message_headers_get_one (msg->request_headers,
@@ -768,6 +1008,7 @@ http_server_cb (SoupServer *server,
       buff = (gchar *) g_byte_array_free (array, FALSE);
       soup_message_body_append (self->priv->msg->response_body,
         SOUP_MEMORY_TAKE, buff, len);
+      self->priv->soup_pending++;
 
       soup_server_unpause_message (self->priv->server, self->priv->msg);
     }
@@ -932,9 +1173,20 @@ gibber_oob_file_transfer_send (GibberFileTransfer *ft,
 
   g_return_if_fail (self->priv->msg != NULL);
 
-  DEBUG("Starting HTTP chunked file transfer");
   self->priv->channel = src;
   g_io_channel_ref (src);
+
+#ifdef USE_SENDFILE
+  if (can_use_sendfile (self, src))
+    {
+      DEBUG ("Starting HTTP file transfer using sendfile");
+      self->priv->use_sendfile = TRUE;
+      start_sendfile (self);
+      return;
+    }
+#endif
+
+  DEBUG("Starting HTTP chunked file transfer");
   g_signal_connect (self->priv->msg, "wrote-chunk",
       G_CALLBACK (http_server_wrote_chunk_cb), self);
 
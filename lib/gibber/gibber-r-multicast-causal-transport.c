@@ -30,12 +30,29 @@
 #define DEBUG_FLAG DEBUG_RMULTICAST
 #include "gibber-debug.h"
 
+#include "gibber-multicast-transport.h"
+#include "gibber-r-multicast-clock.h"
 #include "gibber-r-multicast-packet.h"
+#include "gibber-r-multicast-compress.h"
 #include "gibber-r-multicast-sender.h"
 
 #define SESSION_TIMEOUT_MIN 1500
 #define SESSION_TIMEOUT_MAX 3000
 
+/* Once the round trip time is known, session messages are sent every 20 to 40
+ * round trips, but no more often than every 250 to 500 ms */
+#define SESSION_RTT_FACTOR 20
+#define SESSION_TIMEOUT_FLOOR 250
+
+/* Send our own session message at least every 10 seconds (in microseconds)
+ * when there is a timestamp to echo, even if others are up to date, so round
+ * trip times keep being measured */
+#define RTT_PROBE_INTERVAL 10000000
+
+/* Data packets only depend on the senders that progressed since our previous
+ * packet, every 64th packet carries the full dependency vector again */
+#define DEPENDS_FULL_INTERVAL 64
+
 #define NR_JOIN_REQUESTS_TO_SEND 3
 #define PASSIVE_JOIN_TIME  500
 #define ACTIVE_JOIN_INTERVAL 250
@@ -48,14 +65,52 @@
 #define NR_BYE_TO_SEND 3
 #define BYE_INTERVAL 500
 
+/* The token bucket of the pacer holds up to 8 full packets */
+#define PACING_BURST_PACKETS 8
+/* Adaptive pacing starts at 256 KiB/s and never goes below 8 KiB/s */
+#define PACING_INITIAL_RATE (256 * 1024)
+#define PACING_MIN_RATE (8 * 1024)
+/* Adapt the rate at most once per 100 ms (in microseconds) */
+#define PACING_ADAPT_INTERVAL 100000
+/* Receivers more than 256 of our packets behind are falling behind */
+#define PACING_MAX_BEHIND 256
+
+/* Messages queued on different streams are sent out a fragment at a time,
+ * taking turns weighted round robin. Each turn a stream sends up to its weight
+ * in full packets of payload. Chat on the default stream goes well before bulk
+ * transfers on tubes, membership packets go before any data */
+#define STREAM_WEIGHT_DEFAULT 1
+#define STREAM_WEIGHT_DEFAULT_STREAM 8
+
 #define DEBUG_TRANSPORT(transport, format,...) \
   DEBUG("%s (%x): " format, \
       GIBBER_R_MULTICAST_CAUSAL_TRANSPORT_GET_PRIVATE(transport)->name, \
       transport->sender_id, ##__VA_ARGS__)
 
+/* Message waiting for its fragments to be sent out */
+typedef struct {
+  GBytes *data;
+  /* Payload already fragmented */
+  gsize offset;
+  /* GIBBER_R_MULTICAST_DATA_PACKET_DEFLATE or 0 */
+  guint8 flags;
+} QueuedMessage;
+
+typedef struct {
+  guint16 stream_id;
+  guint weight;
+  /* Payload bytes left of this turn, negative if it overran the last one */
+  gssize deficit;
+  GQueue messages;
+  /* Not fragmented yet */
+  gsize queued_bytes;
+} SendStream;
+
 struct hash_data {
   GibberRMulticastSender *sender;
   GibberRMulticastPacket *packet;
+  GHashTable *sent;
+  gboolean full;
 };
 
 static void repair_message_cb (GibberRMulticastSender *sender,
@@ -67,6 +122,8 @@ static void schedule_session_message (
     GibberRMulticastCausalTransport *transport);
 static void schedule_keepalive_message (
     GibberRMulticastCausalTransport *transport);
+static void add_packet_depends (GibberRMulticastCausalTransport *self,
+    GibberRMulticastPacket *packet, gboolean full);
 
 G_DEFINE_TYPE(GibberRMulticastCausalTransport,
     gibber_r_multicast_causal_transport,
@@ -87,6 +144,9 @@ static guint signals[LAST_SIGNAL] = {0};
 enum {
   PROP_NAME = 1,
   PROP_TRANSPORT,
+  PROP_FEC_GROUP_SIZE,
+  PROP_SEND_RATE,
+  PROP_ADAPTIVE_RATE,
   LAST_PROPERTY
 };
 
@@ -104,6 +164,65 @@ struct _GibberRMulticastCausalTransportPrivate
   guint timer;
   guint keepalive_timer;
   gchar *name;
+  /* Recycles the packets we parse and send */
+  GibberRMulticastPacketPool *packet_pool;
+
+  /* Number of our reliable packets covered by each parity packet, 0 if we
+   * don't send any */
+  guint fec_group_size;
+  /* Parity of the group being sent, fec_count packets from fec_first */
+  guint8 *fec_parity;
+  gsize fec_parity_size;
+  guint16 fec_length;
+  guint32 fec_first;
+  guint fec_count;
+  /* Id of the first of our packets not sent out yet */
+  guint32 fec_next;
+
+  /* sender id => packet id we last put in the depends of one of our
+   * packets, to only send what changed */
+  GHashTable *depends_sent;
+  /* Number of packets sent with partial depends since the last full one */
+  guint depends_partial;
+  /* Last sender in the rotating digest of the last session message */
+  guint32 session_cursor;
+
+  /* Set of GUINT_TO_POINTER (stream_id) on which messages are compressed */
+  GHashTable *compressed_streams;
+  /* Set of GUINT_TO_POINTER (sender_id) that told us they can inflate */
+  GHashTable *inflating_senders;
+  /* GUINT_TO_POINTER (stream_id) => GUINT_TO_POINTER (weight) for the streams
+   * not using the default weight */
+  GHashTable *stream_weights;
+  /* GUINT_TO_POINTER (stream_id) => owned SendStream, for the streams with
+   * messages queued */
+  GHashTable *send_streams;
+  /* SendStreams with messages queued, the one whose turn it is first */
+  GQueue send_order;
+
+  /* Last round trip time probe received, to echo in ours */
+  guint32 echo_sender;
+  guint32 echo_timestamp;
+  gint64 echo_received;
+  /* Monotonic time we last sent out a session message */
+  gint64 session_sent;
+
+  /* Maximum send rate in bytes per second, 0 for no limit */
+  guint pace_max_rate;
+  /* Whether to adapt the rate to how well receivers keep up */
+  gboolean pace_adaptive;
+  /* Rate currently paced at, 0 if not pacing */
+  guint pace_rate;
+  /* Token bucket, in bytes, as of pace_last (monotonic time) */
+  gint64 pace_tokens;
+  gint64 pace_last;
+  /* Monotonic time the rate was last adapted */
+  gint64 pace_adapted;
+  /* Our reliable packets waiting for tokens, in packet id order. Holds at
+   * most one data fragment, the others are only numbered once it's their
+   * turn */
+  GQueue pace_queue;
+  guint pace_timer;
 
   gint nr_join_requests;
   gint nr_join_requests_seen;
@@ -129,6 +248,28 @@ _random_nonzero_uint (void)
   return result;
 }
 
+static void pace_reset_rate (GibberRMulticastCausalTransport *transport);
+static void pace_clear (GibberRMulticastCausalTransport *transport);
+
+static void
+queued_message_free (QueuedMessage *message)
+{
+  g_bytes_unref (message->data);
+  g_slice_free (QueuedMessage, message);
+}
+
+static void
+send_stream_free (gpointer data)
+{
+  SendStream *stream = data;
+  QueuedMessage *message;
+
+  while ((message = g_queue_pop_head (&stream->messages)) != NULL)
+    queued_message_free (message);
+
+  g_slice_free (SendStream, stream);
+}
+
 static void
 gibber_r_multicast_causal_transport_set_property (GObject *object,
                                                   guint property_id,
@@ -148,6 +289,20 @@ gibber_r_multicast_causal_transport_set_property (GObject *object,
     case PROP_TRANSPORT:
       priv->transport = GIBBER_TRANSPORT (g_value_dup_object (value));
       break;
+    case PROP_FEC_GROUP_SIZE:
+      /* Start over, the current group can't be finished anymore */
+      priv->fec_group_size = g_value_get_uint (value);
+      priv->fec_count = 0;
+      priv->fec_next = priv->packet_id;
+      break;
+    case PROP_SEND_RATE:
+      priv->pace_max_rate = g_value_get_uint (value);
+      pace_reset_rate (transport);
+      break;
+    case PROP_ADAPTIVE_RATE:
+      priv->pace_adaptive = g_value_get_boolean (value);
+      pace_reset_rate (transport);
+      break;
     default:
       G_OBJECT_WARN_INVALID_PROPERTY_ID (object, property_id, pspec);
       break;
@@ -172,6 +327,15 @@ gibber_r_multicast_causal_transport_get_property (GObject *object,
     case PROP_TRANSPORT:
       g_value_set_object (value, priv->transport);
       break;
+    case PROP_FEC_GROUP_SIZE:
+      g_value_set_uint (value, priv->fec_group_size);
+      break;
+    case PROP_SEND_RATE:
+      g_value_set_uint (value, priv->pace_max_rate);
+      break;
+    case PROP_ADAPTIVE_RATE:
+      g_value_set_boolean (value, priv->pace_adaptive);
+      break;
     default:
       G_OBJECT_WARN_INVALID_PROPERTY_ID (object, property_id, pspec);
       break;
@@ -188,6 +352,18 @@ gibber_r_multicast_causal_transport_init (GibberRMulticastCausalTransport *obj)
   /* allocate any data required by the object here */
   priv->sender_group = gibber_r_multicast_sender_group_new ();
   priv->packet_id = g_random_int ();
+  priv->fec_next = priv->packet_id;
+  priv->packet_pool = gibber_r_multicast_packet_pool_new ();
+  g_queue_init (&priv->pace_queue);
+  priv->depends_sent = g_hash_table_new (g_direct_hash, g_direct_equal);
+  priv->compressed_streams = g_hash_table_new (g_direct_hash,
+      g_direct_equal);
+  priv->inflating_senders = g_hash_table_new (g_direct_hash,
+      g_direct_equal);
+  priv->stream_weights = g_hash_table_new (g_direct_hash, g_direct_equal);
+  priv->send_streams = g_hash_table_new_full (g_direct_hash, g_direct_equal,
+      NULL, send_stream_free);
+  g_queue_init (&priv->send_order);
 }
 
 static void gibber_r_multicast_causal_transport_dispose (GObject *object);
@@ -231,15 +407,16 @@ gibber_r_multicast_causal_transport_class_init (
         0,
         NULL, NULL, NULL,
         G_TYPE_NONE, 2, GIBBER_TYPE_R_MULTICAST_SENDER,
-        GIBBER_TYPE_R_MULTICAST_PACKET);
+        GIBBER_TYPE_R_MULTICAST_PACKET | G_SIGNAL_TYPE_STATIC_SCOPE);
 
   signals[RECEIVED_FOREIGN_PACKET] = g_signal_new ("received-foreign-packet",
         G_OBJECT_CLASS_TYPE (gibber_r_multicast_causal_transport_class),
         G_SIGNAL_RUN_LAST,
         0,
         NULL, NULL,
-        g_cclosure_marshal_VOID__OBJECT,
-        G_TYPE_NONE, 1, GIBBER_TYPE_R_MULTICAST_PACKET);
+        g_cclosure_marshal_VOID__BOXED,
+        G_TYPE_NONE, 1,
+        GIBBER_TYPE_R_MULTICAST_PACKET | G_SIGNAL_TYPE_STATIC_SCOPE);
 
   object_class->set_property =
       gibber_r_multicast_causal_transport_set_property;
@@ -256,6 +433,26 @@ gibber_r_multicast_causal_transport_class_init (
       G_PARAM_CONSTRUCT_ONLY | G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS);
   g_object_class_install_property (object_class, PROP_NAME, param_spec);
 
+  param_spec = g_param_spec_uint ("fec-group-size", "FEC group size",
+      "Number of reliable packets covered by each parity packet sent, "
+      "0 to disable forward error correction", 0, G_MAXUINT8, 0,
+      G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS);
+  g_object_class_install_property (object_class, PROP_FEC_GROUP_SIZE,
+      param_spec);
+
+  param_spec = g_param_spec_uint ("send-rate", "Send rate",
+      "Maximum rate in bytes per second our reliable packets are paced at, "
+      "0 for no limit", 0, G_MAXINT, 0,
+      G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS);
+  g_object_class_install_property (object_class, PROP_SEND_RATE, param_spec);
+
+  param_spec = g_param_spec_boolean ("adaptive-rate", "Adaptive rate",
+      "Whether to slow down when receivers fall behind or request repairs "
+      "and to speed up again, up to send-rate, as they keep up", FALSE,
+      G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS);
+  g_object_class_install_property (object_class, PROP_ADAPTIVE_RATE,
+      param_spec);
+
   transport_class->send = gibber_r_multicast_causal_transport_do_send;
   transport_class->disconnect = gibber_r_multicast_causal_transport_disconnect;
 }
@@ -280,15 +477,17 @@ gibber_r_multicast_causal_transport_dispose (GObject *object)
 
   if (priv->timer != 0)
     {
-      g_source_remove (priv->timer);
+      gibber_r_multicast_timeout_remove (priv->timer);
     }
 
   if (priv->keepalive_timer != 0)
     {
-      g_source_remove (priv->keepalive_timer);
+      gibber_r_multicast_timeout_remove (priv->keepalive_timer);
       priv->keepalive_timer = 0;
     }
 
+  pace_clear (self);
+
   if (priv->self != NULL)
     {
       g_object_unref (priv->self);
@@ -316,11 +515,114 @@ gibber_r_multicast_causal_transport_finalize (GObject *object)
 
   /* free any data held directly by the object here */
   g_free (priv->name);
+  g_free (priv->fec_parity);
+  g_hash_table_unref (priv->depends_sent);
+  g_hash_table_unref (priv->compressed_streams);
+  g_hash_table_unref (priv->inflating_senders);
+  g_hash_table_unref (priv->stream_weights);
+  g_hash_table_unref (priv->send_streams);
+  gibber_r_multicast_packet_pool_unref (priv->packet_pool);
 
   G_OBJECT_CLASS (
       gibber_r_multicast_causal_transport_parent_class)->finalize (object);
 }
 
+static void
+packet_sent (GibberRMulticastCausalTransport *transport,
+             GibberRMulticastPacket *packet)
+{
+  /* Depends only list what changed, so any reliable packet but a bye acks
+   * everything we received so far */
+  if (GIBBER_R_MULTICAST_PACKET_IS_RELIABLE_PACKET (packet)
+      && packet->type != PACKET_TYPE_BYE)
+    schedule_keepalive_message (transport);
+}
+
+/* Maximum size of the packets we originate, with FEC enabled they need to
+ * leave room for the parity packet header */
+static gsize
+reliable_packet_size (GibberRMulticastCausalTransport *transport)
+{
+  GibberRMulticastCausalTransportPrivate *priv =
+    GIBBER_R_MULTICAST_CAUSAL_TRANSPORT_GET_PRIVATE (transport);
+
+  if (priv->fec_group_size == 0)
+    return priv->transport->max_packet_size;
+
+  return priv->transport->max_packet_size
+      - GIBBER_R_MULTICAST_PARITY_OVERHEAD;
+}
+
+/* Add one of our packets to the current FEC group. Returns the parity packet
+ * to send after it when that completes the group, NULL otherwise */
+static GibberRMulticastPacket *
+fec_add_packet (GibberRMulticastCausalTransport *transport,
+                GibberRMulticastPacket *packet)
+{
+  GibberRMulticastCausalTransportPrivate *priv =
+    GIBBER_R_MULTICAST_CAUSAL_TRANSPORT_GET_PRIVATE (transport);
+  GibberRMulticastPacket *parity;
+  gsize max_size, size;
+  guint8 *data;
+
+  if (priv->fec_group_size == 0
+      || !GIBBER_R_MULTICAST_PACKET_IS_RELIABLE_PACKET (packet)
+      || priv->self == NULL || packet->sender != priv->self->id)
+    return NULL;
+
+  /* Repairs and repeats of packets sent earlier, or a bye which doesn't use
+   * up an id */
+  if (gibber_r_multicast_packet_diff (priv->fec_next, packet->packet_id) < 0
+      || gibber_r_multicast_packet_diff (packet->packet_id,
+          priv->packet_id) <= 0)
+    return NULL;
+
+  /* Packets in between weren't covered, so start a new group */
+  if (packet->packet_id != priv->fec_next)
+    priv->fec_count = 0;
+
+  priv->fec_next = packet->packet_id + 1;
+
+  max_size = priv->transport->max_packet_size
+      - GIBBER_R_MULTICAST_PARITY_OVERHEAD;
+  data = gibber_r_multicast_packet_get_raw_data (packet, &size);
+
+  if (size > max_size)
+    {
+      /* Can't be covered, the group can't be consecutive anymore either */
+      priv->fec_count = 0;
+      return NULL;
+    }
+
+  if (priv->fec_parity == NULL)
+    priv->fec_parity = g_malloc (max_size);
+
+  if (priv->fec_count == 0)
+    {
+      memset (priv->fec_parity, 0, max_size);
+      priv->fec_parity_size = 0;
+      priv->fec_length = 0;
+      priv->fec_first = packet->packet_id;
+    }
+
+  gibber_r_multicast_packet_parity_add (priv->fec_parity, data, size);
+  priv->fec_parity_size = MAX (priv->fec_parity_size, size);
+  priv->fec_length ^= size;
+  priv->fec_count++;
+
+  if (priv->fec_count < priv->fec_group_size)
+    return NULL;
+
+  parity = gibber_r_multicast_packet_new_pooled (priv->packet_pool,
+      PACKET_TYPE_PARITY, priv->self->id, priv->transport->max_packet_size);
+  gibber_r_multicast_packet_set_parity_info (parity, priv->fec_first,
+      priv->fec_count, priv->fec_length, priv->fec_parity,
+      priv->fec_parity_size);
+  priv->fec_count = 0;
+
+  return parity;
+}
+
 static gboolean
 sendout_packet (GibberRMulticastCausalTransport *transport,
                 GibberRMulticastPacket *packet,
@@ -328,17 +630,446 @@ sendout_packet (GibberRMulticastCausalTransport *transport,
 {
   GibberRMulticastCausalTransportPrivate *priv =
     GIBBER_R_MULTICAST_CAUSAL_TRANSPORT_GET_PRIVATE (transport);
+  GibberRMulticastPacket *parity;
   guint8 *rawdata;
   gsize rawsize;
+  gboolean ret;
 
-  if (GIBBER_R_MULTICAST_PACKET_IS_RELIABLE_PACKET (packet)
-      && (packet->depends->len != 0
-          || g_hash_table_size (priv->sender_group->senders) == 0))
-    schedule_keepalive_message (transport);
+  packet_sent (transport, packet);
+  parity = fec_add_packet (transport, packet);
 
   rawdata = gibber_r_multicast_packet_get_raw_data (packet, &rawsize);
-  return gibber_transport_send (GIBBER_TRANSPORT(priv->transport),
+  ret = gibber_transport_send (GIBBER_TRANSPORT(priv->transport),
       rawdata, rawsize, error);
+
+  if (parity != NULL)
+    {
+      rawdata = gibber_r_multicast_packet_get_raw_data (parity, &rawsize);
+      gibber_transport_send (GIBBER_TRANSPORT(priv->transport),
+          rawdata, rawsize, NULL);
+      gibber_r_multicast_packet_unref (parity);
+    }
+
+  return ret;
+}
+
+/* Send out a number of packets in one go if the underlying transport
+ * supports it, one by one otherwise */
+static gboolean
+sendout_packets (GibberRMulticastCausalTransport *transport,
+                 GPtrArray *packets,
+                 GError **error)
+{
+  GibberRMulticastCausalTransportPrivate *priv =
+    GIBBER_R_MULTICAST_CAUSAL_TRANSPORT_GET_PRIVATE (transport);
+  GibberBuffer *datagrams;
+  GPtrArray *parities;
+  gboolean ret = TRUE;
+  guint i, n = 0;
+
+  if (!GIBBER_IS_MULTICAST_TRANSPORT (priv->transport))
+    {
+      for (i = 0; i < packets->len; i++)
+        {
+          /* Only report the first failure */
+          if (!sendout_packet (transport, g_ptr_array_index (packets, i),
+                ret ? error : NULL))
+            ret = FALSE;
+        }
+
+      return ret;
+    }
+
+  /* Leave room for a parity packet after every packet */
+  datagrams = g_new (GibberBuffer, 2 * packets->len);
+  parities = g_ptr_array_new_with_free_func (
+      (GDestroyNotify) gibber_r_multicast_packet_unref);
+
+  for (i = 0; i < packets->len; i++)
+    {
+      GibberRMulticastPacket *packet = g_ptr_array_index (packets, i);
+      GibberRMulticastPacket *parity;
+
+      packet_sent (transport, packet);
+      datagrams[n].data = gibber_r_multicast_packet_get_raw_data (packet,
+          &datagrams[n].length);
+      n++;
+
+      parity = fec_add_packet (transport, packet);
+      if (parity != NULL)
+        {
+          datagrams[n].data = gibber_r_multicast_packet_get_raw_data (parity,
+              &datagrams[n].length);
+          n++;
+          g_ptr_array_add (parities, parity);
+        }
+    }
+
+  ret = gibber_multicast_transport_send_batch (
+      GIBBER_MULTICAST_TRANSPORT (priv->transport), datagrams, n, error);
+  g_free (datagrams);
+  g_ptr_array_unref (parities);
+
+  return ret;
+}
+
+static gboolean pace_flush (GibberRMulticastCausalTransport *transport,
+    gboolean all, GError **error);
+
+static guint
+stream_get_weight (GibberRMulticastCausalTransport *transport,
+                   guint16 stream_id)
+{
+  GibberRMulticastCausalTransportPrivate *priv =
+    GIBBER_R_MULTICAST_CAUSAL_TRANSPORT_GET_PRIVATE (transport);
+  gpointer weight;
+
+  if (g_hash_table_lookup_extended (priv->stream_weights,
+        GUINT_TO_POINTER (stream_id), NULL, &weight))
+    return GPOINTER_TO_UINT (weight);
+
+  if (stream_id == GIBBER_R_MULTICAST_CAUSAL_DEFAULT_STREAM)
+    return STREAM_WEIGHT_DEFAULT_STREAM;
+
+  return STREAM_WEIGHT_DEFAULT;
+}
+
+/* Queue a message to be fragmented once it's the turn of its stream, takes
+ * over the reference to data */
+static void
+pace_queue_message (GibberRMulticastCausalTransport *transport,
+                    guint16 stream_id,
+                    GBytes *data,
+                    guint8 flags)
+{
+  GibberRMulticastCausalTransportPrivate *priv =
+    GIBBER_R_MULTICAST_CAUSAL_TRANSPORT_GET_PRIVATE (transport);
+  SendStream *stream;
+  QueuedMessage *message;
+
+  stream = g_hash_table_lookup (priv->send_streams,
+      GUINT_TO_POINTER (stream_id));
+
+  if (stream == NULL)
+    {
+      stream = g_slice_new0 (SendStream);
+      stream->stream_id = stream_id;
+      stream->weight = stream_get_weight (transport, stream_id);
+      /* Starts out with a full turn, so it doesn't wait a round for it */
+      stream->deficit = (gssize) (stream->weight
+          * reliable_packet_size (transport));
+      g_queue_init (&stream->messages);
+
+      g_hash_table_insert (priv->send_streams, GUINT_TO_POINTER (stream_id),
+          stream);
+      g_queue_push_tail (&priv->send_order, stream);
+    }
+
+  message = g_slice_new0 (QueuedMessage);
+  message->data = data;
+  message->flags = flags;
+
+  g_queue_push_tail (&stream->messages, message);
+  stream->queued_bytes += g_bytes_get_size (data);
+}
+
+/* Number the next fragment of the stream whose turn it is and put it on the
+ * pace queue, FALSE if nothing is queued. Fragments are numbered as they're
+ * sent, so receivers still get our packets in order while messages of
+ * different streams interleave. As receivers reassemble per stream, only
+ * fragments of the same stream have to be consecutive */
+static gboolean
+pace_next_fragment (GibberRMulticastCausalTransport *transport)
+{
+  GibberRMulticastCausalTransportPrivate *priv =
+    GIBBER_R_MULTICAST_CAUSAL_TRANSPORT_GET_PRIVATE (transport);
+  GibberRMulticastPacket *packet;
+  SendStream *stream;
+  QueuedMessage *message;
+  const guint8 *data;
+  gsize size, payloaded;
+  guint8 flags;
+
+  /* Streams that used up their turn get the next one at the back */
+  while ((stream = g_queue_peek_head (&priv->send_order)) != NULL
+      && stream->deficit <= 0)
+    {
+      stream->deficit += (gssize) (stream->weight
+          * reliable_packet_size (transport));
+      g_queue_push_tail (&priv->send_order,
+          g_queue_pop_head (&priv->send_order));
+    }
+
+  if (stream == NULL)
+    return FALSE;
+
+  message = g_queue_peek_head (&stream->messages);
+  data = g_bytes_get_data (message->data, &size);
+  flags = message->flags;
+
+  packet = gibber_r_multicast_packet_new_pooled (priv->packet_pool,
+      PACKET_TYPE_DATA, priv->self->id, reliable_packet_size (transport));
+
+  if (message->offset == 0)
+    {
+      add_packet_depends (transport, packet, FALSE);
+      flags |= GIBBER_R_MULTICAST_DATA_PACKET_START;
+    }
+
+  payloaded = gibber_r_multicast_packet_add_payload (packet,
+      data + message->offset, size - message->offset);
+  message->offset += payloaded;
+  stream->deficit -= (gssize) payloaded;
+  stream->queued_bytes -= payloaded;
+
+  if (message->offset == size)
+    {
+      flags |= GIBBER_R_MULTICAST_DATA_PACKET_END;
+      queued_message_free (g_queue_pop_head (&stream->messages));
+    }
+
+  gibber_r_multicast_packet_set_data_info (packet, stream->stream_id, flags,
+      size);
+  gibber_r_multicast_packet_set_packet_id (packet, priv->packet_id++);
+
+  if (g_queue_is_empty (&stream->messages))
+    {
+      g_queue_pop_head (&priv->send_order);
+      g_hash_table_remove (priv->send_streams,
+          GUINT_TO_POINTER (stream->stream_id));
+    }
+
+  g_queue_push_tail (&priv->pace_queue,
+      gibber_r_multicast_packet_ref (packet));
+
+  /* Might deliver our own messages and so send more, so only after
+   * everything is consistent again */
+  gibber_r_multicast_sender_push (priv->self, packet);
+  gibber_r_multicast_packet_unref (packet);
+
+  return TRUE;
+}
+
+static gboolean
+pace_timeout_cb (gpointer data)
+{
+  GibberRMulticastCausalTransport *self =
+      GIBBER_R_MULTICAST_CAUSAL_TRANSPORT (data);
+  GibberRMulticastCausalTransportPrivate *priv =
+    GIBBER_R_MULTICAST_CAUSAL_TRANSPORT_GET_PRIVATE (self);
+
+  priv->pace_timer = 0;
+  pace_flush (self, FALSE, NULL);
+
+  return FALSE;
+}
+
+static void
+pace_refill (GibberRMulticastCausalTransport *transport)
+{
+  GibberRMulticastCausalTransportPrivate *priv =
+    GIBBER_R_MULTICAST_CAUSAL_TRANSPORT_GET_PRIVATE (transport);
+  gint64 now = gibber_r_multicast_get_time ();
+  gint64 elapsed = MIN (now - priv->pace_last, G_USEC_PER_SEC);
+  gint64 burst = PACING_BURST_PACKETS * priv->transport->max_packet_size;
+
+  priv->pace_tokens += elapsed * priv->pace_rate / G_USEC_PER_SEC;
+  priv->pace_tokens = MIN (priv->pace_tokens, burst);
+  priv->pace_last = now;
+}
+
+/* Send out the queued packets the bucket has tokens for, or all of them, and
+ * wait for the tokens the next one needs */
+static gboolean
+pace_flush (GibberRMulticastCausalTransport *transport,
+            gboolean all,
+            GError **error)
+{
+  GibberRMulticastCausalTransportPrivate *priv =
+    GIBBER_R_MULTICAST_CAUSAL_TRANSPORT_GET_PRIVATE (transport);
+  GibberRMulticastPacket *packet;
+  GPtrArray *packets;
+  gboolean ret = TRUE;
+
+  if (g_queue_is_empty (&priv->pace_queue)
+      && g_queue_is_empty (&priv->send_order))
+    return TRUE;
+
+  if (priv->pace_rate == 0)
+    all = TRUE;
+  else
+    pace_refill (transport);
+
+  packets = g_ptr_array_new_with_free_func (
+      (GDestroyNotify) gibber_r_multicast_packet_unref);
+
+  for (;;)
+    {
+      gsize size;
+
+      packet = g_queue_peek_head (&priv->pace_queue);
+
+      /* Data fragments are numbered once everything before is out */
+      if (packet == NULL && pace_next_fragment (transport))
+        packet = g_queue_peek_head (&priv->pace_queue);
+
+      if (packet == NULL)
+        break;
+
+      gibber_r_multicast_packet_get_raw_data (packet, &size);
+      if (!all && priv->pace_tokens < (gint64) size)
+        break;
+
+      priv->pace_tokens -= size;
+      g_ptr_array_add (packets, g_queue_pop_head (&priv->pace_queue));
+    }
+
+  if (packets->len > 0)
+    ret = sendout_packets (transport, packets, error);
+  g_ptr_array_unref (packets);
+
+  /* Sending might have delivered our own messages and paced more */
+  packet = g_queue_peek_head (&priv->pace_queue);
+  if (packet != NULL && priv->pace_timer == 0)
+    {
+      gsize size;
+      gint64 wait;
+
+      gibber_r_multicast_packet_get_raw_data (packet, &size);
+      wait = ((gint64) size - priv->pace_tokens) * 1000 / priv->pace_rate;
+      priv->pace_timer = gibber_r_multicast_timeout_add (wait + 1,
+          pace_timeout_cb, transport);
+    }
+
+  return ret;
+}
+
+/* Send out a newly numbered membership or keepalive packet of our own,
+ * keeping to the current rate if any. It goes out before any data fragments
+ * that weren't numbered yet */
+static void
+pace_packet (GibberRMulticastCausalTransport *transport,
+             GibberRMulticastPacket *packet)
+{
+  GibberRMulticastCausalTransportPrivate *priv =
+    GIBBER_R_MULTICAST_CAUSAL_TRANSPORT_GET_PRIVATE (transport);
+
+  if (priv->pace_rate == 0)
+    {
+      sendout_packet (transport, packet, NULL);
+      return;
+    }
+
+  g_queue_push_tail (&priv->pace_queue,
+      gibber_r_multicast_packet_ref (packet));
+
+  if (priv->pace_timer == 0)
+    pace_flush (transport, FALSE, NULL);
+}
+
+/* Whether our packet is still waiting to be paced out. Session messages
+ * already announce those, so they can get requested early */
+static gboolean
+pace_is_queued (GibberRMulticastCausalTransport *transport,
+                guint32 packet_id)
+{
+  GibberRMulticastCausalTransportPrivate *priv =
+    GIBBER_R_MULTICAST_CAUSAL_TRANSPORT_GET_PRIVATE (transport);
+  GibberRMulticastPacket *head = g_queue_peek_head (&priv->pace_queue);
+
+  return head != NULL
+      && gibber_r_multicast_packet_diff (head->packet_id, packet_id) >= 0;
+}
+
+static void
+pace_clear (GibberRMulticastCausalTransport *transport)
+{
+  GibberRMulticastCausalTransportPrivate *priv =
+    GIBBER_R_MULTICAST_CAUSAL_TRANSPORT_GET_PRIVATE (transport);
+  GibberRMulticastPacket *packet;
+
+  if (priv->pace_timer != 0)
+    {
+      gibber_r_multicast_timeout_remove (priv->pace_timer);
+      priv->pace_timer = 0;
+    }
+
+  while ((packet = g_queue_pop_head (&priv->pace_queue)) != NULL)
+    gibber_r_multicast_packet_unref (packet);
+
+  g_queue_clear (&priv->send_order);
+  g_hash_table_remove_all (priv->send_streams);
+}
+
+static void
+pace_reset_rate (GibberRMulticastCausalTransport *transport)
+{
+  GibberRMulticastCausalTransportPrivate *priv =
+    GIBBER_R_MULTICAST_CAUSAL_TRANSPORT_GET_PRIVATE (transport);
+
+  if (!priv->pace_adaptive)
+    priv->pace_rate = priv->pace_max_rate;
+  else if (priv->pace_max_rate != 0)
+    priv->pace_rate = MIN (priv->pace_max_rate, PACING_INITIAL_RATE);
+  else
+    priv->pace_rate = PACING_INITIAL_RATE;
+
+  if (priv->pace_timer != 0)
+    {
+      gibber_r_multicast_timeout_remove (priv->pace_timer);
+      priv->pace_timer = 0;
+    }
+
+  /* Reschedules with the new rate, or sends everything when not pacing */
+  pace_flush (transport, FALSE, NULL);
+}
+
+/* Receivers are losing our packets, back off multiplicatively */
+static void
+pace_congestion (GibberRMulticastCausalTransport *transport)
+{
+  GibberRMulticastCausalTransportPrivate *priv =
+    GIBBER_R_MULTICAST_CAUSAL_TRANSPORT_GET_PRIVATE (transport);
+  gint64 now = gibber_r_multicast_get_time ();
+
+  if (!priv->pace_adaptive
+      || now - priv->pace_adapted < PACING_ADAPT_INTERVAL)
+    return;
+
+  priv->pace_adapted = now;
+  priv->pace_rate = MAX (priv->pace_rate / 4 * 3, PACING_MIN_RATE);
+  DEBUG_TRANSPORT (transport, "Slowing down to %u bytes/s", priv->pace_rate);
+}
+
+/* A receiver told us it got our packets up to packet_id */
+static void
+pace_ack (GibberRMulticastCausalTransport *transport,
+          guint32 packet_id)
+{
+  GibberRMulticastCausalTransportPrivate *priv =
+    GIBBER_R_MULTICAST_CAUSAL_TRANSPORT_GET_PRIVATE (transport);
+  GibberRMulticastPacket *head = g_queue_peek_head (&priv->pace_queue);
+  guint32 sent = head != NULL ? head->packet_id : priv->packet_id;
+  guint max_rate = priv->pace_max_rate != 0 ? priv->pace_max_rate : G_MAXINT;
+  gint64 now = gibber_r_multicast_get_time ();
+
+  if (!priv->pace_adaptive)
+    return;
+
+  if (gibber_r_multicast_packet_diff (packet_id, sent) > PACING_MAX_BEHIND)
+    {
+      pace_congestion (transport);
+      return;
+    }
+
+  if (now - priv->pace_adapted < PACING_ADAPT_INTERVAL)
+    return;
+
+  /* Keeping up, so speed up additively */
+  priv->pace_adapted = now;
+  priv->pace_rate = MIN ((guint64) priv->pace_rate
+      + PACING_BURST_PACKETS / 2 * priv->transport->max_packet_size,
+      max_rate);
 }
 
 static gchar *
@@ -364,21 +1095,80 @@ g_array_uint32_to_str (GArray *array)
 }
 
 static void
-add_sender_info (gpointer key, gpointer value, gpointer user_data)
+add_sender_id (gpointer key, gpointer value, gpointer user_data)
 {
   GibberRMulticastSender *sender = GIBBER_R_MULTICAST_SENDER (value);
-  GibberRMulticastPacket *packet = GIBBER_R_MULTICAST_PACKET (user_data);
-  gboolean r;
+  GArray *ids = (GArray *) user_data;
 
   if (sender->state == GIBBER_R_MULTICAST_SENDER_STATE_NEW ||
       sender->state >= GIBBER_R_MULTICAST_SENDER_STATE_FAILED)
     return;
 
+  g_array_append_val (ids, sender->id);
+}
+
+static gint
+compare_sender_id (gconstpointer a, gconstpointer b)
+{
+  guint32 ia = *(const guint32 *) a;
+  guint32 ib = *(const guint32 *) b;
+
+  return ia < ib ? -1 : (ia > ib ? 1 : 0);
+}
+
+static void
+add_sender_info (GibberRMulticastCausalTransport *self,
+                 GibberRMulticastPacket *packet,
+                 guint32 sender_id)
+{
+  GibberRMulticastCausalTransportPrivate *priv =
+      GIBBER_R_MULTICAST_CAUSAL_TRANSPORT_GET_PRIVATE (self);
+  GibberRMulticastSender *sender =
+      gibber_r_multicast_sender_group_lookup (priv->sender_group, sender_id);
+  gboolean r;
+
   r = gibber_r_multicast_packet_add_sender_info (packet, sender->id,
                sender->next_input_packet, NULL);
   g_assert (r);
 }
 
+/* Add ourselves and the next slice of the other senders, ordered by id and
+ * continuing after the last one in the previous session message seen */
+static void
+add_session_digest (GibberRMulticastCausalTransport *self,
+                    GibberRMulticastPacket *packet)
+{
+  GibberRMulticastCausalTransportPrivate *priv =
+      GIBBER_R_MULTICAST_CAUSAL_TRANSPORT_GET_PRIVATE (self);
+  GArray *ids = g_array_new (FALSE, FALSE, sizeof (guint32));
+  guint i, start, n;
+
+  g_hash_table_foreach (priv->sender_group->senders, add_sender_id, ids);
+  g_array_sort (ids, compare_sender_id);
+
+  if (priv->self->state != GIBBER_R_MULTICAST_SENDER_STATE_NEW)
+    add_sender_info (self, packet, priv->self->id);
+
+  for (start = 0; start < ids->len; start++)
+    if (g_array_index (ids, guint32, start) > priv->session_cursor)
+      break;
+
+  n = MIN (ids->len, GIBBER_R_MULTICAST_SESSION_DIGEST_SENDERS - 1);
+  for (i = 0; n > 0 && i < ids->len; i++)
+    {
+      guint32 id = g_array_index (ids, guint32, (start + i) % ids->len);
+
+      if (id == priv->self->id)
+        continue;
+
+      add_sender_info (self, packet, id);
+      priv->session_cursor = id;
+      n--;
+    }
+
+  g_array_free (ids, TRUE);
+}
+
 static gboolean
 sendout_session_cb (gpointer data)
 {
@@ -390,12 +1180,29 @@ sendout_session_cb (gpointer data)
   GibberRMulticastPacket *packet =
       gibber_r_multicast_packet_new (PACKET_TYPE_SESSION, priv->self->id,
           priv->transport->max_packet_size);
+  GibberRMulticastPacket *probe;
+  gint64 now = gibber_r_multicast_get_time ();
 
   DEBUG_TRANSPORT (self, "Preparing session message");
-  g_hash_table_foreach (priv->sender_group->senders, add_sender_info, packet);
+  add_session_digest (self, packet);
   DEBUG_TRANSPORT (self, "Sending out session message");
   sendout_packet (self, packet, NULL);
-  g_object_unref (packet);
+  gibber_r_multicast_packet_unref (packet);
+
+  /* The timestamps go in a packet of their own, older peers don't know the
+   * type and drop it without rejecting the session message */
+  probe = gibber_r_multicast_packet_new (PACKET_TYPE_RTT_PROBE,
+      priv->self->id, priv->transport->max_packet_size);
+  /* Timestamps wrap around, only differences between them matter */
+  gibber_r_multicast_packet_set_rtt_probe_info (probe, (guint32) now,
+      priv->echo_sender, priv->echo_timestamp,
+      priv->echo_sender != 0 ? now - priv->echo_received : 0,
+      gibber_r_multicast_compress_available () ?
+          GIBBER_R_MULTICAST_CAPABILITY_DEFLATE : 0);
+  priv->echo_sender = 0;
+  priv->session_sent = now;
+  sendout_packet (self, probe, NULL);
+  gibber_r_multicast_packet_unref (probe);
 
   priv->timer = 0;
   schedule_session_message (self);
@@ -409,13 +1216,26 @@ schedule_session_message (GibberRMulticastCausalTransport *transport)
   GibberRMulticastCausalTransportPrivate *priv =
       GIBBER_R_MULTICAST_CAUSAL_TRANSPORT_GET_PRIVATE (transport);
 
+  guint rtt = priv->sender_group->rtt;
+  guint timeout;
+
   if (priv->timer != 0)
-    g_source_remove (priv->timer);
+    gibber_r_multicast_timeout_remove (priv->timer);
+
+  if (rtt == 0)
+    {
+      timeout = g_random_int_range (SESSION_TIMEOUT_MIN, SESSION_TIMEOUT_MAX);
+    }
+  else
+    {
+      guint min = CLAMP ((guint64) SESSION_RTT_FACTOR * rtt / 1000,
+          SESSION_TIMEOUT_FLOOR, SESSION_TIMEOUT_MIN);
+
+      timeout = g_random_int_range (min, 2 * min);
+    }
 
-  priv->timer =
-      g_timeout_add (
-          g_random_int_range (SESSION_TIMEOUT_MIN, SESSION_TIMEOUT_MAX),
-          sendout_session_cb, transport);
+  priv->timer = gibber_r_multicast_timeout_add (timeout, sendout_session_cb,
+      transport);
 }
 
 static void
@@ -451,7 +1271,7 @@ connected (GibberRMulticastCausalTransport *transport)
   gibber_r_multicast_packet_set_whois_reply_info (packet, priv->name);
 
   sendout_packet (transport, packet, NULL);
-  g_object_unref (packet);
+  gibber_r_multicast_packet_unref (packet);
 
   schedule_session_message (transport);
   schedule_keepalive_message (transport);
@@ -481,9 +1301,9 @@ next_join_step (gpointer data)
           transport->sender_id);
 
       sendout_packet (transport, packet, NULL);
-      g_object_unref (packet);
+      gibber_r_multicast_packet_unref (packet);
 
-      priv->timer = g_timeout_add (ACTIVE_JOIN_INTERVAL,
+      priv->timer = gibber_r_multicast_timeout_add (ACTIVE_JOIN_INTERVAL,
           next_join_step, transport);
     }
   else
@@ -509,26 +1329,27 @@ start_joining (GibberRMulticastCausalTransport *transport)
 
   if (priv->timer != 0)
   {
-    g_source_remove (priv->timer);
+    gibber_r_multicast_timeout_remove (priv->timer);
   }
 
-  priv->timer = g_timeout_add (PASSIVE_JOIN_TIME,
+  priv->timer = gibber_r_multicast_timeout_add (PASSIVE_JOIN_TIME,
     next_join_step, transport);
 }
 
 static void
 data_received_cb (GibberRMulticastSender *sender,
                   guint16 stream_id,
-                  guint8 *data,
-                  gsize size,
+                  GBytes *payload,
                   gpointer user_data)
 {
   GibberRMulticastCausalBuffer rmbuffer;
+  gsize size;
 
-  rmbuffer.buffer.data = data;
+  rmbuffer.buffer.data = g_bytes_get_data (payload, &size);
   rmbuffer.buffer.length = size;
   rmbuffer.sender = sender->name;
   rmbuffer.stream_id = stream_id;
+  rmbuffer.payload = payload;
   rmbuffer.sender_id = sender->id;
 
   gibber_transport_received_data_custom (GIBBER_TRANSPORT (user_data),
@@ -548,21 +1369,51 @@ control_packet_received_cb (GibberRMulticastSender *sender,
 
 static void
 repair_request_cb (GibberRMulticastSender *sender,
-                   guint id,
+                   GArray *ids,
                    gpointer user_data)
 {
   GibberRMulticastCausalTransport *self =
       GIBBER_R_MULTICAST_CAUSAL_TRANSPORT (user_data);
   GibberRMulticastCausalTransportPrivate *priv =
       GIBBER_R_MULTICAST_CAUSAL_TRANSPORT_GET_PRIVATE (self);
-  GibberRMulticastPacket *packet =
-      gibber_r_multicast_packet_new (PACKET_TYPE_REPAIR_REQUEST,
+  GibberRMulticastPacket *packet = NULL;
+  guint i;
+
+  if (ids->len == 1)
+    {
+      /* Single losses are the common case, use the plain request */
+      packet = gibber_r_multicast_packet_new (PACKET_TYPE_REPAIR_REQUEST,
           priv->self->id, priv->transport->max_packet_size);
+      gibber_r_multicast_packet_set_repair_request_info (packet, sender->id,
+          g_array_index (ids, guint32, 0));
+
+      sendout_packet (self, packet, NULL);
+      gibber_r_multicast_packet_unref (packet);
+      return;
+    }
+
+  for (i = 0; i < ids->len; i++)
+    {
+      guint32 id = g_array_index (ids, guint32, i);
+
+      if (packet != NULL &&
+          gibber_r_multicast_packet_repair_range_add (packet, id))
+        continue;
+
+      if (packet != NULL)
+        {
+          sendout_packet (self, packet, NULL);
+          gibber_r_multicast_packet_unref (packet);
+        }
 
-  gibber_r_multicast_packet_set_repair_request_info (packet, sender->id, id);
+      packet = gibber_r_multicast_packet_new_pooled (priv->packet_pool,
+          PACKET_TYPE_REPAIR_RANGE_REQUEST, priv->self->id,
+          priv->transport->max_packet_size);
+      gibber_r_multicast_packet_set_repair_range_info (packet, sender->id, id);
+    }
 
   sendout_packet (self, packet, NULL);
-  g_object_unref (packet);
+  gibber_r_multicast_packet_unref (packet);
 }
 
 static void
@@ -572,6 +1423,12 @@ repair_message_cb (GibberRMulticastSender *sender,
 {
   GibberRMulticastCausalTransport *self =
       GIBBER_R_MULTICAST_CAUSAL_TRANSPORT (user_data);
+  GibberRMulticastCausalTransportPrivate *priv =
+    GIBBER_R_MULTICAST_CAUSAL_TRANSPORT_GET_PRIVATE (self);
+
+  /* Still waiting for its turn, it'll be sent out soon enough */
+  if (sender == priv->self && pace_is_queued (self, packet->packet_id))
+    return;
 
   sendout_packet (self, packet, NULL);
 }
@@ -591,7 +1448,7 @@ whois_reply_cb (GibberRMulticastSender *sender,
   gibber_r_multicast_packet_set_whois_reply_info (packet, sender->name);
 
   sendout_packet (self, packet, NULL);
-  g_object_unref (packet);
+  gibber_r_multicast_packet_unref (packet);
 }
 
 static void
@@ -609,7 +1466,7 @@ whois_request_cb (GibberRMulticastSender *sender,
   gibber_r_multicast_packet_set_whois_request_info (packet, sender->id);
 
   sendout_packet (self, packet, NULL);
-  g_object_unref (packet);
+  gibber_r_multicast_packet_unref (packet);
 }
 
 static void
@@ -686,6 +1543,7 @@ handle_session_message (GibberRMulticastCausalTransport *self,
 {
   GibberRMulticastCausalTransportPrivate *priv =
       GIBBER_R_MULTICAST_CAUSAL_TRANSPORT_GET_PRIVATE (self);
+  gint64 now = gibber_r_multicast_get_time ();
   guint i;
   gboolean outdated = FALSE;
 
@@ -694,8 +1552,8 @@ handle_session_message (GibberRMulticastCausalTransport *self,
   for (i = 0; i < packet->depends->len ; i++)
     {
       GibberRMulticastPacketSenderInfo *sender_info =
-          g_array_index (packet->depends,
-              GibberRMulticastPacketSenderInfo *, i);
+          &g_array_index (packet->depends,
+              GibberRMulticastPacketSenderInfo, i);
       GibberRMulticastSender *sender =
           gibber_r_multicast_sender_group_lookup (priv->sender_group,
               sender_info->sender_id);
@@ -707,6 +1565,9 @@ handle_session_message (GibberRMulticastCausalTransport *self,
           continue;
         }
 
+      if (sender == priv->self)
+        pace_ack (self, sender_info->packet_id);
+
       if (gibber_r_multicast_packet_diff (sender_info->packet_id,
                      sender->next_input_packet) > 0)
         {
@@ -716,17 +1577,59 @@ handle_session_message (GibberRMulticastCausalTransport *self,
       gibber_r_multicast_sender_seen (sender, sender_info->packet_id);
     }
 
+  /* Members rotate through the group together, the last one listed is
+   * where the digest of the session message stopped */
+  if (packet->depends->len > 1)
+    priv->session_cursor = g_array_index (packet->depends,
+        GibberRMulticastPacketSenderInfo, packet->depends->len - 1).sender_id;
+
   /* Reschedule the sending out of a session message if the received session
-   * message was at least as up to date as us */
+   * message was at least as up to date as us and as complete as ours would
+   * be */
   if (!outdated &&
-        g_hash_table_size (priv->sender_group->senders)
-            == packet->depends->len)
+        packet->depends->len >=
+            MIN (GIBBER_R_MULTICAST_SESSION_DIGEST_SENDERS,
+                g_hash_table_size (priv->sender_group->senders)) &&
+        (priv->echo_sender == 0
+            || now - priv->session_sent < RTT_PROBE_INTERVAL))
     {
       DEBUG_TRANSPORT (self, "Rescheduling session message");
       schedule_session_message (self);
     }
 }
 
+static void
+handle_rtt_probe (GibberRMulticastCausalTransport *self,
+                  GibberRMulticastPacket *packet)
+{
+  GibberRMulticastCausalTransportPrivate *priv =
+      GIBBER_R_MULTICAST_CAUSAL_TRANSPORT_GET_PRIVATE (self);
+  GibberRMulticastRttProbePacket *probe = &packet->data.rtt_probe;
+  gint64 now = gibber_r_multicast_get_time ();
+  GibberRMulticastSender *sender;
+
+  g_assert (packet->type == PACKET_TYPE_RTT_PROBE);
+
+  sender = gibber_r_multicast_sender_group_lookup (priv->sender_group,
+      packet->sender);
+
+  /* It echoes one of ours, so we know how long the round trip took */
+  if (sender != NULL && probe->echo_sender == self->sender_id)
+    gibber_r_multicast_sender_update_rtt (sender,
+        (guint32) now - probe->echo_timestamp - probe->echo_delay);
+
+  priv->echo_sender = packet->sender;
+  priv->echo_timestamp = probe->timestamp;
+  priv->echo_received = now;
+
+  if (probe->capabilities & GIBBER_R_MULTICAST_CAPABILITY_DEFLATE)
+    g_hash_table_add (priv->inflating_senders,
+        GUINT_TO_POINTER (packet->sender));
+  else
+    g_hash_table_remove (priv->inflating_senders,
+        GUINT_TO_POINTER (packet->sender));
+}
+
 static void
 handle_packet_depends (GibberRMulticastCausalTransport *self,
                        GibberRMulticastPacket *packet)
@@ -740,18 +1643,25 @@ handle_packet_depends (GibberRMulticastCausalTransport *self,
   for (i = 0 ; i <  packet->depends->len; i++)
     {
       GibberRMulticastPacketSenderInfo *sender_info =
-          g_array_index (packet->depends,
-              GibberRMulticastPacketSenderInfo *, i);
+          &g_array_index (packet->depends,
+              GibberRMulticastPacketSenderInfo, i);
       GibberRMulticastSender *sender =
           gibber_r_multicast_sender_group_lookup (priv->sender_group,
               sender_info->sender_id);
 
+      if (sender != NULL && sender == priv->self)
+        pace_ack (self, sender_info->packet_id);
+
       /* This might be a resent after which the sender was removed */
       if (sender != NULL)
         gibber_r_multicast_sender_seen (sender, sender_info->packet_id);
     }
 }
 
+static void
+handle_parity (GibberRMulticastCausalTransport *self,
+               GibberRMulticastPacket *packet);
+
 static void
 joining_multicast_receive (GibberRMulticastCausalTransport *self,
                            GibberRMulticastPacket *packet)
@@ -844,14 +1754,30 @@ joined_multicast_receive (GibberRMulticastCausalTransport *self,
 
   switch (packet->type)
     {
+      case PACKET_TYPE_REPAIR_REQUEST:
+        if (packet->data.repair_request.sender_id == self->sender_id
+            && !pace_is_queued (self, packet->data.repair_request.packet_id))
+          pace_congestion (self);
+        break;
+      case PACKET_TYPE_REPAIR_RANGE_REQUEST:
+        if (packet->data.repair_range_request.sender_id == self->sender_id
+            && !pace_is_queued (self,
+                packet->data.repair_range_request.packet_id))
+          pace_congestion (self);
+        break;
       case PACKET_TYPE_WHOIS_REQUEST:
       case PACKET_TYPE_WHOIS_REPLY:
-      case PACKET_TYPE_REPAIR_REQUEST:
          /* No postprocessing needed */
          break;
       case PACKET_TYPE_SESSION:
         handle_session_message (self, packet);
         break;
+      case PACKET_TYPE_PARITY:
+        handle_parity (self, packet);
+        break;
+      case PACKET_TYPE_RTT_PROBE:
+        handle_rtt_probe (self, packet);
+        break;
       default:
         if (GIBBER_R_MULTICAST_PACKET_IS_RELIABLE_PACKET (packet))
           {
@@ -865,6 +1791,32 @@ joined_multicast_receive (GibberRMulticastCausalTransport *self,
     }
 }
 
+/* Try to rebuild a lost packet from a parity packet, so we don't have to wait
+ * for a repair */
+static void
+handle_parity (GibberRMulticastCausalTransport *self,
+               GibberRMulticastPacket *packet)
+{
+  GibberRMulticastCausalTransportPrivate *priv =
+      GIBBER_R_MULTICAST_CAUSAL_TRANSPORT_GET_PRIVATE (self);
+  GibberRMulticastSender *sender;
+  GibberRMulticastPacket *recovered;
+
+  sender = gibber_r_multicast_sender_group_lookup (priv->sender_group,
+      packet->sender);
+  if (sender == NULL)
+    return;
+
+  recovered = gibber_r_multicast_sender_recover (sender, packet);
+  if (recovered == NULL)
+    return;
+
+  DEBUG_TRANSPORT (self, "Recovered packet %x from %x",
+      recovered->packet_id, recovered->sender);
+  joined_multicast_receive (self, recovered);
+  gibber_r_multicast_packet_unref (recovered);
+}
+
 /* Packet received while disconnecting. Only react on repair requests and
  * incoming reliable packets (to cancel repair request sends)
  */
@@ -894,6 +1846,20 @@ disconnecting_multicast_receive (GibberRMulticastCausalTransport *self,
           packet->data.repair_request.packet_id);
     }
 
+  if (packet->type == PACKET_TYPE_REPAIR_RANGE_REQUEST)
+    {
+      guint32 id = packet->data.repair_range_request.packet_id;
+
+      sender = gibber_r_multicast_sender_group_lookup (priv->sender_group,
+        packet->data.repair_range_request.sender_id);
+      if (sender != NULL)
+        {
+          do
+            gibber_r_multicast_sender_repair_request (sender, id);
+          while (gibber_r_multicast_packet_repair_range_next (packet, &id));
+        }
+    }
+
   if (GIBBER_R_MULTICAST_PACKET_IS_RELIABLE_PACKET (packet))
     {
       gibber_r_multicast_sender_push (sender, packet);
@@ -902,6 +1868,26 @@ disconnecting_multicast_receive (GibberRMulticastCausalTransport *self,
 
 
 
+static void
+receive_packet (GibberRMulticastCausalTransport *self,
+                GibberRMulticastPacket *packet)
+{
+  switch (GIBBER_TRANSPORT (self)->state)
+    {
+      case GIBBER_TRANSPORT_CONNECTING:
+        joining_multicast_receive (self, packet);
+        break;
+      case GIBBER_TRANSPORT_CONNECTED:
+        joined_multicast_receive (self, packet);
+        break;
+      case GIBBER_TRANSPORT_DISCONNECTING:
+        disconnecting_multicast_receive (self, packet);
+        break;
+      default:
+        g_assert_not_reached ();
+    }
+}
+
 static void
 r_multicast_receive (GibberTransport *transport,
                      GibberBuffer *buffer,
@@ -909,39 +1895,63 @@ r_multicast_receive (GibberTransport *transport,
 {
   GibberRMulticastCausalTransport *self =
       GIBBER_R_MULTICAST_CAUSAL_TRANSPORT (user_data);
+  GibberRMulticastCausalTransportPrivate *priv =
+      GIBBER_R_MULTICAST_CAUSAL_TRANSPORT_GET_PRIVATE (self);
   GibberRMulticastPacket *packet = NULL;
   GError *error = NULL;
 
-  packet = gibber_r_multicast_packet_parse (buffer->data,
-      buffer->length, &error);
+  packet = gibber_r_multicast_packet_parse_pooled (priv->packet_pool,
+      buffer->data, buffer->length, &error);
 
   if (packet == NULL)
     {
       DEBUG_TRANSPORT (self, "Failed to parse packet: %s", error->message);
+      g_error_free (error);
+      return;
     }
-  else
+
+  receive_packet (self, packet);
+  gibber_r_multicast_packet_unref (packet);
+}
+
+static void
+r_multicast_receive_batch (GibberMulticastTransport *transport,
+                           GBytes **datagrams,
+                           guint n_datagrams,
+                           gpointer user_data)
+{
+  GibberRMulticastCausalTransport *self =
+      GIBBER_R_MULTICAST_CAUSAL_TRANSPORT (user_data);
+  GibberRMulticastCausalTransportPrivate *priv =
+      GIBBER_R_MULTICAST_CAUSAL_TRANSPORT_GET_PRIVATE (self);
+  guint i;
+
+  g_object_ref (self);
+
+  /* Handling a packet might finish disconnecting us, drop the rest then */
+  for (i = 0; i < n_datagrams &&
+      GIBBER_TRANSPORT (self)->state != GIBBER_TRANSPORT_DISCONNECTED; i++)
     {
-      switch (GIBBER_TRANSPORT (self)->state)
+      GibberRMulticastPacket *packet;
+      GError *error = NULL;
+
+      /* Parse in place, packets that are kept get their own copy */
+      packet = gibber_r_multicast_packet_parse_bytes (priv->packet_pool,
+          datagrams[i], &error);
+
+      if (packet == NULL)
         {
-          case GIBBER_TRANSPORT_CONNECTING:
-            joining_multicast_receive (self, packet);
-            break;
-          case GIBBER_TRANSPORT_CONNECTED:
-            joined_multicast_receive (self, packet);
-            break;
-          case GIBBER_TRANSPORT_DISCONNECTING:
-            disconnecting_multicast_receive (self, packet);
-            break;
-          default:
-            g_assert_not_reached ();
+          DEBUG_TRANSPORT (self, "Failed to parse packet: %s",
+              error->message);
+          g_error_free (error);
+          continue;
         }
-    }
 
-  if (error != NULL)
-    g_error_free (error);
+      receive_packet (self, packet);
+      gibber_r_multicast_packet_unref (packet);
+    }
 
-  if (packet != NULL)
-    g_object_unref (packet);
+  g_object_unref (self);
 }
 
 GibberRMulticastCausalTransport *
@@ -960,6 +1970,11 @@ gibber_r_multicast_causal_transport_new (GibberTransport *transport,
   gibber_transport_set_handler (GIBBER_TRANSPORT (transport),
       r_multicast_receive, result);
 
+  if (GIBBER_IS_MULTICAST_TRANSPORT (transport))
+    gibber_multicast_transport_set_batch_handler (
+        GIBBER_MULTICAST_TRANSPORT (transport), r_multicast_receive_batch,
+        result);
+
   return result;
 }
 
@@ -998,21 +2013,55 @@ add_depend (gpointer key,
   if (sender == d->sender)
     return;
 
+  if (!d->full)
+    {
+      gpointer sent;
+
+      if (g_hash_table_lookup_extended (d->sent, GUINT_TO_POINTER (sender->id),
+              NULL, &sent)
+          && GPOINTER_TO_UINT (sent) == sender->next_output_packet)
+        return;
+    }
+
   r = gibber_r_multicast_packet_add_sender_info (d->packet, sender->id,
       sender->next_output_packet, NULL);
   g_assert (r);
+
+  g_hash_table_insert (d->sent, GUINT_TO_POINTER (sender->id),
+      GUINT_TO_POINTER (sender->next_output_packet));
 }
 
+/* Our packets are delivered in order, so a packet implicitly depends on
+ * everything our previous packet depended on. Unless full is set, only the
+ * senders that progressed since then are listed. The membership packets need
+ * the full vector, data packets get it every DEPENDS_FULL_INTERVAL packets
+ * so receivers that missed the start don't lag for long */
 static void
 add_packet_depends (GibberRMulticastCausalTransport *self,
-                    GibberRMulticastPacket *packet)
+                    GibberRMulticastPacket *packet,
+                    gboolean full)
 {
   GibberRMulticastCausalTransportPrivate *priv =
     GIBBER_R_MULTICAST_CAUSAL_TRANSPORT_GET_PRIVATE (self);
   struct hash_data hd;
 
+  if (priv->depends_partial >= DEPENDS_FULL_INTERVAL)
+    full = TRUE;
+
+  if (full)
+    {
+      g_hash_table_remove_all (priv->depends_sent);
+      priv->depends_partial = 0;
+    }
+  else
+    {
+      priv->depends_partial++;
+    }
+
   hd.sender = priv->self;
   hd.packet = packet;
+  hd.sent = priv->depends_sent;
+  hd.full = full;
   g_hash_table_foreach (priv->sender_group->senders, add_depend, &hd);
 }
 
@@ -1029,15 +2078,15 @@ send_keepalive_cb (gpointer data)
   priv->keepalive_timer = 0;
 
   DEBUG ("Sending out keepalive");
-  packet = gibber_r_multicast_packet_new (PACKET_TYPE_NO_DATA,
-      priv->self->id, priv->transport->max_packet_size);
+  packet = gibber_r_multicast_packet_new_pooled (priv->packet_pool,
+      PACKET_TYPE_NO_DATA, priv->self->id, reliable_packet_size (self));
 
   gibber_r_multicast_packet_set_packet_id (packet, priv->packet_id++);
-  add_packet_depends (self, packet);
+  add_packet_depends (self, packet, TRUE);
 
   gibber_r_multicast_sender_push (priv->self, packet);
-  sendout_packet (self, packet, NULL);
-  g_object_unref (packet);
+  pace_packet (self, packet);
+  gibber_r_multicast_packet_unref (packet);
 
   return FALSE;
 }
@@ -1050,13 +2099,41 @@ schedule_keepalive_message (GibberRMulticastCausalTransport *transport)
       GIBBER_R_MULTICAST_CAUSAL_TRANSPORT_GET_PRIVATE (transport);
 
   if (priv->keepalive_timer != 0)
-    g_source_remove (priv->keepalive_timer);
+    gibber_r_multicast_timeout_remove (priv->keepalive_timer);
 
   priv->keepalive_timer =
-      g_timeout_add (KEEPALIVE_TIMEOUT, send_keepalive_cb, transport);
+      gibber_r_multicast_timeout_add (KEEPALIVE_TIMEOUT, send_keepalive_cb,
+          transport);
 }
 
 
+/* Whether every other member advertised that it can inflate messages, older
+ * members would hand the compressed bytes to the application */
+static gboolean
+group_can_inflate (GibberRMulticastCausalTransport *self)
+{
+  GibberRMulticastCausalTransportPrivate *priv =
+    GIBBER_R_MULTICAST_CAUSAL_TRANSPORT_GET_PRIVATE (self);
+  GHashTableIter iter;
+  gpointer value;
+
+  g_hash_table_iter_init (&iter, priv->sender_group->senders);
+  while (g_hash_table_iter_next (&iter, NULL, &value))
+    {
+      GibberRMulticastSender *sender = GIBBER_R_MULTICAST_SENDER (value);
+
+      if (sender == priv->self
+          || sender->state >= GIBBER_R_MULTICAST_SENDER_STATE_STOPPED)
+        continue;
+
+      if (!g_hash_table_contains (priv->inflating_senders,
+            GUINT_TO_POINTER (sender->id)))
+        return FALSE;
+    }
+
+  return TRUE;
+}
+
 gboolean
 gibber_r_multicast_causal_transport_send (
     GibberRMulticastCausalTransport *transport,
@@ -1069,54 +2146,91 @@ gibber_r_multicast_causal_transport_send (
       GIBBER_R_MULTICAST_CAUSAL_TRANSPORT (transport);
   GibberRMulticastCausalTransportPrivate *priv =
     GIBBER_R_MULTICAST_CAUSAL_TRANSPORT_GET_PRIVATE (self);
-  GibberRMulticastPacket *packet;
-  gsize payloaded;
-  gboolean ret = TRUE;
+  GBytes *message = NULL;
+  guint8 flags = 0;
 
   if (priv->resetting)
     return TRUE;
 
   g_assert (priv->self != NULL);
 
-  packet = gibber_r_multicast_packet_new (PACKET_TYPE_DATA, priv->self->id,
-      priv->transport->max_packet_size);
+  /* Compressed as a whole, so it might need less fragments */
+  if (g_hash_table_contains (priv->compressed_streams,
+        GUINT_TO_POINTER (stream_id))
+      && group_can_inflate (self))
+    message = gibber_r_multicast_compress (data, size);
+
+  if (message != NULL)
+    flags = GIBBER_R_MULTICAST_DATA_PACKET_DEFLATE;
+  else if (priv->pace_rate == 0)
+    /* Not pacing, so it's fragmented and sent out before we return */
+    message = g_bytes_new_static (data, size);
+  else
+    message = g_bytes_new (data, size);
 
-  add_packet_depends (self, packet);
-  payloaded = gibber_r_multicast_packet_add_payload (packet, data, size);
-  gibber_r_multicast_packet_set_data_info (packet, stream_id,
-        GIBBER_R_MULTICAST_DATA_PACKET_START, size);
+  pace_queue_message (self, stream_id, message, flags);
 
-  if (payloaded < size)
-    {
-      do
-        {
-          gibber_r_multicast_packet_set_packet_id (packet, priv->packet_id++);
-          ret = sendout_packet (self, packet, error);
-          gibber_r_multicast_sender_push (priv->self, packet);
-          g_object_unref (packet);
-
-          packet = gibber_r_multicast_packet_new (PACKET_TYPE_DATA,
-              priv->self->id, priv->transport->max_packet_size);
-          payloaded += gibber_r_multicast_packet_add_payload (packet,
-              data + payloaded, size - payloaded);
-          gibber_r_multicast_packet_set_data_info (packet, stream_id, 0, size);
-      } while (payloaded < size);
-     gibber_r_multicast_packet_set_data_info (packet, stream_id,
-        GIBBER_R_MULTICAST_DATA_PACKET_END, size);
-   }
+  if (priv->pace_timer != 0)
+    return TRUE;
+
+  return pace_flush (self, FALSE, error);
+}
+
+void
+gibber_r_multicast_causal_transport_set_stream_compression (
+    GibberRMulticastCausalTransport *transport,
+    guint16 stream_id,
+    gboolean compress)
+{
+  GibberRMulticastCausalTransportPrivate *priv =
+    GIBBER_R_MULTICAST_CAUSAL_TRANSPORT_GET_PRIVATE (transport);
+
+  if (compress && gibber_r_multicast_compress_available ())
+    g_hash_table_add (priv->compressed_streams, GUINT_TO_POINTER (stream_id));
   else
-    {
-      gibber_r_multicast_packet_set_data_info (packet, stream_id,
-        GIBBER_R_MULTICAST_DATA_PACKET_START
-        | GIBBER_R_MULTICAST_DATA_PACKET_END, size);
+    g_hash_table_remove (priv->compressed_streams,
+        GUINT_TO_POINTER (stream_id));
+}
 
-    }
-  gibber_r_multicast_packet_set_packet_id (packet, priv->packet_id++);
-  gibber_r_multicast_sender_push (priv->self, packet);
-  ret = sendout_packet (self, packet, error);
-  g_object_unref (packet);
+void
+gibber_r_multicast_causal_transport_set_stream_weight (
+    GibberRMulticastCausalTransport *transport,
+    guint16 stream_id,
+    guint weight)
+{
+  GibberRMulticastCausalTransportPrivate *priv =
+    GIBBER_R_MULTICAST_CAUSAL_TRANSPORT_GET_PRIVATE (transport);
+  SendStream *stream;
 
-  return ret;
+  g_return_if_fail (weight > 0);
+
+  g_hash_table_insert (priv->stream_weights, GUINT_TO_POINTER (stream_id),
+      GUINT_TO_POINTER (weight));
+
+  /* Takes effect from its next turn */
+  stream = g_hash_table_lookup (priv->send_streams,
+      GUINT_TO_POINTER (stream_id));
+  if (stream != NULL)
+    stream->weight = weight;
+}
+
+guint
+gibber_r_multicast_causal_transport_get_stream_queue_depth (
+    GibberRMulticastCausalTransport *transport,
+    guint16 stream_id,
+    gsize *bytes)
+{
+  GibberRMulticastCausalTransportPrivate *priv =
+    GIBBER_R_MULTICAST_CAUSAL_TRANSPORT_GET_PRIVATE (transport);
+  SendStream *stream;
+
+  stream = g_hash_table_lookup (priv->send_streams,
+      GUINT_TO_POINTER (stream_id));
+
+  if (bytes != NULL)
+    *bytes = stream != NULL ? stream->queued_bytes : 0;
+
+  return stream != NULL ? g_queue_get_length (&stream->messages) : 0;
 }
 
 static gboolean
@@ -1139,6 +2253,12 @@ reconnect (GibberRMulticastCausalTransport *self)
   gibber_r_multicast_sender_group_free (priv->sender_group);
   priv->sender_group = gibber_r_multicast_sender_group_new ();
   priv->packet_id = g_random_int ();
+  priv->fec_next = priv->packet_id;
+  priv->fec_count = 0;
+  pace_clear (self);
+  g_hash_table_remove_all (priv->depends_sent);
+  priv->depends_partial = 0;
+  priv->session_cursor = 0;
   priv->resetting = FALSE;
 
   g_assert (gibber_r_multicast_causal_transport_connect (self, FALSE, NULL));
@@ -1152,7 +2272,7 @@ disconnect_done (GibberRMulticastCausalTransport *self)
 
   if (priv->timer != 0)
     {
-      g_source_remove (priv->timer);
+      gibber_r_multicast_timeout_remove (priv->timer);
     }
 
   gibber_transport_disconnect (GIBBER_TRANSPORT (priv->transport));
@@ -1183,13 +2303,13 @@ send_next_bye (gpointer data)
    gibber_r_multicast_packet_set_packet_id (packet, priv->packet_id);
 
    sendout_packet (self, packet, NULL);
-   g_object_unref (packet);
+   gibber_r_multicast_packet_unref (packet);
 
    priv->nr_bye++;
 
   if (priv->nr_bye < NR_BYE_TO_SEND)
     {
-      priv->timer = g_timeout_add (BYE_INTERVAL,
+      priv->timer = gibber_r_multicast_timeout_add (BYE_INTERVAL,
           send_next_bye, self);
     }
   else if (priv->resetting)
@@ -1218,15 +2338,18 @@ do_disconnect (GibberRMulticastCausalTransport *transport)
 
   if (priv->timer != 0)
     {
-      g_source_remove (priv->timer);
+      gibber_r_multicast_timeout_remove (priv->timer);
     }
 
   if (priv->keepalive_timer != 0)
     {
-      g_source_remove (priv->keepalive_timer);
+      gibber_r_multicast_timeout_remove (priv->keepalive_timer);
       priv->keepalive_timer = 0;
     }
 
+  /* Everything we sent has to be out before the bye */
+  pace_flush (self, TRUE, NULL);
+
   gibber_transport_set_state (GIBBER_TRANSPORT (self),
                               GIBBER_TRANSPORT_DISCONNECTING);
 
@@ -1285,7 +2408,7 @@ gibber_r_multicast_causal_transport_send_attempt_join (
   gibber_r_multicast_packet_set_packet_id (packet, priv->packet_id++);
   gibber_r_multicast_packet_attempt_join_add_senders (packet, new_senders,
       NULL);
-  add_packet_depends (transport, packet);
+  add_packet_depends (transport, packet, TRUE);
 
   str = g_array_uint32_to_str (new_senders);
   DEBUG_TRANSPORT (transport, "Sending out %sAJ: %s",
@@ -1296,10 +2419,10 @@ gibber_r_multicast_causal_transport_send_attempt_join (
   gibber_r_multicast_sender_set_packet_repeat (priv->self,
       packet->packet_id, repeat);
 
-  sendout_packet (transport, packet, NULL);
+  pace_packet (transport, packet);
 
   packet_id = packet->packet_id;
-  g_object_unref (packet);
+  gibber_r_multicast_packet_unref (packet);
 
   return packet_id;
 }
@@ -1331,7 +2454,7 @@ gibber_r_multicast_causal_transport_send_failure (
   gibber_r_multicast_packet_set_packet_id (packet, priv->packet_id++);
   gibber_r_multicast_packet_failure_add_senders (packet, failures,
       NULL);
-  add_packet_depends (transport, packet);
+  add_packet_depends (transport, packet, TRUE);
 
   str = g_array_uint32_to_str (failures);
   DEBUG_TRANSPORT (transport, "Sending out failure: %s", str);
@@ -1339,8 +2462,8 @@ gibber_r_multicast_causal_transport_send_failure (
 
   gibber_r_multicast_sender_push (priv->self, packet);
 
-  sendout_packet (transport, packet, NULL);
-  g_object_unref (packet);
+  pace_packet (transport, packet);
+  gibber_r_multicast_packet_unref (packet);
 }
 
 void
@@ -1354,12 +2477,12 @@ gibber_r_multicast_causal_transport_send_join (
       priv->self->id, priv->transport->max_packet_size);
 
   gibber_r_multicast_packet_set_packet_id (packet, priv->packet_id++);
-  add_packet_depends (transport, packet);
+  add_packet_depends (transport, packet, TRUE);
   gibber_r_multicast_packet_join_add_failures (packet, failures, NULL);
 
   gibber_r_multicast_sender_push (priv->self, packet);
-  sendout_packet (transport, packet, NULL);
-  g_object_unref (packet);
+  pace_packet (transport, packet);
+  gibber_r_multicast_packet_unref (packet);
 }
 
 GibberRMulticastSender *
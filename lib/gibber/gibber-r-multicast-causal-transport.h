@@ -46,6 +46,8 @@ typedef struct {
   GibberBuffer buffer;
   const gchar *sender;
   guint16 stream_id;
+  /* Holds buffer.data, ref it to keep the data without copying it */
+  GBytes *payload;
   guint32 sender_id;
 } GibberRMulticastCausalBuffer;
 
@@ -84,6 +86,25 @@ gboolean gibber_r_multicast_causal_transport_send (
     GibberRMulticastCausalTransport *transport, guint16 stream_id,
     const guint8 *data, gsize size, GError **error);
 
+/* Compress messages sent on stream_id, as long as every member advertised
+ * it can inflate them. Does nothing if compression isn't available */
+void gibber_r_multicast_causal_transport_set_stream_compression (
+    GibberRMulticastCausalTransport *transport, guint16 stream_id,
+    gboolean compress);
+
+/* Share of the send rate stream_id gets while messages of several streams are
+ * waiting to be paced out, relative to the weights of the others. Defaults to
+ * 8 for GIBBER_R_MULTICAST_CAUSAL_DEFAULT_STREAM and 1 for other streams */
+void gibber_r_multicast_causal_transport_set_stream_weight (
+    GibberRMulticastCausalTransport *transport, guint16 stream_id,
+    guint weight);
+
+/* Number of messages sent on stream_id still waiting to be paced out. If
+ * bytes isn't NULL it's set to how much of those isn't fragmented yet */
+guint gibber_r_multicast_causal_transport_get_stream_queue_depth (
+    GibberRMulticastCausalTransport *transport, guint16 stream_id,
+    gsize *bytes);
+
 GibberRMulticastSender *gibber_r_multicast_causal_transport_add_sender (
     GibberRMulticastCausalTransport *transport, guint32 sender_id);
 
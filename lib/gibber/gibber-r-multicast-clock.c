@@ -0,0 +1,183 @@
+/*
+ * gibber-r-multicast-clock.c - Source for the r-multicast timers and clock
+ * Copyright (C) 2007 Collabora Ltd.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+#include "config.h"
+#include "gibber-r-multicast-clock.h"
+
+typedef struct {
+  guint id;
+  /* in milliseconds, like g_timeout_add */
+  guint interval;
+  gint64 due;
+  /* tie breaker for timeouts due at the same time, so they run in the order
+   * they were scheduled */
+  guint64 order;
+  GSourceFunc function;
+  gpointer data;
+  /* NULL while the timeout is being dispatched */
+  GSequenceIter *iter;
+  gboolean removed;
+} VirtualTimeout;
+
+static gboolean use_virtual = FALSE;
+
+/* Start well away from 0, which is used as never set in places */
+static gint64 virtual_now = 1000 * G_USEC_PER_SEC;
+static guint virtual_next_id = 1;
+static guint64 virtual_next_order = 0;
+
+/* guint id -> owned VirtualTimeout */
+static GHashTable *virtual_timeouts = NULL;
+/* VirtualTimeout sorted by due time */
+static GSequence *virtual_queue = NULL;
+
+static void
+virtual_timeout_free (gpointer data)
+{
+  g_slice_free (VirtualTimeout, data);
+}
+
+static gint
+compare_virtual_timeouts (gconstpointer a,
+                          gconstpointer b,
+                          gpointer user_data)
+{
+  const VirtualTimeout *ta = a;
+  const VirtualTimeout *tb = b;
+
+  if (ta->due != tb->due)
+    return ta->due < tb->due ? -1 : 1;
+
+  if (ta->order != tb->order)
+    return ta->order < tb->order ? -1 : 1;
+
+  return 0;
+}
+
+static void
+virtual_timeout_schedule (VirtualTimeout *t)
+{
+  t->due = virtual_now + (gint64) t->interval * 1000;
+  t->order = virtual_next_order++;
+  t->iter = g_sequence_insert_sorted (virtual_queue, t,
+      compare_virtual_timeouts, NULL);
+}
+
+guint
+gibber_r_multicast_timeout_add (guint interval,
+                                GSourceFunc function,
+                                gpointer data)
+{
+  VirtualTimeout *t;
+
+  if (!use_virtual)
+    return g_timeout_add (interval, function, data);
+
+  t = g_slice_new0 (VirtualTimeout);
+  t->id = virtual_next_id++;
+  t->interval = interval;
+  t->function = function;
+  t->data = data;
+
+  if (G_UNLIKELY (virtual_next_id == 0))
+    virtual_next_id = 1;
+
+  virtual_timeout_schedule (t);
+  g_hash_table_insert (virtual_timeouts, GUINT_TO_POINTER (t->id), t);
+
+  return t->id;
+}
+
+void
+gibber_r_multicast_timeout_remove (guint id)
+{
+  VirtualTimeout *t;
+
+  if (!use_virtual)
+    {
+      g_source_remove (id);
+      return;
+    }
+
+  t = g_hash_table_lookup (virtual_timeouts, GUINT_TO_POINTER (id));
+  g_return_if_fail (t != NULL);
+
+  if (t->iter == NULL)
+    {
+      /* Removing itself from its callback, freed once it returns */
+      t->removed = TRUE;
+      return;
+    }
+
+  g_sequence_remove (t->iter);
+  g_hash_table_remove (virtual_timeouts, GUINT_TO_POINTER (id));
+}
+
+gint64
+gibber_r_multicast_get_time (void)
+{
+  if (use_virtual)
+    return virtual_now;
+
+  return g_get_monotonic_time ();
+}
+
+void
+gibber_r_multicast_clock_use_virtual (void)
+{
+  g_return_if_fail (!use_virtual);
+
+  use_virtual = TRUE;
+  virtual_timeouts = g_hash_table_new_full (g_direct_hash, g_direct_equal,
+      NULL, virtual_timeout_free);
+  virtual_queue = g_sequence_new (NULL);
+}
+
+gboolean
+gibber_r_multicast_clock_run_next (gint64 until)
+{
+  GSequenceIter *iter;
+  VirtualTimeout *t;
+
+  g_return_val_if_fail (use_virtual, FALSE);
+
+  iter = g_sequence_get_begin_iter (virtual_queue);
+  if (g_sequence_iter_is_end (iter))
+    goto none;
+
+  t = g_sequence_get (iter);
+  if (t->due > until)
+    goto none;
+
+  virtual_now = MAX (virtual_now, t->due);
+
+  g_sequence_remove (iter);
+  t->iter = NULL;
+
+  if (t->function (t->data) && !t->removed)
+    virtual_timeout_schedule (t);
+  else
+    g_hash_table_remove (virtual_timeouts, GUINT_TO_POINTER (t->id));
+
+  return TRUE;
+
+none:
+  virtual_now = MAX (virtual_now, until);
+  return FALSE;
+}
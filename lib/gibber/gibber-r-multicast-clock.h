@@ -0,0 +1,50 @@
+/*
+ * gibber-r-multicast-clock.h - Header for the r-multicast timers and clock
+ * Copyright (C) 2007 Collabora Ltd.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+#ifndef __GIBBER_R_MULTICAST_CLOCK_H__
+#define __GIBBER_R_MULTICAST_CLOCK_H__
+
+#include <glib.h>
+
+G_BEGIN_DECLS
+
+/* All timeouts and timestamps of the r-multicast code go through these.
+ * Normally they are g_timeout_add, g_source_remove and g_get_monotonic_time,
+ * after gibber_r_multicast_clock_use_virtual they run on a virtual clock
+ * which only moves on when gibber_r_multicast_clock_run_next is called */
+guint gibber_r_multicast_timeout_add (guint interval, GSourceFunc function,
+    gpointer data);
+
+void gibber_r_multicast_timeout_remove (guint id);
+
+/* Monotonic time in microseconds */
+gint64 gibber_r_multicast_get_time (void);
+
+/* Switch to the virtual clock, must be called before any timeout is
+ * added */
+void gibber_r_multicast_clock_use_virtual (void);
+
+/* Advance the virtual clock to the first timeout due at or before @until and
+ * dispatch it. Returns FALSE after advancing the clock to @until if there is
+ * no such timeout */
+gboolean gibber_r_multicast_clock_run_next (gint64 until);
+
+G_END_DECLS
+
+#endif /* #ifndef __GIBBER_R_MULTICAST_CLOCK_H__ */
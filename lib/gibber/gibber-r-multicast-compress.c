@@ -0,0 +1,176 @@
+/*
+ * gibber-r-multicast-compress.c - Source for r-multicast message compression
+ * Copyright (C) 2007 Collabora Ltd.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+#include "config.h"
+#include "gibber-r-multicast-compress.h"
+
+#include <string.h>
+
+#ifdef HAVE_ZLIB
+#include <zlib.h>
+#endif
+
+/* Compressed messages are the uncompressed size (32 bit) followed by a raw
+ * deflate stream. Each message is compressed on its own, as members joining
+ * later never see the earlier ones, so the shared dictionary is what makes
+ * short stanzas compress at all */
+#define SIZE_HEADER 4
+
+/* Not worth the effort below 64 bytes */
+#define COMPRESS_MIN_SIZE 64
+
+/* Refuse to inflate messages claiming to be bigger than 16 MiB */
+#define DECOMPRESS_MAX_SIZE (16 * 1024 * 1024)
+
+#ifdef HAVE_ZLIB
+/* Strings common in the stanzas sent to muc's, the most common ones last as
+ * those are the cheapest to refer to. Changing this breaks compatibility */
+static const gchar dictionary[] =
+  "http://telepathy.freedesktop.org/xmpp/protocol/muc-bytestream"
+  "http://telepathy.freedesktop.org/xmpp/tubes"
+  "http://laptop.org/xmpp/buddy-properties"
+  "http://laptop.org/xmpp/current-activity"
+  "http://laptop.org/xmpp/activities"
+  "http://laptop.org/xmpp/activity-properties"
+  "http://jabber.org/protocol/muc#user"
+  "http://jabber.org/protocol/chatstates"
+  "<composing/><active/><paused/>"
+  "urn:ietf:params:xml:ns:xmpp-stanzas"
+  " type='error'><error type='cancel'>"
+  "<property name='' type='str'></property>"
+  "<properties xmlns='' activity='' room=''></properties>"
+  "<tube xmlns='' type='dbus' service='' stream-id='' id='' initiator=''>"
+  "<parameters><parameter name='' type=''></parameter></parameters></tube>"
+  "<presence from='' to=''></presence>"
+  "<x xmlns='jabber:x:delay' stamp=''/>"
+  "<message type='groupchat' from='' to=''><body></body></message>"
+  " xmlns='jabber:client'";
+
+static void
+init_stream (z_stream *z)
+{
+  memset (z, 0, sizeof (z_stream));
+}
+#endif
+
+gboolean
+gibber_r_multicast_compress_available (void)
+{
+#ifdef HAVE_ZLIB
+  return TRUE;
+#else
+  return FALSE;
+#endif
+}
+
+GBytes *
+gibber_r_multicast_compress (const guint8 *data,
+                             gsize size)
+{
+#ifdef HAVE_ZLIB
+  z_stream z;
+  guint8 *out;
+  gsize out_size;
+  guint32 nsize;
+  int ret;
+
+  if (size < COMPRESS_MIN_SIZE || size > DECOMPRESS_MAX_SIZE)
+    return NULL;
+
+  init_stream (&z);
+  if (deflateInit2 (&z, Z_BEST_COMPRESSION, Z_DEFLATED, -MAX_WBITS, 8,
+        Z_DEFAULT_STRATEGY) != Z_OK)
+    return NULL;
+
+  deflateSetDictionary (&z, (const Bytef *) dictionary,
+      sizeof (dictionary) - 1);
+
+  out_size = SIZE_HEADER + deflateBound (&z, size);
+  out = g_malloc (out_size);
+
+  nsize = g_htonl (size);
+  memcpy (out, &nsize, SIZE_HEADER);
+
+  z.next_in = (Bytef *) data;
+  z.avail_in = size;
+  z.next_out = out + SIZE_HEADER;
+  z.avail_out = out_size - SIZE_HEADER;
+
+  ret = deflate (&z, Z_FINISH);
+  deflateEnd (&z);
+
+  if (ret != Z_STREAM_END || SIZE_HEADER + z.total_out >= size)
+    {
+      g_free (out);
+      return NULL;
+    }
+
+  return g_bytes_new_take (out, SIZE_HEADER + z.total_out);
+#else
+  return NULL;
+#endif
+}
+
+GBytes *
+gibber_r_multicast_decompress (const guint8 *data,
+                               gsize size)
+{
+#ifdef HAVE_ZLIB
+  z_stream z;
+  guint8 *out;
+  guint32 out_size;
+  int ret;
+
+  if (size < SIZE_HEADER)
+    return NULL;
+
+  memcpy (&out_size, data, SIZE_HEADER);
+  out_size = g_ntohl (out_size);
+
+  if (out_size == 0 || out_size > DECOMPRESS_MAX_SIZE)
+    return NULL;
+
+  init_stream (&z);
+  if (inflateInit2 (&z, -MAX_WBITS) != Z_OK)
+    return NULL;
+
+  inflateSetDictionary (&z, (const Bytef *) dictionary,
+      sizeof (dictionary) - 1);
+
+  out = g_malloc (out_size);
+
+  z.next_in = (Bytef *) data + SIZE_HEADER;
+  z.avail_in = size - SIZE_HEADER;
+  z.next_out = out;
+  z.avail_out = out_size;
+
+  ret = inflate (&z, Z_FINISH);
+  inflateEnd (&z);
+
+  if (ret != Z_STREAM_END || z.total_out != out_size || z.avail_in != 0)
+    {
+      g_free (out);
+      return NULL;
+    }
+
+  return g_bytes_new_take (out, out_size);
+#else
+  return NULL;
+#endif
+}
@@ -0,0 +1,40 @@
+/*
+ * gibber-r-multicast-compress.h - Header for r-multicast message compression
+ * Copyright (C) 2007 Collabora Ltd.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+#ifndef __GIBBER_R_MULTICAST_COMPRESS_H__
+#define __GIBBER_R_MULTICAST_COMPRESS_H__
+
+#include <glib.h>
+
+G_BEGIN_DECLS
+
+/* Whether this build can compress and decompress messages */
+gboolean gibber_r_multicast_compress_available (void);
+
+/* Deflate a message with the shared XMPP dictionary. Returns NULL if
+ * compression is unavailable or doesn't make the message smaller */
+GBytes *gibber_r_multicast_compress (const guint8 *data, gsize size);
+
+/* Inflate a message compressed by gibber_r_multicast_compress. Returns NULL
+ * if it is corrupt or compression is unavailable */
+GBytes *gibber_r_multicast_decompress (const guint8 *data, gsize size);
+
+G_END_DECLS
+
+#endif /* #ifndef __GIBBER_R_MULTICAST_COMPRESS_H__ */
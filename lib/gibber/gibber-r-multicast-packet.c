@@ -37,25 +37,47 @@
 #define PACKET_HEADER_SIZE (6 + PACKET_PREFIX_LENGTH)
 
 
-static void gibber_r_multicast_packet_sender_info_free (
-    GibberRMulticastPacketSenderInfo *sender_info);
+/* Packets the pool keeps around for reuse at most */
+#define POOL_MAX_FREE 64
 
-G_DEFINE_TYPE(GibberRMulticastPacket, gibber_r_multicast_packet, G_TYPE_OBJECT)
+G_DEFINE_BOXED_TYPE (GibberRMulticastPacket, gibber_r_multicast_packet,
+    gibber_r_multicast_packet_ref, gibber_r_multicast_packet_unref)
 
 GQuark gibber_r_multicast_packet_error_quark (void);
 
-/* private structure */
+/* private structure, the public one is embedded at the start */
 typedef struct _GibberRMulticastPacketPrivate GibberRMulticastPacketPrivate;
 
 struct _GibberRMulticastPacketPrivate
 {
-  gboolean dispose_has_run;
+  GibberRMulticastPacket packet;
+
+  gint ref_count;
+  /* Pool this packet returns to when released, NULL if none */
+  GibberRMulticastPacketPool *pool;
+  /* Next packet in the pools free list */
+  GibberRMulticastPacketPrivate *next_free;
+
   /* Actually needed data size untill this point */
   gsize size;
 
   guint8 *data;
   /* Maximum data size */
   gsize max_data;
+
+  /* Receive buffer data borrows from, NULL if data is owned */
+  GBytes *backing;
+  /* Whether the data or parity packet payload points into data */
+  gboolean payload_is_view;
+};
+
+/* Packets are only ever used from the main loop, so neither the pool nor the
+ * refcounts are thread safe */
+struct _GibberRMulticastPacketPool
+{
+  gint ref_count;
+  GibberRMulticastPacketPrivate *free_list;
+  guint n_free;
 };
 
 GQuark
@@ -72,107 +94,152 @@ gibber_r_multicast_packet_error_quark (void)
 
 
 #define GIBBER_R_MULTICAST_PACKET_GET_PRIVATE(o) \
-  (G_TYPE_INSTANCE_GET_PRIVATE ((o), GIBBER_TYPE_R_MULTICAST_PACKET, \
-      GibberRMulticastPacketPrivate))
+  ((GibberRMulticastPacketPrivate *) (o))
 
-static void
-gibber_r_multicast_packet_init (GibberRMulticastPacket *obj)
+GibberRMulticastPacketPool *
+gibber_r_multicast_packet_pool_new (void)
 {
-  GibberRMulticastPacket *self = GIBBER_R_MULTICAST_PACKET (obj);
-  self->version = PACKET_VERSION;
-  self->depends = g_array_new (FALSE, FALSE,
-      sizeof (GibberRMulticastPacketSenderInfo *));
+  GibberRMulticastPacketPool *pool = g_slice_new0 (GibberRMulticastPacketPool);
+
+  pool->ref_count = 1;
+
+  return pool;
 }
 
-static void gibber_r_multicast_packet_dispose (GObject *object);
-static void gibber_r_multicast_packet_finalize (GObject *object);
+GibberRMulticastPacketPool *
+gibber_r_multicast_packet_pool_ref (GibberRMulticastPacketPool *pool)
+{
+  pool->ref_count++;
 
-static void
-gibber_r_multicast_packet_class_init (GibberRMulticastPacketClass *gibber_r_multicast_packet_class)
+  return pool;
+}
+
+void
+gibber_r_multicast_packet_pool_unref (GibberRMulticastPacketPool *pool)
 {
-  GObjectClass *object_class = G_OBJECT_CLASS (gibber_r_multicast_packet_class);
+  if (--pool->ref_count > 0)
+    return;
 
-  g_type_class_add_private (gibber_r_multicast_packet_class, sizeof (GibberRMulticastPacketPrivate));
+  while (pool->free_list != NULL)
+    {
+      GibberRMulticastPacketPrivate *priv = pool->free_list;
 
-  object_class->dispose = gibber_r_multicast_packet_dispose;
-  object_class->finalize = gibber_r_multicast_packet_finalize;
+      pool->free_list = priv->next_free;
+      g_array_unref (priv->packet.depends);
+      g_slice_free (GibberRMulticastPacketPrivate, priv);
+    }
 
+  g_slice_free (GibberRMulticastPacketPool, pool);
 }
 
-void
-gibber_r_multicast_packet_dispose (GObject *object)
+static GibberRMulticastPacket *
+gibber_r_multicast_packet_alloc (GibberRMulticastPacketPool *pool)
 {
-  GibberRMulticastPacket *self = GIBBER_R_MULTICAST_PACKET (object);
-  GibberRMulticastPacketPrivate *priv =
-      GIBBER_R_MULTICAST_PACKET_GET_PRIVATE (self);
+  GibberRMulticastPacketPrivate *priv;
 
-  if (priv->dispose_has_run)
-    return;
+  if (pool != NULL && pool->free_list != NULL)
+    {
+      /* Already cleared when it was put back, depends keeps its storage */
+      priv = pool->free_list;
+      pool->free_list = priv->next_free;
+      pool->n_free--;
+      priv->next_free = NULL;
+    }
+  else
+    {
+      priv = g_slice_new0 (GibberRMulticastPacketPrivate);
+      priv->packet.depends = g_array_new (FALSE, FALSE,
+          sizeof (GibberRMulticastPacketSenderInfo));
+    }
 
-  priv->dispose_has_run = TRUE;
+  priv->ref_count = 1;
+  priv->packet.version = PACKET_VERSION;
 
-  /* release any references held by the object here */
+  if (pool != NULL)
+    priv->pool = gibber_r_multicast_packet_pool_ref (pool);
 
-  if (G_OBJECT_CLASS (gibber_r_multicast_packet_parent_class)->dispose)
-    G_OBJECT_CLASS (gibber_r_multicast_packet_parent_class)->dispose (object);
+  return &priv->packet;
 }
 
-void
-gibber_r_multicast_packet_finalize (GObject *object)
+static void
+gibber_r_multicast_packet_release (GibberRMulticastPacket *self)
 {
-  GibberRMulticastPacket *self = GIBBER_R_MULTICAST_PACKET (object);
   GibberRMulticastPacketPrivate *priv =
       GIBBER_R_MULTICAST_PACKET_GET_PRIVATE (self);
-  guint i;
+  GibberRMulticastPacketPool *pool = priv->pool;
+  GArray *depends = self->depends;
 
-  for (i = 0; i < self->depends->len ; i++) {
-    gibber_r_multicast_packet_sender_info_free (
-        g_array_index (self->depends, GibberRMulticastPacketSenderInfo *, i));
-  }
-  g_array_unref (self->depends);
-
-  /* free any data held directly by the object here */
+  /* free any data held directly by the packet here */
   switch (self->type) {
     case PACKET_TYPE_WHOIS_REPLY:
       g_free (self->data.whois_reply.sender_name);
       break;
     case PACKET_TYPE_DATA:
-      g_free (self->data.data.payload);
+      if (!priv->payload_is_view)
+        g_free (self->data.data.payload);
+      break;
+    case PACKET_TYPE_PARITY:
+      if (!priv->payload_is_view)
+        g_free (self->data.parity.parity);
       break;
     case PACKET_TYPE_ATTEMPT_JOIN:
-      g_array_unref (self->data.attempt_join.senders);
+      if (self->data.attempt_join.senders != NULL)
+        g_array_unref (self->data.attempt_join.senders);
       break;
     case PACKET_TYPE_JOIN:
-      g_array_unref (self->data.join.failures);
+      if (self->data.join.failures != NULL)
+        g_array_unref (self->data.join.failures);
       break;
     case PACKET_TYPE_FAILURE:
-      g_array_unref (self->data.failure.failures);
+      if (self->data.failure.failures != NULL)
+        g_array_unref (self->data.failure.failures);
       break;
     default:
       /* Nothing specific to free */;
   }
-  g_free (priv->data);
+  if (priv->backing != NULL)
+    g_bytes_unref (priv->backing);
+  else
+    g_free (priv->data);
 
-  G_OBJECT_CLASS (gibber_r_multicast_packet_parent_class)->finalize (object);
+  if (pool == NULL || pool->n_free >= POOL_MAX_FREE)
+    {
+      g_array_unref (depends);
+      g_slice_free (GibberRMulticastPacketPrivate, priv);
+    }
+  else
+    {
+      memset (priv, 0, sizeof (GibberRMulticastPacketPrivate));
+      g_array_set_size (depends, 0);
+      priv->packet.depends = depends;
+
+      priv->next_free = pool->free_list;
+      pool->free_list = priv;
+      pool->n_free++;
+    }
+
+  if (pool != NULL)
+    gibber_r_multicast_packet_pool_unref (pool);
 }
 
-static GibberRMulticastPacketSenderInfo *
-gibber_r_multicast_packet_sender_info_new (guint32 sender_id,
-   guint32 expected_packet)
+GibberRMulticastPacket *
+gibber_r_multicast_packet_ref (GibberRMulticastPacket *packet)
 {
-  GibberRMulticastPacketSenderInfo *result
-      = g_slice_new (GibberRMulticastPacketSenderInfo);
-  result->sender_id = sender_id;
-  result->packet_id = expected_packet;
+  GIBBER_R_MULTICAST_PACKET_GET_PRIVATE (packet)->ref_count++;
 
-  return result;
+  return packet;
 }
 
-static void
-gibber_r_multicast_packet_sender_info_free (
-    GibberRMulticastPacketSenderInfo *sender_info)
+void
+gibber_r_multicast_packet_unref (GibberRMulticastPacket *packet)
 {
-  g_slice_free (GibberRMulticastPacketSenderInfo, sender_info);
+  GibberRMulticastPacketPrivate *priv =
+      GIBBER_R_MULTICAST_PACKET_GET_PRIVATE (packet);
+
+  g_assert (priv->ref_count > 0);
+
+  if (--priv->ref_count == 0)
+    gibber_r_multicast_packet_release (packet);
 }
 
 /* Start a new packet */
@@ -180,8 +247,14 @@ GibberRMulticastPacket *
 gibber_r_multicast_packet_new (GibberRMulticastPacketType type,
     guint32 sender, gsize max_size)
 {
-  GibberRMulticastPacket *result =
-      g_object_new (GIBBER_TYPE_R_MULTICAST_PACKET, NULL);
+  return gibber_r_multicast_packet_new_pooled (NULL, type, sender, max_size);
+}
+
+GibberRMulticastPacket *
+gibber_r_multicast_packet_new_pooled (GibberRMulticastPacketPool *pool,
+    GibberRMulticastPacketType type, guint32 sender, gsize max_size)
+{
+  GibberRMulticastPacket *result = gibber_r_multicast_packet_alloc (pool);
   GibberRMulticastPacketPrivate *priv =
       GIBBER_R_MULTICAST_PACKET_GET_PRIVATE(result);
 
@@ -215,8 +288,7 @@ gboolean
 gibber_r_multicast_packet_add_sender_info (GibberRMulticastPacket *packet,
     guint32 sender_id, guint32 packet_id, GError **error)
 {
-  GibberRMulticastPacketSenderInfo *s =
-      gibber_r_multicast_packet_sender_info_new (sender_id, packet_id);
+  GibberRMulticastPacketSenderInfo s = { sender_id, packet_id };
   GibberRMulticastPacketPrivate *priv =
       GIBBER_R_MULTICAST_PACKET_GET_PRIVATE (packet);
 
@@ -259,6 +331,113 @@ gibber_r_multicast_packet_set_repair_request_info (
   packet->data.repair_request.sender_id = sender_id;
 }
 
+void
+gibber_r_multicast_packet_set_repair_range_info (
+     GibberRMulticastPacket *packet, guint32 sender_id, guint32 packet_id)
+{
+  g_assert (packet->type == PACKET_TYPE_REPAIR_RANGE_REQUEST);
+
+  memset (&packet->data.repair_range_request, 0,
+      sizeof (GibberRMulticastRepairRangeRequestPacket));
+  packet->data.repair_range_request.packet_id = packet_id;
+  packet->data.repair_range_request.sender_id = sender_id;
+}
+
+gboolean
+gibber_r_multicast_packet_repair_range_add (GibberRMulticastPacket *packet,
+    guint32 packet_id)
+{
+  GibberRMulticastRepairRangeRequestPacket *r =
+      &packet->data.repair_range_request;
+  guint32 bit;
+
+  g_assert (packet->type == PACKET_TYPE_REPAIR_RANGE_REQUEST);
+  g_assert (GIBBER_R_MULTICAST_PACKET_GET_PRIVATE (packet)->data == NULL);
+
+  if (packet_id == r->packet_id)
+    return TRUE;
+
+  bit = packet_id - r->packet_id - 1;
+  if (gibber_r_multicast_packet_diff (r->packet_id, packet_id) < 0
+      || bit >= GIBBER_R_MULTICAST_REPAIR_BITMAP_SIZE * 8)
+    return FALSE;
+
+  r->bitmap[bit / 8] |= 1 << (bit % 8);
+  r->bitmap_length = MAX (r->bitmap_length, bit / 8 + 1);
+
+  return TRUE;
+}
+
+gboolean
+gibber_r_multicast_packet_repair_range_next (GibberRMulticastPacket *packet,
+    guint32 *packet_id)
+{
+  GibberRMulticastRepairRangeRequestPacket *r =
+      &packet->data.repair_range_request;
+  guint32 bit;
+
+  g_assert (packet->type == PACKET_TYPE_REPAIR_RANGE_REQUEST);
+
+  /* Bit n stands for packet_id + 1 + n, so the bit after the current packet
+   * is at the current offset */
+  for (bit = *packet_id - r->packet_id; bit < r->bitmap_length * 8u; bit++)
+    {
+      if (r->bitmap[bit / 8] & (1 << (bit % 8)))
+        {
+          *packet_id = r->packet_id + 1 + bit;
+          return TRUE;
+        }
+    }
+
+  return FALSE;
+}
+
+void
+gibber_r_multicast_packet_set_parity_info (GibberRMulticastPacket *packet,
+    guint32 packet_id, guint8 count, guint16 length, const guint8 *parity,
+    gsize parity_size)
+{
+  GibberRMulticastPacketPrivate *priv =
+      GIBBER_R_MULTICAST_PACKET_GET_PRIVATE (packet);
+
+  g_assert (packet->type == PACKET_TYPE_PARITY);
+  g_assert (priv->data == NULL);
+
+  if (!priv->payload_is_view)
+    g_free (packet->data.parity.parity);
+  priv->payload_is_view = FALSE;
+
+  packet->data.parity.packet_id = packet_id;
+  packet->data.parity.count = count;
+  packet->data.parity.length = length;
+  packet->data.parity.parity = g_memdup (parity, parity_size);
+  packet->data.parity.parity_size = parity_size;
+}
+
+void
+gibber_r_multicast_packet_parity_add (guint8 *parity, const guint8 *data,
+    gsize size)
+{
+  gsize i;
+
+  for (i = 0; i < size; i++)
+    parity[i] ^= data[i];
+}
+
+void
+gibber_r_multicast_packet_set_rtt_probe_info (
+    GibberRMulticastPacket *packet, guint32 timestamp, guint32 echo_sender,
+    guint32 echo_timestamp, guint32 echo_delay, guint8 capabilities)
+{
+  g_assert (packet->type == PACKET_TYPE_RTT_PROBE);
+
+  packet->data.rtt_probe.timestamp = timestamp;
+  packet->data.rtt_probe.echo_sender = echo_sender;
+  packet->data.rtt_probe.echo_timestamp = echo_timestamp;
+  packet->data.rtt_probe.echo_delay = echo_delay;
+  packet->data.rtt_probe.capabilities = capabilities;
+}
+
 void
 gibber_r_multicast_packet_set_whois_request_info (
     GibberRMulticastPacket *packet,
@@ -311,6 +490,19 @@ gibber_r_multicast_packet_calculate_size (GibberRMulticastPacket *packet)
       /* 32 bit packet id and 32 sender id*/
       result += 8;
       break;
+    case PACKET_TYPE_REPAIR_RANGE_REQUEST:
+      /* 32 bit sender id, 32 bit packet id, 8 bit bitmap length + bitmap */
+      result += 9 + packet->data.repair_range_request.bitmap_length;
+      break;
+    case PACKET_TYPE_PARITY:
+      /* 32 bit packet id, 8 bit count, 16 bit length + parity */
+      result += 7 + packet->data.parity.parity_size;
+      break;
+    case PACKET_TYPE_RTT_PROBE:
+      /* 32 bit timestamp, echo sender, echo timestamp and echo delay, 8 bit
+       * capabilities */
+      result += 17;
+      break;
     case PACKET_TYPE_ATTEMPT_JOIN:
       /* 8 bit nr of senders, 32 bit per sender */
       result += 1 + 4 * packet->data.attempt_join.senders->len;
@@ -441,7 +633,7 @@ add_sender_info (guint8 *data, gsize length, gsize *offset, GArray *senders)
   for (i = 0; i < senders->len; i++)
     {
       GibberRMulticastPacketSenderInfo *info =
-          g_array_index (senders, GibberRMulticastPacketSenderInfo *, i);
+          &g_array_index (senders, GibberRMulticastPacketSenderInfo, i);
       add_guint32 (data, length, offset, info->sender_id);
       add_guint32 (data, length, offset, info->packet_id);
     }
@@ -459,17 +651,13 @@ get_sender_info (guint8 *data, gsize length, gsize *offset, GArray *depends)
 
   for (; nr_items > 0; nr_items--)
     {
-      GibberRMulticastPacketSenderInfo *sender_info;
-      guint32 sender_id;
-      guint32 packet_id;
+      GibberRMulticastPacketSenderInfo sender_info;
 
       if (*offset + 8 > length)
         return FALSE;
 
-      sender_id = get_guint32 (data, length, offset);
-      packet_id = get_guint32 (data, length, offset);
-      sender_info =
-        gibber_r_multicast_packet_sender_info_new (sender_id, packet_id);
+      sender_info.sender_id = get_guint32 (data, length, offset);
+      sender_info.packet_id = get_guint32 (data, length, offset);
       g_array_append_val (depends, sender_info);
     }
 
@@ -552,6 +740,49 @@ gibber_r_multicast_packet_build (GibberRMulticastPacket *packet)
       add_guint32 (priv->data, priv->max_data, &(priv->size),
             packet->data.repair_request.packet_id);
       break;
+    case PACKET_TYPE_REPAIR_RANGE_REQUEST:
+      {
+        GibberRMulticastRepairRangeRequestPacket *r =
+            &packet->data.repair_range_request;
+
+        add_guint32 (priv->data, priv->max_data, &(priv->size),
+              r->sender_id);
+        add_guint32 (priv->data, priv->max_data, &(priv->size),
+              r->packet_id);
+        add_guint8 (priv->data, priv->max_data, &(priv->size),
+              r->bitmap_length);
+        g_assert (priv->size + r->bitmap_length <= priv->max_data);
+        memcpy (priv->data + priv->size, r->bitmap, r->bitmap_length);
+        priv->size += r->bitmap_length;
+        break;
+      }
+    case PACKET_TYPE_PARITY:
+      add_guint32 (priv->data, priv->max_data, &(priv->size),
+            packet->data.parity.packet_id);
+      add_guint8 (priv->data, priv->max_data, &(priv->size),
+            packet->data.parity.count);
+      add_guint16 (priv->data, priv->max_data, &(priv->size),
+            packet->data.parity.length);
+
+      g_assert (priv->size + packet->data.parity.parity_size
+          == priv->max_data);
+
+      memcpy (priv->data + priv->size, packet->data.parity.parity,
+          packet->data.parity.parity_size);
+      priv->size += packet->data.parity.parity_size;
+      break;
+    case PACKET_TYPE_RTT_PROBE:
+      add_guint32 (priv->data, priv->max_data, &(priv->size),
+            packet->data.rtt_probe.timestamp);
+      add_guint32 (priv->data, priv->max_data, &(priv->size),
+            packet->data.rtt_probe.echo_sender);
+      add_guint32 (priv->data, priv->max_data, &(priv->size),
+            packet->data.rtt_probe.echo_timestamp);
+      add_guint32 (priv->data, priv->max_data, &(priv->size),
+            packet->data.rtt_probe.echo_delay);
+      add_guint8 (priv->data, priv->max_data, &(priv->size),
+            packet->data.rtt_probe.capabilities);
+      break;
     case PACKET_TYPE_ATTEMPT_JOIN: {
       guint i;
       add_guint8 (priv->data, priv->max_data, &(priv->size),
@@ -653,10 +884,11 @@ packet_check_prefix (const guint8 *data)
   target = get_guint32 (priv->data, priv->max_data, &(priv->size));   \
 } G_STMT_END
 
-/* Create a packet by parsing raw data, packet is immutable afterwards */
-GibberRMulticastPacket *
-gibber_r_multicast_packet_parse (const guint8 *data, gsize size,
-    GError **error)
+/* Parse a datagram into a packet. If backing is given data lies within it
+ * and is borrowed, otherwise it is copied */
+static GibberRMulticastPacket *
+parse_datagram (GibberRMulticastPacketPool *pool, const guint8 *data,
+    gsize size, GBytes *backing, GError **error)
 {
   GibberRMulticastPacket *result = NULL;
 
@@ -665,10 +897,19 @@ gibber_r_multicast_packet_parse (const guint8 *data, gsize size,
   if (size < PACKET_HEADER_SIZE || !packet_check_prefix (data))
     goto parse_error;
 
-  result = g_object_new (GIBBER_TYPE_R_MULTICAST_PACKET, NULL);
+  result = gibber_r_multicast_packet_alloc (pool);
   priv = GIBBER_R_MULTICAST_PACKET_GET_PRIVATE (result);
 
-  priv->data = g_memdup (data, size);
+  if (backing != NULL)
+    {
+      /* Parsed packets are immutable, so it's never written to */
+      priv->backing = g_bytes_ref (backing);
+      priv->data = (guint8 *) data;
+    }
+  else
+    {
+      priv->data = g_memdup (data, size);
+    }
   priv->size = PACKET_PREFIX_LENGTH;
   priv->max_data = size;
 
@@ -704,14 +945,51 @@ gibber_r_multicast_packet_parse (const guint8 *data, gsize size,
       GET_GUINT32 (result->data.data.total_size);
 
       result->data.data.payload_size = priv->max_data - priv->size;
-      result->data.data.payload = g_memdup (priv->data + priv->size,
-          result->data.data.payload_size);
+      result->data.data.payload = priv->data + priv->size;
+      priv->payload_is_view = TRUE;
       priv->size += result->data.data.payload_size;
       break;
     case PACKET_TYPE_REPAIR_REQUEST:
       GET_GUINT32 (result->data.repair_request.sender_id);
       GET_GUINT32 (result->data.repair_request.packet_id);
       break;
+    case PACKET_TYPE_REPAIR_RANGE_REQUEST:
+      {
+        GibberRMulticastRepairRangeRequestPacket *r =
+            &result->data.repair_range_request;
+
+        GET_GUINT32 (r->sender_id);
+        GET_GUINT32 (r->packet_id);
+        GET_GUINT8 (r->bitmap_length);
+
+        if (r->bitmap_length > GIBBER_R_MULTICAST_REPAIR_BITMAP_SIZE
+            || priv->size + r->bitmap_length > priv->max_data)
+          goto parse_error;
+
+        memcpy (r->bitmap, priv->data + priv->size, r->bitmap_length);
+        priv->size += r->bitmap_length;
+        break;
+      }
+    case PACKET_TYPE_PARITY:
+      GET_GUINT32 (result->data.parity.packet_id);
+      GET_GUINT8 (result->data.parity.count);
+      GET_GUINT16 (result->data.parity.length);
+
+      if (result->data.parity.count == 0)
+        goto parse_error;
+
+      result->data.parity.parity_size = priv->max_data - priv->size;
+      result->data.parity.parity = priv->data + priv->size;
+      priv->payload_is_view = TRUE;
+      priv->size += result->data.parity.parity_size;
+      break;
+    case PACKET_TYPE_RTT_PROBE:
+      GET_GUINT32 (result->data.rtt_probe.timestamp);
+      GET_GUINT32 (result->data.rtt_probe.echo_sender);
+      GET_GUINT32 (result->data.rtt_probe.echo_timestamp);
+      GET_GUINT32 (result->data.rtt_probe.echo_delay);
+      GET_GUINT8 (result->data.rtt_probe.capabilities);
+      break;
     case PACKET_TYPE_ATTEMPT_JOIN:
       {
         guint8 nr;
@@ -789,7 +1067,7 @@ gibber_r_multicast_packet_parse (const guint8 *data, gsize size,
 
 parse_error:
   if (result != NULL)
-    g_object_unref (result);
+    gibber_r_multicast_packet_unref (result);
 
   g_set_error (error,
     GIBBER_R_MULTICAST_PACKET_ERROR,
@@ -799,6 +1077,55 @@ parse_error:
   return NULL;
 }
 
+/* Create a packet by parsing raw data, packet is immutable afterwards */
+GibberRMulticastPacket *
+gibber_r_multicast_packet_parse (const guint8 *data, gsize size,
+    GError **error)
+{
+  return parse_datagram (NULL, data, size, NULL, error);
+}
+
+GibberRMulticastPacket *
+gibber_r_multicast_packet_parse_pooled (GibberRMulticastPacketPool *pool,
+    const guint8 *data, gsize size, GError **error)
+{
+  return parse_datagram (pool, data, size, NULL, error);
+}
+
+GibberRMulticastPacket *
+gibber_r_multicast_packet_parse_bytes (GibberRMulticastPacketPool *pool,
+    GBytes *datagram, GError **error)
+{
+  gsize size;
+  const guint8 *data = g_bytes_get_data (datagram, &size);
+
+  return parse_datagram (pool, data, size, datagram, error);
+}
+
+void
+gibber_r_multicast_packet_own_data (GibberRMulticastPacket *packet)
+{
+  GibberRMulticastPacketPrivate *priv =
+     GIBBER_R_MULTICAST_PACKET_GET_PRIVATE (packet);
+  guint8 *data;
+
+  if (priv->backing == NULL)
+    return;
+
+  data = g_memdup (priv->data, priv->max_data);
+
+  if (priv->payload_is_view && packet->type == PACKET_TYPE_DATA)
+    packet->data.data.payload = data +
+        (packet->data.data.payload - priv->data);
+  else if (priv->payload_is_view && packet->type == PACKET_TYPE_PARITY)
+    packet->data.parity.parity = data +
+        (packet->data.parity.parity - priv->data);
+
+  priv->data = data;
+  g_bytes_unref (priv->backing);
+  priv->backing = NULL;
+}
+
 /* Get the packets payload */
 guint8 *
 gibber_r_multicast_packet_get_payload (GibberRMulticastPacket *packet,
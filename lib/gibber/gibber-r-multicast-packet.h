@@ -39,6 +39,12 @@ typedef enum {
   PACKET_TYPE_WHOIS_REPLY,
   PACKET_TYPE_REPAIR_REQUEST,
   PACKET_TYPE_SESSION,
+  /* Repair request for a range of packets of one sender */
+  PACKET_TYPE_REPAIR_RANGE_REQUEST,
+  /* Forward error correction parity over consecutive reliable packets */
+  PACKET_TYPE_PARITY,
+  /* Timestamp echo to measure round trip times */
+  PACKET_TYPE_RTT_PROBE,
   /* Reliable packets */
   FIRST_RELIABLE_PACKET = 0xf,
   PACKET_TYPE_DATA = FIRST_RELIABLE_PACKET,
@@ -63,10 +69,6 @@ typedef struct {
   guint32 packet_id;
 } GibberRMulticastPacketSenderInfo;
 
-struct _GibberRMulticastPacketClass {
-    GObjectClass parent_class;
-};
-
 typedef struct _GibberRMulticastWhoisRequestPacket
     GibberRMulticastWhoisRequestPacket;
 struct _GibberRMulticastWhoisRequestPacket {
@@ -82,6 +84,8 @@ struct _GibberRMulticastWhoisReplyPacket {
 
 #define GIBBER_R_MULTICAST_DATA_PACKET_START 0x1
 #define GIBBER_R_MULTICAST_DATA_PACKET_END  0x2
+/* The message was compressed with gibber_r_multicast_compress */
+#define GIBBER_R_MULTICAST_DATA_PACKET_DEFLATE 0x4
 
 typedef struct _GibberRMulticastDataPacket GibberRMulticastDataPacket;
 struct _GibberRMulticastDataPacket {
@@ -106,6 +110,66 @@ struct _GibberRMulticastRepairRequestPacket {
     guint32 packet_id;
 };
 
+/* Bitmap bytes in a repair range request, enough to cover a full window of
+ * a sender */
+#define GIBBER_R_MULTICAST_REPAIR_BITMAP_SIZE 32
+
+typedef struct _GibberRMulticastRepairRangeRequestPacket
+    GibberRMulticastRepairRangeRequestPacket;
+struct _GibberRMulticastRepairRangeRequestPacket {
+    /* Sender identifier */
+    guint32 sender_id;
+    /* first missing packet identifier */
+    guint32 packet_id;
+    /* Bit n of the bitmap (least significant bit of byte 0 first) set means
+     * packet_id + 1 + n is missing as well */
+    guint8 bitmap_length;
+    guint8 bitmap[GIBBER_R_MULTICAST_REPAIR_BITMAP_SIZE];
+};
+
+/* Bytes a PACKET_TYPE_PARITY packet needs in front of the parity, so the
+ * covered packets should be this much smaller than the maximum packet size */
+#define GIBBER_R_MULTICAST_PARITY_OVERHEAD 19
+
+typedef struct _GibberRMulticastParityPacket GibberRMulticastParityPacket;
+struct _GibberRMulticastParityPacket {
+    /* first packet identifier covered */
+    guint32 packet_id;
+    /* number of consecutive packets covered */
+    guint8 count;
+    /* XOR of the raw sizes of the covered packets */
+    guint16 length;
+    /* XOR of the raw data of the covered packets, each zero padded to the
+     * longest of them */
+    guint8 *parity;
+    gsize parity_size;
+};
+
+/* PACKET_TYPE_SESSION packets list their sender plus up to 31 other senders,
+ * rotating through the group over successive session messages of all
+ * members. A shorter list covers every sender its sender knows about */
+#define GIBBER_R_MULTICAST_SESSION_DIGEST_SENDERS 32
+
+/* The sender can inflate GIBBER_R_MULTICAST_DATA_PACKET_DEFLATE messages */
+#define GIBBER_R_MULTICAST_CAPABILITY_DEFLATE 0x1
+
+/* PACKET_TYPE_RTT_PROBE packets, sent along with session messages to
+ * measure the round trip time between two nodes. All times are in
+ * microseconds. As every member sends them, they also advertise what the
+ * sender supports */
+typedef struct _GibberRMulticastRttProbePacket GibberRMulticastRttProbePacket;
+struct _GibberRMulticastRttProbePacket {
+    /* senders clock when sending */
+    guint32 timestamp;
+    /* node whose probe is echoed, its timestamp and how long ago the echoed
+     * probe was received */
+    guint32 echo_sender;
+    guint32 echo_timestamp;
+    guint32 echo_delay;
+    /* GIBBER_R_MULTICAST_CAPABILITY_* flags */
+    guint8 capabilities;
+};
+
 typedef struct _GibberRMulticastAttemptJoinPacket
     GibberRMulticastAttemptJoinPacket;
 struct _GibberRMulticastAttemptJoinPacket {
@@ -128,10 +192,11 @@ struct _GibberRMulticastJoinPacket {
 
 
 typedef struct _GibberRMulticastPacket GibberRMulticastPacket;
-typedef struct _GibberRMulticastPacketClass GibberRMulticastPacketClass;
 
+/* Packets are refcounted structs instead of GObjects, as a busy group sends
+ * and receives thousands of them per second. Packets allocated from a
+ * GibberRMulticastPacketPool go back to it when released for reuse */
 struct _GibberRMulticastPacket {
-    GObject parent;
     GibberRMulticastPacketType type;
     guint8 version;
     /* sender */
@@ -140,8 +205,9 @@ struct _GibberRMulticastPacket {
     /* packet identifier for reliable packets */
     guint32 packet_id;
 
-    /* List of GibberRMulticastSenderInfo encoding dependency information for
-     * reliable packets or session information for session packets */
+    /* Array of GibberRMulticastPacketSenderInfo values encoding dependency
+     * information for reliable packets or session information for session
+     * packets */
     GArray *depends;
 
     union {
@@ -149,32 +215,45 @@ struct _GibberRMulticastPacket {
       GibberRMulticastWhoisReplyPacket whois_reply;
       GibberRMulticastDataPacket data;
       GibberRMulticastRepairRequestPacket repair_request;
+      GibberRMulticastRepairRangeRequestPacket repair_range_request;
+      GibberRMulticastParityPacket parity;
       GibberRMulticastAttemptJoinPacket attempt_join;
       GibberRMulticastJoinPacket join;
       GibberRMulticastFailurePacket failure;
+      GibberRMulticastRttProbePacket rtt_probe;
     } data;
 };
 
+typedef struct _GibberRMulticastPacketPool GibberRMulticastPacketPool;
+
+/* Boxed type, copying it takes a reference */
 GType gibber_r_multicast_packet_get_type (void);
 
-/* TYPE MACROS */
 #define GIBBER_TYPE_R_MULTICAST_PACKET \
   (gibber_r_multicast_packet_get_type ())
-#define GIBBER_R_MULTICAST_PACKET(obj) \
-  (G_TYPE_CHECK_INSTANCE_CAST((obj), GIBBER_TYPE_R_MULTICAST_PACKET, GibberRMulticastPacket))
-#define GIBBER_R_MULTICAST_PACKET_CLASS(klass) \
-  (G_TYPE_CHECK_CLASS_CAST((klass), GIBBER_TYPE_R_MULTICAST_PACKET, GibberRMulticastPacketClass))
-#define GIBBER_IS_R_MULTICAST_PACKET(obj) \
-  (G_TYPE_CHECK_INSTANCE_TYPE((obj), GIBBER_TYPE_R_MULTICAST_PACKET))
-#define GIBBER_IS_R_MULTICAST_PACKET_CLASS(klass) \
-  (G_TYPE_CHECK_CLASS_TYPE((klass), GIBBER_TYPE_R_MULTICAST_PACKET))
-#define GIBBER_R_MULTICAST_PACKET_GET_CLASS(obj) \
-  (G_TYPE_INSTANCE_GET_CLASS ((obj), GIBBER_TYPE_R_MULTICAST_PACKET, GibberRMulticastPacketClass))
+
+GibberRMulticastPacket *gibber_r_multicast_packet_ref (
+    GibberRMulticastPacket *packet);
+
+void gibber_r_multicast_packet_unref (GibberRMulticastPacket *packet);
+
+/* Pool of released packets to recycle, one per transport */
+GibberRMulticastPacketPool *gibber_r_multicast_packet_pool_new (void);
+
+GibberRMulticastPacketPool *gibber_r_multicast_packet_pool_ref (
+    GibberRMulticastPacketPool *pool);
+
+void gibber_r_multicast_packet_pool_unref (GibberRMulticastPacketPool *pool);
 
 /* Start a new packet */
 GibberRMulticastPacket * gibber_r_multicast_packet_new (
     GibberRMulticastPacketType type, guint32 sender, gsize max_size);
 
+/* Start a new packet, recycling one from @pool if possible */
+GibberRMulticastPacket * gibber_r_multicast_packet_new_pooled (
+    GibberRMulticastPacketPool *pool, GibberRMulticastPacketType type,
+    guint32 sender, gsize max_size);
+
 /* Add depend if packet type is PACKET_TYPE_DATA otherwise add sender info if
  * PACKET_TYPE_SESSION */
 gboolean gibber_r_multicast_packet_add_sender_info (
@@ -192,6 +271,35 @@ void gibber_r_multicast_packet_set_data_info (GibberRMulticastPacket *packet,
 void gibber_r_multicast_packet_set_repair_request_info (
     GibberRMulticastPacket *packet, guint32 sender_id, guint32 packet_id);
 
+/* Set info for PACKET_TYPE_REPAIR_RANGE_REQUEST packets, packet_id being the
+ * first packet requested */
+void gibber_r_multicast_packet_set_repair_range_info (
+    GibberRMulticastPacket *packet, guint32 sender_id, guint32 packet_id);
+
+/* Request packet_id as well in a PACKET_TYPE_REPAIR_RANGE_REQUEST packet.
+ * Returns FALSE if it's not within reach of the bitmap */
+gboolean gibber_r_multicast_packet_repair_range_add (
+    GibberRMulticastPacket *packet, guint32 packet_id);
+
+/* Advance packet_id to the next packet requested by a
+ * PACKET_TYPE_REPAIR_RANGE_REQUEST packet. Returns FALSE if there is none */
+gboolean gibber_r_multicast_packet_repair_range_next (
+    GibberRMulticastPacket *packet, guint32 *packet_id);
+
+/* Set the info for PACKET_TYPE_PARITY packets, parity is copied */
+void gibber_r_multicast_packet_set_parity_info (
+    GibberRMulticastPacket *packet, guint32 packet_id, guint8 count,
+    guint16 length, const guint8 *parity, gsize parity_size);
+
+/* XOR size bytes of data into parity, which is at least size bytes long */
+void gibber_r_multicast_packet_parity_add (guint8 *parity,
+    const guint8 *data, gsize size);
+
+/* Set the info for PACKET_TYPE_RTT_PROBE packets */
+void gibber_r_multicast_packet_set_rtt_probe_info (
+    GibberRMulticastPacket *packet, guint32 timestamp, guint32 echo_sender,
+    guint32 echo_timestamp, guint32 echo_delay, guint8 capabilities);
+
 /* Set the info for PACKET_TYPE_WHOIS_REQUEST packets */
 void gibber_r_multicast_packet_set_whois_request_info (
     GibberRMulticastPacket *packet, const guint32 sender_id);
@@ -209,6 +317,19 @@ gsize gibber_r_multicast_packet_add_payload (GibberRMulticastPacket *packet,
 GibberRMulticastPacket * gibber_r_multicast_packet_parse (const guint8 *data,
     gsize size, GError **error);
 
+GibberRMulticastPacket * gibber_r_multicast_packet_parse_pooled (
+    GibberRMulticastPacketPool *pool, const guint8 *data, gsize size,
+    GError **error);
+
+/* Like gibber_r_multicast_packet_parse_pooled, but without copying the
+ * datagram: the packet, and its payload, borrow @datagram's data */
+GibberRMulticastPacket * gibber_r_multicast_packet_parse_bytes (
+    GibberRMulticastPacketPool *pool, GBytes *datagram, GError **error);
+
+/* Copy the data of a packet that borrows it from a receive buffer, to be
+ * called before keeping the packet around for longer */
+void gibber_r_multicast_packet_own_data (GibberRMulticastPacket *packet);
+
 /* Get the packets payload */
 guint8 * gibber_r_multicast_packet_get_payload (GibberRMulticastPacket *packet,
     gsize *size);
@@ -26,6 +26,8 @@
 #include <string.h>
 
 #include "gibber-util.h"
+#include "gibber-r-multicast-clock.h"
+#include "gibber-r-multicast-compress.h"
 
 #define DEBUG_FLAG DEBUG_RMULTICAST_SENDER
 #include "gibber-debug.h"
@@ -44,6 +46,10 @@
 #define MIN_REPAIR_TIMEOUT 500
 #define MAX_REPAIR_TIMEOUT 800
 
+/* Repair requests due within this many ms of the one that triggered the
+ * repair timer are sent out along with it */
+#define REPAIR_COALESCE_TIME 100
+
 #define MIN_FIRST_WHOIS_TIMEOUT 50
 #define MAX_FIRST_WHOIS_TIMEOUT 200
 
@@ -53,6 +59,19 @@
 #define MIN_WHOIS_REPLY_TIMEOUT 50
 #define MAX_WHOIS_REPLY_TIMEOUT 200
 
+/* The timeouts above are only used until a round trip time is known. After
+ * that requests are timed SRM style, uniformly within [C1 d, (C1 + C2) d] with
+ * d the one way distance to the node, and replies within [D1 d, (D1 + D2) d]
+ * with d the distance to the requester. Retries back off by RETRY_FACTOR */
+#define REQUEST_C1 2
+#define REQUEST_C2 2
+#define REPLY_D1 1
+#define REPLY_D2 1
+#define RETRY_FACTOR 2
+
+/* Round trip samples above 10 seconds (in microseconds) are bogus */
+#define MAX_RTT 10000000
+
 /* At least one packet must be popped every 5 minutes.. Reliable keepalives
  * are send out every three minutes.. */
 #define MAX_PROGRESS_TIMEOUT 300000
@@ -74,13 +93,31 @@ static void set_state (GibberRMulticastSender *sender,
 struct _GibberRMulticastSenderPrivate
 {
   gboolean dispose_has_run;
-  /* hash table with packets */
-  GHashTable *packet_cache;
-
-  /* Table with acks per sender
+  /* Ring buffer with the packets in the window, indexed by
+   * packet_id & (window_size - 1). Slots for the ids from window_head up to
+   * (but not including) window_tail hold either that packet or NULL */
+  gpointer *window;
+  guint32 window_size;
+  guint32 window_head;
+  guint32 window_tail;
+  guint window_count;
+
+  /* Messages being reassembled per data stream
+   * guint16 stream_id => owned Reassembly * */
+  GHashTable *reassembly;
+
+  /* Table with acks per sender, our row of the groups ack matrix
    * guint32 * => owned AckInfo * */
   GHashTable *acks;
 
+  /* Minimum of our column in the ack matrix, the packet all other senders
+   * acked up to. Only valid if stable_known */
+  gboolean stable_known;
+  guint32 stable;
+  /* Whether and up to where the stable point was applied to our packets */
+  gboolean stable_applied;
+  guint32 stable_acked;
+
   /* Sendergroup to which we belong */
   GibberRMulticastSenderGroup *group;
 
@@ -90,6 +127,10 @@ struct _GibberRMulticastSenderPrivate
   /* whois reply/request timer */
   guint whois_timer;
 
+  /* timer for the earliest pending repair request and when it's due */
+  guint repair_timer;
+  gint64 repair_timer_due;
+
   /* timer untill which a failure even occurs  */
   guint fail_timer;
 
@@ -103,6 +144,9 @@ struct _GibberRMulticastSenderPrivate
 
   /* Endpoint is just there in case we are in failure mode */
   guint32 end_point;
+
+  /* Whether sender->rtt is based on exact measurements */
+  gboolean rtt_measured;
 };
 
 typedef struct {
@@ -138,6 +182,8 @@ static AckInfo *
 gibber_r_multicast_sender_get_ackinfo (GibberRMulticastSender *sender,
     guint32 sender_id);
 
+static void group_update_stable_points (GibberRMulticastSenderGroup *group);
+
 GibberRMulticastSenderGroup *
 gibber_r_multicast_sender_group_new (void)
 {
@@ -194,7 +240,21 @@ void
 gibber_r_multicast_sender_group_add (GibberRMulticastSenderGroup *group,
     GibberRMulticastSender *sender)
 {
+  GHashTableIter iter;
+  gpointer value;
+
   DEBUG ("Adding %x to sender group", sender->id);
+
+  /* The new row is empty, so no column minimum is known until it acks */
+  g_hash_table_iter_init (&iter, group->senders);
+  while (g_hash_table_iter_next (&iter, NULL, &value))
+    {
+      GibberRMulticastSenderPrivate *priv =
+          GIBBER_R_MULTICAST_SENDER_GET_PRIVATE (value);
+
+      priv->stable_known = FALSE;
+    }
+
   g_hash_table_insert (group->senders, GUINT_TO_POINTER (sender->id), sender);
 }
 
@@ -291,57 +351,119 @@ gibber_r_multicast_sender_group_remove (GibberRMulticastSenderGroup *group,
      gibber_r_multicast_sender_group_gc_acks (group, sender_id);
    }
 
+  /* Its row no longer counts, so the minimum of any column can go up */
+  group_update_stable_points (group);
 }
 
+/* The ack tables of the senders form the rows of an ack matrix: row r,
+ * column t holds up to where r acked the packets of t. The minimum of a
+ * column over all running senders is the stable point of t, every member has
+ * the packets of t before it. Acks only go forward, so raising an entry
+ * above the minimum of its column can't change it. Only when the entry was
+ * at the minimum, the column has to be rescanned */
+
 static void
-create_sender_array (gpointer key, gpointer value, gpointer user_data)
+apply_stable_point (GibberRMulticastSender *target)
 {
-  GibberRMulticastSender *sender = GIBBER_R_MULTICAST_SENDER (value);
-  GArray *array = (GArray *) user_data;
-  AckInfo info;
+  GibberRMulticastSenderPrivate *priv =
+      GIBBER_R_MULTICAST_SENDER_GET_PRIVATE (target);
+  guint32 ack;
 
-  if (sender->state >= GIBBER_R_MULTICAST_SENDER_STATE_STOPPED)
+  if (!priv->stable_known)
     return;
 
-  info.sender_id =  sender->id;
-  info.packet_id = sender->next_input_packet;
+  /* Never beyond what we received ourselves */
+  ack = priv->stable;
+  if (gibber_r_multicast_packet_diff (target->next_input_packet, ack) > 0)
+    ack = target->next_input_packet;
 
-  g_array_append_val (array, info);
+  if (priv->stable_applied && priv->stable_acked == ack)
+    return;
+
+  priv->stable_applied = TRUE;
+  priv->stable_acked = ack;
+  gibber_r_multicast_sender_ack (target, ack);
 }
 
 static void
-update_sender_acks (gpointer key, gpointer value, gpointer user_data)
+update_stable_point (GibberRMulticastSenderGroup *group,
+    GibberRMulticastSender *target)
 {
-  GibberRMulticastSender *sender = GIBBER_R_MULTICAST_SENDER (value);
-  GArray *array = (GArray *) user_data;
-  guint i;
+  GibberRMulticastSenderPrivate *priv =
+      GIBBER_R_MULTICAST_SENDER_GET_PRIVATE (target);
+  GHashTableIter iter;
+  gpointer value;
+  gboolean found = FALSE;
+  guint32 stable = target->next_input_packet;
 
-  if (sender->state >= GIBBER_R_MULTICAST_SENDER_STATE_STOPPED)
-    return;
+  priv->stable_known = FALSE;
 
-  for (i = 0; i < array->len ; i++)
+  g_hash_table_iter_init (&iter, group->senders);
+  while (g_hash_table_iter_next (&iter, NULL, &value))
     {
-      AckInfo *info = &g_array_index (array, AckInfo, i);
+      GibberRMulticastSender *sender = GIBBER_R_MULTICAST_SENDER (value);
       AckInfo *ack;
 
-      if (sender->id == info->sender_id)
+      if (sender == target
+          || sender->state >= GIBBER_R_MULTICAST_SENDER_STATE_STOPPED)
         continue;
 
-      if ((ack = gibber_r_multicast_sender_get_ackinfo (sender,
-           info->sender_id)) != NULL)
-        {
-          if (gibber_r_multicast_packet_diff (ack->packet_id,
-               info->packet_id) > 0)
-            info->packet_id = ack->packet_id;
-        }
-      else
-       {
-         g_array_remove_index_fast (array, i);
-         /* The last element is now placed at location i, so retry i */
-         i--;
-         continue;
-       }
+      ack = gibber_r_multicast_sender_get_ackinfo (sender, target->id);
+      if (ack == NULL)
+        return;
+
+      if (!found || gibber_r_multicast_packet_diff (stable,
+            ack->packet_id) < 0)
+        stable = ack->packet_id;
+      found = TRUE;
     }
+
+  priv->stable_known = TRUE;
+  priv->stable = stable;
+  apply_stable_point (target);
+}
+
+static void
+group_update_stable_points (GibberRMulticastSenderGroup *group)
+{
+  GHashTableIter iter;
+  gpointer value;
+
+  g_hash_table_iter_init (&iter, group->senders);
+  while (g_hash_table_iter_next (&iter, NULL, &value))
+    {
+      GibberRMulticastSender *target = GIBBER_R_MULTICAST_SENDER (value);
+
+      if (target->state < GIBBER_R_MULTICAST_SENDER_STATE_STOPPED)
+        update_stable_point (group, target);
+    }
+}
+
+/* Row sender acked target up to a new point, previously up to old if
+ * had_old */
+static void
+ack_matrix_update (GibberRMulticastSenderGroup *group,
+    GibberRMulticastSender *sender, guint32 target_id, gboolean had_old,
+    guint32 old)
+{
+  GibberRMulticastSender *target;
+  GibberRMulticastSenderPrivate *tpriv;
+
+  if (sender->state >= GIBBER_R_MULTICAST_SENDER_STATE_STOPPED)
+    return;
+
+  target = gibber_r_multicast_sender_group_lookup (group, target_id);
+  if (target == NULL || target == sender
+      || target->state >= GIBBER_R_MULTICAST_SENDER_STATE_STOPPED)
+    return;
+
+  tpriv = GIBBER_R_MULTICAST_SENDER_GET_PRIVATE (target);
+
+  if (!had_old || !tpriv->stable_known || old == tpriv->stable)
+    update_stable_point (group, target);
+  else
+    /* The minimum is unchanged, but we might have received more */
+    apply_stable_point (target);
 }
 
 static AckInfo *
@@ -431,26 +553,8 @@ can_gc_sender (GibberRMulticastSenderGroup *group,
 static void
 gibber_r_multicast_sender_group_gc (GibberRMulticastSenderGroup *group)
 {
-  GArray *array;
   guint i;
 
-  array = g_array_sized_new (FALSE, TRUE, sizeof (AckInfo),
-      g_hash_table_size (group->senders));
-
-  g_hash_table_foreach (group->senders, create_sender_array, array);
-  g_hash_table_foreach (group->senders, update_sender_acks, array);
-
-  for (i = 0; i < array->len ; i++)
-    {
-      AckInfo *info = &g_array_index (array, AckInfo, i);
-      GibberRMulticastSender *sender = g_hash_table_lookup (group->senders,
-        GUINT_TO_POINTER (info->sender_id));
-
-      gibber_r_multicast_sender_ack (sender, info->packet_id);
-    }
-
-  g_array_unref (array);
-
   /* Check if we can remove pending removals */
   for (i = 0; i < group->pending_removal->len ; i++)
     {
@@ -469,6 +573,43 @@ gibber_r_multicast_sender_group_gc (GibberRMulticastSenderGroup *group)
     }
 }
 
+static gboolean repair_request (GibberRMulticastSender *sender, guint32 id,
+    guint rtt);
+
+static gboolean
+group_repair_request (GibberRMulticastSenderGroup *group, guint32 requester,
+    guint32 sender_id, guint32 packet_id)
+{
+  GibberRMulticastSender *rsender;
+  guint rtt = 0;
+  guint i;
+
+  /* Replies are timed by the distance to the requester */
+  rsender = gibber_r_multicast_sender_group_lookup (group, requester);
+  if (rsender != NULL)
+    rtt = rsender->rtt;
+
+  rsender = gibber_r_multicast_sender_group_lookup (group, sender_id);
+
+  if (rsender != NULL && repair_request (rsender, packet_id, rtt))
+    {
+      /* rsender took up the repair request. */
+      return TRUE;
+    }
+
+  for (i = 0; i < group->pending_removal->len ; i++)
+    {
+      rsender = GIBBER_R_MULTICAST_SENDER (
+         g_ptr_array_index (group->pending_removal, i));
+      if (rsender->id == sender_id &&
+          repair_request (rsender, packet_id, rtt))
+        return TRUE;
+    }
+
+  DEBUG ("Ignoring repair request for unknown original sender");
+  return FALSE;
+}
+
 gboolean
 gibber_r_multicast_sender_group_push_packet (
     GibberRMulticastSenderGroup *group, GibberRMulticastPacket *packet)
@@ -512,43 +653,35 @@ gibber_r_multicast_sender_group_push_packet (
           }
         break;
     case PACKET_TYPE_REPAIR_REQUEST:
-        {
-          GibberRMulticastSender *rsender;
-          guint32 sender_id = packet->data.repair_request.sender_id;
-          guint32 packet_id = packet->data.repair_request.packet_id;
+        g_assert (packet->data.repair_request.sender_id != 0);
 
-          rsender = gibber_r_multicast_sender_group_lookup (group, sender_id);
+        handled = group_repair_request (group, packet->sender,
+            packet->data.repair_request.sender_id,
+            packet->data.repair_request.packet_id);
+        break;
+    case PACKET_TYPE_REPAIR_RANGE_REQUEST:
+        {
+          guint32 sender_id = packet->data.repair_range_request.sender_id;
+          guint32 packet_id = packet->data.repair_range_request.packet_id;
 
-          g_assert (sender_id != 0);
+          if (sender_id == 0)
+            break;
 
-          if (rsender != NULL &&
-                gibber_r_multicast_sender_repair_request (rsender, packet_id))
+          do
             {
-              /* rsender took up the repair request. */
-              handled = TRUE;
-              break;
+              if (group_repair_request (group, packet->sender, sender_id,
+                    packet_id))
+                handled = TRUE;
             }
-
-            for (i = 0; i < group->pending_removal->len ; i++)
-              {
-                rsender = GIBBER_R_MULTICAST_SENDER (
-                   g_ptr_array_index (group->pending_removal, i));
-                if (rsender->id == sender_id)
-                  {
-                    if (gibber_r_multicast_sender_repair_request (rsender,
-                          packet_id))
-                      {
-                        handled = TRUE;
-                        break;
-                      }
-                  }
-              }
-            DEBUG ("Ignoring repair request for unknown original sender");
+          while (gibber_r_multicast_packet_repair_range_next (packet,
+                &packet_id));
           break;
         }
     case PACKET_TYPE_SESSION:
-      /* Session message aren't handled by us. But if we know the sender it's
-       * at least not a foreign sender */
+    case PACKET_TYPE_PARITY:
+    case PACKET_TYPE_RTT_PROBE:
+      /* Session, parity and probe message aren't handled by us. But if we
+       * know the sender it's at least not a foreign sender */
       if (sender != NULL)
         handled = TRUE;
       break;
@@ -589,7 +722,8 @@ gibber_r_multicast_sender_group_push_packet (
 }
 
 static void schedule_repair (GibberRMulticastSender *sender, guint32 id);
-static void schedule_do_repair (GibberRMulticastSender *sender, guint32 id);
+static void schedule_do_repair (GibberRMulticastSender *sender, guint32 id,
+    guint rtt);
 static void schedule_whois_request (GibberRMulticastSender *sender,
     gboolean rescheduled);
 static gboolean name_discovery_failed_cb (gpointer data);
@@ -621,24 +755,57 @@ static guint signals[LAST_SIGNAL] = {0};
 
 typedef struct {
   guint32 packet_id;
+  /* pending repair message */
   guint timeout;
+  /* monotonic time in ms a repair request for this missing packet is due,
+   * 0 if none is pending */
+  gint64 repair_due;
+  /* monotonic time in us the first repair request was sent out, 0 if none */
+  gint64 repair_requested;
   gboolean repeating;
   GibberRMulticastPacket *packet;
   GibberRMulticastSender *sender;
   gboolean acked;
   gboolean popped;
+  /* Set on the last fragment of a data message once all its fragments were
+   * seen: the id of the first fragment and the reassembled payload, which is
+   * NULL if the fragments didn't add up to the claimed size */
+  gboolean complete;
+  guint32 message_start;
+  GBytes *message;
 } PacketInfo;
 
+/* Data message whose fragments are being appended as pop_packet walks past
+ * them in packet id order */
+typedef struct {
+  guint32 start;
+  guint8 *data;
+  gsize size;
+  gsize offset;
+} Reassembly;
+
+static void
+reassembly_free (gpointer data)
+{
+  Reassembly *r = (Reassembly *) data;
+
+  g_free (r->data);
+  g_slice_free (Reassembly, r);
+}
+
 static void
 packet_info_free (gpointer data)
 {
   PacketInfo *p = (PacketInfo *) data;
   if (p->packet != NULL) {
-    g_object_unref (p->packet);
+    gibber_r_multicast_packet_unref (p->packet);
   }
 
+  if (p->message != NULL)
+    g_bytes_unref (p->message);
+
   if (p->timeout != 0) {
-    g_source_remove (p->timeout);
+    gibber_r_multicast_timeout_remove (p->timeout);
   }
   g_slice_free (PacketInfo, data);
 }
@@ -653,6 +820,95 @@ packet_info_new (GibberRMulticastSender*sender, guint32 packet_id)
   return result;
 }
 
+static PacketInfo *
+packet_cache_lookup (GibberRMulticastSenderPrivate *priv, guint32 packet_id)
+{
+  if (packet_id - priv->window_head >= priv->window_tail - priv->window_head)
+    return NULL;
+
+  return priv->window[packet_id & (priv->window_size - 1)];
+}
+
+static void
+packet_cache_grow (GibberRMulticastSenderPrivate *priv, guint32 span)
+{
+  gpointer *window;
+  guint32 size, i;
+
+  for (size = priv->window_size; size < span; size *= 2)
+    ;
+
+  window = g_new0 (gpointer, size);
+
+  for (i = priv->window_head; i != priv->window_tail; i++)
+    window[i & (size - 1)] = priv->window[i & (priv->window_size - 1)];
+
+  g_free (priv->window);
+  priv->window = window;
+  priv->window_size = size;
+}
+
+static void
+packet_cache_insert (GibberRMulticastSenderPrivate *priv, PacketInfo *info)
+{
+  guint32 id = info->packet_id;
+  guint32 head = priv->window_head;
+  guint32 tail = priv->window_tail;
+
+  if (priv->window_count == 0)
+    {
+      head = id;
+      tail = id + 1;
+    }
+  else if (gibber_r_multicast_packet_diff (head, id) < 0)
+    {
+      head = id;
+    }
+  else if (gibber_r_multicast_packet_diff (tail, id) >= 0)
+    {
+      tail = id + 1;
+    }
+
+  if (tail - head > priv->window_size)
+    packet_cache_grow (priv, tail - head);
+
+  priv->window_head = head;
+  priv->window_tail = tail;
+  priv->window[id & (priv->window_size - 1)] = info;
+  priv->window_count++;
+}
+
+static void
+packet_cache_remove (GibberRMulticastSenderPrivate *priv, guint32 packet_id)
+{
+  guint32 mask = priv->window_size - 1;
+  PacketInfo *info;
+
+  info = packet_cache_lookup (priv, packet_id);
+  if (info == NULL)
+    return;
+
+  priv->window[packet_id & mask] = NULL;
+  priv->window_count--;
+
+  if (priv->window_count == 0)
+    {
+      priv->window_head = priv->window_tail = packet_id;
+    }
+  else if (packet_id == priv->window_head)
+    {
+      while (priv->window[priv->window_head & mask] == NULL)
+        priv->window_head++;
+    }
+  else if (packet_id + 1 == priv->window_tail)
+    {
+      while (priv->window[(priv->window_tail - 1) & mask] == NULL)
+        priv->window_tail--;
+    }
+
+  packet_info_free (info);
+}
+
 static void
 gibber_r_multicast_sender_init (GibberRMulticastSender *obj)
 {
@@ -660,8 +916,11 @@ gibber_r_multicast_sender_init (GibberRMulticastSender *obj)
     GIBBER_R_MULTICAST_SENDER_GET_PRIVATE (obj);
 
   /* allocate any data required by the object here */
-  priv->packet_cache = g_hash_table_new_full (g_int_hash, g_int_equal,
-      NULL, packet_info_free);
+  priv->window_size = PACKET_CACHE_SIZE;
+  priv->window = g_new0 (gpointer, priv->window_size);
+
+  priv->reassembly = g_hash_table_new_full (NULL, NULL, NULL,
+      reassembly_free);
 
   priv->acks = g_hash_table_new_full (g_int_hash, g_int_equal,
       NULL, ack_info_free);
@@ -705,36 +964,40 @@ gibber_r_multicast_sender_class_init (
 
   object_class->set_property = gibber_r_multicast_sender_set_property;
 
+  /* Emitted with the ascending ids (as a GArray of guint32) of all missing
+   * packets whose repair request is due */
   signals[REPAIR_REQUEST] = g_signal_new ("repair-request",
       G_OBJECT_CLASS_TYPE(gibber_r_multicast_sender_class),
       G_SIGNAL_RUN_LAST | G_SIGNAL_DETAILED,
       0,
       NULL, NULL,
-      g_cclosure_marshal_VOID__UINT,
-      G_TYPE_NONE, 1, G_TYPE_UINT);
+      g_cclosure_marshal_VOID__BOXED,
+      G_TYPE_NONE, 1, G_TYPE_ARRAY | G_SIGNAL_TYPE_STATIC_SCOPE);
 
   signals[REPAIR_MESSAGE] = g_signal_new ("repair-message",
       G_OBJECT_CLASS_TYPE(gibber_r_multicast_sender_class),
       G_SIGNAL_RUN_LAST | G_SIGNAL_DETAILED,
       0,
       NULL, NULL,
-      g_cclosure_marshal_VOID__OBJECT,
-      G_TYPE_NONE, 1, GIBBER_TYPE_R_MULTICAST_PACKET);
+      g_cclosure_marshal_VOID__BOXED,
+      G_TYPE_NONE, 1,
+      GIBBER_TYPE_R_MULTICAST_PACKET | G_SIGNAL_TYPE_STATIC_SCOPE);
 
   signals[RECEIVED_DATA] = g_signal_new ("received-data",
       G_OBJECT_CLASS_TYPE(gibber_r_multicast_sender_class),
       G_SIGNAL_RUN_LAST | G_SIGNAL_DETAILED,
       0,
       NULL, NULL, NULL,
-      G_TYPE_NONE, 3, G_TYPE_UINT, G_TYPE_POINTER, G_TYPE_ULONG);
+      G_TYPE_NONE, 2, G_TYPE_UINT, G_TYPE_BYTES);
 
   signals[RECEIVED_CONTROL_PACKET] = g_signal_new ("received-control-packet",
       G_OBJECT_CLASS_TYPE(gibber_r_multicast_sender_class),
       G_SIGNAL_RUN_LAST | G_SIGNAL_DETAILED,
       0,
       NULL, NULL,
-      g_cclosure_marshal_VOID__OBJECT,
-      G_TYPE_NONE, 1, GIBBER_TYPE_R_MULTICAST_PACKET);
+      g_cclosure_marshal_VOID__BOXED,
+      G_TYPE_NONE, 1,
+      GIBBER_TYPE_R_MULTICAST_PACKET | G_SIGNAL_TYPE_STATIC_SCOPE);
 
   signals[WHOIS_REPLY] = g_signal_new ("whois-reply",
        G_OBJECT_CLASS_TYPE(gibber_r_multicast_sender_class),
@@ -792,18 +1055,30 @@ gibber_r_multicast_sender_dispose (GObject *object)
 
   priv->dispose_has_run = TRUE;
 
-  g_hash_table_unref (priv->packet_cache);
+  while (priv->window_count > 0)
+    packet_cache_remove (priv, priv->window_head);
+  g_free (priv->window);
+  priv->window = NULL;
+
+  g_hash_table_unref (priv->reassembly);
+
   g_hash_table_unref (priv->acks);
 
   if (priv->whois_timer != 0)
     {
-      g_source_remove (priv->whois_timer);
+      gibber_r_multicast_timeout_remove (priv->whois_timer);
       priv->whois_timer = 0;
     }
 
+  if (priv->repair_timer != 0)
+    {
+      gibber_r_multicast_timeout_remove (priv->repair_timer);
+      priv->repair_timer = 0;
+    }
+
   if (priv->fail_timer != 0)
     {
-      g_source_remove (priv->fail_timer);
+      gibber_r_multicast_timeout_remove (priv->fail_timer);
       priv->fail_timer = 0;
     }
 
@@ -853,7 +1128,7 @@ gibber_r_multicast_sender_new (guint32 id, const gchar *name,
   if (sender->name == NULL)
     {
       schedule_whois_request (sender, FALSE);
-      priv->fail_timer = g_timeout_add (NAME_DISCOVERY_TIME,
+      priv->fail_timer = gibber_r_multicast_timeout_add (NAME_DISCOVERY_TIME,
         name_discovery_failed_cb, sender);
     }
   else
@@ -869,21 +1144,22 @@ packet_info_try_gc (GibberRMulticastSender *sender, PacketInfo *info)
 {
   GibberRMulticastSenderPrivate *priv =
       GIBBER_R_MULTICAST_SENDER_GET_PRIVATE (sender);
-  guint32 packet_id, i;
+  guint32 packet_id;
 
   if (!info->acked || !info->popped || info->repeating)
     return;
 
   packet_id = info->packet_id;
-  g_hash_table_remove (priv->packet_cache, &packet_id);
+  packet_cache_remove (priv, packet_id);
 
   if (packet_id == priv->first_packet)
     {
-      for (i = packet_id; i != sender->next_output_data_packet; i++)
-        if (g_hash_table_lookup (priv->packet_cache, &i) != NULL)
-          break;
-
-      priv->first_packet = i;
+      /* The window head is the oldest packet we still have */
+      if (priv->window_count > 0 && gibber_r_multicast_packet_diff (
+            priv->window_head, sender->next_output_data_packet) > 0)
+        priv->first_packet = priv->window_head;
+      else
+        priv->first_packet = sender->next_output_data_packet;
     }
 }
 
@@ -896,26 +1172,26 @@ cancel_failure_timers (GibberRMulticastSender *sender)
   /* Cancel timers that are not needed anymore now the sender has failed */
   if (priv->fail_timer != 0)
     {
-      g_source_remove (priv->fail_timer);
+      gibber_r_multicast_timeout_remove (priv->fail_timer);
       priv->fail_timer = 0;
     }
 
   /* failed, no need to get our name anymore */
   if (priv->whois_timer != 0)
     {
-      g_source_remove (priv->whois_timer);
+      gibber_r_multicast_timeout_remove (priv->whois_timer);
       priv->whois_timer = 0;
     }
 }
 
 static void
 signal_data (GibberRMulticastSender *sender, guint16 stream_id,
-    guint8 *data, gsize size)
+    GBytes *message)
 {
   set_state (sender,
     MAX(GIBBER_R_MULTICAST_SENDER_STATE_DATA_RUNNING, sender->state));
 
-  g_signal_emit (sender, signals[RECEIVED_DATA], 0, stream_id, data, size);
+  g_signal_emit (sender, signals[RECEIVED_DATA], 0, stream_id, message);
 }
 
 static void
@@ -950,7 +1226,7 @@ name_discovery_failed_cb (gpointer data)
 
   g_assert (priv->whois_timer != 0);
 
-  g_source_remove (priv->whois_timer);
+  gibber_r_multicast_timeout_remove (priv->whois_timer);
   priv->whois_timer = 0;
   priv->fail_timer = 0;
 
@@ -990,9 +1266,9 @@ schedule_progress_timer (GibberRMulticastSender *self)
     return;
 
   if (priv->fail_timer != 0)
-    g_source_remove (priv->fail_timer);
+    gibber_r_multicast_timeout_remove (priv->fail_timer);
 
-  priv->fail_timer = g_timeout_add (MAX_PROGRESS_TIMEOUT,
+  priv->fail_timer = gibber_r_multicast_timeout_add (MAX_PROGRESS_TIMEOUT,
       progress_failed_cb, self);
 }
 
@@ -1004,13 +1280,13 @@ stop_whois_discovery (GibberRMulticastSender *self)
 
   if (priv->whois_timer != 0)
     {
-      g_source_remove (priv->whois_timer);
+      gibber_r_multicast_timeout_remove (priv->whois_timer);
       priv->whois_timer = 0;
     }
 
   if (priv->fail_timer != 0)
     {
-      g_source_remove (priv->fail_timer);
+      gibber_r_multicast_timeout_remove (priv->fail_timer);
       priv->fail_timer = 0;
     }
 
@@ -1028,17 +1304,132 @@ name_discovered (GibberRMulticastSender *self, const gchar *name)
   schedule_progress_timer (self);
 }
 
+static gint64
+now_ms (void)
+{
+  return gibber_r_multicast_get_time () / 1000;
+}
+
+/* Round trip time to use for timers concerning the node, 0 if unknown */
+static guint
+timer_rtt (GibberRMulticastSender *sender)
+{
+  GibberRMulticastSenderPrivate *priv =
+      GIBBER_R_MULTICAST_SENDER_GET_PRIVATE (sender);
+
+  if (sender->rtt != 0)
+    return sender->rtt;
+
+  return priv->group->rtt;
+}
+
+/* Random timeout in ms within [c1 d, (c1 + c2) d] for a round trip time rtt
+ * in us, or within [fallback_min, fallback_max) if the rtt is unknown */
+static guint
+srm_timeout (guint rtt, guint c1, guint c2, guint factor,
+    guint fallback_min, guint fallback_max)
+{
+  guint min, max;
+
+  if (rtt == 0)
+    return g_random_int_range (fallback_min, fallback_max);
+
+  min = MAX ((guint64) factor * c1 * rtt / 2000, 1);
+  max = MAX ((guint64) factor * (c1 + c2) * rtt / 2000, min + 1);
+
+  return g_random_int_range (min, max);
+}
+
+static void
+update_rtt (GibberRMulticastSender *sender, guint rtt)
+{
+  GibberRMulticastSenderPrivate *priv =
+      GIBBER_R_MULTICAST_SENDER_GET_PRIVATE (sender);
+
+  if (rtt == 0 || rtt > MAX_RTT)
+    return;
+
+  /* Smoothed like TCP's srtt */
+  if (sender->rtt == 0)
+    sender->rtt = rtt;
+  else
+    sender->rtt = sender->rtt - sender->rtt / 8 + rtt / 8;
+
+  if (priv->group->rtt == 0)
+    priv->group->rtt = rtt;
+  else
+    priv->group->rtt = priv->group->rtt - priv->group->rtt / 8 + rtt / 8;
+}
+
+static gboolean request_repairs (gpointer data);
+
+/* Make sure the repair timer fires no later than due */
+static void
+arm_repair_timer (GibberRMulticastSender *sender, gint64 due)
+{
+  GibberRMulticastSenderPrivate *priv =
+      GIBBER_R_MULTICAST_SENDER_GET_PRIVATE (sender);
+
+  if (priv->repair_timer != 0)
+    {
+      if (priv->repair_timer_due <= due)
+        return;
+      gibber_r_multicast_timeout_remove (priv->repair_timer);
+    }
+
+  priv->repair_timer_due = due;
+  priv->repair_timer = gibber_r_multicast_timeout_add (
+      MAX (due - now_ms (), 0), request_repairs, sender);
+}
+
+/* Request all missing packets that are (nearly) due in one go, so a burst
+ * of losses results in one repair request instead of one per packet */
 static gboolean
-request_repair (gpointer data)
+request_repairs (gpointer data)
 {
-  PacketInfo *info = (PacketInfo *) data;
+  GibberRMulticastSender *sender = GIBBER_R_MULTICAST_SENDER (data);
+  GibberRMulticastSenderPrivate *priv =
+      GIBBER_R_MULTICAST_SENDER_GET_PRIVATE (sender);
+  GArray *ids = g_array_new (FALSE, FALSE, sizeof (guint32));
+  gint64 now = now_ms ();
+  gint64 retry, next_due = 0;
+  guint32 i;
 
-  DEBUG_SENDER (info->sender, "Sending out repair request for 0x%x",
-    info->packet_id);
+  priv->repair_timer = 0;
+  retry = now + srm_timeout (timer_rtt (sender), REQUEST_C1, REQUEST_C2,
+      RETRY_FACTOR, MIN_REPAIR_TIMEOUT, MAX_REPAIR_TIMEOUT);
 
-  info->timeout = 0;
-  g_signal_emit (info->sender, signals[REPAIR_REQUEST], 0, info->packet_id);
-  schedule_repair (info->sender, info->packet_id);
+  for (i = priv->window_head; i != priv->window_tail; i++)
+    {
+      PacketInfo *info = packet_cache_lookup (priv, i);
+
+      if (info == NULL || info->repair_due == 0)
+        continue;
+
+      if (info->repair_due <= now + REPAIR_COALESCE_TIME)
+        {
+          g_array_append_val (ids, i);
+          /* Retried together, so they stay coalesced */
+          info->repair_due = retry;
+          if (info->repair_requested == 0)
+            info->repair_requested = gibber_r_multicast_get_time ();
+        }
+
+      if (next_due == 0 || info->repair_due < next_due)
+        next_due = info->repair_due;
+    }
+
+  if (next_due != 0)
+    arm_repair_timer (sender, next_due);
+
+  if (ids->len > 0)
+    {
+      DEBUG_SENDER (sender, "Sending out repair request for %d packets "
+          "starting at 0x%x", ids->len, g_array_index (ids, guint32, 0));
+      g_signal_emit (sender, signals[REPAIR_REQUEST], 0, ids);
+    }
+
+  g_array_unref (ids);
 
   return FALSE;
 }
@@ -1055,25 +1446,27 @@ schedule_repair (GibberRMulticastSender *sender, guint32 id)
   if (sender->state > GIBBER_R_MULTICAST_SENDER_STATE_STOPPED)
     return;
 
-  info = g_hash_table_lookup (priv->packet_cache, &id);
+  info = packet_cache_lookup (priv, id);
 
-  if (info != NULL && (info->packet != NULL || info->timeout != 0)) {
+  if (info != NULL && (info->packet != NULL || info->repair_due != 0)) {
     return;
   }
 
   if (info == NULL)
     {
       info = packet_info_new (sender, id);
-      g_hash_table_insert (priv->packet_cache, &info->packet_id, info);
-      timeout = g_random_int_range (MIN_INITIAL_REPAIR_TIMEOUT,
-          MAX_INITIAL_REPAIR_TIMEOUT);
+      packet_cache_insert (priv, info);
+      timeout = srm_timeout (timer_rtt (sender), REQUEST_C1, REQUEST_C2, 1,
+          MIN_INITIAL_REPAIR_TIMEOUT, MAX_INITIAL_REPAIR_TIMEOUT);
     }
   else
     {
-      timeout = g_random_int_range (MIN_REPAIR_TIMEOUT, MAX_REPAIR_TIMEOUT);
+      timeout = srm_timeout (timer_rtt (sender), REQUEST_C1, REQUEST_C2,
+          RETRY_FACTOR, MIN_REPAIR_TIMEOUT, MAX_REPAIR_TIMEOUT);
     }
 
-  info->timeout = g_timeout_add (timeout, request_repair, info);
+  info->repair_due = now_ms () + timeout;
+  arm_repair_timer (sender, info->repair_due);
   DEBUG_SENDER (sender,
     "Scheduled repair request for 0x%x in %d ms", id, timeout);
 }
@@ -1093,21 +1486,23 @@ do_repair (gpointer data)
 
   if (info->repeating)
     {
-      schedule_do_repair (info->sender, info->packet_id);
+      schedule_do_repair (info->sender, info->packet_id, 0);
     }
 
   return FALSE;
 }
 
+/* Schedule sending out a repair, rtt is the round trip time to the requester
+ * or 0 if unknown */
 static void
-schedule_do_repair (GibberRMulticastSender *sender, guint32 id)
+schedule_do_repair (GibberRMulticastSender *sender, guint32 id, guint rtt)
 {
   GibberRMulticastSenderPrivate *priv =
       GIBBER_R_MULTICAST_SENDER_GET_PRIVATE (sender);
   PacketInfo *info;
   guint timeout;
 
-  info = g_hash_table_lookup (priv->packet_cache, &id);
+  info = packet_cache_lookup (priv, id);
 
   g_assert (info != NULL && info->packet != NULL);
   if (info->timeout != 0)
@@ -1116,8 +1511,12 @@ schedule_do_repair (GibberRMulticastSender *sender, guint32 id)
       return;
     }
 
-  timeout = g_random_int_range (MIN_DO_REPAIR_TIMEOUT, MAX_DO_REPAIR_TIMEOUT);
-  info->timeout = g_timeout_add (timeout, do_repair, info);
+  if (rtt == 0)
+    rtt = priv->group->rtt;
+
+  timeout = srm_timeout (rtt, REPLY_D1, REPLY_D2, 1,
+      MIN_DO_REPAIR_TIMEOUT, MAX_DO_REPAIR_TIMEOUT);
+  info->timeout = gibber_r_multicast_timeout_add (timeout, do_repair, info);
   DEBUG_SENDER (sender, "Scheduled repair for 0x%x in %d ms", id, timeout);
 }
 
@@ -1159,17 +1558,19 @@ schedule_whois_request (GibberRMulticastSender *sender, gboolean rescheduled)
      return;
 
    if (rescheduled)
-    timeout = g_random_int_range (MIN_WHOIS_TIMEOUT, MAX_WHOIS_TIMEOUT);
+    timeout = srm_timeout (timer_rtt (sender), REQUEST_C1, REQUEST_C2,
+        RETRY_FACTOR, MIN_WHOIS_TIMEOUT, MAX_WHOIS_TIMEOUT);
    else
-    timeout = g_random_int_range (MIN_FIRST_WHOIS_TIMEOUT,
-        MAX_FIRST_WHOIS_TIMEOUT);
+    timeout = srm_timeout (timer_rtt (sender), REQUEST_C1, REQUEST_C2, 1,
+        MIN_FIRST_WHOIS_TIMEOUT, MAX_FIRST_WHOIS_TIMEOUT);
 
    DEBUG_SENDER (sender, "(Re)Scheduled whois request in %d ms", timeout);
 
    if (priv->whois_timer != 0)
-     g_source_remove (priv->whois_timer);
+     gibber_r_multicast_timeout_remove (priv->whois_timer);
 
-   priv->whois_timer = g_timeout_add (timeout, do_whois_request, sender);
+   priv->whois_timer = gibber_r_multicast_timeout_add (timeout,
+       do_whois_request, sender);
 }
 
 static gboolean
@@ -1188,8 +1589,8 @@ check_depends (GibberRMulticastSender *sender, GibberRMulticastPacket *packet,
       GibberRMulticastPacketSenderInfo *sender_info;
       guint32 other;
 
-      sender_info = g_array_index (packet->depends,
-          GibberRMulticastPacketSenderInfo *, i);
+      sender_info = &g_array_index (packet->depends,
+          GibberRMulticastPacketSenderInfo, i);
 
       s = gibber_r_multicast_sender_group_lookup (priv->group,
           sender_info->sender_id);
@@ -1240,8 +1641,7 @@ update_next_data_output_state (GibberRMulticastSender *self)
       self->next_output_data_packet++)
     {
       PacketInfo *p;
-      p = g_hash_table_lookup (priv->packet_cache,
-          &(self->next_output_data_packet));
+      p = packet_cache_lookup (priv, self->next_output_data_packet);
 
       if (p == NULL)
         continue;
@@ -1254,13 +1654,88 @@ update_next_data_output_state (GibberRMulticastSender *self)
     }
 }
 
+static void
+reassemble_fragment (GibberRMulticastSender *sender, PacketInfo *info)
+{
+  GibberRMulticastSenderPrivate *priv =
+      GIBBER_R_MULTICAST_SENDER_GET_PRIVATE (sender);
+  GibberRMulticastPacket *packet = info->packet;
+  gpointer key = GUINT_TO_POINTER (packet->data.data.stream_id);
+  guint8 flags = packet->data.data.flags;
+  Reassembly *r;
+  guint8 *payload;
+  gsize size;
+
+  payload = gibber_r_multicast_packet_get_payload (packet, &size);
+
+  if (flags & GIBBER_R_MULTICAST_DATA_PACKET_START)
+    {
+      g_hash_table_remove (priv->reassembly, key);
+
+      if (flags & GIBBER_R_MULTICAST_DATA_PACKET_END)
+        {
+          /* Single fragment message, hand out the packets own payload */
+          info->complete = TRUE;
+          info->message_start = packet->packet_id;
+
+          if (size == packet->data.data.total_size)
+            info->message = g_bytes_new_with_free_func (payload, size,
+                (GDestroyNotify) gibber_r_multicast_packet_unref,
+                gibber_r_multicast_packet_ref (packet));
+          return;
+        }
+
+      r = g_slice_new0 (Reassembly);
+      r->start = packet->packet_id;
+      r->size = packet->data.data.total_size;
+      r->data = g_malloc (r->size);
+      g_hash_table_insert (priv->reassembly, key, r);
+    }
+  else
+    {
+      r = g_hash_table_lookup (priv->reassembly, key);
+
+      /* The message started before we joined the causal ordering */
+      if (r == NULL)
+        return;
+    }
+
+  if (r->offset + size <= r->size)
+    memcpy (r->data + r->offset, payload, size);
+  r->offset += size;
+
+  if (!(flags & GIBBER_R_MULTICAST_DATA_PACKET_END))
+    {
+      /* The payload is copied out, only the first and the last fragment are
+       * needed to pop the message */
+      if (!(flags & GIBBER_R_MULTICAST_DATA_PACKET_START))
+        {
+          info->popped = TRUE;
+          packet_info_try_gc (sender, info);
+        }
+      return;
+    }
+
+  info->complete = TRUE;
+  info->message_start = r->start;
+
+  if (r->offset == r->size)
+    {
+      info->message = g_bytes_new_take (r->data, r->size);
+      r->data = NULL;
+    }
+
+  g_hash_table_remove (priv->reassembly, key);
+}
+
 static gboolean
 pop_data_packet (GibberRMulticastSender *sender)
 {
   GibberRMulticastSenderPrivate *priv =
       GIBBER_R_MULTICAST_SENDER_GET_PRIVATE (sender);
-  PacketInfo *p;
+  PacketInfo *p, *end;
   guint16 stream_id;
+  GBytes *message;
 
   /* If we're holding before this, skip */
   if (priv->holding_data &&
@@ -1276,49 +1751,25 @@ pop_data_packet (GibberRMulticastSender *sender)
   DEBUG_SENDER (sender, "Trying to pop data finishing at %x",
     sender->next_output_data_packet);
 
-  p = g_hash_table_lookup (priv->packet_cache,
-    &sender->next_output_data_packet);
-  g_assert (p != NULL);
+  end = packet_cache_lookup (priv, sender->next_output_data_packet);
+  g_assert (end != NULL);
 
-  g_assert (p->packet->data.data.flags & GIBBER_R_MULTICAST_DATA_PACKET_END);
+  g_assert (end->packet->data.data.flags & GIBBER_R_MULTICAST_DATA_PACKET_END);
 
-  stream_id = p->packet->data.data.stream_id;
+  stream_id = end->packet->data.data.stream_id;
 
-  /* Backwards search for the start, validate the pieces and check the size */
-  if (!(p->packet->data.data.flags & GIBBER_R_MULTICAST_DATA_PACKET_START))
+  if (!end->complete)
     {
-      guint32 i;
-      gboolean found = FALSE;
-
-      for (i = p->packet->packet_id - 1;
-        gibber_r_multicast_packet_diff (priv->first_packet, i) >= 0; i--)
-        {
-           p = g_hash_table_lookup (priv->packet_cache, &i);
-           if (p == NULL)
-             continue;
-
-           if (p->packet->type == PACKET_TYPE_DATA
-             && p->packet->data.data.stream_id == stream_id
-             && (p->packet->data.data.flags &
-                  GIBBER_R_MULTICAST_DATA_PACKET_START))
-               {
-                 found = TRUE;
-                 break;
-               }
-        }
-
-      if (!found)
-        {
-          /* If we couldn't find the start it must have happened before we
-           * joined the causal ordering */
-          DEBUG_SENDER (sender,
-            "Ignoring data starting before our first packet");
-          update_next_data_output_state (sender);
-          return TRUE;
-        }
+      /* If we never saw the start it must have happened before we joined the
+       * causal ordering */
+      DEBUG_SENDER (sender,
+        "Ignoring data starting before our first packet");
+      update_next_data_output_state (sender);
+      return TRUE;
     }
 
-  /* p is guaranteed to be the PacketInfo of the first packet */
+  p = packet_cache_lookup (priv, end->message_start);
+  g_assert (p != NULL && p->packet != NULL);
 
   /* If there is data from before our startpoint, ignore it */
   if (sender->state != GIBBER_R_MULTICAST_SENDER_STATE_DATA_RUNNING
@@ -1345,72 +1796,50 @@ pop_data_packet (GibberRMulticastSender *sender)
       return FALSE;
     }
 
-  /* Everything is fine, now do a forward pass to gather all the payload, we
-   * could have cached this info, but oh well */
   DEBUG_SENDER (sender, "Popping data 0x%x -> 0x%x stream_id: %x",
-    p->packet_id, sender->next_output_data_packet,
-    p->packet->data.data.stream_id);
-
-  if (p->packet->packet_id == sender->next_output_data_packet)
-    {
-      gsize size;
-      guint8 *data;
+    p->packet_id, sender->next_output_data_packet, stream_id);
 
-      data = gibber_r_multicast_packet_get_payload (p->packet, &size);
+  if (end->message == NULL)
+    goto incorrect_data_size;
 
-      if (size != p->packet->data.data.total_size)
-        goto incorrect_data_size;
-
-      update_next_data_output_state (sender);
-      signal_data (sender, p->packet->data.data.stream_id, data, size);
-
-      p->popped = TRUE;
-      packet_info_try_gc (sender, p);
-    }
-  else
+  if (p->packet->data.data.flags & GIBBER_R_MULTICAST_DATA_PACKET_DEFLATE)
     {
-      gsize off = 0;
-      guint8 *data = NULL, *d;
-      guint32 payload_size, i;
       gsize size;
+      const guint8 *data = g_bytes_get_data (end->message, &size);
 
-      payload_size = p->packet->data.data.total_size;
-      data = g_malloc (payload_size);
-
-      for (i = p->packet_id ; i != sender->next_output_data_packet + 1 ; i++)
+      /* Skipping the message would leave a hole in an ordered stream, so
+       * data we can't inflate fails the sender just like corrupt data */
+      if (!gibber_r_multicast_compress_available ())
         {
-          PacketInfo *tp  = g_hash_table_lookup (priv->packet_cache, &i);
-
-          if (tp == NULL)
-            continue;
-
-          if (tp->packet->type == PACKET_TYPE_DATA
-              && tp->packet->data.data.stream_id == stream_id)
-            {
-              d = gibber_r_multicast_packet_get_payload (tp->packet, &size);
-              if (off + size > payload_size)
-                {
-                  off += size;
-                  break;
-                }
-
-              memcpy (data + off, d, size);
-              off += size;
-
-              tp->popped = TRUE;
-              packet_info_try_gc (sender, tp);
-            }
+          DEBUG_SENDER (sender, "Got compressed data, but can't inflate it");
+          signal_failure (sender);
+          return FALSE;
         }
 
-      if (off != payload_size)
+      message = gibber_r_multicast_decompress (data, size);
+      if (message == NULL)
         {
-          g_free (data);
-          goto incorrect_data_size;
+          DEBUG_SENDER (sender, "Couldn't decompress data");
+          signal_failure (sender);
+          return FALSE;
         }
+    }
+  else
+    {
+      message = g_bytes_ref (end->message);
+    }
 
-      update_next_data_output_state (sender);
-      signal_data (sender, stream_id, data, payload_size);
-      g_free (data);
+  update_next_data_output_state (sender);
+  signal_data (sender, stream_id, message);
+  g_bytes_unref (message);
+
+  p->popped = TRUE;
+  packet_info_try_gc (sender, p);
+
+  if (end != p)
+    {
+      end->popped = TRUE;
+      packet_info_try_gc (sender, end);
     }
 
   return TRUE;
@@ -1435,9 +1864,10 @@ update_acks (GibberRMulticastSender *sender, GibberRMulticastPacket *packet)
     {
       GibberRMulticastPacketSenderInfo *senderinfo;
       AckInfo *info;
+      guint32 old;
 
-      senderinfo = g_array_index (packet->depends,
-        GibberRMulticastPacketSenderInfo *, i);
+      senderinfo = &g_array_index (packet->depends,
+        GibberRMulticastPacketSenderInfo, i);
 
       info = (AckInfo *) g_hash_table_lookup (priv->acks,
           &senderinfo->sender_id);
@@ -1449,6 +1879,7 @@ update_acks (GibberRMulticastSender *sender, GibberRMulticastPacket *packet)
           info->packet_id = senderinfo->packet_id;
           info->first_packet_id = packet->packet_id;
           updated = TRUE;
+          ack_matrix_update (priv->group, sender, info->sender_id, FALSE, 0);
         }
 
       if (gibber_r_multicast_packet_diff (info->packet_id,
@@ -1462,13 +1893,15 @@ update_acks (GibberRMulticastSender *sender, GibberRMulticastPacket *packet)
       if (gibber_r_multicast_packet_diff (info->packet_id,
           senderinfo->packet_id) > 0)
         {
+          old = info->packet_id;
           info->packet_id = senderinfo->packet_id;
           info->first_packet_id = packet->packet_id;
           updated = TRUE;
+          ack_matrix_update (priv->group, sender, info->sender_id, TRUE, old);
         }
     }
 
-    if (updated)
+    if (updated && priv->group->pending_removal->len > 0)
       {
         gibber_r_multicast_sender_group_gc (priv->group);
       }
@@ -1500,7 +1933,7 @@ pop_packet (GibberRMulticastSender *sender)
        return FALSE;
     }
 
-  p = g_hash_table_lookup (priv->packet_cache, &(sender->next_output_packet));
+  p = packet_cache_lookup (priv, sender->next_output_packet);
 
   DEBUG_SENDER (sender, "Looking at 0x%x", sender->next_output_packet);
 
@@ -1522,6 +1955,12 @@ pop_packet (GibberRMulticastSender *sender)
 
   if (p->packet->type == PACKET_TYPE_DATA)
     {
+      gboolean end = (p->packet->data.data.flags &
+          GIBBER_R_MULTICAST_DATA_PACKET_END) != 0;
+
+      /* Might free p if it is a middle fragment */
+      reassemble_fragment (sender, p);
+
       /* A data packet. If we had a potential end before this one, skip it
        * we're holding back the data for some reason otherwise check
        * if it's an end */
@@ -1530,7 +1969,7 @@ pop_packet (GibberRMulticastSender *sender)
         {
           sender->next_output_packet++;
           /* If this is the end, try to pop it. Otherwise ignore */
-          if (p->packet->data.data.flags & GIBBER_R_MULTICAST_DATA_PACKET_END)
+          if (end)
             {
               /* If we could pop this, then advance next_output_data_packet
                * otherwise keep it at this location */
@@ -1674,7 +2113,7 @@ insert_packet (GibberRMulticastSender *sender, GibberRMulticastPacket *packet)
 
   g_assert (sender->state > GIBBER_R_MULTICAST_SENDER_STATE_NEW);
 
-  info = g_hash_table_lookup (priv->packet_cache, &packet->packet_id);
+  info = packet_cache_lookup (priv, packet->packet_id);
   if (info != NULL && info->packet != NULL)
     {
       /* Already seen this packet */
@@ -1685,17 +2124,23 @@ insert_packet (GibberRMulticastSender *sender, GibberRMulticastPacket *packet)
   if (info == NULL)
     {
       info = packet_info_new (sender, packet->packet_id);
-      g_hash_table_insert (priv->packet_cache, &info->packet_id, info);
+      packet_cache_insert (priv, info);
     }
 
-  if (info->timeout != 0)
-    {
-      g_source_remove (info->timeout);
-      info->timeout = 0;
-    }
+  /* A stale repair timer firing just finds nothing to request */
+  info->repair_due = 0;
+
+  /* Request to repair is at least a round trip plus the suppression delay of
+   * the repairer, so only good enough until there are exact measurements */
+  if (info->repair_requested != 0 && !priv->rtt_measured)
+    update_rtt (sender,
+        gibber_r_multicast_get_time () - info->repair_requested);
+  info->repair_requested = 0;
 
   DEBUG_SENDER (sender, "Inserting packet 0x%x", packet->packet_id);
-  info->packet = g_object_ref (packet);
+  info->packet = gibber_r_multicast_packet_ref (packet);
+  /* Kept for repairs, so stop borrowing from the receive buffer */
+  gibber_r_multicast_packet_own_data (packet);
 
   if (gibber_r_multicast_packet_diff (sender->next_input_packet,
                  packet->packet_id) >= 0)
@@ -1707,6 +2152,9 @@ insert_packet (GibberRMulticastSender *sender, GibberRMulticastPacket *packet)
           schedule_repair (sender, i);
         }
       sender->next_input_packet = packet->packet_id + 1;
+
+      /* The stable point might have been capped at what we had received */
+      apply_stable_point (sender);
     }
 
   /* pop out as many packets as we can */
@@ -1728,7 +2176,7 @@ gibber_r_multicast_sender_update_start (GibberRMulticastSender *sender,
 
   if (sender->state == GIBBER_R_MULTICAST_SENDER_STATE_NEW)
     {
-      g_assert (g_hash_table_size (priv->packet_cache) == 0);
+      g_assert (priv->window_count == 0);
 
       set_state (sender, GIBBER_R_MULTICAST_SENDER_STATE_PREPARING);
 
@@ -1745,18 +2193,20 @@ gibber_r_multicast_sender_update_start (GibberRMulticastSender *sender,
       for (i = priv->first_packet; i < packet_id; i++)
         {
           PacketInfo *info;
-          info = g_hash_table_lookup (priv->packet_cache, &i);
-          if (info != NULL && info->packet == NULL && info->timeout != 0)
-            {
-              g_source_remove (info->timeout);
-              info->timeout = 0;
-            }
+          info = packet_cache_lookup (priv, i);
+          if (info != NULL && info->packet == NULL)
+            info->repair_due = 0;
         }
 
+      /* Fragments before the new start will never be walked */
+      g_hash_table_remove_all (priv->reassembly);
+
       sender->next_input_packet = packet_id;
       sender->next_output_packet = packet_id;
       sender->next_output_data_packet = packet_id;
     }
+
+  apply_stable_point (sender);
 }
 
 void
@@ -1857,9 +2307,8 @@ gibber_r_multicast_sender_push (GibberRMulticastSender *sender,
       sender->next_output_packet, sender->next_input_packet);
 }
 
-gboolean
-gibber_r_multicast_sender_repair_request (GibberRMulticastSender *sender,
-    guint32 id)
+static gboolean
+repair_request (GibberRMulticastSender *sender, guint32 id, guint rtt)
 {
   GibberRMulticastSenderPrivate *priv =
       GIBBER_R_MULTICAST_SENDER_GET_PRIVATE (sender);
@@ -1872,10 +2321,10 @@ gibber_r_multicast_sender_repair_request (GibberRMulticastSender *sender,
       return FALSE;
     }
 
-  info = g_hash_table_lookup (priv->packet_cache, &id);
+  info = packet_cache_lookup (priv, id);
   if (info != NULL && info->packet != NULL)
     {
-      schedule_do_repair (sender, id);
+      schedule_do_repair (sender, id, rtt);
       return TRUE;
     }
 
@@ -1900,11 +2349,10 @@ gibber_r_multicast_sender_repair_request (GibberRMulticastSender *sender,
         {
           /* else we already knew about the packets existance, but didn't see
            the packet just yet. Which means we already have a repair timeout
-           running */
-           g_assert (info->timeout != 0);
+           pending */
+           g_assert (info->repair_due != 0);
            /* Reschedule the repair */
-           g_source_remove (info->timeout);
-           info->timeout = 0;
+           info->repair_due = 0;
            schedule_repair (sender, id);
         }
 
@@ -1917,6 +2365,116 @@ gibber_r_multicast_sender_repair_request (GibberRMulticastSender *sender,
   return FALSE;
 }
 
+gboolean
+gibber_r_multicast_sender_repair_request (GibberRMulticastSender *sender,
+    guint32 id)
+{
+  return repair_request (sender, id, 0);
+}
+
+void
+gibber_r_multicast_sender_update_rtt (GibberRMulticastSender *sender,
+    guint rtt)
+{
+  GibberRMulticastSenderPrivate *priv =
+      GIBBER_R_MULTICAST_SENDER_GET_PRIVATE (sender);
+
+  if (!priv->rtt_measured)
+    {
+      /* Forget the estimates based on repairs */
+      priv->rtt_measured = TRUE;
+      sender->rtt = 0;
+    }
+
+  update_rtt (sender, rtt);
+}
+
+GibberRMulticastPacket *
+gibber_r_multicast_sender_recover (GibberRMulticastSender *sender,
+    GibberRMulticastPacket *parity)
+{
+  GibberRMulticastSenderPrivate *priv =
+      GIBBER_R_MULTICAST_SENDER_GET_PRIVATE (sender);
+  GibberRMulticastParityPacket *p = &parity->data.parity;
+  GibberRMulticastPacket *result;
+  guint32 i, missing = 0, end = p->packet_id + p->count;
+  guint nr_missing = 0;
+  guint8 *data;
+  gsize length;
+
+  g_assert (parity->type == PACKET_TYPE_PARITY);
+
+  if (sender->state < GIBBER_R_MULTICAST_SENDER_STATE_PREPARING
+      || sender->state >= GIBBER_R_MULTICAST_SENDER_STATE_FAILED)
+    return NULL;
+
+  for (i = p->packet_id; i != end; i++)
+    {
+      PacketInfo *info = packet_cache_lookup (priv, i);
+
+      if (info != NULL && info->packet != NULL)
+        continue;
+
+      /* Already dropped from the window, so it can't be used to recover
+       * anything else in the group */
+      if (gibber_r_multicast_packet_diff (priv->first_packet, i) < 0)
+        return NULL;
+
+      missing = i;
+      nr_missing++;
+    }
+
+  if (nr_missing != 1)
+    {
+      /* The packets up to the end of the group exist in any case */
+      gibber_r_multicast_sender_seen (sender, end);
+      return NULL;
+    }
+
+  data = g_memdup (p->parity, p->parity_size);
+  length = p->length;
+
+  for (i = p->packet_id; i != end; i++)
+    {
+      guint8 *raw;
+      gsize size;
+
+      if (i == missing)
+        continue;
+
+      raw = gibber_r_multicast_packet_get_raw_data (
+          packet_cache_lookup (priv, i)->packet, &size);
+      if (size > p->parity_size)
+        goto out;
+
+      gibber_r_multicast_packet_parity_add (data, raw, size);
+      length ^= size;
+    }
+
+  if (length > p->parity_size)
+    goto out;
+
+  result = gibber_r_multicast_packet_parse (data, length, NULL);
+  g_free (data);
+
+  if (result != NULL && (result->sender != sender->id
+      || !GIBBER_R_MULTICAST_PACKET_IS_RELIABLE_PACKET (result)
+      || result->packet_id != missing))
+    {
+      gibber_r_multicast_packet_unref (result);
+      result = NULL;
+    }
+
+  if (result != NULL)
+    DEBUG_SENDER (sender, "Recovered packet 0x%x from parity", missing);
+
+  return result;
+
+out:
+  g_free (data);
+  return NULL;
+}
+
 gboolean
 gibber_r_multicast_sender_seen (GibberRMulticastSender *sender, guint32 id)
 {
@@ -1969,10 +2527,12 @@ gibber_r_multicast_sender_whois_push (GibberRMulticastSender *sender,
         {
           if (priv->whois_timer == 0)
             {
-              gint timeout = g_random_int_range (MIN_WHOIS_REPLY_TIMEOUT,
-                   MAX_WHOIS_REPLY_TIMEOUT);
+              gint timeout = srm_timeout (priv->group->rtt, REPLY_D1,
+                  REPLY_D2, 1, MIN_WHOIS_REPLY_TIMEOUT,
+                  MAX_WHOIS_REPLY_TIMEOUT);
               priv->whois_timer =
-                g_timeout_add (timeout, do_whois_reply, sender);
+                gibber_r_multicast_timeout_add (timeout, do_whois_reply,
+                    sender);
               DEBUG_SENDER (sender, "Scheduled whois reply in %d ms", timeout);
             }
         }
@@ -2010,7 +2570,7 @@ gibber_r_multicast_sender_set_packet_repeat (GibberRMulticastSender *sender,
 
   PacketInfo *info;
 
-  info = g_hash_table_lookup (priv->packet_cache, &packet_id);
+  info = packet_cache_lookup (priv, packet_id);
   g_assert (info != NULL && info->packet != NULL);
 
   if (info->repeating == repeat)
@@ -2023,7 +2583,7 @@ gibber_r_multicast_sender_set_packet_repeat (GibberRMulticastSender *sender,
   if (repeat)
     {
       if (info->timeout == 0)
-         schedule_do_repair (sender, packet_id);
+         schedule_do_repair (sender, packet_id, 0);
     }
   else
    {
@@ -2077,7 +2637,7 @@ gibber_r_multicast_sender_ack (GibberRMulticastSender *sender, guint32 ack)
     {
       PacketInfo *info;
 
-      info = g_hash_table_lookup (priv->packet_cache, &i);
+      info = packet_cache_lookup (priv, i);
       if (info == NULL)
         continue;
 
@@ -2116,34 +2676,43 @@ gibber_r_multicast_sender_release_data (GibberRMulticastSender *sender)
   pop_packets (sender);
 }
 
-static void
-stop_packet (gpointer key, gpointer value, gpointer user_data)
-{
-  PacketInfo *p = (PacketInfo *) value;
-
-  if (p->timeout != 0)
-    {
-      g_source_remove (p->timeout);
-      p->timeout = 0;
-    }
-}
-
 void
 gibber_r_multicast_sender_stop (GibberRMulticastSender *sender)
 {
   GibberRMulticastSenderPrivate *priv =
     GIBBER_R_MULTICAST_SENDER_GET_PRIVATE(sender);
+  guint32 i;
 
   if (sender->state >= GIBBER_R_MULTICAST_SENDER_STATE_STOPPED)
     return;
 
   if (priv->whois_timer != 0)
     {
-      g_source_remove (priv->whois_timer);
+      gibber_r_multicast_timeout_remove (priv->whois_timer);
       priv->whois_timer = 0;
     }
 
-  g_hash_table_foreach (priv->packet_cache, stop_packet, NULL);
+  for (i = priv->window_head; i != priv->window_tail; i++)
+    {
+      PacketInfo *p = packet_cache_lookup (priv, i);
+
+      if (p == NULL)
+        continue;
+
+      p->repair_due = 0;
+      if (p->timeout != 0)
+        {
+          gibber_r_multicast_timeout_remove (p->timeout);
+          p->timeout = 0;
+        }
+    }
+
+  if (priv->repair_timer != 0)
+    {
+      gibber_r_multicast_timeout_remove (priv->repair_timer);
+      priv->repair_timer = 0;
+    }
+
   set_state (sender, GIBBER_R_MULTICAST_SENDER_STATE_STOPPED);
 }
 
@@ -40,6 +40,9 @@ struct _GibberRMulticastSenderGroup {
   GQueue *pop_queue;
   /* GArray of pending removal GibberRMulticastSenders */
   GPtrArray *pending_removal;
+  /* <public> smoothed round trip time to all nodes in microseconds, 0 if
+   * unknown */
+  guint rtt;
 };
 
 typedef struct _GibberRMulticastSender GibberRMulticastSender;
@@ -84,6 +87,9 @@ struct _GibberRMulticastSender {
 
     /* Next packet we expect from the sender */
     guint32 next_input_packet;
+
+    /* Smoothed round trip time to the sender in microseconds, 0 if unknown */
+    guint rtt;
 };
 
 GType gibber_r_multicast_sender_get_type (void);
@@ -160,6 +166,17 @@ gboolean gibber_r_multicast_sender_seen (GibberRMulticastSender *sender,
 gboolean gibber_r_multicast_sender_repair_request (
     GibberRMulticastSender *sender, guint32 id);
 
+/* Feed a measured round trip time to the sender in microseconds. Timers for
+ * repairs and whois requests are derived from it */
+void gibber_r_multicast_sender_update_rtt (GibberRMulticastSender *sender,
+    guint rtt);
+
+/* Rebuild the one packet of the group covered by a PACKET_TYPE_PARITY packet
+ * we're missing, which the caller should then handle as if it was received.
+ * Returns NULL if that's not possible */
+GibberRMulticastPacket *gibber_r_multicast_sender_recover (
+    GibberRMulticastSender *sender, GibberRMulticastPacket *parity);
+
 void gibber_r_multicast_sender_whois_push (GibberRMulticastSender *sender,
     const GibberRMulticastPacket *packet);
 
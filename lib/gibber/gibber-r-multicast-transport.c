@@ -28,6 +28,7 @@
 #define DEBUG_FLAG DEBUG_RMULTICAST
 #include "gibber-debug.h"
 
+#include "gibber-r-multicast-clock.h"
 #include "gibber-r-multicast-packet.h"
 #include "gibber-r-multicast-sender.h"
 
@@ -39,6 +40,12 @@
 #define MIN_JOINING_START_TIMEOUT 4800
 #define MAX_JOINING_START_TIMEOUT 5200
 
+/* Same, when the start points of everyone we know of have been exchanged and
+ * no failures are in progress. Longer than the attempt join interval, so only
+ * a quiet exchange is cut short */
+#define MIN_FAST_JOINING_START_TIMEOUT 500
+#define MAX_FAST_JOINING_START_TIMEOUT 700
+
 /* Time-out before within which we should have complete a failure */
 #define FAILURE_TIMEOUT 60000
 
@@ -61,6 +68,7 @@ static guint signals[LAST_SIGNAL] = {0};
 /* properties */
 enum {
   PROP_TRANSPORT = 1,
+  PROP_FAST_JOIN,
   LAST_PROPERTY
 };
 
@@ -109,6 +117,16 @@ struct _GibberRMulticastTransportPrivate
   /* People we saw to have failed, but not send a failure packet for yet */
   GArray *pending_failures;
 
+  gboolean fast_join;
+  /* Senders of a group we're not part of, as listed by its last complete
+   * session message or by a full rotation of its session digests */
+  GArray *session_view;
+  /* Senders seen in the digests of the rotation in progress, which started
+   * with session_rotation_start */
+  GArray *session_rotation;
+  guint32 session_rotation_start;
+  guint session_rotation_start_len;
+
   State state;
 
   gulong reconnect_handler;
@@ -182,6 +200,9 @@ gibber_r_multicast_transport_set_property (GObject *object,
       priv->transport = GIBBER_R_MULTICAST_CAUSAL_TRANSPORT (
           g_value_dup_object (value));
       break;
+    case PROP_FAST_JOIN:
+      priv->fast_join = g_value_get_boolean (value);
+      break;
     default:
       G_OBJECT_WARN_INVALID_PROPERTY_ID (object, property_id, pspec);
       break;
@@ -200,6 +221,9 @@ gibber_r_multicast_transport_get_property (GObject *object,
       case PROP_TRANSPORT:
         g_value_set_object (value, priv->transport);
         break;
+      case PROP_FAST_JOIN:
+        g_value_set_boolean (value, priv->fast_join);
+        break;
       default:
         G_OBJECT_WARN_INVALID_PROPERTY_ID (object, property_id, pspec);
         break;
@@ -217,6 +241,8 @@ gibber_r_multicast_transport_init (GibberRMulticastTransport *obj)
       NULL, free_member_info);
 
   priv->pending_failures = g_array_new (FALSE, FALSE, sizeof (guint32));
+  priv->session_view = g_array_new (FALSE, FALSE, sizeof (guint32));
+  priv->session_rotation = g_array_new (FALSE, FALSE, sizeof (guint32));
 }
 
 static void gibber_r_multicast_transport_dispose (GObject *object);
@@ -273,6 +299,15 @@ gibber_r_multicast_transport_class_init (
   g_object_class_install_property (object_class, PROP_TRANSPORT,
                                   param_spec);
 
+  param_spec = g_param_spec_boolean ("fast-join", "Fast join",
+      "Whether to wait a shorter time before starting to join when the "
+      "group looks stable. Only the gathering wait gets shorter, the join "
+      "itself takes as many rounds as usual", TRUE,
+      G_PARAM_CONSTRUCT | G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS);
+
+  g_object_class_install_property (object_class, PROP_FAST_JOIN,
+                                  param_spec);
+
   transport_class->send = gibber_r_multicast_transport_do_send;
   transport_class->disconnect = gibber_r_multicast_transport_disconnect;
 }
@@ -288,13 +323,13 @@ gibber_r_multicast_transport_flush_state (GibberRMulticastTransport *self)
 
   if (priv->timeout != 0)
     {
-      g_source_remove (priv->timeout);
+      gibber_r_multicast_timeout_remove (priv->timeout);
       priv->timeout = 0;
     }
 
   if (priv->joining_timeout != 0)
     {
-      g_source_remove (priv->joining_timeout);
+      gibber_r_multicast_timeout_remove (priv->joining_timeout);
       priv->joining_timeout = 0;
     }
 
@@ -316,6 +351,10 @@ gibber_r_multicast_transport_flush_state (GibberRMulticastTransport *self)
           priv->pending_failures->len);
     }
 
+  g_array_set_size (priv->session_view, 0);
+  g_array_set_size (priv->session_rotation, 0);
+  priv->session_rotation_start = 0;
+
   g_hash_table_remove_all (priv->members);
 }
 
@@ -358,6 +397,8 @@ gibber_r_multicast_transport_finalize (GObject *object)
       g_array_unref (priv->pending_failures);
       priv->pending_failures = NULL;
     }
+  g_array_unref (priv->session_view);
+  g_array_unref (priv->session_rotation);
 
   G_OBJECT_CLASS (
       gibber_r_multicast_transport_parent_class)->finalize (object);
@@ -447,7 +488,7 @@ free_member_info (gpointer data)
   MemberInfo *info = (MemberInfo *) data;
 
   if (info->fail_timeout != 0)
-    g_source_remove (info->fail_timeout);
+    gibber_r_multicast_timeout_remove (info->fail_timeout);
   g_array_unref (info->failures);
   g_slice_free (MemberInfo, info);
 }
@@ -637,7 +678,7 @@ setup_joining_phase (GibberRMulticastTransport *self)
   if (priv->state == STATE_GATHERING)
     {
       stop_send_attempt_join (self);
-      g_source_remove (priv->joining_timeout);
+      gibber_r_multicast_timeout_remove (priv->joining_timeout);
       priv->joining_timeout = 0;
       /* every member with state >= MEMBER_STATE_ATTEMPT_JOIN_REPEAT, will be
        * in our join */
@@ -727,9 +768,9 @@ start_joining_phase (GibberRMulticastTransport *self)
     }
 
   if (priv->timeout != 0)
-    g_source_remove (priv->timeout);
+    gibber_r_multicast_timeout_remove (priv->timeout);
 
-  priv->timeout = g_timeout_add (JOIN_TIMEOUT,
+  priv->timeout = gibber_r_multicast_timeout_add (JOIN_TIMEOUT,
     join_timeout_cb, self);
 }
 
@@ -744,10 +785,67 @@ do_start_joining_phase (gpointer user_data)
   return FALSE;
 }
 
+static gboolean
+find_unsettled_member (gpointer key, gpointer value, gpointer user_data)
+{
+  MemberInfo *info = (MemberInfo *) value;
+  gboolean *in_group = (gboolean *) user_data;
+
+  if (info->state == MEMBER_STATE_MEMBER)
+    {
+      *in_group = TRUE;
+      return FALSE;
+    }
+
+  /* Either still exchanging start points or failing */
+  return info->state != MEMBER_STATE_ATTEMPT_JOIN_DONE;
+}
+
+/* Whether the gathering phase can be cut short. That is when no failures are
+ * in progress, start points have been exchanged with everyone we know of and,
+ * if we're not in a group yet, its session messages showed us all of its
+ * members. Only the wait before joining gets shorter, the join itself still
+ * needs a round for every change in membership. Otherwise wait the full
+ * gathering time, so concurrent joiners and merging groups can find each
+ * other first */
+static gboolean
+join_can_be_fast (GibberRMulticastTransport *self)
+{
+  GibberRMulticastTransportPrivate *priv =
+    GIBBER_R_MULTICAST_TRANSPORT_GET_PRIVATE (self);
+  gboolean in_group = FALSE;
+  guint i;
+
+  if (!priv->fast_join || priv->pending_failures->len > 0)
+    return FALSE;
+
+  if (g_hash_table_find (priv->members, find_unsettled_member,
+        &in_group) != NULL)
+    return FALSE;
+
+  if (in_group)
+    return TRUE;
+
+  if (priv->session_view->len == 0)
+    return FALSE;
+
+  for (i = 0; i < priv->session_view->len; i++)
+    {
+      guint32 id = g_array_index (priv->session_view, guint32, i);
+
+      if (id != priv->transport->sender_id &&
+          member_get_state (self, id) != MEMBER_STATE_ATTEMPT_JOIN_DONE)
+        return FALSE;
+    }
+
+  return TRUE;
+}
+
 static void
 continue_gathering_phase (GibberRMulticastTransport *self) {
   GibberRMulticastTransportPrivate *priv =
     GIBBER_R_MULTICAST_TRANSPORT_GET_PRIVATE (self);
+  guint timeout;
 
   g_assert (priv->state != STATE_JOINING);
 
@@ -757,10 +855,21 @@ continue_gathering_phase (GibberRMulticastTransport *self) {
   }
 
   if (priv->joining_timeout != 0)
-    g_source_remove (priv->joining_timeout);
+    gibber_r_multicast_timeout_remove (priv->joining_timeout);
+
+  if (join_can_be_fast (self))
+    {
+      DEBUG ("Group looks stable, shortening the gathering wait");
+      timeout = g_random_int_range (MIN_FAST_JOINING_START_TIMEOUT,
+          MAX_FAST_JOINING_START_TIMEOUT);
+    }
+  else
+    {
+      timeout = g_random_int_range (MIN_JOINING_START_TIMEOUT,
+          MAX_JOINING_START_TIMEOUT);
+    }
 
-  priv->joining_timeout = g_timeout_add (
-    g_random_int_range (MIN_JOINING_START_TIMEOUT, MAX_JOINING_START_TIMEOUT),
+  priv->joining_timeout = gibber_r_multicast_timeout_add (timeout,
     do_start_joining_phase, self);
 }
 
@@ -816,7 +925,7 @@ stop_send_attempt_join (GibberRMulticastTransport *self) {
   }
 
   if (priv->timeout != 0) {
-    g_source_remove (priv->timeout);
+    gibber_r_multicast_timeout_remove (priv->timeout);
     priv->timeout = 0;
   }
 }
@@ -868,7 +977,7 @@ send_attempt_join (GibberRMulticastTransport *self, gboolean send_empty) {
 
   if (priv->timeout == 0) {
     /* No send attempt scheduled yet, schedule one now */
-    priv->timeout = g_timeout_add (
+    priv->timeout = gibber_r_multicast_timeout_add (
       g_random_int_range (MIN_ATTEMPT_JOIN_TIMEOUT, MAX_ATTEMPT_JOIN_TIMEOUT),
       do_send_attempt_join, self);
   }
@@ -881,7 +990,7 @@ depends_list_contains (GArray *depends, guint32 id) {
 
   for (i = 0; i < depends->len; i++) {
     GibberRMulticastPacketSenderInfo *info =
-        g_array_index (depends, GibberRMulticastPacketSenderInfo *, i);
+        &g_array_index (depends, GibberRMulticastPacketSenderInfo, i);
 
     if (info->sender_id == id)
       return TRUE;
@@ -931,12 +1040,94 @@ update_foreign_member_list (GibberRMulticastTransport *self,
       packet->packet_id + 1);
   for (i = 0 ; i < packet->depends->len; i++) {
     GibberRMulticastPacketSenderInfo *info =
-        g_array_index (packet->depends, GibberRMulticastPacketSenderInfo *, i);
+        &g_array_index (packet->depends, GibberRMulticastPacketSenderInfo, i);
     changed |= update_member (self, info->sender_id, state, info->packet_id);
   }
   return changed;
 }
 
+static void
+session_view_add (GArray *view, guint32 id)
+{
+  if (!guint32_array_contains (view, id))
+    g_array_append_val (view, id);
+}
+
+/* Learn the members of the group we're about to join from its session
+ * messages. A small group fits in a single digest. Bigger groups list a window
+ * of the members in every digest, rotating through all of them in id order,
+ * so collect the windows until the rotation comes back to where we started */
+static void
+update_session_view (GibberRMulticastTransport *self,
+    GibberRMulticastPacket *packet)
+{
+  GibberRMulticastTransportPrivate *priv =
+    GIBBER_R_MULTICAST_TRANSPORT_GET_PRIVATE (self);
+  gboolean wrapped = FALSE;
+  guint32 first = 0;
+  guint i;
+
+  if (packet->depends->len < GIBBER_R_MULTICAST_SESSION_DIGEST_SENDERS)
+    {
+      /* Lists all senders it knows about */
+      g_array_set_size (priv->session_view, 0);
+      session_view_add (priv->session_view, packet->sender);
+
+      for (i = 0; i < packet->depends->len; i++)
+        session_view_add (priv->session_view,
+            g_array_index (packet->depends,
+                GibberRMulticastPacketSenderInfo, i).sender_id);
+
+      g_array_set_size (priv->session_rotation, 0);
+      priv->session_rotation_start = 0;
+      return;
+    }
+
+  for (i = 0; i < packet->depends->len; i++)
+    {
+      guint32 id = g_array_index (packet->depends,
+          GibberRMulticastPacketSenderInfo, i).sender_id;
+
+      /* The sender lists itself first, outside of the rotation */
+      if (id == packet->sender)
+        continue;
+
+      if (first == 0)
+        first = id;
+
+      wrapped |= (id == priv->session_rotation_start);
+    }
+
+  /* A digest that only repeats the window we started with, because two
+   * members sent out the same one, doesn't complete the rotation */
+  if (wrapped &&
+      priv->session_rotation->len > priv->session_rotation_start_len)
+    {
+      GArray *tmp = priv->session_view;
+
+      DEBUG ("Saw a full rotation of session digests, %u members",
+          priv->session_rotation->len);
+      priv->session_view = priv->session_rotation;
+      priv->session_rotation = tmp;
+      priv->session_rotation_start = 0;
+    }
+
+  if (priv->session_rotation_start == 0)
+    {
+      g_array_set_size (priv->session_rotation, 0);
+      priv->session_rotation_start = first;
+    }
+
+  session_view_add (priv->session_rotation, packet->sender);
+  for (i = 0; i < packet->depends->len; i++)
+    session_view_add (priv->session_rotation,
+        g_array_index (packet->depends,
+            GibberRMulticastPacketSenderInfo, i).sender_id);
+
+  if (priv->session_rotation_start == first)
+    priv->session_rotation_start_len = priv->session_rotation->len;
+}
+
 static void
 received_foreign_packet_cb (GibberRMulticastCausalTransport *ctransport,
     GibberRMulticastPacket *packet, gpointer user_data) {
@@ -956,6 +1147,9 @@ received_foreign_packet_cb (GibberRMulticastCausalTransport *ctransport,
       return;
     }
 
+  if (packet->type == PACKET_TYPE_SESSION)
+    update_session_view (self, packet);
+
   /* Always add sender, regardless of the packet. So that the causal layer can
    * start requesting id -> name mapping */
   gibber_r_multicast_causal_transport_add_sender (priv->transport,
@@ -1007,8 +1201,15 @@ received_foreign_packet_cb (GibberRMulticastCausalTransport *ctransport,
     if (packet->type != PACKET_TYPE_DATA
         || packet->data.data.flags & GIBBER_R_MULTICAST_DATA_PACKET_START)
       {
-        /* Foreign packet, with no mention of us.. Mark them as unknown */
-        update_foreign_member_list (self, packet, MEMBER_STATE_UNKNOWN);
+        /* Foreign packet, with no mention of us.. Mark them as unknown.
+         * Data and session packets only list part of the senders, so only
+         * the membership packets and keepalives tell who is in the group */
+        if (packet->type == PACKET_TYPE_DATA
+            || packet->type == PACKET_TYPE_SESSION)
+          update_member (self, packet->sender, MEMBER_STATE_UNKNOWN,
+              packet->packet_id + 1);
+        else
+          update_foreign_member_list (self, packet, MEMBER_STATE_UNKNOWN);
         send_attempt_join (self, FALSE);
       }
   }
@@ -1020,7 +1221,7 @@ cmp_member_attempt_join_state (gpointer key, gpointer value,
     gpointer user_data)
 {
   MemberInfo *member = (MemberInfo *) value;
-  GibberRMulticastPacket *packet = GIBBER_R_MULTICAST_PACKET (user_data);
+  GibberRMulticastPacket *packet = (GibberRMulticastPacket *) user_data;
 
   if (guint32_array_contains (packet->data.attempt_join.senders, member->id)) {
     return member->state > MEMBER_STATE_ATTEMPT_JOIN_STARTED;
@@ -1193,7 +1394,7 @@ check_failure_completion (GibberRMulticastTransport *self, guint32 id)
       info->state = MEMBER_STATE_INSTANT_FAILURE;
       if (info->fail_timeout != 0)
         {
-          g_source_remove (info->fail_timeout);
+          gibber_r_multicast_timeout_remove (info->fail_timeout);
           info->fail_timeout = 0;
         }
       check_join_agreement (self);
@@ -1262,7 +1463,7 @@ fail_member (GibberRMulticastTransport *self, MemberInfo *info, guint32 id)
        else
          finfo->state = MEMBER_STATE_FAILING;
 
-       finfo->fail_timeout = g_timeout_add (FAILURE_TIMEOUT,
+       finfo->fail_timeout = gibber_r_multicast_timeout_add (FAILURE_TIMEOUT,
            fail_member_timeout_cb, finfo);
        send_failure_packet (self);
     }
@@ -1360,8 +1561,8 @@ check_join (GibberRMulticastTransport *self, GibberRMulticastPacket *packet)
   for (i = 0; i < packet->depends->len; i++)
     {
       GibberRMulticastPacketSenderInfo *sinfo =
-          g_array_index (packet->depends,
-              GibberRMulticastPacketSenderInfo *, i);
+          &g_array_index (packet->depends,
+              GibberRMulticastPacketSenderInfo, i);
 
       if (guint32_array_contains (priv->send_join, sinfo->sender_id)
           || sinfo->sender_id == priv->transport->sender_id)
@@ -1515,10 +1716,13 @@ check_join_agreement (GibberRMulticastTransport *self)
   g_array_unref (priv->send_join_failures);
   priv->send_join_failures = NULL;
   priv->state = STATE_NORMAL;
+  g_array_set_size (priv->session_view, 0);
+  g_array_set_size (priv->session_rotation, 0);
+  priv->session_rotation_start = 0;
 
   if (priv->timeout != 0)
     {
-      g_source_remove (priv->timeout);
+      gibber_r_multicast_timeout_remove (priv->timeout);
       priv->timeout = 0;
     }
   DEBUG ("--------------------------------");
@@ -1716,6 +1920,42 @@ gibber_r_multicast_transport_send (GibberRMulticastTransport *transport,
      stream_id, data, size, error);
 }
 
+void
+gibber_r_multicast_transport_set_stream_compression (
+    GibberRMulticastTransport *transport, guint16 stream_id,
+    gboolean compress)
+{
+  GibberRMulticastTransportPrivate *priv =
+    GIBBER_R_MULTICAST_TRANSPORT_GET_PRIVATE (transport);
+
+  gibber_r_multicast_causal_transport_set_stream_compression (
+      priv->transport, stream_id, compress);
+}
+
+void
+gibber_r_multicast_transport_set_stream_weight (
+    GibberRMulticastTransport *transport, guint16 stream_id,
+    guint weight)
+{
+  GibberRMulticastTransportPrivate *priv =
+    GIBBER_R_MULTICAST_TRANSPORT_GET_PRIVATE (transport);
+
+  gibber_r_multicast_causal_transport_set_stream_weight (
+      priv->transport, stream_id, weight);
+}
+
+guint
+gibber_r_multicast_transport_get_stream_queue_depth (
+    GibberRMulticastTransport *transport, guint16 stream_id,
+    gsize *bytes)
+{
+  GibberRMulticastTransportPrivate *priv =
+    GIBBER_R_MULTICAST_TRANSPORT_GET_PRIVATE (transport);
+
+  return gibber_r_multicast_causal_transport_get_stream_queue_depth (
+      priv->transport, stream_id, bytes);
+}
+
 static gboolean
 gibber_r_multicast_transport_do_send (GibberTransport *transport,
     const guint8 *data, gsize size, GError **error)
@@ -42,6 +42,8 @@ typedef struct {
   GibberBuffer buffer;
   const gchar *sender;
   guint16 stream_id;
+  /* Holds buffer.data, ref it to keep the data without copying it */
+  GBytes *payload;
 } GibberRMulticastBuffer;
 
 GType gibber_r_multicast_transport_get_type (void);
@@ -73,6 +75,16 @@ gboolean gibber_r_multicast_transport_send (
     GibberRMulticastTransport *transport, guint16 stream_id,
     const guint8 *data, gsize size, GError **error);
 
+void gibber_r_multicast_transport_set_stream_compression (
+    GibberRMulticastTransport *transport, guint16 stream_id,
+    gboolean compress);
+
+void gibber_r_multicast_transport_set_stream_weight (
+    GibberRMulticastTransport *transport, guint16 stream_id, guint weight);
+
+guint gibber_r_multicast_transport_get_stream_queue_depth (
+    GibberRMulticastTransport *transport, guint16 stream_id, gsize *bytes);
+
 G_END_DECLS
 
 #endif /* #ifndef __GIBBER_R_MULTICAST_TRANSPORT_H__*/
@@ -0,0 +1,535 @@
+/*
+ * gibber-reactor.c - Source for GibberReactor
+ * Copyright (C) 2009 Collabora Ltd.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+#include "config.h"
+#include "gibber-reactor.h"
+
+#include <errno.h>
+#include <string.h>
+
+#ifdef HAVE_UNISTD_H
+# include <unistd.h>
+#endif
+
+#if defined(HAVE_SYS_EPOLL_H) && defined(HAVE_EPOLL_CREATE1)
+# include <sys/epoll.h>
+# define USE_EPOLL
+#endif
+
+#define DEBUG_FLAG DEBUG_NET
+#include "gibber-debug.h"
+
+/* GibberReactor multiplexes any number of fds through a single epoll
+ * instance, which is the only fd GLib polls for them. Every fd is registered
+ * once, edge triggered, for all the conditions its owner cares about; the
+ * conditions reported by epoll are remembered until the owner says it
+ * drained them, so nothing is lost if it stops reading early. */
+
+/* Number of events fetched per epoll_wait call */
+#define MAX_EVENTS 64
+
+GQuark
+gibber_reactor_error_quark (void)
+{
+  static GQuark quark = 0;
+
+  if (!quark)
+    quark = g_quark_from_static_string ("gibber_reactor_error");
+
+  return quark;
+}
+
+#ifdef USE_EPOLL
+
+typedef struct {
+  int fd;
+  /* conditions the owner is interested in, G_IO_ERR is always implied */
+  GIOCondition events;
+  /* conditions reported by epoll and not drained yet */
+  GIOCondition ready;
+  GibberReactorFunc func;
+  gpointer user_data;
+  /* TRUE while in the ready queue */
+  gboolean queued;
+  gboolean removed;
+} Registration;
+
+typedef struct {
+  GSource source;
+  GibberReactor *reactor;
+  GPollFD pollfd;
+} ReactorSource;
+
+struct _GibberReactor
+{
+  gint refcount;
+  int epfd;
+  ReactorSource *source;
+  /* int fd => owned Registration */
+  GHashTable *registrations;
+  /* Registration with ready conditions to dispatch */
+  GQueue ready;
+  /* Registration removed while dispatching, freed once it's done */
+  GSList *removed;
+  gboolean dispatching;
+};
+
+static GibberReactor *default_reactor = NULL;
+static gboolean default_reactor_set = FALSE;
+
+static guint32
+condition_to_epoll (GIOCondition condition)
+{
+  guint32 events = EPOLLET;
+
+  if (condition & G_IO_IN)
+    events |= EPOLLIN;
+
+  if (condition & G_IO_OUT)
+    events |= EPOLLOUT;
+
+  return events;
+}
+
+static GIOCondition
+epoll_to_condition (guint32 events)
+{
+  GIOCondition condition = 0;
+
+  if (events & EPOLLIN)
+    condition |= G_IO_IN;
+
+  if (events & EPOLLOUT)
+    condition |= G_IO_OUT;
+
+  if (events & EPOLLERR)
+    condition |= G_IO_ERR;
+
+  if (events & EPOLLHUP)
+    condition |= G_IO_HUP;
+
+  return condition;
+}
+
+/* The conditions of @reg the owner should be told about. A hangup is
+ * reported as readable, so that the owner reads the EOF like it would with
+ * a GLib watch */
+static GIOCondition
+registration_pending (Registration *reg)
+{
+  GIOCondition pending = reg->ready & (reg->events | G_IO_ERR);
+
+  if ((reg->ready & G_IO_HUP) && (reg->events & G_IO_IN))
+    pending |= G_IO_IN;
+
+  return pending;
+}
+
+static void
+registration_queue (GibberReactor *reactor,
+    Registration *reg)
+{
+  if (reg->queued || reg->removed || registration_pending (reg) == 0)
+    return;
+
+  reg->queued = TRUE;
+  g_queue_push_tail (&reactor->ready, reg);
+}
+
+static void
+collect_events (GibberReactor *reactor)
+{
+  struct epoll_event events[MAX_EVENTS];
+  int n, i;
+
+  do
+    {
+      n = epoll_wait (reactor->epfd, events, MAX_EVENTS, 0);
+
+      if (n == -1)
+        {
+          if (errno != EINTR)
+            DEBUG ("epoll_wait failed: %s", g_strerror (errno));
+          return;
+        }
+
+      for (i = 0; i < n; i++)
+        {
+          Registration *reg = g_hash_table_lookup (reactor->registrations,
+              GINT_TO_POINTER (events[i].data.fd));
+
+          if (reg == NULL)
+            continue;
+
+          reg->ready |= epoll_to_condition (events[i].events);
+          registration_queue (reactor, reg);
+        }
+    }
+  while (n == MAX_EVENTS);
+}
+
+static gboolean
+reactor_source_prepare (GSource *source,
+    gint *timeout)
+{
+  ReactorSource *rsource = (ReactorSource *) source;
+
+  if (!g_queue_is_empty (&rsource->reactor->ready))
+    {
+      *timeout = 0;
+      return TRUE;
+    }
+
+  *timeout = -1;
+  return FALSE;
+}
+
+static gboolean
+reactor_source_check (GSource *source)
+{
+  ReactorSource *rsource = (ReactorSource *) source;
+
+  return (rsource->pollfd.revents & G_IO_IN) != 0 ||
+      !g_queue_is_empty (&rsource->reactor->ready);
+}
+
+static gboolean
+reactor_source_dispatch (GSource *source,
+    GSourceFunc callback,
+    gpointer user_data)
+{
+  ReactorSource *rsource = (ReactorSource *) source;
+  GibberReactor *reactor = rsource->reactor;
+  GQueue pending;
+  Registration *reg;
+
+  if (rsource->pollfd.revents & G_IO_IN)
+    collect_events (reactor);
+
+  /* Only dispatch what is ready now, fds that weren't drained are queued
+   * again for the next iteration so they can't starve the main loop */
+  pending = reactor->ready;
+  g_queue_init (&reactor->ready);
+
+  gibber_reactor_ref (reactor);
+  reactor->dispatching = TRUE;
+
+  while ((reg = g_queue_pop_head (&pending)) != NULL)
+    {
+      GIOCondition condition, again;
+
+      reg->queued = FALSE;
+
+      if (reg->removed)
+        continue;
+
+      condition = registration_pending (reg);
+      if (condition == 0)
+        continue;
+
+      again = reg->func (reg->fd, condition, reg->user_data);
+
+      if (reg->removed)
+        continue;
+
+      reg->ready &= ~(condition & ~again);
+
+      if ((condition & G_IO_IN) && !(again & G_IO_IN))
+        /* The owner read up to the EOF */
+        reg->ready &= ~G_IO_HUP;
+
+      registration_queue (reactor, reg);
+    }
+
+  reactor->dispatching = FALSE;
+
+  g_slist_foreach (reactor->removed, (GFunc) g_free, NULL);
+  g_slist_free (reactor->removed);
+  reactor->removed = NULL;
+
+  gibber_reactor_unref (reactor);
+
+  return TRUE;
+}
+
+static GSourceFuncs reactor_source_funcs = {
+  reactor_source_prepare,
+  reactor_source_check,
+  reactor_source_dispatch,
+  NULL
+};
+
+gboolean
+gibber_reactor_is_supported (void)
+{
+  return TRUE;
+}
+
+GibberReactor *
+gibber_reactor_new (GMainContext *context,
+    GError **error)
+{
+  GibberReactor *reactor;
+  int epfd;
+
+  epfd = epoll_create1 (EPOLL_CLOEXEC);
+  if (epfd == -1)
+    {
+      g_set_error (error, GIBBER_REACTOR_ERROR, GIBBER_REACTOR_ERROR_FAILED,
+          "epoll_create1 failed: %s", g_strerror (errno));
+      return NULL;
+    }
+
+  reactor = g_slice_new0 (GibberReactor);
+  reactor->refcount = 1;
+  reactor->epfd = epfd;
+  reactor->registrations = g_hash_table_new_full (g_direct_hash,
+      g_direct_equal, NULL, g_free);
+  g_queue_init (&reactor->ready);
+
+  reactor->source = (ReactorSource *) g_source_new (&reactor_source_funcs,
+      sizeof (ReactorSource));
+  reactor->source->reactor = reactor;
+  reactor->source->pollfd.fd = epfd;
+  reactor->source->pollfd.events = G_IO_IN;
+  g_source_add_poll ((GSource *) reactor->source, &reactor->source->pollfd);
+  g_source_attach ((GSource *) reactor->source, context);
+
+  return reactor;
+}
+
+GibberReactor *
+gibber_reactor_ref (GibberReactor *reactor)
+{
+  g_atomic_int_inc (&reactor->refcount);
+  return reactor;
+}
+
+void
+gibber_reactor_unref (GibberReactor *reactor)
+{
+  if (!g_atomic_int_dec_and_test (&reactor->refcount))
+    return;
+
+  g_source_destroy ((GSource *) reactor->source);
+  g_source_unref ((GSource *) reactor->source);
+
+  g_queue_clear (&reactor->ready);
+  g_hash_table_unref (reactor->registrations);
+  close (reactor->epfd);
+
+  g_slice_free (GibberReactor, reactor);
+}
+
+GibberReactor *
+gibber_reactor_get_default (void)
+{
+  if (!default_reactor_set)
+    {
+      GError *error = NULL;
+
+      default_reactor_set = TRUE;
+
+      if (g_strcmp0 (g_getenv ("GIBBER_REACTOR"), "epoll") != 0)
+        return NULL;
+
+      default_reactor = gibber_reactor_new (NULL, &error);
+      if (default_reactor == NULL)
+        {
+          DEBUG ("Falling back to GLib watches: %s", error->message);
+          g_error_free (error);
+        }
+    }
+
+  return default_reactor;
+}
+
+void
+gibber_reactor_set_default (GibberReactor *reactor)
+{
+  if (reactor != NULL)
+    gibber_reactor_ref (reactor);
+
+  if (default_reactor != NULL)
+    gibber_reactor_unref (default_reactor);
+
+  default_reactor = reactor;
+  default_reactor_set = TRUE;
+}
+
+gboolean
+gibber_reactor_add (GibberReactor *reactor,
+    int fd,
+    GIOCondition events,
+    GibberReactorFunc func,
+    gpointer user_data)
+{
+  struct epoll_event event;
+  Registration *reg;
+
+  g_return_val_if_fail (g_hash_table_lookup (reactor->registrations,
+        GINT_TO_POINTER (fd)) == NULL, FALSE);
+
+  memset (&event, 0, sizeof (event));
+  event.events = condition_to_epoll (events);
+  event.data.fd = fd;
+
+  /* Fails with EPERM for regular files, the caller should fall back to
+   * GLib watches */
+  if (epoll_ctl (reactor->epfd, EPOLL_CTL_ADD, fd, &event) == -1)
+    {
+      DEBUG ("Can't add fd %d: %s", fd, g_strerror (errno));
+      return FALSE;
+    }
+
+  reg = g_new0 (Registration, 1);
+  reg->fd = fd;
+  reg->events = events;
+  reg->func = func;
+  reg->user_data = user_data;
+
+  g_hash_table_insert (reactor->registrations, GINT_TO_POINTER (fd), reg);
+
+  return TRUE;
+}
+
+void
+gibber_reactor_modify (GibberReactor *reactor,
+    int fd,
+    GIOCondition events)
+{
+  struct epoll_event event;
+  Registration *reg;
+
+  reg = g_hash_table_lookup (reactor->registrations, GINT_TO_POINTER (fd));
+  g_return_if_fail (reg != NULL);
+
+  if (reg->events == events)
+    return;
+
+  reg->events = events;
+
+  /* Modifying the registration makes epoll check the fd again, so
+   * conditions the owner wasn't interested in so far are reported anew */
+  memset (&event, 0, sizeof (event));
+  event.events = condition_to_epoll (events);
+  event.data.fd = fd;
+
+  if (epoll_ctl (reactor->epfd, EPOLL_CTL_MOD, fd, &event) == -1)
+    DEBUG ("Can't modify fd %d: %s", fd, g_strerror (errno));
+
+  registration_queue (reactor, reg);
+}
+
+void
+gibber_reactor_remove (GibberReactor *reactor,
+    int fd)
+{
+  Registration *reg;
+
+  reg = g_hash_table_lookup (reactor->registrations, GINT_TO_POINTER (fd));
+  g_return_if_fail (reg != NULL);
+
+  if (epoll_ctl (reactor->epfd, EPOLL_CTL_DEL, fd, NULL) == -1)
+    DEBUG ("Can't remove fd %d: %s", fd, g_strerror (errno));
+
+  g_hash_table_steal (reactor->registrations, GINT_TO_POINTER (fd));
+  reg->removed = TRUE;
+
+  if (reactor->dispatching)
+    {
+      /* It might still be referenced by the pending queue */
+      reactor->removed = g_slist_prepend (reactor->removed, reg);
+      return;
+    }
+
+  if (reg->queued)
+    g_queue_remove (&reactor->ready, reg);
+
+  g_free (reg);
+}
+
+#else /* !USE_EPOLL */
+
+gboolean
+gibber_reactor_is_supported (void)
+{
+  return FALSE;
+}
+
+GibberReactor *
+gibber_reactor_new (GMainContext *context,
+    GError **error)
+{
+  g_set_error_literal (error, GIBBER_REACTOR_ERROR,
+      GIBBER_REACTOR_ERROR_NOT_SUPPORTED,
+      "epoll is not supported on this platform");
+  return NULL;
+}
+
+GibberReactor *
+gibber_reactor_ref (GibberReactor *reactor)
+{
+  g_return_val_if_reached (NULL);
+}
+
+void
+gibber_reactor_unref (GibberReactor *reactor)
+{
+  g_return_if_reached ();
+}
+
+GibberReactor *
+gibber_reactor_get_default (void)
+{
+  return NULL;
+}
+
+void
+gibber_reactor_set_default (GibberReactor *reactor)
+{
+  g_return_if_fail (reactor == NULL);
+}
+
+gboolean
+gibber_reactor_add (GibberReactor *reactor,
+    int fd,
+    GIOCondition events,
+    GibberReactorFunc func,
+    gpointer user_data)
+{
+  g_return_val_if_reached (FALSE);
+}
+
+void
+gibber_reactor_modify (GibberReactor *reactor,
+    int fd,
+    GIOCondition events)
+{
+  g_return_if_reached ();
+}
+
+void
+gibber_reactor_remove (GibberReactor *reactor,
+    int fd)
+{
+  g_return_if_reached ();
+}
+
+#endif /* USE_EPOLL */
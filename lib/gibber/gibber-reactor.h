@@ -0,0 +1,71 @@
+/*
+ * gibber-reactor.h - Header for GibberReactor
+ * Copyright (C) 2009 Collabora Ltd.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+#ifndef __GIBBER_REACTOR_H__
+#define __GIBBER_REACTOR_H__
+
+#include <glib.h>
+
+G_BEGIN_DECLS
+
+GQuark gibber_reactor_error_quark (void);
+#define GIBBER_REACTOR_ERROR gibber_reactor_error_quark ()
+
+typedef enum
+{
+  GIBBER_REACTOR_ERROR_NOT_SUPPORTED,
+  GIBBER_REACTOR_ERROR_FAILED,
+} GibberReactorError;
+
+typedef struct _GibberReactor GibberReactor;
+
+/* Called with the conditions the fd became ready for since it was last
+ * drained. Notifications are edge triggered, so the callback returns the
+ * subset of @condition it didn't exhaust (it stopped before hitting EAGAIN);
+ * the fd is dispatched again for those on the next main loop iteration. */
+typedef GIOCondition (*GibberReactorFunc) (int fd,
+    GIOCondition condition,
+    gpointer user_data);
+
+gboolean gibber_reactor_is_supported (void);
+
+GibberReactor *gibber_reactor_new (GMainContext *context, GError **error);
+
+GibberReactor *gibber_reactor_ref (GibberReactor *reactor);
+
+void gibber_reactor_unref (GibberReactor *reactor);
+
+/* The reactor GibberFdTransports register with, or NULL if they should use
+ * plain GLib watches. Unless set explicitly, an epoll based reactor is used
+ * when the GIBBER_REACTOR environment variable is set to "epoll". */
+GibberReactor *gibber_reactor_get_default (void);
+
+void gibber_reactor_set_default (GibberReactor *reactor);
+
+gboolean gibber_reactor_add (GibberReactor *reactor, int fd,
+    GIOCondition events, GibberReactorFunc func, gpointer user_data);
+
+void gibber_reactor_modify (GibberReactor *reactor, int fd,
+    GIOCondition events);
+
+void gibber_reactor_remove (GibberReactor *reactor, int fd);
+
+G_END_DECLS
+
+#endif /* #ifndef __GIBBER_REACTOR_H__*/
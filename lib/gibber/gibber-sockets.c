@@ -78,6 +78,16 @@ gibber_socket_errno_is_eaddrinuse (void)
 #endif
 }
 
+gboolean
+gibber_socket_errno_would_block (void)
+{
+#ifdef G_OS_WIN32
+  return (WSAGetLastError () == WSAEWOULDBLOCK);
+#else
+  return (errno == EAGAIN || errno == EWOULDBLOCK);
+#endif
+}
+
 void
 gibber_socket_set_error (GError **error, const gchar *context,
     GQuark domain, gint code)
@@ -35,6 +35,7 @@ G_BEGIN_DECLS
 gboolean gibber_connect_errno_requires_retry (void);
 gboolean gibber_socket_errno_is_eafnosupport (void);
 gboolean gibber_socket_errno_is_eaddrinuse (void);
+gboolean gibber_socket_errno_would_block (void);
 void gibber_socket_set_error (GError **error, const gchar *context,
     GQuark domain, gint code);
 gint gibber_socket_errno (void);
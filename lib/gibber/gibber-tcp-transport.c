@@ -41,15 +41,31 @@
 G_DEFINE_TYPE(GibberTCPTransport, gibber_tcp_transport,
               GIBBER_TYPE_FD_TRANSPORT)
 
+/* How long to wait for a pending attempt before racing the next address
+ * against it, as recommended by RFC 8305 */
+#define DEFAULT_CONNECT_ATTEMPT_DELAY 250
+
+typedef struct {
+  GibberTCPTransport *self;
+  struct addrinfo *addr;
+  int fd;
+  GIOChannel *channel;
+  guint watch;
+} ConnectAttempt;
+
 /* private structure */
 typedef struct _GibberTCPTransportPrivate GibberTCPTransportPrivate;
 
 struct _GibberTCPTransportPrivate
 {
-  GIOChannel *channel;
   struct addrinfo *ans;
-  struct addrinfo *tmpaddr;
-  guint watch_in;
+  /* struct addrinfo * pointing into ans, in the order they will be tried */
+  GPtrArray *candidates;
+  guint next_candidate;
+  /* ConnectAttempt currently in progress */
+  GSList *attempts;
+  guint attempt_timer;
+  guint attempt_delay;
 
   gboolean dispose_has_run;
 };
@@ -58,13 +74,14 @@ struct _GibberTCPTransportPrivate
   (G_TYPE_INSTANCE_GET_PRIVATE ((o), GIBBER_TYPE_TCP_TRANSPORT, \
    GibberTCPTransportPrivate))
 
+static GibberTCPTransportConnectStats connect_stats;
+
 static void
 gibber_tcp_transport_init (GibberTCPTransport *obj)
 {
-  /* GibberTCPTransportPrivate *priv = GIBBER_TCP_TRANSPORT_GET_PRIVATE (obj);
-   */
+  GibberTCPTransportPrivate *priv = GIBBER_TCP_TRANSPORT_GET_PRIVATE (obj);
 
-  /* allocate any data required by the object here */
+  priv->attempt_delay = DEFAULT_CONNECT_ATTEMPT_DELAY;
 }
 
 static void gibber_tcp_transport_dispose (GObject *object);
@@ -84,22 +101,17 @@ gibber_tcp_transport_class_init (
 }
 
 static void
-clean_connect_attempt (GibberTCPTransport *self)
+connect_attempt_free (ConnectAttempt *attempt,
+    gboolean close_fd)
 {
-  GibberTCPTransportPrivate *priv = GIBBER_TCP_TRANSPORT_GET_PRIVATE (
-      self);
+  if (attempt->watch != 0)
+    g_source_remove (attempt->watch);
 
-  if (priv->watch_in != 0)
-    {
-      g_source_remove (priv->watch_in);
-      priv->watch_in = 0;
-    }
+  if (close_fd)
+    g_io_channel_shutdown (attempt->channel, FALSE, NULL);
 
-  if (priv->channel != NULL)
-    {
-      g_io_channel_unref (priv->channel);
-      priv->channel = NULL;
-    }
+  g_io_channel_unref (attempt->channel);
+  g_slice_free (ConnectAttempt, attempt);
 }
 
 static void
@@ -108,15 +120,31 @@ clean_all_connect_attempts (GibberTCPTransport *self)
   GibberTCPTransportPrivate *priv = GIBBER_TCP_TRANSPORT_GET_PRIVATE (
       self);
 
-  clean_connect_attempt (self);
+  if (priv->attempt_timer != 0)
+    {
+      g_source_remove (priv->attempt_timer);
+      priv->attempt_timer = 0;
+    }
+
+  while (priv->attempts != NULL)
+    {
+      connect_attempt_free (priv->attempts->data, TRUE);
+      priv->attempts = g_slist_delete_link (priv->attempts, priv->attempts);
+    }
+
+  if (priv->candidates != NULL)
+    {
+      g_ptr_array_unref (priv->candidates);
+      priv->candidates = NULL;
+    }
+
+  priv->next_candidate = 0;
 
   if (priv->ans != NULL)
     {
       freeaddrinfo (priv->ans);
       priv->ans = NULL;
     }
-
-  priv->tmpaddr = NULL;
 }
 
 void
@@ -156,27 +184,44 @@ gibber_tcp_transport_new ()
   return g_object_new (GIBBER_TYPE_TCP_TRANSPORT, NULL);
 }
 
-static void new_connect_attempt (GibberTCPTransport *self);
+static void start_next_attempt (GibberTCPTransport *self);
+
+static void
+connect_succeeded (GibberTCPTransport *self,
+    ConnectAttempt *attempt)
+{
+  GibberTCPTransportPrivate *priv = GIBBER_TCP_TRANSPORT_GET_PRIVATE (
+      self);
+  int fd = attempt->fd;
+
+  if (attempt->addr->ai_family == AF_INET6)
+    connect_stats.ipv6_wins++;
+  else
+    connect_stats.ipv4_wins++;
+
+  /* Keep the winning socket open, the other attempts lost the race */
+  priv->attempts = g_slist_remove (priv->attempts, attempt);
+  connect_attempt_free (attempt, FALSE);
+  clean_all_connect_attempts (self);
+
+  gibber_fd_transport_set_fd (GIBBER_FD_TRANSPORT (self), fd, TRUE);
+}
 
 static gboolean
-try_to_connect (GibberTCPTransport *self)
+try_to_connect (ConnectAttempt *attempt)
 {
+  GibberTCPTransport *self = attempt->self;
   GibberTCPTransportPrivate *priv = GIBBER_TCP_TRANSPORT_GET_PRIVATE (
       self);
-  gint fd;
   int ret;
 
-  g_assert (priv->channel != NULL);
-
-  fd = g_io_channel_unix_get_fd (priv->channel);
-  ret = connect (fd, priv->tmpaddr->ai_addr, priv->tmpaddr->ai_addrlen);
+  ret = connect (attempt->fd, attempt->addr->ai_addr,
+      attempt->addr->ai_addrlen);
 
   if (ret == 0)
     {
       DEBUG ("connect succeeded");
-
-      clean_all_connect_attempts (self);
-      gibber_fd_transport_set_fd (GIBBER_FD_TRANSPORT (self), fd, TRUE);
+      connect_succeeded (self, attempt);
       return FALSE;
     }
 
@@ -186,9 +231,14 @@ try_to_connect (GibberTCPTransport *self)
       return TRUE;
     }
 
-  clean_connect_attempt (self);
-  priv->tmpaddr = priv->tmpaddr->ai_next;
-  new_connect_attempt (self);
+  DEBUG ("connect failed: #%d %s", gibber_socket_errno (),
+      gibber_socket_strerror ());
+
+  priv->attempts = g_slist_remove (priv->attempts, attempt);
+  connect_attempt_free (attempt, TRUE);
+
+  /* No point in waiting for the timer, move on to the next address */
+  start_next_attempt (self);
   return FALSE;
 }
 
@@ -196,62 +246,141 @@ static gboolean
 _channel_io (GIOChannel *source,
              GIOCondition condition,
              gpointer data)
+{
+  return try_to_connect (data);
+}
+
+static gboolean
+attempt_timeout_cb (gpointer data)
 {
   GibberTCPTransport *self = GIBBER_TCP_TRANSPORT (data);
+  GibberTCPTransportPrivate *priv = GIBBER_TCP_TRANSPORT_GET_PRIVATE (
+      self);
+
+  priv->attempt_timer = 0;
+
+  DEBUG ("Not connected after %u ms, racing the next address",
+      priv->attempt_delay);
+  start_next_attempt (self);
 
-  return try_to_connect (self);
+  return FALSE;
 }
 
 static void
-new_connect_attempt (GibberTCPTransport *self)
+schedule_next_attempt (GibberTCPTransport *self)
 {
   GibberTCPTransportPrivate *priv = GIBBER_TCP_TRANSPORT_GET_PRIVATE (
       self);
-  int fd;
-  char name[NI_MAXHOST], portname[NI_MAXSERV];
 
-  if (priv->tmpaddr == NULL)
+  if (priv->attempt_timer != 0)
     {
-      /* no more candidate to try */
-      DEBUG ("connection failed");
-      goto failed;
+      g_source_remove (priv->attempt_timer);
+      priv->attempt_timer = 0;
     }
 
-  getnameinfo (priv->tmpaddr->ai_addr, priv->tmpaddr->ai_addrlen,
-      name, sizeof (name), portname, sizeof (portname),
-      NI_NUMERICHOST | NI_NUMERICSERV);
+  /* A delay of 0 means only trying the next address once the current one
+   * failed */
+  if (priv->attempt_delay == 0 ||
+      priv->next_candidate >= priv->candidates->len)
+    return;
 
-  DEBUG ("Trying %s port %s...", name, portname);
+  priv->attempt_timer = g_timeout_add (priv->attempt_delay,
+      attempt_timeout_cb, self);
+}
 
-  fd = socket (priv->tmpaddr->ai_family, priv->tmpaddr->ai_socktype,
-      priv->tmpaddr->ai_protocol);
+static void
+start_next_attempt (GibberTCPTransport *self)
+{
+  GibberTCPTransportPrivate *priv = GIBBER_TCP_TRANSPORT_GET_PRIVATE (
+      self);
 
-  if (fd < 0)
+  while (priv->next_candidate < priv->candidates->len)
     {
-      DEBUG("socket failed: #%d %s", gibber_socket_errno (),
-          gibber_socket_strerror ());
-      goto failed;
+      struct addrinfo *addr = g_ptr_array_index (priv->candidates,
+          priv->next_candidate++);
+      ConnectAttempt *attempt;
+      char name[NI_MAXHOST], portname[NI_MAXSERV];
+      int fd;
+
+      getnameinfo (addr->ai_addr, addr->ai_addrlen,
+          name, sizeof (name), portname, sizeof (portname),
+          NI_NUMERICHOST | NI_NUMERICSERV);
+
+      DEBUG ("Trying %s port %s...", name, portname);
+
+      fd = socket (addr->ai_family, addr->ai_socktype, addr->ai_protocol);
+
+      if (fd < 0)
+        {
+          DEBUG("socket failed: #%d %s", gibber_socket_errno (),
+              gibber_socket_strerror ());
+          continue;
+        }
+
+      attempt = g_slice_new0 (ConnectAttempt);
+      attempt->self = self;
+      attempt->addr = addr;
+      attempt->fd = fd;
+
+      gibber_socket_set_nonblocking (fd);
+      attempt->channel = gibber_io_channel_new_from_socket (fd);
+      g_io_channel_set_close_on_unref (attempt->channel, FALSE);
+      g_io_channel_set_encoding (attempt->channel, NULL, NULL);
+      g_io_channel_set_buffered (attempt->channel, FALSE);
+
+      attempt->watch = g_io_add_watch (attempt->channel,
+          G_IO_IN | G_IO_PRI | G_IO_OUT, _channel_io, attempt);
+
+      priv->attempts = g_slist_prepend (priv->attempts, attempt);
+      connect_stats.attempts++;
+
+      schedule_next_attempt (self);
+      try_to_connect (attempt);
+      return;
     }
 
-  gibber_socket_set_nonblocking (fd);
-  priv->channel = gibber_io_channel_new_from_socket (fd);
-  g_io_channel_set_close_on_unref (priv->channel, FALSE);
-  g_io_channel_set_encoding (priv->channel, NULL, NULL);
-  g_io_channel_set_buffered (priv->channel, FALSE);
-
-  priv->watch_in = g_io_add_watch (priv->channel, G_IO_IN | G_IO_PRI | G_IO_OUT,
-      _channel_io, self);
+  if (priv->attempts != NULL)
+    /* Out of candidates, but some attempts are still pending */
+    return;
 
-  try_to_connect (self);
-  return;
+  DEBUG ("connection failed");
+  connect_stats.failures++;
 
-failed:
   clean_all_connect_attempts (self);
 
   gibber_transport_set_state (GIBBER_TRANSPORT (self),
       GIBBER_TRANSPORT_DISCONNECTED);
 }
 
+/* Order the addresses so the families alternate, starting with the one
+ * getaddrinfo prefers (RFC 8305 section 4) */
+static GPtrArray *
+sort_candidates (struct addrinfo *ans)
+{
+  GPtrArray *candidates = g_ptr_array_new ();
+  GPtrArray *first = g_ptr_array_new ();
+  GPtrArray *other = g_ptr_array_new ();
+  struct addrinfo *a;
+  guint i;
+
+  for (a = ans; a != NULL; a = a->ai_next)
+    g_ptr_array_add (a->ai_family == ans->ai_family ? first : other, a);
+
+  for (i = 0; i < MAX (first->len, other->len); i++)
+    {
+      if (i < first->len)
+        g_ptr_array_add (candidates, g_ptr_array_index (first, i));
+
+      if (i < other->len)
+        g_ptr_array_add (candidates, g_ptr_array_index (other, i));
+    }
+
+  g_ptr_array_unref (first);
+  g_ptr_array_unref (other);
+
+  return candidates;
+}
+
 void
 gibber_tcp_transport_connect (GibberTCPTransport *tcp_transport,
     const gchar *host, const gchar *port)
@@ -271,8 +400,8 @@ gibber_tcp_transport_connect (GibberTCPTransport *tcp_transport,
   req.ai_protocol = IPPROTO_TCP;
 
   g_assert (priv->ans == NULL);
-  g_assert (priv->tmpaddr == NULL);
-  g_assert (priv->channel == NULL);
+  g_assert (priv->candidates == NULL);
+  g_assert (priv->attempts == NULL);
 
   ret = getaddrinfo (host, port, &req, &priv->ans);
   if (ret != 0)
@@ -284,7 +413,41 @@ gibber_tcp_transport_connect (GibberTCPTransport *tcp_transport,
       return;
     }
 
-  priv->tmpaddr = priv->ans;
+  priv->candidates = sort_candidates (priv->ans);
+  priv->next_candidate = 0;
+
+  start_next_attempt (tcp_transport);
+}
+
+/**
+ * gibber_tcp_transport_set_connect_attempt_delay:
+ * @tcp_transport: a #GibberTCPTransport
+ * @delay: time in milliseconds
+ *
+ * Sets how long a connection attempt may be pending before an attempt to the
+ * next address is started in parallel. A @delay of 0 tries the addresses one
+ * after the other.
+ */
+void
+gibber_tcp_transport_set_connect_attempt_delay (
+    GibberTCPTransport *tcp_transport,
+    guint delay)
+{
+  GibberTCPTransportPrivate *priv = GIBBER_TCP_TRANSPORT_GET_PRIVATE (
+      tcp_transport);
+
+  priv->attempt_delay = delay;
+}
+
+void
+gibber_tcp_transport_get_connect_stats (
+    GibberTCPTransportConnectStats *stats)
+{
+  *stats = connect_stats;
+}
 
-  new_connect_attempt (tcp_transport);
+void
+gibber_tcp_transport_reset_connect_stats (void)
+{
+  memset (&connect_stats, 0, sizeof (connect_stats));
 }
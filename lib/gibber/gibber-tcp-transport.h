@@ -29,6 +29,17 @@ G_BEGIN_DECLS
 typedef struct _GibberTCPTransport GibberTCPTransport;
 typedef struct _GibberTCPTransportClass GibberTCPTransportClass;
 
+/* Process-wide connection counters, to help tuning the attempt delay */
+typedef struct {
+  /* connections won by an IPv4 or IPv6 address */
+  guint ipv4_wins;
+  guint ipv6_wins;
+  /* connects where every address failed */
+  guint failures;
+  /* connection attempts started, including the ones that lost the race */
+  guint attempts;
+} GibberTCPTransportConnectStats;
+
 struct _GibberTCPTransportClass {
     GibberFdTransportClass parent_class;
 };
@@ -62,6 +73,13 @@ gibber_tcp_transport_new (void);
 void gibber_tcp_transport_connect (GibberTCPTransport *tcp_transport,
     const gchar *host, const gchar *port);
 
+void gibber_tcp_transport_set_connect_attempt_delay (
+    GibberTCPTransport *tcp_transport, guint delay);
+
+void gibber_tcp_transport_get_connect_stats (
+    GibberTCPTransportConnectStats *stats);
+void gibber_tcp_transport_reset_connect_stats (void);
+
 G_END_DECLS
 
 #endif /* #ifndef __GIBBER_TCP_TRANSPORT_H__*/
@@ -38,6 +38,8 @@ enum
   DISCONNECTING,
   ERROR,
   BUFFER_EMPTY,
+  CONGESTED,
+  WRITABLE,
   LAST_SIGNAL
 };
 
@@ -48,16 +50,30 @@ typedef struct _GibberTransportPrivate GibberTransportPrivate;
 
 struct _GibberTransportPrivate
 {
+  /* Once more than high_watermark bytes are queued the transport is
+   * congested until the queue drops to low_watermark bytes again */
+  gsize low_watermark;
+  gsize high_watermark;
+  gboolean congested;
+
   gboolean dispose_has_run;
 };
 
 #define GIBBER_TRANSPORT_GET_PRIVATE(o)     (G_TYPE_INSTANCE_GET_PRIVATE ((o), GIBBER_TYPE_TRANSPORT, GibberTransportPrivate))
 
+#define DEFAULT_LOW_WATERMARK (16 * 1024)
+#define DEFAULT_HIGH_WATERMARK (64 * 1024)
+
 static void
 gibber_transport_init (GibberTransport *obj)
 {
+  GibberTransportPrivate *priv = GIBBER_TRANSPORT_GET_PRIVATE (obj);
+
   obj->state = GIBBER_TRANSPORT_DISCONNECTED;
   obj->handler = NULL;
+
+  priv->low_watermark = DEFAULT_LOW_WATERMARK;
+  priv->high_watermark = DEFAULT_HIGH_WATERMARK;
 }
 
 static void gibber_transport_dispose (GObject *object);
@@ -82,6 +98,24 @@ gibber_transport_class_init (GibberTransportClass *gibber_transport_class)
                   g_cclosure_marshal_VOID__VOID,
                   G_TYPE_NONE, 0);
 
+  signals[CONGESTED] =
+    g_signal_new ("congested",
+                  G_OBJECT_CLASS_TYPE (gibber_transport_class),
+                  G_SIGNAL_RUN_LAST | G_SIGNAL_DETAILED,
+                  0,
+                  NULL, NULL,
+                  g_cclosure_marshal_VOID__VOID,
+                  G_TYPE_NONE, 0);
+
+  signals[WRITABLE] =
+    g_signal_new ("writable",
+                  G_OBJECT_CLASS_TYPE (gibber_transport_class),
+                  G_SIGNAL_RUN_LAST | G_SIGNAL_DETAILED,
+                  0,
+                  NULL, NULL,
+                  g_cclosure_marshal_VOID__VOID,
+                  G_TYPE_NONE, 0);
+
   signals[CONNECTED] =
     g_signal_new ("connected",
                   G_OBJECT_CLASS_TYPE (gibber_transport_class),
@@ -215,15 +249,78 @@ gibber_transport_emit_error (GibberTransport *transport, GError *error)
       error->domain, error->code, error->message);
 }
 
+/* To be called by subclasses when their queue shrunk without emptying
+ * completely. Emits congested or writable when crossing a watermark */
+void
+gibber_transport_check_watermarks (GibberTransport *transport)
+{
+  GibberTransportPrivate *priv = GIBBER_TRANSPORT_GET_PRIVATE (transport);
+  gsize queued = gibber_transport_get_queued_bytes (transport);
+
+  if (!priv->congested && queued > priv->high_watermark)
+    {
+      DEBUG ("%" G_GSIZE_FORMAT " bytes queued, transport is congested",
+          queued);
+      priv->congested = TRUE;
+      g_signal_emit (transport, signals[CONGESTED], 0);
+    }
+  else if (priv->congested && queued <= priv->low_watermark)
+    {
+      DEBUG ("%" G_GSIZE_FORMAT " bytes queued, transport is writable",
+          queued);
+      priv->congested = FALSE;
+      g_signal_emit (transport, signals[WRITABLE], 0);
+    }
+}
+
 gboolean
 gibber_transport_send (GibberTransport *transport, const guint8 *data,
   gsize size, GError **error)
 {
   GibberTransportClass *cls = GIBBER_TRANSPORT_GET_CLASS (transport);
+  gboolean ret;
+
+  g_assert (transport->state == GIBBER_TRANSPORT_CONNECTED);
+
+  ret = cls->send (transport, data, size, error);
+  gibber_transport_check_watermarks (transport);
+
+  return ret;
+}
+
+gboolean
+gibber_transport_sendv (GibberTransport *transport,
+    const GibberBuffer *buffers, guint n_buffers, GError **error)
+{
+  GibberTransportClass *cls = GIBBER_TRANSPORT_GET_CLASS (transport);
+  GByteArray *arr;
+  gboolean ret;
+  guint i;
 
   g_assert (transport->state == GIBBER_TRANSPORT_CONNECTED);
 
-  return cls->send (transport, data, size, error);
+  if (cls->sendv != NULL)
+    {
+      ret = cls->sendv (transport, buffers, n_buffers, error);
+    }
+  else if (n_buffers == 1)
+    {
+      ret = cls->send (transport, buffers[0].data, buffers[0].length, error);
+    }
+  else
+    {
+      /* No native support, fall back to concatenating the buffers */
+      arr = g_byte_array_new ();
+      for (i = 0; i < n_buffers; i++)
+        g_byte_array_append (arr, buffers[i].data, buffers[i].length);
+
+      ret = cls->send (transport, arr->data, arr->len, error);
+      g_byte_array_unref (arr);
+    }
+
+  gibber_transport_check_watermarks (transport);
+
+  return ret;
 }
 
 void
@@ -279,9 +376,55 @@ gibber_transport_buffer_is_empty (GibberTransport *transport)
 void
 gibber_transport_emit_buffer_empty (GibberTransport *transport)
 {
+  gibber_transport_check_watermarks (transport);
   g_signal_emit (transport, signals[BUFFER_EMPTY], 0);
 }
 
+gsize
+gibber_transport_get_queued_bytes (GibberTransport *transport)
+{
+  GibberTransportClass *cls = GIBBER_TRANSPORT_GET_CLASS (transport);
+
+  if (cls->get_queued_bytes != NULL)
+    return cls->get_queued_bytes (transport);
+
+  if (cls->buffer_is_empty == NULL || cls->buffer_is_empty (transport))
+    return 0;
+
+  return G_MAXSIZE;
+}
+
+/**
+ * gibber_transport_set_watermarks:
+ * @transport: a #GibberTransport
+ * @low: the number of queued bytes at which the transport becomes writable
+ * @high: the number of queued bytes above which the transport is congested
+ *
+ * Users should keep sending until the transport emits congested, and resume
+ * once it emits writable. Defaults to 16 KiB and 64 KiB.
+ */
+void
+gibber_transport_set_watermarks (GibberTransport *transport,
+    gsize low,
+    gsize high)
+{
+  GibberTransportPrivate *priv = GIBBER_TRANSPORT_GET_PRIVATE (transport);
+
+  g_return_if_fail (low <= high);
+
+  priv->low_watermark = low;
+  priv->high_watermark = high;
+  gibber_transport_check_watermarks (transport);
+}
+
+gboolean
+gibber_transport_is_congested (GibberTransport *transport)
+{
+  GibberTransportPrivate *priv = GIBBER_TRANSPORT_GET_PRIVATE (transport);
+
+  return priv->congested;
+}
+
 void
 gibber_transport_block_receiving (GibberTransport *transport,
                                   gboolean block)
@@ -51,12 +51,19 @@ struct _GibberTransportClass {
     GObjectClass parent_class;
     gboolean (*send) (GibberTransport *transport,
                           const guint8 *data, gsize length, GError **error);
+    /* Optional, send several buffers as if they were concatenated. When not
+     * implemented the buffers are concatenated and passed to send */
+    gboolean (*sendv) (GibberTransport *transport,
+        const GibberBuffer *buffers, guint n_buffers, GError **error);
     void (*disconnect) (GibberTransport *transport);
     gboolean (*get_peeraddr) (GibberTransport *transport,
         struct sockaddr_storage *addr, socklen_t *len);
     gboolean (*get_sockaddr) (GibberTransport *transport,
         struct sockaddr_storage *addr, socklen_t *len);
     gboolean (*buffer_is_empty) (GibberTransport *transport);
+    /* Optional, number of bytes queued for sending. When not implemented a
+     * non-empty buffer counts as being above the high watermark */
+    gsize (*get_queued_bytes) (GibberTransport *transport);
     void (*block_receiving) (GibberTransport *transport, gboolean block);
 };
 
@@ -101,12 +108,17 @@ void gibber_transport_set_state (GibberTransport *transport,
 
 void gibber_transport_emit_error (GibberTransport *transport, GError *error);
 
+void gibber_transport_check_watermarks (GibberTransport *transport);
+
 /* Public api */
 GibberTransportState gibber_transport_get_state (GibberTransport *transport);
 
 gboolean gibber_transport_send (GibberTransport *transport, const guint8 *data,
     gsize size, GError **error);
 
+gboolean gibber_transport_sendv (GibberTransport *transport,
+    const GibberBuffer *buffers, guint n_buffers, GError **error);
+
 void gibber_transport_disconnect (GibberTransport *transport);
 
 void gibber_transport_set_handler (GibberTransport *transport,
@@ -123,6 +135,13 @@ gboolean gibber_transport_buffer_is_empty (GibberTransport *transport);
 
 void gibber_transport_emit_buffer_empty (GibberTransport *transport);
 
+gsize gibber_transport_get_queued_bytes (GibberTransport *transport);
+
+void gibber_transport_set_watermarks (GibberTransport *transport,
+    gsize low, gsize high);
+
+gboolean gibber_transport_is_congested (GibberTransport *transport);
+
 void gibber_transport_block_receiving (GibberTransport *transport,
     gboolean block);
 
@@ -70,6 +70,9 @@ struct _GibberUnixTransportPrivate
   GibberUnixTransportRecvCredentialsCb recv_creds_cb;
   gpointer recv_creds_data;
 
+  GibberUnixTransportRecvFdCb recv_fd_cb;
+  gpointer recv_fd_data;
+
   gboolean dispose_has_run;
 };
 
@@ -123,6 +126,8 @@ gibber_unix_transport_dispose (GObject *object)
 
   priv->recv_creds_cb = NULL;
   priv->recv_creds_data = NULL;
+  priv->recv_fd_cb = NULL;
+  priv->recv_fd_data = NULL;
 
   if (G_OBJECT_CLASS (gibber_unix_transport_parent_class)->dispose)
     G_OBJECT_CLASS (gibber_unix_transport_parent_class)->dispose (object);
@@ -202,6 +207,8 @@ gibber_unix_transport_new_from_fd (int fd)
   return transport;
 }
 
+#define BUFSIZE 1024
+
 /* Patches that reimplement these functions for non-Linux would be welcome
  * (please file a bug) */
 
@@ -261,14 +268,10 @@ gibber_unix_transport_send_credentials (GibberUnixTransport *transport,
   return TRUE;
 }
 
-#define BUFSIZE 1024
-
 static GibberFdIOResult
-gibber_unix_transport_read (GibberFdTransport *transport,
-    GIOChannel *channel,
+read_credentials (GibberUnixTransport *self,
     GError **error)
 {
-  GibberUnixTransport *self = GIBBER_UNIX_TRANSPORT (transport);
   GibberUnixTransportPrivate *priv = GIBBER_UNIX_TRANSPORT_GET_PRIVATE (self);
   int fd;
   guint8 buffer[BUFSIZE];
@@ -281,11 +284,8 @@ gibber_unix_transport_read (GibberFdTransport *transport,
   struct ucred *cred;
   int opt;
 
-  if (priv->recv_creds_cb == NULL)
-    return gibber_fd_transport_read (transport, channel, error);
-
   /* We are waiting for credentials */
-  fd = transport->fd;
+  fd = GIBBER_FD_TRANSPORT (self)->fd;
 
   /* set SO_PASSCRED flag */
   opt = 1;
@@ -403,14 +403,208 @@ gibber_unix_transport_send_credentials (GibberUnixTransport *transport,
   return FALSE;
 }
 
+#endif /* OSs where we have no implementation of credentials */
+
+gboolean
+gibber_unix_transport_send_fd (GibberUnixTransport *transport,
+    int fd_to_send,
+    const guint8 *data,
+    gsize size)
+{
+  int fd, ret;
+  struct msghdr msg;
+  struct cmsghdr *ch;
+  struct iovec iov;
+  char buffer[CMSG_SPACE (sizeof (int))];
+
+  /* At least one byte of payload is needed to carry ancillary data */
+  g_return_val_if_fail (size > 0, FALSE);
+
+  /* Whatever is queued was sent before, it has to reach the peer before the
+   * payload carrying the fd */
+  if (!gibber_fd_transport_flush (GIBBER_FD_TRANSPORT (transport)))
+    {
+      DEBUG ("output still queued, can't send fd %d yet", fd_to_send);
+      return FALSE;
+    }
+
+  DEBUG ("send fd %d", fd_to_send);
+  fd = GIBBER_FD_TRANSPORT (transport)->fd;
+
+  memset (&iov, 0, sizeof (iov));
+  iov.iov_base = (void *) data;
+  iov.iov_len = size;
+
+  memset (&msg, 0, sizeof (msg));
+  msg.msg_iov = &iov;
+  msg.msg_iovlen = 1;
+  msg.msg_control = buffer;
+  msg.msg_controllen = sizeof (buffer);
+  memset (buffer, 0, sizeof (buffer));
+
+  ch = CMSG_FIRSTHDR (&msg);
+  ch->cmsg_len = CMSG_LEN (sizeof (int));
+  ch->cmsg_level = SOL_SOCKET;
+  ch->cmsg_type = SCM_RIGHTS;
+  memcpy (CMSG_DATA (ch), &fd_to_send, sizeof (int));
+
+  do
+    ret = sendmsg (fd, &msg, 0);
+  while (ret == -1 && errno == EINTR);
+
+  if (ret == -1)
+    {
+      /* Nothing went out on EAGAIN either, the caller can try again once
+       * the socket is writable */
+      DEBUG ("sendmsg failed: %s", g_strerror (errno));
+      return FALSE;
+    }
+
+  /* The fd went along with the first byte, the rest is plain data */
+  if ((gsize) ret < size)
+    return gibber_transport_send (GIBBER_TRANSPORT (transport), data + ret,
+        size - ret, NULL);
+
+  return TRUE;
+}
+
+static GibberFdIOResult
+read_fd (GibberUnixTransport *self,
+    GError **error)
+{
+  GibberUnixTransportPrivate *priv = GIBBER_UNIX_TRANSPORT_GET_PRIVATE (self);
+  GibberUnixTransportRecvFdCb callback = priv->recv_fd_cb;
+  gpointer user_data = priv->recv_fd_data;
+  guint8 buffer[BUFSIZE];
+  ssize_t bytes_read;
+  GibberBuffer buf;
+  struct iovec iov;
+  struct msghdr msg;
+  char control[CMSG_SPACE (sizeof (int))];
+  struct cmsghdr *ch;
+  int flags = 0;
+  int received = -1;
+
+#ifdef MSG_CMSG_CLOEXEC
+  flags |= MSG_CMSG_CLOEXEC;
+#endif
+
+  memset (&iov, 0, sizeof (iov));
+  iov.iov_base = buffer;
+  iov.iov_len = sizeof (buffer);
+
+  memset (&msg, 0, sizeof (msg));
+  msg.msg_iov = &iov;
+  msg.msg_iovlen = 1;
+  msg.msg_control = control;
+  msg.msg_controllen = sizeof (control);
+
+  bytes_read = recvmsg (GIBBER_FD_TRANSPORT (self)->fd, &msg, flags);
+
+  if (bytes_read == -1 && (errno == EAGAIN || errno == EINTR))
+    return GIBBER_FD_IO_RESULT_AGAIN;
+
+  /* The callback may want to wait for another fd */
+  priv->recv_fd_cb = NULL;
+  priv->recv_fd_data = NULL;
+
+  /* Nobody is handling the data following the fd yet, leave it in the
+   * socket until the callback has set things up and unblocks receiving */
+  gibber_transport_block_receiving (GIBBER_TRANSPORT (self), TRUE);
+
+  if (bytes_read == -1)
+    {
+      GError *err = NULL;
+
+      g_set_error_literal (&err, G_IO_CHANNEL_ERROR,
+          g_io_channel_error_from_errno (errno), "recvmsg failed");
+
+      callback (self, NULL, -1, err, user_data);
+      g_propagate_error (error, err);
+      return GIBBER_FD_IO_RESULT_ERROR;
+    }
+
+  for (ch = CMSG_FIRSTHDR (&msg); ch != NULL; ch = CMSG_NXTHDR (&msg, ch))
+    {
+      int *fds;
+      guint i, n;
+
+      if (ch->cmsg_level != SOL_SOCKET || ch->cmsg_type != SCM_RIGHTS)
+        continue;
+
+      fds = (int *) CMSG_DATA (ch);
+      n = (ch->cmsg_len - CMSG_LEN (0)) / sizeof (int);
+
+      /* Only one fd is expected, don't leak any extra ones */
+      for (i = 0; i < n; i++)
+        {
+          if (received == -1)
+            received = fds[i];
+          else
+            close (fds[i]);
+        }
+    }
+
+  buf.data = buffer;
+  buf.length = bytes_read;
+
+  if (received == -1)
+    {
+      GError *err = NULL;
+
+      DEBUG ("Message doesn't contain a file descriptor");
+
+      g_set_error_literal (&err, GIBBER_UNIX_TRANSPORT_ERROR,
+          GIBBER_UNIX_TRANSPORT_ERROR_NO_FD, "no file descriptor received");
+
+      callback (self, &buf, -1, err, user_data);
+      g_error_free (err);
+    }
+  else
+    {
+      DEBUG ("received fd %d", received);
+      callback (self, &buf, received, NULL, user_data);
+    }
+
+  return bytes_read == 0 ? GIBBER_FD_IO_RESULT_EOF :
+      GIBBER_FD_IO_RESULT_SUCCESS;
+}
+
+gboolean
+gibber_unix_transport_recv_fd (GibberUnixTransport *self,
+    GibberUnixTransportRecvFdCb callback,
+    gpointer user_data)
+{
+  GibberUnixTransportPrivate *priv = GIBBER_UNIX_TRANSPORT_GET_PRIVATE (self);
+
+  if (priv->recv_fd_cb != NULL)
+    {
+      DEBUG ("already waiting for a file descriptor");
+      return FALSE;
+    }
+
+  priv->recv_fd_cb = callback;
+  priv->recv_fd_data = user_data;
+  return TRUE;
+}
+
 static GibberFdIOResult
 gibber_unix_transport_read (GibberFdTransport *transport,
     GIOChannel *channel,
     GError **error)
 {
+  GibberUnixTransport *self = GIBBER_UNIX_TRANSPORT (transport);
+  GibberUnixTransportPrivate *priv = GIBBER_UNIX_TRANSPORT_GET_PRIVATE (self);
+
+  if (priv->recv_fd_cb != NULL)
+    return read_fd (self, error);
+
+#if defined(__linux__)
+  if (priv->recv_creds_cb != NULL)
+    return read_credentials (self, error);
+#endif
+
   return gibber_fd_transport_read (transport, channel, error);
 }
 
-#endif /* OSs where we have no implementation of credentials */
-
 #endif /* G_OS_UNIX */
@@ -48,6 +48,7 @@ typedef enum
   GIBBER_UNIX_TRANSPORT_ERROR_CONNECT_FAILED,
   GIBBER_UNIX_TRANSPORT_ERROR_FAILED,
   GIBBER_UNIX_TRANSPORT_ERROR_NO_CREDENTIALS,
+  GIBBER_UNIX_TRANSPORT_ERROR_NO_FD,
 } GibberUnixTransportError;
 
 typedef struct _GibberUnixTransport GibberUnixTransport;
@@ -110,6 +111,25 @@ gboolean gibber_unix_transport_recv_credentials (GibberUnixTransport *transport,
     GibberUnixTransportRecvCredentialsCb callback,
     gpointer user_data);
 
+/* Fails without sending anything if earlier output can't be written out
+ * right away; try again on ::buffer-empty */
+gboolean gibber_unix_transport_send_fd (GibberUnixTransport *transport,
+    int fd, const guint8 *data, gsize size);
+
+/* fd is -1 if error is set, otherwise the callback owns it. Receiving is
+ * blocked when the callback is called, unblock it once the data following
+ * the fd has somewhere to go */
+typedef void (*GibberUnixTransportRecvFdCb) (
+    GibberUnixTransport *transport,
+    GibberBuffer *buffer,
+    int fd,
+    GError *error,
+    gpointer user_data);
+
+gboolean gibber_unix_transport_recv_fd (GibberUnixTransport *transport,
+    GibberUnixTransportRecvFdCb callback,
+    gpointer user_data);
+
 G_END_DECLS
 
 #endif /* G_OS_UNIX */
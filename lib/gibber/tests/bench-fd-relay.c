@@ -0,0 +1,240 @@
+/*
+ * bench-fd-relay - compare relaying a stream through userspace with
+ * GibberFdRelay, the way SalutTubeStream forwards tube connections
+ *
+ * Usage: bench-fd-relay [MiB]
+ */
+
+#include "config.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/resource.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <sys/wait.h>
+
+#include <glib.h>
+
+#include <gibber/gibber-fd-relay.h>
+#include <gibber/gibber-unix-transport.h>
+
+#define CHUNK (64 * 1024)
+
+typedef struct {
+  GMainLoop *loop;
+  GibberTransport *in;
+  GibberTransport *out;
+  gboolean in_done;
+} Relay;
+
+static void
+copy_handler (GibberTransport *transport,
+    GibberBuffer *buffer,
+    gpointer user_data)
+{
+  Relay *relay = user_data;
+
+  gibber_transport_send (relay->out, buffer->data, buffer->length, NULL);
+}
+
+static void
+out_congested_cb (GibberTransport *transport,
+    Relay *relay)
+{
+  gibber_transport_block_receiving (relay->in, TRUE);
+}
+
+static void
+out_writable_cb (GibberTransport *transport,
+    Relay *relay)
+{
+  if (!relay->in_done)
+    gibber_transport_block_receiving (relay->in, FALSE);
+}
+
+static void
+check_done (Relay *relay)
+{
+  if (relay->in_done && gibber_transport_buffer_is_empty (relay->out))
+    g_main_loop_quit (relay->loop);
+}
+
+static void
+in_disconnected_cb (GibberTransport *transport,
+    Relay *relay)
+{
+  relay->in_done = TRUE;
+  check_done (relay);
+}
+
+static void
+out_buffer_empty_cb (GibberTransport *transport,
+    Relay *relay)
+{
+  check_done (relay);
+}
+
+static pid_t
+spawn_writer (int fd,
+    gsize total)
+{
+  pid_t pid = fork ();
+  guint8 *buf;
+  gsize left = total;
+
+  g_assert (pid >= 0);
+  if (pid > 0)
+    return pid;
+
+  buf = g_malloc (CHUNK);
+  memset (buf, 'x', CHUNK);
+
+  while (left > 0)
+    {
+      ssize_t n = write (fd, buf, MIN (left, CHUNK));
+
+      if (n <= 0)
+        _exit (1);
+
+      left -= n;
+    }
+
+  _exit (0);
+}
+
+static pid_t
+spawn_reader (int fd,
+    gsize total)
+{
+  pid_t pid = fork ();
+  guint8 *buf;
+  gsize got = 0;
+  ssize_t n;
+
+  g_assert (pid >= 0);
+  if (pid > 0)
+    return pid;
+
+  buf = g_malloc (CHUNK);
+
+  while ((n = read (fd, buf, CHUNK)) > 0)
+    got += n;
+
+  _exit (got == total ? 0 : 1);
+}
+
+static gdouble
+tv_secs (const struct timeval *tv)
+{
+  return tv->tv_sec + tv->tv_usec / 1e6;
+}
+
+static void
+run (gboolean use_relay,
+    gsize total)
+{
+  int in_pair[2], out_pair[2];
+  pid_t writer, reader;
+  Relay relay;
+  GibberFdRelay *fd_relay = NULL;
+  struct rusage before, after;
+  GTimer *timer;
+  gdouble secs, cpu;
+  int status;
+
+  g_assert (socketpair (AF_UNIX, SOCK_STREAM, 0, in_pair) == 0);
+  g_assert (socketpair (AF_UNIX, SOCK_STREAM, 0, out_pair) == 0);
+
+  writer = spawn_writer (in_pair[0], total);
+  close (in_pair[0]);
+  reader = spawn_reader (out_pair[0], total);
+  close (out_pair[0]);
+
+  relay.loop = g_main_loop_new (NULL, FALSE);
+  relay.in = GIBBER_TRANSPORT (gibber_unix_transport_new_from_fd (
+      in_pair[1]));
+  relay.out = GIBBER_TRANSPORT (gibber_unix_transport_new_from_fd (
+      out_pair[1]));
+  relay.in_done = FALSE;
+
+  g_signal_connect (relay.in, "disconnected",
+      G_CALLBACK (in_disconnected_cb), &relay);
+  g_signal_connect (relay.out, "buffer-empty",
+      G_CALLBACK (out_buffer_empty_cb), &relay);
+
+  /* Same setup as SalutTubeStream uses when copying */
+  gibber_fd_transport_set_read_mode (GIBBER_FD_TRANSPORT (relay.in),
+      GIBBER_FD_TRANSPORT_READ_MODE_BATCHED);
+  gibber_transport_set_handler (relay.in, copy_handler, &relay);
+  g_signal_connect (relay.out, "congested",
+      G_CALLBACK (out_congested_cb), &relay);
+  g_signal_connect (relay.out, "writable",
+      G_CALLBACK (out_writable_cb), &relay);
+
+  if (use_relay)
+    {
+      GError *error = NULL;
+
+      fd_relay = gibber_fd_relay_new (GIBBER_FD_TRANSPORT (relay.in),
+          GIBBER_FD_TRANSPORT (relay.out));
+      if (!gibber_fd_relay_start (fd_relay, &error))
+        g_error ("Failed to start the relay: %s", error->message);
+    }
+
+  getrusage (RUSAGE_SELF, &before);
+  timer = g_timer_new ();
+
+  g_main_loop_run (relay.loop);
+
+  secs = g_timer_elapsed (timer, NULL);
+  getrusage (RUSAGE_SELF, &after);
+
+  cpu = tv_secs (&after.ru_utime) - tv_secs (&before.ru_utime) +
+      tv_secs (&after.ru_stime) - tv_secs (&before.ru_stime);
+
+  if (fd_relay != NULL)
+    g_object_unref (fd_relay);
+  g_object_unref (relay.in);
+  /* closes the socket, so the reader sees EOF */
+  g_object_unref (relay.out);
+
+  g_assert (waitpid (writer, &status, 0) == writer);
+  g_assert (WIFEXITED (status) && WEXITSTATUS (status) == 0);
+  g_assert (waitpid (reader, &status, 0) == reader);
+  if (!WIFEXITED (status) || WEXITSTATUS (status) != 0)
+    g_error ("Reader didn't get all the data");
+
+  printf ("%-6s %" G_GSIZE_FORMAT " MiB in %.2f s: %.1f MiB/s, "
+      "%.2f s CPU (%.0f%%)\n", use_relay ? "splice" : "copy",
+      total / (1024 * 1024), secs, total / (1024 * 1024) / secs, cpu,
+      100 * cpu / secs);
+
+  g_timer_destroy (timer);
+  g_main_loop_unref (relay.loop);
+}
+
+int
+main (int argc,
+    char **argv)
+{
+  gsize total = 512;
+
+  g_type_init ();
+
+  if (argc > 1)
+    total = atoi (argv[1]);
+
+  total *= 1024 * 1024;
+
+  run (FALSE, total);
+
+  if (gibber_fd_relay_is_supported ())
+    run (TRUE, total);
+  else
+    printf ("splice not supported on this platform\n");
+
+  return 0;
+}
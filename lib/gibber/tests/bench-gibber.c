@@ -0,0 +1,437 @@
+/*
+ * bench-gibber - repeatable benchmarks of the r-multicast hot paths
+ *
+ * Every benchmark is run RUNS times with a fixed amount of work. The output
+ * is one tab separated line per benchmark, after a header line:
+ *
+ *   benchmark  parameter  iterations  bytes  best_ns  median_ns
+ *
+ * where best_ns and median_ns are the time per iteration over the runs and
+ * bytes is the payload handled per iteration, 0 if that doesn't apply.
+ * Timeouts run on the virtual clock, so nothing depends on timing other than
+ * the measurements themselves.
+ *
+ * Usage: bench-gibber [benchmark name prefix]
+ */
+
+#include "config.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <glib.h>
+
+#include <gibber/gibber-r-multicast-causal-transport.h>
+#include <gibber/gibber-r-multicast-clock.h>
+#include <gibber/gibber-r-multicast-packet.h>
+#include <gibber/gibber-r-multicast-sender.h>
+#include "test-transport.h"
+
+#define RUNS 5
+
+#define MAX_PACKET_SIZE 65536
+#define DATAGRAM_SIZE 1500
+#define SENDER 0x1234
+#define FIRST_PACKET 1000
+
+/* Packets pushed per run of the sender benchmarks */
+#define NR_PACKETS 10000
+#define MESSAGE_SIZE 100
+#define FRAGMENT_SIZE 1000
+
+/* Payload sent per run of the causal transport benchmark */
+#define SEND_BYTES (4 * 1024 * 1024)
+
+typedef void (*BenchFunc) (gpointer data, guint iterations);
+
+static const gchar *filter = NULL;
+static guint8 payload[1024 * 1024];
+
+static gint
+compare_doubles (gconstpointer a,
+    gconstpointer b)
+{
+  gdouble da = *(const gdouble *) a;
+  gdouble db = *(const gdouble *) b;
+
+  return da < db ? -1 : (da > db ? 1 : 0);
+}
+
+static void
+measure (const gchar *name,
+    const gchar *parameter,
+    guint iterations,
+    gsize bytes,
+    BenchFunc func,
+    gpointer data)
+{
+  gdouble ns[RUNS];
+  GTimer *timer;
+  guint i;
+
+  if (filter != NULL && !g_str_has_prefix (name, filter))
+    return;
+
+  timer = g_timer_new ();
+
+  for (i = 0; i < RUNS; i++)
+    {
+      g_timer_start (timer);
+      func (data, iterations);
+      ns[i] = g_timer_elapsed (timer, NULL) * 1e9 / iterations;
+    }
+
+  g_timer_destroy (timer);
+
+  qsort (ns, RUNS, sizeof (gdouble), compare_doubles);
+
+  printf ("%s\t%s\t%u\t%" G_GSIZE_FORMAT "\t%.0f\t%.0f\n", name, parameter,
+      iterations, bytes, ns[0], ns[RUNS / 2]);
+  fflush (stdout);
+}
+
+/* Packet building and parsing */
+
+static GibberRMulticastPacket *
+build_packet (guint32 packet_id,
+    guint depends)
+{
+  GibberRMulticastPacket *p;
+  guint i;
+
+  p = gibber_r_multicast_packet_new (PACKET_TYPE_DATA, SENDER,
+      MAX_PACKET_SIZE);
+  gibber_r_multicast_packet_set_packet_id (p, packet_id);
+  gibber_r_multicast_packet_set_data_info (p, 0,
+      GIBBER_R_MULTICAST_DATA_PACKET_START | GIBBER_R_MULTICAST_DATA_PACKET_END,
+      MESSAGE_SIZE);
+
+  for (i = 0; i < depends; i++)
+    gibber_r_multicast_packet_add_sender_info (p, 0x100 + i,
+        packet_id + i, NULL);
+
+  gibber_r_multicast_packet_add_payload (p, payload, MESSAGE_SIZE);
+
+  return p;
+}
+
+static void
+bench_packet_build (gpointer data,
+    guint iterations)
+{
+  guint depends = GPOINTER_TO_UINT (data);
+  guint i;
+
+  for (i = 0; i < iterations; i++)
+    {
+      GibberRMulticastPacket *p = build_packet (i, depends);
+      gsize size;
+
+      gibber_r_multicast_packet_get_raw_data (p, &size);
+      gibber_r_multicast_packet_unref (p);
+    }
+}
+
+static void
+bench_packet_parse (gpointer data,
+    guint iterations)
+{
+  GibberRMulticastPacket *p = data;
+  guint8 *raw;
+  gsize size;
+  guint i;
+
+  raw = gibber_r_multicast_packet_get_raw_data (p, &size);
+
+  for (i = 0; i < iterations; i++)
+    {
+      GibberRMulticastPacket *parsed;
+
+      parsed = gibber_r_multicast_packet_parse (raw, size, NULL);
+      g_assert (parsed != NULL);
+      gibber_r_multicast_packet_unref (parsed);
+    }
+}
+
+static void
+packet_benchmarks (void)
+{
+  guint depends[] = { 0, 8, 64, 256 };
+  guint i;
+
+  for (i = 0; i < G_N_ELEMENTS (depends); i++)
+    {
+      GibberRMulticastPacket *p;
+      gchar *parameter = g_strdup_printf ("depends=%u", depends[i]);
+
+      measure ("packet-build", parameter, 200000, MESSAGE_SIZE,
+          bench_packet_build, GUINT_TO_POINTER (depends[i]));
+
+      p = build_packet (FIRST_PACKET, depends[i]);
+      measure ("packet-parse", parameter, 200000, MESSAGE_SIZE,
+          bench_packet_parse, p);
+      gibber_r_multicast_packet_unref (p);
+
+      g_free (parameter);
+    }
+}
+
+/* Sender input and reassembly */
+
+typedef enum {
+  ORDER_IN_ORDER,
+  ORDER_REORDERED,
+  ORDER_LOSSY,
+} PushOrder;
+
+typedef struct {
+  GPtrArray *packets;
+  PushOrder order;
+  guint received;
+} PushData;
+
+static void
+received_data_cb (GibberRMulticastSender *sender,
+    guint16 stream_id,
+    GBytes *data,
+    gpointer user_data)
+{
+  PushData *d = user_data;
+
+  d->received++;
+}
+
+/* Split messages of @fragments packets of FRAGMENT_SIZE each, or single
+ * packet messages of MESSAGE_SIZE */
+static GPtrArray *
+build_messages (guint fragments)
+{
+  GPtrArray *packets = g_ptr_array_new_with_free_func (
+      (GDestroyNotify) gibber_r_multicast_packet_unref);
+  guint32 id = FIRST_PACKET;
+  gsize size = fragments == 1 ? MESSAGE_SIZE : FRAGMENT_SIZE;
+  guint m, f;
+
+  for (m = 0; m < NR_PACKETS / fragments; m++)
+    {
+      for (f = 0; f < fragments; f++)
+        {
+          GibberRMulticastPacket *p;
+          guint8 flags = 0;
+
+          if (f == 0)
+            flags |= GIBBER_R_MULTICAST_DATA_PACKET_START;
+          if (f == fragments - 1)
+            flags |= GIBBER_R_MULTICAST_DATA_PACKET_END;
+
+          p = gibber_r_multicast_packet_new (PACKET_TYPE_DATA, SENDER,
+              DATAGRAM_SIZE);
+          gibber_r_multicast_packet_set_packet_id (p, id++);
+          gibber_r_multicast_packet_set_data_info (p, 0, flags,
+              fragments * size);
+          gibber_r_multicast_packet_add_payload (p, payload, size);
+          g_ptr_array_add (packets, p);
+        }
+    }
+
+  return packets;
+}
+
+static void
+push (GibberRMulticastSender *sender,
+    GPtrArray *packets,
+    guint i)
+{
+  gibber_r_multicast_sender_push (sender, g_ptr_array_index (packets, i));
+}
+
+/* Pushes all packets into a new sender, @iterations being the number of
+ * messages they make up */
+static void
+bench_sender_push (gpointer data,
+    guint iterations)
+{
+  PushData *d = data;
+  GibberRMulticastSenderGroup *group;
+  GibberRMulticastSender *sender;
+  guint len = d->packets->len;
+  guint i;
+
+  group = gibber_r_multicast_sender_group_new ();
+  sender = gibber_r_multicast_sender_new (SENDER, "sender", group);
+  gibber_r_multicast_sender_update_start (sender, FIRST_PACKET);
+  gibber_r_multicast_sender_set_data_start (sender, FIRST_PACKET);
+  gibber_r_multicast_sender_group_add (group, sender);
+  g_signal_connect (sender, "received-data", G_CALLBACK (received_data_cb),
+      d);
+
+  d->received = 0;
+
+  for (i = 0; i < len; i++)
+    {
+      switch (d->order)
+        {
+          case ORDER_IN_ORDER:
+            push (sender, d->packets, i);
+            break;
+          case ORDER_REORDERED:
+            /* Swap every pair */
+            if (i % 2 == 0 && i + 1 < len)
+              push (sender, d->packets, i + 1);
+            else if (i % 2 == 1)
+              push (sender, d->packets, i - 1);
+            else
+              push (sender, d->packets, i);
+            break;
+          case ORDER_LOSSY:
+            /* Lose one in ten packets, repaired at the end of its ten */
+            if (i % 10 != 3)
+              push (sender, d->packets, i);
+            if ((i % 10 == 9 || i == len - 1) && i % 10 >= 3)
+              push (sender, d->packets, i - i % 10 + 3);
+            break;
+        }
+    }
+
+  g_assert_cmpuint (d->received, ==, iterations);
+
+  gibber_r_multicast_sender_group_free (group);
+}
+
+static void
+sender_benchmarks (void)
+{
+  const gchar *orders[] = { "in-order", "reordered", "lossy" };
+  guint fragments[] = { 1, 10, 100 };
+  PushData d;
+  guint i;
+
+  d.packets = build_messages (1);
+
+  for (i = 0; i < G_N_ELEMENTS (orders); i++)
+    {
+      d.order = i;
+      measure ("sender-push", orders[i], NR_PACKETS, MESSAGE_SIZE,
+          bench_sender_push, &d);
+    }
+
+  g_ptr_array_unref (d.packets);
+
+  d.order = ORDER_IN_ORDER;
+
+  for (i = 0; i < G_N_ELEMENTS (fragments); i++)
+    {
+      gchar *parameter = g_strdup_printf ("fragments=%u", fragments[i]);
+
+      d.packets = build_messages (fragments[i]);
+      measure ("sender-reassemble", parameter, NR_PACKETS / fragments[i],
+          fragments[i] * FRAGMENT_SIZE, bench_sender_push, &d);
+
+      g_ptr_array_unref (d.packets);
+      g_free (parameter);
+    }
+}
+
+/* Causal transport sending */
+
+typedef struct {
+  GibberRMulticastCausalTransport *rmc;
+  gsize size;
+} SendData;
+
+static gboolean
+send_hook (GibberTransport *transport,
+    const guint8 *data,
+    gsize length,
+    GError **error,
+    gpointer user_data)
+{
+  return TRUE;
+}
+
+static void
+drain_main_context (void)
+{
+  /* test transports send from idle callbacks */
+  while (g_main_context_iteration (NULL, FALSE))
+    ;
+}
+
+static void
+bench_causal_send (gpointer data,
+    guint iterations)
+{
+  SendData *d = data;
+  guint i;
+
+  for (i = 0; i < iterations; i++)
+    {
+      g_assert (gibber_r_multicast_causal_transport_send (d->rmc, 0,
+          payload, d->size, NULL));
+      drain_main_context ();
+    }
+}
+
+static void
+causal_benchmarks (void)
+{
+  gsize sizes[] = { 1024, 16 * 1024, 128 * 1024, 1024 * 1024 };
+  TestTransport *t;
+  SendData d;
+  guint i;
+
+  t = test_transport_new (send_hook, NULL);
+  GIBBER_TRANSPORT (t)->max_packet_size = DATAGRAM_SIZE;
+
+  d.rmc = gibber_r_multicast_causal_transport_new (GIBBER_TRANSPORT (t),
+      "bench");
+  g_object_unref (t);
+
+  /* Nobody else is around, so joining ends once its timeouts ran */
+  g_assert (gibber_r_multicast_causal_transport_connect (d.rmc, FALSE,
+      NULL));
+
+  while (gibber_transport_get_state (GIBBER_TRANSPORT (d.rmc))
+      != GIBBER_TRANSPORT_CONNECTED)
+    {
+      drain_main_context ();
+      g_assert (gibber_r_multicast_clock_run_next (G_MAXINT64));
+    }
+
+  for (i = 0; i < G_N_ELEMENTS (sizes); i++)
+    {
+      gchar *parameter = g_strdup_printf ("size=%" G_GSIZE_FORMAT, sizes[i]);
+
+      d.size = sizes[i];
+      measure ("causal-send", parameter, MAX (SEND_BYTES / sizes[i], 8),
+          sizes[i], bench_causal_send, &d);
+
+      g_free (parameter);
+    }
+
+  g_object_unref (d.rmc);
+}
+
+int
+main (int argc,
+    char **argv)
+{
+  g_type_init ();
+
+  if (argc > 1)
+    filter = argv[1];
+
+  memset (payload, 'x', sizeof (payload));
+
+  /* Timeouts are only ever run explicitly */
+  gibber_r_multicast_clock_use_virtual ();
+
+  printf ("benchmark\tparameter\titerations\tbytes\tbest_ns\tmedian_ns\n");
+
+  packet_benchmarks ();
+  sender_benchmarks ();
+  causal_benchmarks ();
+
+  return 0;
+}
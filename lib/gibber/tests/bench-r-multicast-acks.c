@@ -0,0 +1,106 @@
+/*
+ * bench-r-multicast-acks - measure ack tracking and garbage collection of a
+ * GibberRMulticastSenderGroup with 10, 50 and 200 members
+ *
+ * Every member sends one packet per round, depending on the packets all
+ * other members sent in the previous round, like a group where everyone is
+ * talking.
+ *
+ * Usage: bench-r-multicast-acks [packets per group size]
+ */
+
+#include "config.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#include <glib.h>
+
+#include <gibber/gibber-r-multicast-sender.h>
+
+#define MAX_PACKET_SIZE 65536
+#define FIRST_SENDER 0x100
+#define FIRST_PACKET 1000
+
+static void
+run (guint members,
+    guint packets)
+{
+  GibberRMulticastSenderGroup *group;
+  GibberRMulticastSender **senders;
+  GTimer *timer;
+  gdouble secs;
+  guint rounds = MAX (packets / members, 1);
+  guint cached = 0;
+  guint i, j, r;
+
+  group = gibber_r_multicast_sender_group_new ();
+  senders = g_new (GibberRMulticastSender *, members);
+
+  for (i = 0; i < members; i++)
+    {
+      gchar *name = g_strdup_printf ("member%u", i);
+
+      senders[i] = gibber_r_multicast_sender_new (FIRST_SENDER + i, name,
+          group);
+      gibber_r_multicast_sender_update_start (senders[i], FIRST_PACKET);
+      gibber_r_multicast_sender_group_add (group, senders[i]);
+      g_free (name);
+    }
+
+  timer = g_timer_new ();
+
+  for (r = 0; r < rounds; r++)
+    {
+      for (i = 0; i < members; i++)
+        {
+          GibberRMulticastPacket *p;
+
+          p = gibber_r_multicast_packet_new (PACKET_TYPE_NO_DATA,
+              FIRST_SENDER + i, MAX_PACKET_SIZE);
+          gibber_r_multicast_packet_set_packet_id (p, FIRST_PACKET + r);
+
+          for (j = 0; j < members; j++)
+            {
+              if (j != i)
+                gibber_r_multicast_packet_add_sender_info (p,
+                    FIRST_SENDER + j, FIRST_PACKET + r, NULL);
+            }
+
+          gibber_r_multicast_sender_push (senders[i], p);
+          gibber_r_multicast_packet_unref (p);
+        }
+    }
+
+  secs = g_timer_elapsed (timer, NULL);
+
+  /* With working garbage collection only the last rounds are cached */
+  for (i = 0; i < members; i++)
+    cached += gibber_r_multicast_sender_packet_cache_size (senders[i]);
+
+  printf ("%3u members, %u packets: %.3f s, %.0f ns per packet, "
+      "%u packets cached\n", members, rounds * members, secs,
+      secs * 1e9 / (rounds * members), cached);
+
+  g_timer_destroy (timer);
+  g_free (senders);
+  gibber_r_multicast_sender_group_free (group);
+}
+
+int
+main (int argc,
+    char **argv)
+{
+  guint packets = 100000;
+
+  g_type_init ();
+
+  if (argc > 1)
+    packets = atoi (argv[1]);
+
+  run (10, packets);
+  run (50, packets);
+  run (200, packets);
+
+  return 0;
+}
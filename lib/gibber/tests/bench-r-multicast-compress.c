@@ -0,0 +1,149 @@
+/*
+ * bench-r-multicast-compress - measure how many r-multicast datagrams
+ * compressing messages saves on a muc trace
+ *
+ * The trace has one serialized stanza per line, as written by the xmpp
+ * writer. Without a trace a few typical chat and activity stanzas are used.
+ *
+ * Usage: bench-r-multicast-compress [trace file]
+ */
+
+#include "config.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <glib.h>
+
+#include <gibber/gibber-r-multicast-packet.h>
+#include <gibber/gibber-r-multicast-compress.h>
+
+/* Default maximum packet size of the multicast transport */
+#define MAX_PACKET_SIZE 1440
+/* Depends of a data packet in a group of 8 */
+#define NR_DEPENDS 7
+
+static const gchar *sample_trace =
+  "<message xmlns='jabber:client' type='groupchat' from='alice@laptop' "
+    "to='chat-room'><body>hi, is everyone here?</body></message>\n"
+  "<message xmlns='jabber:client' type='groupchat' from='bob@desktop' "
+    "to='chat-room'><body>yep, just joined</body></message>\n"
+  "<presence xmlns='jabber:client' from='carol@laptop' to='chat-room'>"
+    "<properties xmlns='http://laptop.org/xmpp/activity-properties' "
+    "activity='4f1a2c' room='chat-room'><property name='type' type='str'>"
+    "org.laptop.Chat</property><property name='name' type='str'>Chat"
+    "</property><property name='color' type='str'>#FF2B34,#005FE4"
+    "</property><property name='private' type='bool'>0</property>"
+    "</properties></presence>\n"
+  "<message xmlns='jabber:client' type='groupchat' from='alice@laptop' "
+    "to='chat-room'><tubes xmlns='http://telepathy.freedesktop.org/xmpp/"
+    "tubes'><tube type='dbus' service='org.laptop.Chat' stream-id='3' "
+    "id='1234' initiator='alice@laptop'><parameters/></tube></tubes>"
+    "</message>\n";
+
+/* Number of datagrams a message needs, fragmented like the causal transport
+ * does */
+static guint
+count_datagrams (const guint8 *data,
+    gsize size)
+{
+  gsize payloaded = 0;
+  guint datagrams = 0;
+
+  do
+    {
+      GibberRMulticastPacket *p;
+      guint i;
+
+      p = gibber_r_multicast_packet_new (PACKET_TYPE_DATA, 0x1234,
+          MAX_PACKET_SIZE);
+      gibber_r_multicast_packet_set_data_info (p, 0, 0, size);
+
+      for (i = 0; datagrams == 0 && i < NR_DEPENDS; i++)
+        gibber_r_multicast_packet_add_sender_info (p, 0x100 + i, i, NULL);
+
+      payloaded += gibber_r_multicast_packet_add_payload (p,
+          data + payloaded, size - payloaded);
+      gibber_r_multicast_packet_unref (p);
+      datagrams++;
+    }
+  while (payloaded < size);
+
+  return datagrams;
+}
+
+int
+main (int argc,
+    char **argv)
+{
+  gchar *contents;
+  gchar **stanzas;
+  gsize bytes = 0, compressed_bytes = 0;
+  guint datagrams = 0, compressed_datagrams = 0, n = 0;
+  guint i;
+
+  g_type_init ();
+
+  if (!gibber_r_multicast_compress_available ())
+    {
+      fprintf (stderr, "Built without compression support\n");
+      return 1;
+    }
+
+  if (argc > 1)
+    {
+      GError *error = NULL;
+
+      if (!g_file_get_contents (argv[1], &contents, NULL, &error))
+        {
+          fprintf (stderr, "%s\n", error->message);
+          g_error_free (error);
+          return 1;
+        }
+    }
+  else
+    {
+      contents = g_strdup (sample_trace);
+    }
+
+  stanzas = g_strsplit (contents, "\n", 0);
+
+  for (i = 0; stanzas[i] != NULL; i++)
+    {
+      const guint8 *data = (const guint8 *) stanzas[i];
+      gsize size = strlen (stanzas[i]);
+      GBytes *compressed;
+
+      if (size == 0)
+        continue;
+
+      n++;
+      bytes += size;
+      datagrams += count_datagrams (data, size);
+
+      /* Sent as is when compressing doesn't help */
+      compressed = gibber_r_multicast_compress (data, size);
+      if (compressed != NULL)
+        {
+          data = g_bytes_get_data (compressed, &size);
+        }
+
+      compressed_bytes += size;
+      compressed_datagrams += count_datagrams (data, size);
+
+      if (compressed != NULL)
+        g_bytes_unref (compressed);
+    }
+
+  printf ("stanzas: %u\n", n);
+  printf ("bytes: %" G_GSIZE_FORMAT " -> %" G_GSIZE_FORMAT "\n", bytes,
+      compressed_bytes);
+  printf ("datagrams: %u -> %u (%u saved)\n", datagrams, compressed_datagrams,
+      datagrams - compressed_datagrams);
+
+  g_strfreev (stanzas);
+  g_free (contents);
+
+  return 0;
+}
@@ -0,0 +1,108 @@
+/*
+ * bench-r-multicast-packet - measure building, parsing and freeing
+ * r-multicast packets, with and without a GibberRMulticastPacketPool
+ *
+ * Usage: bench-r-multicast-packet [iterations]
+ */
+
+#include "config.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <glib.h>
+
+#include <gibber/gibber-r-multicast-packet.h>
+
+#define NR_DEPENDS 10
+#define PAYLOAD_SIZE 1024
+#define MAX_PACKET_SIZE 1500
+
+static guint8 payload[PAYLOAD_SIZE];
+
+static GibberRMulticastPacket *
+build (GibberRMulticastPacketPool *pool,
+    guint32 serial)
+{
+  GibberRMulticastPacket *p;
+  guint i;
+
+  p = gibber_r_multicast_packet_new_pooled (pool, PACKET_TYPE_DATA, 0x1234,
+      MAX_PACKET_SIZE);
+  gibber_r_multicast_packet_set_packet_id (p, serial);
+  gibber_r_multicast_packet_set_data_info (p, 0,
+      GIBBER_R_MULTICAST_DATA_PACKET_START | GIBBER_R_MULTICAST_DATA_PACKET_END,
+      PAYLOAD_SIZE);
+
+  for (i = 0; i < NR_DEPENDS; i++)
+    gibber_r_multicast_packet_add_sender_info (p, 0x100 + i, serial + i,
+        NULL);
+
+  gibber_r_multicast_packet_add_payload (p, payload, PAYLOAD_SIZE);
+
+  return p;
+}
+
+/* One iteration builds and serializes a packet, parses the result back and
+ * frees both, as a node does for every datagram it sends and receives */
+static void
+run (gboolean use_pool,
+    guint iterations)
+{
+  GibberRMulticastPacketPool *pool = NULL;
+  GTimer *timer;
+  gdouble secs;
+  guint i;
+
+  if (use_pool)
+    pool = gibber_r_multicast_packet_pool_new ();
+
+  timer = g_timer_new ();
+
+  for (i = 0; i < iterations; i++)
+    {
+      GibberRMulticastPacket *p, *parsed;
+      guint8 *data;
+      gsize size;
+
+      p = build (pool, i);
+      data = gibber_r_multicast_packet_get_raw_data (p, &size);
+
+      parsed = gibber_r_multicast_packet_parse_pooled (pool, data, size, NULL);
+      g_assert (parsed != NULL);
+      g_assert (parsed->depends->len == NR_DEPENDS);
+
+      gibber_r_multicast_packet_unref (parsed);
+      gibber_r_multicast_packet_unref (p);
+    }
+
+  secs = g_timer_elapsed (timer, NULL);
+
+  printf ("%-6s %u iterations: %.3f s, %.0f ns per build/parse/free\n",
+      use_pool ? "pool" : "slice", iterations, secs, secs * 1e9 / iterations);
+
+  g_timer_destroy (timer);
+
+  if (pool != NULL)
+    gibber_r_multicast_packet_pool_unref (pool);
+}
+
+int
+main (int argc,
+    char **argv)
+{
+  guint iterations = 1000000;
+
+  g_type_init ();
+
+  if (argc > 1)
+    iterations = atoi (argv[1]);
+
+  memset (payload, 'x', PAYLOAD_SIZE);
+
+  run (FALSE, iterations);
+  run (TRUE, iterations);
+
+  return 0;
+}
@@ -0,0 +1,151 @@
+/*
+ * bench-reactor - measure the main loop overhead of many idle
+ * GibberFdTransports, with plain GLib watches and with GibberReactor
+ *
+ * Usage: bench-reactor [rounds]
+ */
+
+#include "config.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/resource.h>
+#include <sys/socket.h>
+
+#include <glib.h>
+
+#include <gibber/gibber-reactor.h>
+#include <gibber/gibber-unix-transport.h>
+
+static guint received;
+
+static void
+count_handler (GibberTransport *transport,
+    GibberBuffer *buffer,
+    gpointer user_data)
+{
+  received += buffer->length;
+}
+
+static gboolean
+raise_fd_limit (guint needed)
+{
+  struct rlimit limit;
+
+  if (getrlimit (RLIMIT_NOFILE, &limit) != 0)
+    return FALSE;
+
+  if (limit.rlim_cur >= needed)
+    return TRUE;
+
+  limit.rlim_cur = MIN (limit.rlim_max, needed);
+  if (setrlimit (RLIMIT_NOFILE, &limit) != 0)
+    return FALSE;
+
+  return limit.rlim_cur >= needed;
+}
+
+/* Wake up one transport after the other and time how long the main loop
+ * takes to deliver a byte to it, while all the others are idle */
+static void
+run (GibberReactor *reactor,
+    guint n_transports,
+    guint rounds)
+{
+  GibberUnixTransport **transports;
+  int *writers;
+  GTimer *timer;
+  gdouble secs;
+  guint i;
+
+  if (!raise_fd_limit (2 * n_transports + 64))
+    {
+      printf ("%-5s %4u transports: not enough file descriptors\n",
+          reactor != NULL ? "epoll" : "glib", n_transports);
+      return;
+    }
+
+  gibber_reactor_set_default (reactor);
+
+  transports = g_new0 (GibberUnixTransport *, n_transports);
+  writers = g_new0 (int, n_transports);
+
+  for (i = 0; i < n_transports; i++)
+    {
+      int sv[2];
+
+      g_assert (socketpair (AF_UNIX, SOCK_STREAM, 0, sv) == 0);
+      writers[i] = sv[0];
+      transports[i] = gibber_unix_transport_new_from_fd (sv[1]);
+      gibber_transport_set_handler (GIBBER_TRANSPORT (transports[i]),
+          count_handler, NULL);
+    }
+
+  while (g_main_context_iteration (NULL, FALSE))
+    ;
+
+  received = 0;
+  timer = g_timer_new ();
+
+  for (i = 0; i < rounds; i++)
+    {
+      g_assert (write (writers[i % n_transports], "x", 1) == 1);
+
+      while (received <= i)
+        g_main_context_iteration (NULL, TRUE);
+    }
+
+  secs = g_timer_elapsed (timer, NULL);
+
+  /* machine readable: backend transports rounds usec-per-wakeup */
+  printf ("%-5s %4u transports: %u wakeups, %.2f us per wakeup\n",
+      reactor != NULL ? "epoll" : "glib", n_transports, rounds,
+      secs * 1e6 / rounds);
+
+  for (i = 0; i < n_transports; i++)
+    {
+      g_object_unref (transports[i]);
+      close (writers[i]);
+    }
+
+  g_timer_destroy (timer);
+  g_free (transports);
+  g_free (writers);
+
+  gibber_reactor_set_default (NULL);
+}
+
+int
+main (int argc,
+    char **argv)
+{
+  static const guint sizes[] = { 10, 100, 1000 };
+  GibberReactor *reactor = NULL;
+  guint rounds = 20000;
+  guint i;
+
+  g_type_init ();
+
+  if (argc > 1)
+    rounds = atoi (argv[1]);
+
+  if (gibber_reactor_is_supported ())
+    reactor = gibber_reactor_new (NULL, NULL);
+  else
+    printf ("epoll not supported on this platform\n");
+
+  for (i = 0; i < G_N_ELEMENTS (sizes); i++)
+    {
+      run (NULL, sizes[i], rounds);
+
+      if (reactor != NULL)
+        run (reactor, sizes[i], rounds);
+    }
+
+  if (reactor != NULL)
+    gibber_reactor_unref (reactor);
+
+  return 0;
+}
@@ -29,6 +29,8 @@
 #include <sys/socket.h>
 #include <netinet/in.h>
 #include <arpa/inet.h>
+#include <sys/un.h>
+#include <netdb.h>
 #include <unistd.h>
 
 #include <gibber/gibber-tcp-transport.h>
@@ -122,8 +124,10 @@ test_tcp_listen (void)
   GMainLoop *mainloop;
   GibberTransport *transport;
   GError *error = NULL;
+  GibberTCPTransportConnectStats stats;
 
   mainloop = g_main_loop_new (NULL, FALSE);
+  gibber_tcp_transport_reset_connect_stats ();
 
   /* tcp socket tests without a specified port */
   listener_without_port = gibber_listener_new ();
@@ -196,11 +200,307 @@ test_tcp_listen (void)
   /* Connected while listening should have stopped */
   g_assert (!got_connection);
 
+  gibber_tcp_transport_get_connect_stats (&stats);
+  g_assert_cmpuint (stats.ipv4_wins, ==, 2);
+  g_assert_cmpuint (stats.ipv6_wins, ==, 0);
+  g_assert_cmpuint (stats.failures, ==, 1);
+  g_assert_cmpuint (stats.attempts, ==, 3);
+
   g_object_unref (transport);
   g_main_loop_unref (mainloop);
 
 }
 
+static void
+count_connection_cb (GibberListener *listener,
+    GibberTransport *connection,
+    struct sockaddr *addr,
+    guint size,
+    guint *count)
+{
+  (*count)++;
+}
+
+static void
+test_accept_burst (void)
+{
+  GibberListener *listener;
+  GibberListenerStats stats;
+  struct sockaddr_un addr;
+  gchar *path = "/tmp/check-gibber-listener-burst";
+  int clients[5];
+  guint count = 0;
+  guint i;
+  int ret;
+
+  ret = unlink (path);
+  g_assert (!(ret == -1 && errno != ENOENT));
+
+  listener = gibber_listener_new ();
+  gibber_listener_set_backlog (listener, 16);
+  g_signal_connect (listener, "new-connection",
+      G_CALLBACK (count_connection_cb), &count);
+  g_assert (gibber_listener_listen_socket (listener, path, FALSE, NULL));
+
+  memset (&addr, 0, sizeof (addr));
+  addr.sun_family = AF_UNIX;
+  g_strlcpy (addr.sun_path, path, sizeof (addr.sun_path));
+
+  /* Queue up all the connections before the listener gets to run */
+  for (i = 0; i < G_N_ELEMENTS (clients); i++)
+    {
+      clients[i] = socket (AF_UNIX, SOCK_STREAM, 0);
+      g_assert (clients[i] >= 0);
+      ret = connect (clients[i], (struct sockaddr *) &addr, sizeof (addr));
+      g_assert (ret == 0);
+    }
+
+  while (count < G_N_ELEMENTS (clients))
+    g_main_context_iteration (NULL, TRUE);
+
+  /* All of them were accepted in a single wakeup */
+  gibber_listener_get_stats (listener, &stats);
+  g_assert_cmpuint (stats.accepted, ==, G_N_ELEMENTS (clients));
+  g_assert_cmpuint (stats.wakeups, ==, 1);
+  g_assert_cmpuint (stats.max_queue_depth, ==, G_N_ELEMENTS (clients));
+  g_assert_cmpuint (stats.errors, ==, 0);
+  g_assert (stats.max_latency_us <= stats.total_latency_us);
+
+  gibber_listener_reset_stats (listener);
+  gibber_listener_get_stats (listener, &stats);
+  g_assert_cmpuint (stats.accepted, ==, 0);
+
+  for (i = 0; i < G_N_ELEMENTS (clients); i++)
+    close (clients[i]);
+
+  g_object_unref (listener);
+}
+
+/* Time a pending attempt gets before the next address is raced */
+#define STAGGER_DELAY 300
+
+/* The families of the first address localhost resolves to and of the first
+ * address of the other family, FALSE if it only has one family */
+static gboolean
+localhost_families (int *first,
+                    int *second)
+{
+  struct addrinfo req, *ans, *a;
+
+  memset (&req, 0, sizeof (req));
+  req.ai_family = AF_UNSPEC;
+  req.ai_socktype = SOCK_STREAM;
+
+  if (getaddrinfo ("localhost", NULL, &req, &ans) != 0)
+    return FALSE;
+
+  *first = ans->ai_family;
+  *second = AF_UNSPEC;
+
+  for (a = ans; a != NULL; a = a->ai_next)
+    {
+      if (a->ai_family != *first &&
+          (a->ai_family == AF_INET || a->ai_family == AF_INET6))
+        {
+          *second = a->ai_family;
+          break;
+        }
+    }
+
+  freeaddrinfo (ans);
+
+  return *second != AF_UNSPEC;
+}
+
+/* Listening socket on the loopback address of family, on *port or any port if
+ * it is 0. Sets *port to the port it's bound to */
+static int
+listen_loopback (int family,
+                 int *port,
+                 int backlog)
+{
+  struct sockaddr_storage addr;
+  socklen_t len;
+  int fd, yes = 1;
+
+  memset (&addr, 0, sizeof (addr));
+
+  if (family == AF_INET)
+    {
+      struct sockaddr_in *in = (struct sockaddr_in *) &addr;
+
+      in->sin_family = AF_INET;
+      in->sin_addr.s_addr = htonl (INADDR_LOOPBACK);
+      in->sin_port = htons (*port);
+      len = sizeof (struct sockaddr_in);
+    }
+  else
+    {
+      struct sockaddr_in6 *in6 = (struct sockaddr_in6 *) &addr;
+
+      in6->sin6_family = AF_INET6;
+      in6->sin6_addr = in6addr_loopback;
+      in6->sin6_port = htons (*port);
+      len = sizeof (struct sockaddr_in6);
+    }
+
+  fd = socket (family, SOCK_STREAM, 0);
+  g_assert (fd >= 0);
+
+  setsockopt (fd, SOL_SOCKET, SO_REUSEADDR, &yes, sizeof (yes));
+  if (family == AF_INET6)
+    setsockopt (fd, IPPROTO_IPV6, IPV6_V6ONLY, &yes, sizeof (yes));
+
+  g_assert (bind (fd, (struct sockaddr *) &addr, len) == 0);
+  g_assert (listen (fd, backlog) == 0);
+
+  len = sizeof (addr);
+  g_assert (getsockname (fd, (struct sockaddr *) &addr, &len) == 0);
+  *port = ntohs (family == AF_INET ?
+      ((struct sockaddr_in *) &addr)->sin_port :
+      ((struct sockaddr_in6 *) &addr)->sin6_port);
+
+  return fd;
+}
+
+static void
+race_connected_cb (GibberTransport *transport,
+                   GMainLoop *loop)
+{
+  g_main_loop_quit (loop);
+}
+
+static void
+race_disconnected_cb (GibberTransport *transport,
+                      GMainLoop *loop)
+{
+  g_assert_not_reached ();
+}
+
+/* Connect to localhost and check the connection went to an address of the
+ * expected family, returns how long it took in microseconds */
+static gint64
+race_localhost (int port,
+                int expected_family)
+{
+  GibberTCPTransport *transport;
+  GMainLoop *mainloop;
+  struct sockaddr_storage peer;
+  socklen_t len = sizeof (peer);
+  gchar sport[16];
+  gint64 start, elapsed;
+
+  mainloop = g_main_loop_new (NULL, FALSE);
+  g_snprintf (sport, sizeof (sport), "%d", port);
+
+  transport = gibber_tcp_transport_new ();
+  gibber_tcp_transport_set_connect_attempt_delay (transport, STAGGER_DELAY);
+  g_signal_connect (transport, "connected",
+      G_CALLBACK (race_connected_cb), mainloop);
+  g_signal_connect (transport, "disconnected",
+      G_CALLBACK (race_disconnected_cb), mainloop);
+
+  start = g_get_monotonic_time ();
+  gibber_tcp_transport_connect (transport, "localhost", sport);
+
+  if (gibber_transport_get_state (GIBBER_TRANSPORT (transport))
+      != GIBBER_TRANSPORT_CONNECTED)
+    g_main_loop_run (mainloop);
+
+  elapsed = g_get_monotonic_time () - start;
+
+  g_assert (getpeername (GIBBER_FD_TRANSPORT (transport)->fd,
+      (struct sockaddr *) &peer, &len) == 0);
+  g_assert_cmpint (peer.ss_family, ==, expected_family);
+
+  g_signal_handlers_disconnect_by_func (transport, race_disconnected_cb,
+      mainloop);
+  g_object_unref (transport);
+  g_main_loop_unref (mainloop);
+
+  return elapsed;
+}
+
+static void
+check_race_stats (int winning_family)
+{
+  GibberTCPTransportConnectStats stats;
+
+  gibber_tcp_transport_get_connect_stats (&stats);
+  g_assert_cmpuint (stats.attempts, ==, 2);
+  g_assert_cmpuint (stats.failures, ==, 0);
+  g_assert_cmpuint (stats.ipv4_wins, ==, winning_family == AF_INET);
+  g_assert_cmpuint (stats.ipv6_wins, ==, winning_family == AF_INET6);
+}
+
+static void
+test_tcp_race_refused (void)
+{
+  int first, second, port = 0, fd;
+  gint64 elapsed;
+
+  if (!localhost_families (&first, &second))
+    {
+      g_test_message ("localhost doesn't resolve to both IPv4 and IPv6, "
+          "skipping");
+      return;
+    }
+
+  gibber_tcp_transport_reset_connect_stats ();
+
+  /* Only the second candidate listens, the first one refuses */
+  fd = listen_loopback (second, &port, 5);
+
+  elapsed = race_localhost (port, second);
+
+  /* A refusal moves on right away, without waiting for the stagger delay */
+  g_assert_cmpint (elapsed, <, STAGGER_DELAY * 1000);
+  check_race_stats (second);
+
+  close (fd);
+}
+
+static void
+test_tcp_race_unreachable (void)
+{
+#if defined(__linux__)
+  int first, second, port = 0, blackhole, filler, fd;
+  struct sockaddr_storage addr;
+  socklen_t len = sizeof (addr);
+  gint64 elapsed;
+
+  if (!localhost_families (&first, &second))
+    {
+      g_test_message ("localhost doesn't resolve to both IPv4 and IPv6, "
+          "skipping");
+      return;
+    }
+
+  gibber_tcp_transport_reset_connect_stats ();
+
+  /* With a full accept queue that's never accepted from, Linux drops new
+   * SYNs, so connecting to the first candidate stays pending */
+  blackhole = listen_loopback (first, &port, 0);
+  g_assert (getsockname (blackhole, (struct sockaddr *) &addr, &len) == 0);
+  filler = socket (first, SOCK_STREAM, 0);
+  g_assert (connect (filler, (struct sockaddr *) &addr, len) == 0);
+
+  fd = listen_loopback (second, &port, 5);
+
+  elapsed = race_localhost (port, second);
+
+  /* The second candidate was only tried once the first was pending for the
+   * stagger delay, and won well before the SYN to the first is retried */
+  g_assert_cmpint (elapsed, >=, STAGGER_DELAY * 1000);
+  g_assert_cmpint (elapsed, <, STAGGER_DELAY * 1000 + G_USEC_PER_SEC / 2);
+  check_race_stats (second);
+
+  close (fd);
+  close (filler);
+  close (blackhole);
+#endif
+}
+
 int
 main (int argc,
       char **argv)
@@ -209,7 +509,12 @@ main (int argc,
   g_type_init ();
 
   g_test_add_func ("/gibber/listener/tcp-listen", test_tcp_listen);
+  g_test_add_func ("/gibber/listener/tcp-race-refused",
+      test_tcp_race_refused);
+  g_test_add_func ("/gibber/listener/tcp-race-unreachable",
+      test_tcp_race_unreachable);
   g_test_add_func ("/gibber/listener/unix-listen", test_unix_listen);
+  g_test_add_func ("/gibber/listener/accept-burst", test_accept_burst);
 
   return g_test_run ();
 }
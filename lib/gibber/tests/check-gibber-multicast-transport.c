@@ -0,0 +1,119 @@
+/*
+ * check-gibber-multicast-transport.c - Test for GibberMulticastTransport
+ * Copyright (C) 2007 Collabora Ltd.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+#include "config.h"
+
+#include <stdio.h>
+#include <string.h>
+
+#include <gibber/gibber-multicast-transport.h>
+
+#define GROUP_ADDRESS "239.255.71.3"
+#define GROUP_PORT "21433"
+
+/* Less than the number of datagrams received per wakeup */
+#define NR_DATAGRAMS 8
+
+static GMainLoop *loop;
+static guint received;
+static guint batches;
+
+static void
+batch_cb (GibberMulticastTransport *transport,
+          GBytes **datagrams,
+          guint n_datagrams,
+          gpointer user_data)
+{
+  guint i;
+
+  batches++;
+
+  for (i = 0; i < n_datagrams; i++)
+    {
+      gchar *expected = g_strdup_printf ("datagram %u", received);
+      gsize size;
+      const gchar *data = g_bytes_get_data (datagrams[i], &size);
+
+      g_assert_cmpuint (size, ==, strlen (expected));
+      g_assert (memcmp (data, expected, size) == 0);
+
+      g_free (expected);
+      received++;
+    }
+
+  if (received == NR_DATAGRAMS)
+    g_main_loop_quit (loop);
+}
+
+static void
+test_batch (void)
+{
+  GibberMulticastTransport *transport;
+  GibberBuffer datagrams[NR_DATAGRAMS];
+  guint i;
+
+  loop = g_main_loop_new (NULL, FALSE);
+  received = 0;
+  batches = 0;
+
+  transport = gibber_multicast_transport_new ();
+  g_assert (gibber_multicast_transport_connect (transport, GROUP_ADDRESS,
+      GROUP_PORT));
+  gibber_multicast_transport_set_batch_handler (transport, batch_cb, NULL);
+
+  for (i = 0; i < NR_DATAGRAMS; i++)
+    {
+      gchar *data = g_strdup_printf ("datagram %u", i);
+
+      datagrams[i].data = (guint8 *) data;
+      datagrams[i].length = strlen (data);
+    }
+
+  /* All of them are looped back before the main loop gets to look */
+  g_assert (gibber_multicast_transport_send_batch (transport, datagrams,
+      NR_DATAGRAMS, NULL));
+
+  for (i = 0; i < NR_DATAGRAMS; i++)
+    g_free ((guint8 *) datagrams[i].data);
+
+  g_main_loop_run (loop);
+
+  g_assert_cmpuint (received, ==, NR_DATAGRAMS);
+#ifdef HAVE_RECVMMSG
+  g_assert_cmpuint (batches, ==, 1);
+#else
+  g_assert_cmpuint (batches, ==, NR_DATAGRAMS);
+#endif
+
+  gibber_transport_disconnect (GIBBER_TRANSPORT (transport));
+  g_object_unref (transport);
+  g_main_loop_unref (loop);
+}
+
+int
+main (int argc,
+      char **argv)
+{
+  g_test_init (&argc, &argv, NULL);
+  g_type_init ();
+
+  g_test_add_func ("/gibber/multicast-transport/batch", test_batch);
+
+  return g_test_run ();
+}
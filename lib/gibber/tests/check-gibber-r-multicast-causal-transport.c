@@ -25,6 +25,7 @@
 #include <string.h>
 
 #include <gibber/gibber-r-multicast-causal-transport.h>
+#include <gibber/gibber-r-multicast-compress.h>
 #include <gibber/gibber-r-multicast-packet.h>
 #include "test-transport.h"
 
@@ -88,6 +89,12 @@ struct {
                 { NULL,    0,        0, FALSE }
 };
 
+/* Number of data packets seen by the depends test */
+static guint depends_data_packets = 0;
+static GibberRMulticastCausalTransport *depends_rmctransport;
+
+static gboolean depends_progress (gpointer data);
+
 static gboolean
 depends_send_hook (GibberTransport *transport,
                    const guint8 *data,
@@ -131,7 +138,7 @@ depends_send_hook (GibberTransport *transport,
 
       pdata = gibber_r_multicast_packet_get_raw_data (reply, &psize);
       test_transport_write (TEST_TRANSPORT(transport), pdata, psize);
-      g_object_unref (reply);
+      gibber_r_multicast_packet_unref (reply);
     }
 
   if (packet->type != PACKET_TYPE_DATA)
@@ -139,6 +146,21 @@ depends_send_hook (GibberTransport *transport,
       goto out;
     }
 
+  if (depends_data_packets++ > 0)
+    {
+      GibberRMulticastPacketSenderInfo *sender_info;
+
+      /* Only the sender that progressed since the first packet is listed */
+      g_assert_cmpuint (packet->depends->len, ==, 1);
+      sender_info = &g_array_index (packet->depends,
+          GibberRMulticastPacketSenderInfo, 0);
+      g_assert_cmpuint (sender_info->sender_id, ==, senders[1].sender_id);
+      g_assert_cmpuint (sender_info->packet_id, ==, senders[1].packet_id + 2);
+
+      g_main_loop_quit (loop);
+      goto out;
+    }
+
   g_assert (packet->depends->len > 0);
 
   for (n = 0; n < packet->depends->len; n++)
@@ -146,8 +168,8 @@ depends_send_hook (GibberTransport *transport,
       for (i = 0; senders[i].name != NULL ; i++)
         {
           GibberRMulticastPacketSenderInfo *sender_info =
-              g_array_index (packet->depends,
-                  GibberRMulticastPacketSenderInfo *, n);
+              &g_array_index (packet->depends,
+                  GibberRMulticastPacketSenderInfo, n);
           if (senders[i].sender_id == sender_info->sender_id)
             {
               g_assert (senders[i].seen == FALSE);
@@ -164,9 +186,9 @@ depends_send_hook (GibberTransport *transport,
       g_assert (senders[i].seen && "Not all senders in depends");
     }
 
-  g_main_loop_quit (loop);
+  g_idle_add (depends_progress, transport);
 out:
-  g_object_unref (packet);
+  gibber_r_multicast_packet_unref (packet);
   return TRUE;
 }
 
@@ -214,13 +236,37 @@ depends_connected (GibberTransport *transport,
 
       data = gibber_r_multicast_packet_get_raw_data (packet, &size);
       test_transport_write (testtransport, data, size);
-      g_object_unref (packet);
+      gibber_r_multicast_packet_unref (packet);
     }
 
   /* Wait more then 200 ms, so all senders can get go to running */
   g_timeout_add (300, depends_send_test_data, rmctransport);
 }
 
+/* Let one sender progress, then send another packet */
+static gboolean
+depends_progress (gpointer data)
+{
+  TestTransport *testtransport = TEST_TRANSPORT (data);
+  GibberRMulticastPacket *packet;
+  guint8 *pdata;
+  gsize size;
+
+  packet = gibber_r_multicast_packet_new (PACKET_TYPE_DATA,
+      senders[1].sender_id,
+      GIBBER_TRANSPORT (testtransport)->max_packet_size);
+  gibber_r_multicast_packet_set_packet_id (packet, senders[1].packet_id + 1);
+  gibber_r_multicast_packet_set_data_info (packet, 0, 0, 1);
+
+  pdata = gibber_r_multicast_packet_get_raw_data (packet, &size);
+  test_transport_write (testtransport, pdata, size);
+  gibber_r_multicast_packet_unref (packet);
+
+  g_timeout_add (100, depends_send_test_data, depends_rmctransport);
+
+  return FALSE;
+}
+
 static void
 test_depends (void)
 {
@@ -232,6 +278,7 @@ test_depends (void)
 
   rmctransport = create_rmulticast_transport (&testtransport, "test123",
        depends_send_hook, NULL);
+  depends_rmctransport = rmctransport;
 
   g_signal_connect (rmctransport, "connected",
       G_CALLBACK (depends_connected), testtransport);
@@ -295,13 +342,13 @@ fragmentation_send_hook (GibberTransport *transport,
     {
       g_assert
         (packet->data.data.flags == GIBBER_R_MULTICAST_DATA_PACKET_END);
-      g_object_unref (packet);
+      gibber_r_multicast_packet_unref (packet);
       g_main_loop_quit (loop);
       return FALSE;
     }
 
 out:
-  g_object_unref (packet);
+  gibber_r_multicast_packet_unref (packet);
   return TRUE;
 }
 
@@ -345,6 +392,322 @@ test_fragmentation (void)
 }
 
 
+/* test pacing */
+#define PACING_RATE 20000
+
+static gint64 pacing_start;
+
+static gboolean
+pacing_send_hook (GibberTransport *transport,
+                  const guint8 *data,
+                  gsize length,
+                  GError **error,
+                  gpointer user_data)
+{
+  GibberRMulticastPacket *packet;
+  static gsize bytes = 0;
+  static gsize raw_bytes = 0;
+  gsize size;
+
+  packet = gibber_r_multicast_packet_parse (data, length, NULL);
+  g_assert (packet != NULL);
+
+  if (packet->type != PACKET_TYPE_DATA)
+    goto out;
+
+  gibber_r_multicast_packet_get_payload (packet, &size);
+  bytes += size;
+  raw_bytes += length;
+
+  if (bytes == TEST_DATA_SIZE)
+    {
+      gint64 elapsed = g_get_monotonic_time () - pacing_start;
+      /* All but the initial burst of 8 packets had to wait for tokens */
+      gint64 expected = (gint64) (raw_bytes - 8 * transport->max_packet_size)
+          * G_USEC_PER_SEC / PACING_RATE;
+
+      g_assert_cmpint (elapsed, >=, expected);
+      g_main_loop_quit (loop);
+    }
+
+out:
+  gibber_r_multicast_packet_unref (packet);
+  return TRUE;
+}
+
+static void
+pacing_connected (GibberTransport *transport,
+                  gpointer user_data)
+{
+  guint8 testdata[TEST_DATA_SIZE];
+
+  memset (testdata, 0xaa, TEST_DATA_SIZE);
+
+  pacing_start = g_get_monotonic_time ();
+  g_assert (gibber_transport_send (transport, testdata, TEST_DATA_SIZE,
+      NULL));
+}
+
+static void
+test_pacing (void)
+{
+  GibberRMulticastCausalTransport *rmctransport;
+
+  loop = g_main_loop_new (NULL, FALSE);
+
+  rmctransport = create_rmulticast_transport (NULL, "test123",
+       pacing_send_hook, NULL);
+  g_object_set (rmctransport, "send-rate", PACING_RATE, NULL);
+
+  g_signal_connect (rmctransport, "connected",
+      G_CALLBACK (pacing_connected), NULL);
+
+  rmulticast_connect (rmctransport);
+
+  g_main_loop_run (loop);
+  g_main_loop_unref (loop);
+
+  g_object_unref (rmctransport);
+}
+
+/* test stream scheduling */
+#define BULK_STREAM 1
+#define CHAT_MESSAGE "hello"
+
+static gboolean chat_seen = FALSE;
+
+static gboolean
+scheduling_send_hook (GibberTransport *transport,
+                      const guint8 *data,
+                      gsize length,
+                      GError **error,
+                      gpointer user_data)
+{
+  GibberRMulticastPacket *packet;
+
+  packet = gibber_r_multicast_packet_parse (data, length, NULL);
+  g_assert (packet != NULL);
+
+  if (packet->type != PACKET_TYPE_DATA)
+    goto out;
+
+  if (packet->data.data.stream_id == GIBBER_R_MULTICAST_CAUSAL_DEFAULT_STREAM)
+    {
+      chat_seen = TRUE;
+    }
+  else if (packet->data.data.flags & GIBBER_R_MULTICAST_DATA_PACKET_END)
+    {
+      /* The chat message got in between the fragments of the bulk one */
+      g_assert (chat_seen);
+      g_main_loop_quit (loop);
+    }
+
+out:
+  gibber_r_multicast_packet_unref (packet);
+  return TRUE;
+}
+
+static void
+scheduling_connected (GibberTransport *transport,
+                      gpointer user_data)
+{
+  GibberRMulticastCausalTransport *rmctransport
+      = GIBBER_R_MULTICAST_CAUSAL_TRANSPORT (transport);
+  guint8 testdata[TEST_DATA_SIZE];
+  gsize bytes;
+
+  memset (testdata, 0xaa, TEST_DATA_SIZE);
+
+  g_assert (gibber_r_multicast_causal_transport_send (rmctransport,
+      BULK_STREAM, testdata, TEST_DATA_SIZE, NULL));
+  g_assert (gibber_transport_send (transport, (guint8 *) CHAT_MESSAGE,
+      strlen (CHAT_MESSAGE), NULL));
+
+  /* Only the initial burst went out */
+  g_assert_cmpuint (gibber_r_multicast_causal_transport_get_stream_queue_depth (
+      rmctransport, BULK_STREAM, &bytes), ==, 1);
+  g_assert_cmpuint (bytes, >, 0);
+  g_assert_cmpuint (bytes, <, TEST_DATA_SIZE);
+}
+
+static void
+test_stream_scheduling (void)
+{
+  GibberRMulticastCausalTransport *rmctransport;
+
+  loop = g_main_loop_new (NULL, FALSE);
+
+  rmctransport = create_rmulticast_transport (NULL, "test123",
+       scheduling_send_hook, NULL);
+  g_object_set (rmctransport, "send-rate", PACING_RATE, NULL);
+
+  g_signal_connect (rmctransport, "connected",
+      G_CALLBACK (scheduling_connected), NULL);
+
+  rmulticast_connect (rmctransport);
+
+  g_main_loop_run (loop);
+  g_main_loop_unref (loop);
+
+  g_assert_cmpuint (gibber_r_multicast_causal_transport_get_stream_queue_depth (
+      rmctransport, BULK_STREAM, NULL), ==, 0);
+
+  g_object_unref (rmctransport);
+}
+
+/* test compression with a member joining mid-stream */
+#define COMPRESS_MEMBER 6
+#define COMPRESS_JOINER 7
+#define COMPRESS_MESSAGE_SIZE 64
+
+static guint compress_sends = 0;
+static GibberRMulticastCausalTransport *compress_rmctransport;
+
+static void
+compress_write_probe (TestTransport *testtransport,
+                      guint32 sender_id)
+{
+  GibberRMulticastPacket *packet;
+  guint8 *data;
+  gsize size;
+
+  packet = gibber_r_multicast_packet_new (PACKET_TYPE_RTT_PROBE, sender_id,
+      GIBBER_TRANSPORT (testtransport)->max_packet_size);
+  gibber_r_multicast_packet_set_rtt_probe_info (packet, 0, 0, 0, 0,
+      GIBBER_R_MULTICAST_CAPABILITY_DEFLATE);
+
+  data = gibber_r_multicast_packet_get_raw_data (packet, &size);
+  test_transport_write (testtransport, data, size);
+  gibber_r_multicast_packet_unref (packet);
+}
+
+static void
+compress_add_member (GibberRMulticastCausalTransport *rmctransport,
+                     guint32 sender_id)
+{
+  gibber_r_multicast_causal_transport_add_sender (rmctransport, sender_id);
+  gibber_r_multicast_causal_transport_update_sender_start (rmctransport,
+      sender_id, 0x100);
+}
+
+static void
+compress_send (GibberRMulticastCausalTransport *rmctransport)
+{
+  guint8 testdata[COMPRESS_MESSAGE_SIZE];
+
+  memset (testdata, 'a', COMPRESS_MESSAGE_SIZE);
+  g_assert (gibber_transport_send (GIBBER_TRANSPORT (rmctransport), testdata,
+      COMPRESS_MESSAGE_SIZE, NULL));
+}
+
+static gboolean
+compress_join_cb (gpointer user_data)
+{
+  /* Joins before its first probe told anyone it can inflate */
+  compress_add_member (compress_rmctransport, COMPRESS_JOINER);
+  compress_send (compress_rmctransport);
+
+  return FALSE;
+}
+
+static gboolean
+compress_probe_cb (gpointer user_data)
+{
+  compress_write_probe (TEST_TRANSPORT (user_data), COMPRESS_JOINER);
+  compress_send (compress_rmctransport);
+
+  return FALSE;
+}
+
+static gboolean
+compression_send_hook (GibberTransport *transport,
+                       const guint8 *data,
+                       gsize length,
+                       GError **error,
+                       gpointer user_data)
+{
+  GibberRMulticastPacket *packet;
+  gboolean deflated;
+
+  packet = gibber_r_multicast_packet_parse (data, length, NULL);
+  g_assert (packet != NULL);
+
+  if (packet->type != PACKET_TYPE_DATA)
+    goto out;
+
+  deflated = (packet->data.data.flags
+      & GIBBER_R_MULTICAST_DATA_PACKET_DEFLATE) != 0;
+
+  switch (compress_sends++)
+    {
+      case 0:
+        /* The only other member advertised it can inflate */
+        g_assert (deflated);
+        g_idle_add (compress_join_cb, NULL);
+        break;
+      case 1:
+        /* The new member might not be able to */
+        g_assert (!deflated);
+        g_idle_add (compress_probe_cb, transport);
+        break;
+      case 2:
+        g_assert (deflated);
+        g_main_loop_quit (loop);
+        break;
+      default:
+        g_assert_not_reached ();
+    }
+
+out:
+  gibber_r_multicast_packet_unref (packet);
+  return TRUE;
+}
+
+static void
+compression_connected (GibberTransport *transport,
+                       gpointer user_data)
+{
+  GibberRMulticastCausalTransport *rmctransport
+      = GIBBER_R_MULTICAST_CAUSAL_TRANSPORT (transport);
+
+  compress_add_member (rmctransport, COMPRESS_MEMBER);
+  compress_write_probe (TEST_TRANSPORT (user_data), COMPRESS_MEMBER);
+  compress_send (rmctransport);
+}
+
+static void
+test_compression_join (void)
+{
+  GibberRMulticastCausalTransport *rmctransport;
+  TestTransport *testtransport;
+
+  if (!gibber_r_multicast_compress_available ())
+    {
+      g_test_message ("Built without compression support");
+      return;
+    }
+
+  loop = g_main_loop_new (NULL, FALSE);
+
+  rmctransport = create_rmulticast_transport (&testtransport, "test123",
+       compression_send_hook, NULL);
+  compress_rmctransport = rmctransport;
+  gibber_r_multicast_causal_transport_set_stream_compression (rmctransport,
+      GIBBER_R_MULTICAST_CAUSAL_DEFAULT_STREAM, TRUE);
+
+  g_signal_connect (rmctransport, "connected",
+      G_CALLBACK (compression_connected), testtransport);
+
+  rmulticast_connect (rmctransport);
+
+  g_main_loop_run (loop);
+  g_main_loop_unref (loop);
+
+  g_assert_cmpuint (compress_sends, ==, 3);
+
+  g_object_unref (rmctransport);
+}
+
 /* test unique id */
 static gboolean
 unique_id_send_hook (GibberTransport *transport,
@@ -381,7 +744,7 @@ unique_id_send_hook (GibberTransport *transport,
 
       pdata = gibber_r_multicast_packet_get_raw_data (reply, &psize);
       test_transport_write (TEST_TRANSPORT(transport), pdata, psize);
-      g_object_unref (reply);
+      gibber_r_multicast_packet_unref (reply);
     }
   else
     {
@@ -403,7 +766,7 @@ unique_id_send_hook (GibberTransport *transport,
         }
     }
 
-  g_object_unref (packet);
+  gibber_r_multicast_packet_unref (packet);
   return TRUE;
 }
 
@@ -485,7 +848,7 @@ id_generation_conflict_send_hook (GibberTransport *transport,
 
             pdata = gibber_r_multicast_packet_get_raw_data (reply, &psize);
             test_transport_write (TEST_TRANSPORT(transport), pdata, psize);
-            g_object_unref (reply);
+            gibber_r_multicast_packet_unref (reply);
           }
         else if (test->count > test->wait)
           {
@@ -509,7 +872,7 @@ id_generation_conflict_send_hook (GibberTransport *transport,
         break;
     }
 
-  g_object_unref (packet);
+  gibber_r_multicast_packet_unref (packet);
   return TRUE;
 }
 
@@ -563,6 +926,12 @@ main (int argc,
       test_fragmentation);
   g_test_add_func ("/gibber/r-multicast-casual-transport/depends",
       test_depends);
+  g_test_add_func ("/gibber/r-multicast-casual-transport/pacing",
+      test_pacing);
+  g_test_add_func ("/gibber/r-multicast-casual-transport/stream-scheduling",
+      test_stream_scheduling);
+  g_test_add_func ("/gibber/r-multicast-casual-transport/compression-join",
+      test_compression_join);
 
   return g_test_run ();
 }
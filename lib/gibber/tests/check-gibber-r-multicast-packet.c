@@ -110,8 +110,8 @@ test_data_packet (void)
     {
       for (i = 0; senders[i].sender_id != 0 ; i++)
         {
-          GibberRMulticastPacketSenderInfo *s = g_array_index (b->depends,
-                  GibberRMulticastPacketSenderInfo *, n);
+          GibberRMulticastPacketSenderInfo *s = &g_array_index (b->depends,
+                  GibberRMulticastPacketSenderInfo, n);
           if (senders[i].sender_id == s->sender_id)
             {
               g_assert (senders[i].packet_id == s->packet_id);
@@ -135,8 +135,8 @@ test_data_packet (void)
 
   g_assert (memcmp (payload, pdata, plen) == 0);
 
-  g_object_unref (a);
-  g_object_unref (b);
+  gibber_r_multicast_packet_unref (a);
+  gibber_r_multicast_packet_unref (b);
 }
 
 static void
@@ -188,8 +188,8 @@ test_attempt_join_packet (void)
     {
       for (i = 0; senders[i].sender_id != 0 ; i++)
         {
-          GibberRMulticastPacketSenderInfo *s = g_array_index (b->depends,
-                  GibberRMulticastPacketSenderInfo *, n);
+          GibberRMulticastPacketSenderInfo *s = &g_array_index (b->depends,
+                  GibberRMulticastPacketSenderInfo, n);
           if (senders[i].sender_id == s->sender_id)
             {
               g_assert (senders[i].packet_id == s->packet_id);
@@ -220,8 +220,179 @@ test_attempt_join_packet (void)
       g_assert (senders[i].seen == TRUE);
     }
 
-  g_object_unref (a);
-  g_object_unref (b);
+  gibber_r_multicast_packet_unref (a);
+  gibber_r_multicast_packet_unref (b);
+}
+
+static void
+test_packet_pool (void)
+{
+  GibberRMulticastPacketPool *pool;
+  GibberRMulticastPacket *a, *b;
+
+  pool = gibber_r_multicast_packet_pool_new ();
+
+  a = gibber_r_multicast_packet_new_pooled (pool, PACKET_TYPE_DATA, 0x1234,
+      1500);
+  gibber_r_multicast_packet_set_packet_id (a, 1);
+  gibber_r_multicast_packet_add_sender_info (a, 0x1, 0x2, NULL);
+  gibber_r_multicast_packet_add_payload (a, (guint8 *) "xyz", 3);
+  gibber_r_multicast_packet_unref (a);
+
+  /* The released packet is handed out again, without its old contents */
+  b = gibber_r_multicast_packet_new_pooled (pool, PACKET_TYPE_SESSION, 0x1234,
+      1500);
+  g_assert (b == a);
+  g_assert (b->type == PACKET_TYPE_SESSION);
+  g_assert_cmpuint (b->packet_id, ==, 0);
+  g_assert_cmpuint (b->depends->len, ==, 0);
+
+  /* Packets keep the pool alive */
+  gibber_r_multicast_packet_pool_unref (pool);
+  gibber_r_multicast_packet_unref (b);
+}
+
+static void
+test_borrowed_packet (void)
+{
+  GibberRMulticastPacket *a, *b;
+  GBytes *datagram;
+  guint8 *raw, *payload;
+  const guint8 *start;
+  gsize len, plen;
+
+  a = gibber_r_multicast_packet_new (PACKET_TYPE_DATA, 0x1234, 1500);
+  gibber_r_multicast_packet_set_packet_id (a, 1);
+  gibber_r_multicast_packet_set_data_info (a, 0,
+      GIBBER_R_MULTICAST_DATA_PACKET_START | GIBBER_R_MULTICAST_DATA_PACKET_END,
+      3);
+  gibber_r_multicast_packet_add_payload (a, (guint8 *) "xyz", 3);
+  raw = gibber_r_multicast_packet_get_raw_data (a, &len);
+
+  datagram = g_bytes_new (raw, len);
+  start = g_bytes_get_data (datagram, NULL);
+
+  /* The payload is a view of the datagram */
+  b = gibber_r_multicast_packet_parse_bytes (NULL, datagram, NULL);
+  g_assert (b != NULL);
+  payload = gibber_r_multicast_packet_get_payload (b, &plen);
+  g_assert (payload == start + len - 3);
+
+  /* Until the packet takes its own copy */
+  gibber_r_multicast_packet_own_data (b);
+  g_bytes_unref (datagram);
+
+  payload = gibber_r_multicast_packet_get_payload (b, &plen);
+  g_assert_cmpuint (plen, ==, 3);
+  g_assert (memcmp (payload, "xyz", 3) == 0);
+
+  gibber_r_multicast_packet_unref (a);
+  gibber_r_multicast_packet_unref (b);
+}
+
+static void
+test_repair_range_packet (void)
+{
+  GibberRMulticastPacket *a, *b;
+  guint32 requested[] = { 0x100, 0x101, 0x105, 0x120, 0x1ff, 0x200 };
+  guint32 id;
+  guint8 *data;
+  gsize len;
+  guint i;
+
+  a = gibber_r_multicast_packet_new (PACKET_TYPE_REPAIR_RANGE_REQUEST,
+      0x1234, 1500);
+  gibber_r_multicast_packet_set_repair_range_info (a, 0x4321, requested[0]);
+
+  for (i = 1; i < G_N_ELEMENTS (requested); i++)
+    g_assert (gibber_r_multicast_packet_repair_range_add (a, requested[i]));
+
+  /* Out of reach of the bitmap */
+  g_assert (!gibber_r_multicast_packet_repair_range_add (a, 0x201));
+  g_assert (!gibber_r_multicast_packet_repair_range_add (a, 0xff));
+
+  data = gibber_r_multicast_packet_get_raw_data (a, &len);
+  b = gibber_r_multicast_packet_parse (data, len, NULL);
+  g_assert (b != NULL);
+
+  COMPARE (type);
+  COMPARE (data.repair_range_request.sender_id);
+  COMPARE (data.repair_range_request.packet_id);
+  COMPARE (data.repair_range_request.bitmap_length);
+
+  id = b->data.repair_range_request.packet_id;
+  for (i = 1; i < G_N_ELEMENTS (requested); i++)
+    {
+      g_assert (gibber_r_multicast_packet_repair_range_next (b, &id));
+      g_assert_cmpuint (id, ==, requested[i]);
+    }
+  g_assert (!gibber_r_multicast_packet_repair_range_next (b, &id));
+
+  /* Truncated bitmap */
+  g_assert (gibber_r_multicast_packet_parse (data, len - 1, NULL) == NULL);
+
+  gibber_r_multicast_packet_unref (a);
+  gibber_r_multicast_packet_unref (b);
+}
+
+static void
+test_parity_packet (void)
+{
+  GibberRMulticastPacket *a, *b;
+  guint8 parity[] = { 1, 2, 3, 4, 5, 6, 7, 8 };
+  guint8 *data;
+  gsize len;
+
+  a = gibber_r_multicast_packet_new (PACKET_TYPE_PARITY, 0x1234, 1500);
+  gibber_r_multicast_packet_set_parity_info (a, 0x4321, 4, 0x77, parity,
+      sizeof (parity));
+
+  data = gibber_r_multicast_packet_get_raw_data (a, &len);
+  b = gibber_r_multicast_packet_parse (data, len, NULL);
+  g_assert (b != NULL);
+
+  COMPARE (type);
+  COMPARE (sender);
+  COMPARE (data.parity.packet_id);
+  COMPARE (data.parity.count);
+  COMPARE (data.parity.length);
+  COMPARE (data.parity.parity_size);
+  g_assert (memcmp (b->data.parity.parity, parity, sizeof (parity)) == 0);
+
+  /* XOR twice with the same data gives back the original */
+  gibber_r_multicast_packet_parity_add (parity, data, sizeof (parity));
+  gibber_r_multicast_packet_parity_add (parity, data, sizeof (parity));
+  g_assert (memcmp (b->data.parity.parity, parity, sizeof (parity)) == 0);
+
+  gibber_r_multicast_packet_unref (a);
+  gibber_r_multicast_packet_unref (b);
+}
+
+static void
+test_rtt_probe_packet (void)
+{
+  GibberRMulticastPacket *a, *b;
+  guint8 *data;
+  gsize len;
+
+  a = gibber_r_multicast_packet_new (PACKET_TYPE_RTT_PROBE, 0x1234, 1500);
+  gibber_r_multicast_packet_set_rtt_probe_info (a, 0xfffffff0, 0x4321,
+      12345, 678, GIBBER_R_MULTICAST_CAPABILITY_DEFLATE);
+
+  data = gibber_r_multicast_packet_get_raw_data (a, &len);
+  b = gibber_r_multicast_packet_parse (data, len, NULL);
+  g_assert (b != NULL);
+
+  COMPARE (type);
+  COMPARE (sender);
+  COMPARE (data.rtt_probe.timestamp);
+  COMPARE (data.rtt_probe.echo_sender);
+  COMPARE (data.rtt_probe.echo_timestamp);
+  COMPARE (data.rtt_probe.echo_delay);
+  COMPARE (data.rtt_probe.capabilities);
+
+  gibber_r_multicast_packet_unref (a);
+  gibber_r_multicast_packet_unref (b);
 }
 
 int
@@ -236,6 +407,14 @@ main (int argc,
       test_attempt_join_packet);
   g_test_add_func ("/gibber/r-multicast-packet/diff",
       test_r_multicast_packet_diff_loop);
+  g_test_add_func ("/gibber/r-multicast-packet/pool", test_packet_pool);
+  g_test_add_func ("/gibber/r-multicast-packet/borrowed",
+      test_borrowed_packet);
+  g_test_add_func ("/gibber/r-multicast-packet/repair-range",
+      test_repair_range_packet);
+  g_test_add_func ("/gibber/r-multicast-packet/parity", test_parity_packet);
+  g_test_add_func ("/gibber/r-multicast-packet/rtt-probe",
+      test_rtt_probe_packet);
 
   return g_test_run ();
 }
@@ -25,6 +25,7 @@
 #include <unistd.h>
 
 #include <gibber/gibber-r-multicast-sender.h>
+#include <gibber/gibber-r-multicast-compress.h>
 
 #define SENDER 4321
 #define SENDER_NAME "testsender"
@@ -104,14 +105,16 @@ generate_packet (guint32 serial)
 }
 
 static void
-data_received_cb (GibberRMulticastSender *sender, guint8 stream_id,
-    guint8 *data, gsize size, gpointer user_data)
+data_received_cb (GibberRMulticastSender *sender, guint16 stream_id,
+    GBytes *payload, gpointer user_data)
 {
   gchar *str;
   gchar **lines;
   int i;
+  gsize size;
+  const gchar *data = g_bytes_get_data (payload, &size);
 
-  str = g_strndup ((const gchar *)data, size);
+  str = g_strndup (data, size);
 
   lines = g_strsplit (str, "\n", 0);
   for (i = 0 ; lines[i] != NULL && *lines[i] != '\0'; i++) {
@@ -136,17 +139,23 @@ data_received_cb (GibberRMulticastSender *sender, guint8 stream_id,
 }
 
 static void
-repair_request_cb (GibberRMulticastSender *sender, guint id, gpointer data)
+repair_request_cb (GibberRMulticastSender *sender, GArray *ids, gpointer data)
 {
-  GibberRMulticastPacket *p;
+  guint i;
+
+  for (i = 0; i < ids->len; i++)
+    {
+      guint32 id = g_array_index (ids, guint32, i);
+      GibberRMulticastPacket *p;
 
-  g_assert (gibber_r_multicast_packet_diff (serial_offset, id) >= 0
-               || gibber_r_multicast_packet_diff (id,
-                  serial_offset + NR_PACKETS + EXTRA_SEEN) < 0);
+      g_assert (gibber_r_multicast_packet_diff (serial_offset, id) >= 0
+                   || gibber_r_multicast_packet_diff (id,
+                      serial_offset + NR_PACKETS + EXTRA_SEEN) < 0);
 
-  p = generate_packet (id);
-  gibber_r_multicast_sender_push (sender, p);
-  g_object_unref (p);
+      p = generate_packet (id);
+      gibber_r_multicast_sender_push (sender, p);
+      gibber_r_multicast_packet_unref (p);
+    }
 }
 
 static void
@@ -177,7 +186,7 @@ add_packet (gpointer data)
     {
       p = generate_packet (i + serial_offset);
       gibber_r_multicast_sender_push (sender, p);
-      g_object_unref (p);
+      gibber_r_multicast_packet_unref (p);
     }
 
   i++;
@@ -257,6 +266,293 @@ test_sender_loop (void)
     test_sender (i);
 }
 
+/* Parity recovery test */
+#define PARITY_GROUP_SIZE 4
+
+static GibberRMulticastPacket *
+generate_parity (guint32 first, guint count)
+{
+  GibberRMulticastPacket *p;
+  guint8 parity[1500] = { 0, };
+  gsize parity_size = 0;
+  guint16 length = 0;
+  guint i;
+
+  for (i = 0; i < count; i++)
+    {
+      GibberRMulticastPacket *d = generate_packet (first + i);
+      guint8 *data;
+      gsize size;
+
+      data = gibber_r_multicast_packet_get_raw_data (d, &size);
+      gibber_r_multicast_packet_parity_add (parity, data, size);
+      parity_size = MAX (parity_size, size);
+      length ^= size;
+
+      gibber_r_multicast_packet_unref (d);
+    }
+
+  p = gibber_r_multicast_packet_new (PACKET_TYPE_PARITY, SENDER, 1500);
+  gibber_r_multicast_packet_set_parity_info (p, first, count, length,
+      parity, parity_size);
+
+  return p;
+}
+
+static void
+test_recover (void)
+{
+  GibberRMulticastSenderGroup *group;
+  GibberRMulticastSender *s;
+  GibberRMulticastPacket *p, *parity, *recovered;
+  guint8 *data, *rdata;
+  gsize size, rsize;
+  guint32 i;
+
+  group = gibber_r_multicast_sender_group_new ();
+
+  for (i = 0 ; receivers[i].receiver_id != 0; i++)
+    {
+      s = gibber_r_multicast_sender_new (receivers[i].receiver_id,
+          receivers[i].name, group);
+      gibber_r_multicast_sender_update_start (s, receivers[i].packet_id);
+      gibber_r_multicast_sender_group_add (group, s);
+    }
+
+  s = gibber_r_multicast_sender_new (SENDER, SENDER_NAME, group);
+  gibber_r_multicast_sender_group_add (group, s);
+  gibber_r_multicast_sender_update_start (s, 0x100);
+
+  /* Lose the third packet of the first group and the last two of the second
+   * one */
+  for (i = 0x100; i < 0x100 + 2 * PARITY_GROUP_SIZE - 2; i++)
+    {
+      if (i == 0x102)
+        continue;
+
+      p = generate_packet (i);
+      gibber_r_multicast_sender_push (s, p);
+      gibber_r_multicast_packet_unref (p);
+    }
+
+  parity = generate_parity (0x100, PARITY_GROUP_SIZE);
+  recovered = gibber_r_multicast_sender_recover (s, parity);
+  gibber_r_multicast_packet_unref (parity);
+
+  g_assert (recovered != NULL);
+  g_assert_cmpuint (recovered->packet_id, ==, 0x102);
+
+  p = generate_packet (0x102);
+  data = gibber_r_multicast_packet_get_raw_data (p, &size);
+  rdata = gibber_r_multicast_packet_get_raw_data (recovered, &rsize);
+  g_assert_cmpuint (size, ==, rsize);
+  g_assert (memcmp (data, rdata, size) == 0);
+  gibber_r_multicast_packet_unref (p);
+
+  gibber_r_multicast_sender_push (s, recovered);
+  gibber_r_multicast_packet_unref (recovered);
+
+  /* Nothing left to recover in the first group */
+  parity = generate_parity (0x100, PARITY_GROUP_SIZE);
+  g_assert (gibber_r_multicast_sender_recover (s, parity) == NULL);
+  gibber_r_multicast_packet_unref (parity);
+
+  /* Two losses are too much for a single parity */
+  parity = generate_parity (0x100 + PARITY_GROUP_SIZE, PARITY_GROUP_SIZE);
+  g_assert (gibber_r_multicast_sender_recover (s, parity) == NULL);
+  gibber_r_multicast_packet_unref (parity);
+
+  gibber_r_multicast_sender_group_free (group);
+}
+
+static void
+push_no_data (GibberRMulticastSender *s, guint32 packet_id,
+    guint32 depend_id, guint32 depend_packet_id)
+{
+  GibberRMulticastPacket *p;
+
+  p = gibber_r_multicast_packet_new (PACKET_TYPE_NO_DATA, s->id, 1500);
+  gibber_r_multicast_packet_set_packet_id (p, packet_id);
+  gibber_r_multicast_packet_add_sender_info (p, depend_id, depend_packet_id,
+      NULL);
+  gibber_r_multicast_sender_push (s, p);
+  gibber_r_multicast_packet_unref (p);
+}
+
+/* Packets others acked before we had them are released once they arrive,
+ * even if the acks don't change any more */
+static void
+test_stable_point (void)
+{
+  GibberRMulticastSenderGroup *group;
+  GibberRMulticastSender *a, *b;
+  guint32 i;
+
+  group = gibber_r_multicast_sender_group_new ();
+
+  a = gibber_r_multicast_sender_new (0x500, "sender1", group);
+  gibber_r_multicast_sender_update_start (a, 0x100);
+  gibber_r_multicast_sender_group_add (group, a);
+
+  b = gibber_r_multicast_sender_new (0x600, "sender2", group);
+  gibber_r_multicast_sender_update_start (b, 0x100);
+  gibber_r_multicast_sender_group_add (group, b);
+
+  /* b already has the first three packets of a */
+  push_no_data (b, 0x100, a->id, 0x103);
+
+  for (i = 0x100; i < 0x103; i++)
+    push_no_data (a, i, b->id, 0x100);
+
+  g_assert_cmpuint (gibber_r_multicast_sender_packet_cache_size (a), ==, 0);
+
+  gibber_r_multicast_sender_group_free (group);
+}
+
+/* Compressed messages are inflated after reassembly */
+#define COMPRESSED_STANZA "<message type='groupchat' from='test@host' " \
+  "to='room'><body>hello</body></message>"
+
+static void
+compressed_received_cb (GibberRMulticastSender *sender, guint16 stream_id,
+    GBytes *payload, gpointer user_data)
+{
+  GString *expected_message = (GString *) user_data;
+  gsize size;
+  const guint8 *data = g_bytes_get_data (payload, &size);
+
+  g_assert_cmpuint (stream_id, ==, 3);
+  g_assert_cmpuint (size, ==, expected_message->len);
+  g_assert (memcmp (data, expected_message->str, size) == 0);
+
+  g_string_truncate (expected_message, 0);
+}
+
+static void
+test_compressed (void)
+{
+  GibberRMulticastSenderGroup *group;
+  GibberRMulticastSender *s;
+  GString *message;
+  GBytes *compressed;
+  const guint8 *data;
+  gsize size, half;
+  guint32 i;
+
+  if (!gibber_r_multicast_compress_available ())
+    return;
+
+  message = g_string_new ("");
+  for (i = 0; i < 20; i++)
+    g_string_append (message, COMPRESSED_STANZA);
+
+  compressed = gibber_r_multicast_compress ((guint8 *) message->str,
+      message->len);
+  g_assert (compressed != NULL);
+  data = g_bytes_get_data (compressed, &size);
+  g_assert_cmpuint (size, <, message->len);
+
+  /* Too short or corrupt data doesn't inflate */
+  g_assert (gibber_r_multicast_decompress (data, 3) == NULL);
+  g_assert (gibber_r_multicast_decompress (data, size - 1) == NULL);
+
+  group = gibber_r_multicast_sender_group_new ();
+  s = gibber_r_multicast_sender_new (SENDER, SENDER_NAME, group);
+  gibber_r_multicast_sender_group_add (group, s);
+  gibber_r_multicast_sender_update_start (s, 0x100);
+  gibber_r_multicast_sender_set_data_start (s, 0x100);
+  g_signal_connect (s, "received-data", G_CALLBACK (compressed_received_cb),
+      message);
+
+  /* Fragmented after compression */
+  half = size / 2;
+  for (i = 0; i < 2; i++)
+    {
+      GibberRMulticastPacket *p;
+
+      p = gibber_r_multicast_packet_new (PACKET_TYPE_DATA, SENDER, 1500);
+      gibber_r_multicast_packet_set_packet_id (p, 0x100 + i);
+      gibber_r_multicast_packet_set_data_info (p, 3,
+          GIBBER_R_MULTICAST_DATA_PACKET_DEFLATE
+          | (i == 0 ? GIBBER_R_MULTICAST_DATA_PACKET_START
+                    : GIBBER_R_MULTICAST_DATA_PACKET_END), size);
+      if (i == 0)
+        gibber_r_multicast_packet_add_payload (p, data, half);
+      else
+        gibber_r_multicast_packet_add_payload (p, data + half, size - half);
+
+      gibber_r_multicast_sender_push (s, p);
+      gibber_r_multicast_packet_unref (p);
+    }
+
+  /* The callback empties the message once it saw it */
+  g_assert_cmpuint (message->len, ==, 0);
+
+  g_bytes_unref (compressed);
+  g_string_free (message, TRUE);
+  gibber_r_multicast_sender_group_free (group);
+}
+
+static void
+count_cb (GibberRMulticastSender *sender, gpointer user_data)
+{
+  (*(guint *) user_data)++;
+}
+
+static void
+count_data_cb (GibberRMulticastSender *sender, guint16 stream_id,
+    GBytes *payload, gpointer user_data)
+{
+  (*(guint *) user_data)++;
+}
+
+/* Without compression support, a compressed message fails its sender rather
+ * than leaving a hole in the stream */
+static void
+test_compressed_unsupported (void)
+{
+  GibberRMulticastSenderGroup *group;
+  GibberRMulticastSender *s;
+  guint received = 0, failed = 0;
+  guint32 i;
+
+  if (gibber_r_multicast_compress_available ())
+    return;
+
+  group = gibber_r_multicast_sender_group_new ();
+  s = gibber_r_multicast_sender_new (SENDER, SENDER_NAME, group);
+  gibber_r_multicast_sender_group_add (group, s);
+  gibber_r_multicast_sender_update_start (s, 0x100);
+  gibber_r_multicast_sender_set_data_start (s, 0x100);
+  g_signal_connect (s, "received-data", G_CALLBACK (count_data_cb),
+      &received);
+  g_signal_connect (s, "failed", G_CALLBACK (count_cb), &failed);
+
+  for (i = 0; i < 2; i++)
+    {
+      GibberRMulticastPacket *p;
+
+      p = gibber_r_multicast_packet_new (PACKET_TYPE_DATA, SENDER, 1500);
+      gibber_r_multicast_packet_set_packet_id (p, 0x100 + i);
+      gibber_r_multicast_packet_set_data_info (p, 3,
+          (i == 0 ? GIBBER_R_MULTICAST_DATA_PACKET_DEFLATE : 0)
+          | GIBBER_R_MULTICAST_DATA_PACKET_START
+          | GIBBER_R_MULTICAST_DATA_PACKET_END, strlen (COMPRESSED_STANZA));
+      gibber_r_multicast_packet_add_payload (p,
+          (const guint8 *) COMPRESSED_STANZA, strlen (COMPRESSED_STANZA));
+
+      gibber_r_multicast_sender_push (s, p);
+      gibber_r_multicast_packet_unref (p);
+    }
+
+  /* Nothing after the compressed message is delivered either, every later
+   * attempt to pop it fails again until the sender is dropped */
+  g_assert_cmpuint (received, ==, 0);
+  g_assert_cmpuint (failed, >, 0);
+
+  gibber_r_multicast_sender_group_free (group);
+}
+
 /* Holding test */
 guint32 idle_timer = 0;
 
@@ -397,7 +693,7 @@ h_next_test_step (h_data_t *d)
 
 static void
 h_received_data_cb (GibberRMulticastSender *sender, guint16 stream_id,
-    guint8 *data, gsize size, gpointer user_data)
+    GBytes *payload, gpointer user_data)
 {
   h_data_t *d = (h_data_t *) user_data;
 
@@ -656,7 +952,7 @@ test_holding (gint _i)
         }
       gibber_r_multicast_sender_push (s0, p);
 
-      g_object_unref (p);
+      gibber_r_multicast_packet_unref (p);
     }
 
     h_next_test_step (&data);
@@ -690,6 +986,12 @@ main (int argc,
 
   g_test_add_func ("/gibber/r-multicast-sender/sender", test_sender_loop);
   g_test_add_func ("/gibber/r-multicast-sender/holding", test_holding_loop);
+  g_test_add_func ("/gibber/r-multicast-sender/recover", test_recover);
+  g_test_add_func ("/gibber/r-multicast-sender/compressed", test_compressed);
+  g_test_add_func ("/gibber/r-multicast-sender/compressed-unsupported",
+      test_compressed_unsupported);
+  g_test_add_func ("/gibber/r-multicast-sender/stable-point",
+      test_stable_point);
 
   return g_test_run ();
 }
@@ -23,6 +23,7 @@
 #include "config.h"
 
 #include <errno.h>
+#include <fcntl.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
@@ -34,6 +35,7 @@
 
 #include <gibber/gibber-unix-transport.h>
 #include <gibber/gibber-listener.h>
+#include <gibber/gibber-reactor.h>
 
 gboolean got_connection;
 gboolean received_credentials;
@@ -225,6 +227,477 @@ test_receive_credentials (void)
   g_main_loop_unref (mainloop);
 }
 
+typedef struct {
+    GMainLoop *loop;
+    GString *received;
+    gsize expected;
+    guint callbacks;
+} SendvData;
+
+static void
+sendv_handler (GibberTransport *transport,
+               GibberBuffer *buffer,
+               gpointer user_data)
+{
+  SendvData *data = user_data;
+
+  data->callbacks++;
+  g_string_append_len (data->received, (const gchar *) buffer->data,
+      buffer->length);
+
+  if (data->received->len >= data->expected)
+    g_main_loop_quit (data->loop);
+}
+
+static void
+writable_cb (GibberTransport *transport,
+    guint *writable)
+{
+  (*writable)++;
+}
+
+static void
+test_sendv (void)
+{
+  GibberUnixTransport *sender, *receiver;
+  GibberBuffer buffers[3];
+  GString *expected;
+  SendvData data;
+  guint8 *big;
+  guint writable = 0;
+  int sv[2];
+  int ret;
+  guint i;
+
+  ret = socketpair (AF_UNIX, SOCK_STREAM, 0, sv);
+  g_assert (ret == 0);
+
+  sender = gibber_unix_transport_new_from_fd (sv[0]);
+  receiver = gibber_unix_transport_new_from_fd (sv[1]);
+
+  /* Big enough to not fit in the socket buffer so part of it gets queued */
+  big = g_malloc (4 * 1024 * 1024);
+  for (i = 0; i < 4 * 1024 * 1024; i++)
+    big[i] = i % 251;
+
+  buffers[0].data = (const guint8 *) DATA;
+  buffers[0].length = strlen (DATA);
+  buffers[1].data = big;
+  buffers[1].length = 4 * 1024 * 1024;
+  buffers[2].data = (const guint8 *) DATA;
+  buffers[2].length = strlen (DATA);
+
+  expected = g_string_new (DATA);
+  g_string_append_len (expected, (const gchar *) big, 4 * 1024 * 1024);
+  g_string_append (expected, DATA);
+
+  data.loop = g_main_loop_new (NULL, FALSE);
+  data.received = g_string_new ("");
+  data.expected = expected->len;
+  data.callbacks = 0;
+
+  gibber_transport_set_handler (GIBBER_TRANSPORT (receiver), sendv_handler,
+      &data);
+  g_signal_connect (sender, "writable", G_CALLBACK (writable_cb), &writable);
+
+  g_assert (gibber_transport_sendv (GIBBER_TRANSPORT (sender), buffers, 3,
+        NULL));
+  g_assert (!gibber_transport_buffer_is_empty (GIBBER_TRANSPORT (sender)));
+  g_assert (gibber_transport_is_congested (GIBBER_TRANSPORT (sender)));
+  g_assert_cmpuint (
+      gibber_transport_get_queued_bytes (GIBBER_TRANSPORT (sender)), >,
+      64 * 1024);
+
+  /* Queue some more behind the backlog */
+  g_assert (gibber_transport_send (GIBBER_TRANSPORT (sender),
+        (const guint8 *) DATA, strlen (DATA), NULL));
+  g_string_append (expected, DATA);
+  data.expected = expected->len;
+
+  g_main_loop_run (data.loop);
+
+  g_assert_cmpuint (data.received->len, ==, expected->len);
+  g_assert (memcmp (data.received->str, expected->str, expected->len) == 0);
+  g_assert (gibber_transport_buffer_is_empty (GIBBER_TRANSPORT (sender)));
+  g_assert (!gibber_transport_is_congested (GIBBER_TRANSPORT (sender)));
+  g_assert_cmpuint (writable, ==, 1);
+
+  g_free (big);
+  g_string_free (expected, TRUE);
+  g_string_free (data.received, TRUE);
+  g_main_loop_unref (data.loop);
+  g_object_unref (sender);
+  g_object_unref (receiver);
+}
+
+static void
+test_batched_read (void)
+{
+  GibberUnixTransport *sender, *receiver;
+  SendvData data;
+  guint8 *big;
+  gsize len = 4 * 1024 * 1024;
+  int sv[2];
+  int ret;
+  gsize i;
+
+  ret = socketpair (AF_UNIX, SOCK_STREAM, 0, sv);
+  g_assert (ret == 0);
+
+  sender = gibber_unix_transport_new_from_fd (sv[0]);
+  receiver = gibber_unix_transport_new_from_fd (sv[1]);
+  gibber_fd_transport_set_read_mode (GIBBER_FD_TRANSPORT (receiver),
+      GIBBER_FD_TRANSPORT_READ_MODE_BATCHED);
+
+  big = g_malloc (len);
+  for (i = 0; i < len; i++)
+    big[i] = i % 251;
+
+  data.loop = g_main_loop_new (NULL, FALSE);
+  data.received = g_string_new ("");
+  data.expected = len;
+  data.callbacks = 0;
+
+  gibber_transport_set_handler (GIBBER_TRANSPORT (receiver), sendv_handler,
+      &data);
+
+  g_assert (gibber_transport_send (GIBBER_TRANSPORT (sender), big, len,
+        NULL));
+
+  g_main_loop_run (data.loop);
+
+  g_assert_cmpuint (data.received->len, ==, len);
+  g_assert (memcmp (data.received->str, big, len) == 0);
+  /* 1024 byte reads would have needed 4096 callbacks */
+  g_assert_cmpuint (data.callbacks, <, len / 1024 / 4);
+
+  g_free (big);
+  g_string_free (data.received, TRUE);
+  g_main_loop_unref (data.loop);
+  g_object_unref (sender);
+  g_object_unref (receiver);
+}
+
+typedef struct {
+  GMainLoop *loop;
+  int fd;
+  guint8 byte;
+  GString *after;
+} RecvFdData;
+
+static void
+recv_fd_cb (GibberUnixTransport *transport,
+    GibberBuffer *buffer,
+    int fd,
+    GError *error,
+    gpointer user_data)
+{
+  RecvFdData *data = user_data;
+
+  g_assert_no_error (error);
+  g_assert_cmpuint (buffer->length, ==, 1);
+
+  data->byte = buffer->data[0];
+  data->fd = fd;
+  g_main_loop_quit (data->loop);
+}
+
+static void
+after_fd_handler (GibberTransport *transport,
+    GibberBuffer *buffer,
+    gpointer user_data)
+{
+  RecvFdData *data = user_data;
+
+  g_string_append_len (data->after, (const gchar *) buffer->data,
+      buffer->length);
+
+  if (data->after->len >= strlen (DATA))
+    g_main_loop_quit (data->loop);
+}
+
+static void
+test_send_fd (void)
+{
+  GibberUnixTransport *sender, *receiver;
+  RecvFdData data;
+  int sv[2], pipe_fds[2];
+  char buf[5];
+  int ret;
+
+  ret = socketpair (AF_UNIX, SOCK_STREAM, 0, sv);
+  g_assert (ret == 0);
+  ret = pipe (pipe_fds);
+  g_assert (ret == 0);
+
+  sender = gibber_unix_transport_new_from_fd (sv[0]);
+  receiver = gibber_unix_transport_new_from_fd (sv[1]);
+
+  data.loop = g_main_loop_new (NULL, FALSE);
+  data.fd = -1;
+  data.byte = 0;
+
+  g_assert (gibber_unix_transport_recv_fd (receiver, recv_fd_cb, &data));
+  /* Only one pending request is allowed */
+  g_assert (!gibber_unix_transport_recv_fd (receiver, recv_fd_cb, &data));
+
+  g_assert (gibber_unix_transport_send_fd (sender, pipe_fds[1],
+        (const guint8 *) "F", 1));
+  close (pipe_fds[1]);
+  g_assert (gibber_transport_send (GIBBER_TRANSPORT (sender),
+        (const guint8 *) DATA, strlen (DATA), NULL));
+
+  g_main_loop_run (data.loop);
+
+  /* What follows the fd is left alone until someone takes care of it */
+  data.after = g_string_new ("");
+  gibber_transport_set_handler (GIBBER_TRANSPORT (receiver),
+      after_fd_handler, &data);
+  gibber_transport_block_receiving (GIBBER_TRANSPORT (receiver), FALSE);
+  g_main_loop_run (data.loop);
+
+  g_assert_cmpstr (data.after->str, ==, DATA);
+  g_string_free (data.after, TRUE);
+
+  g_assert_cmpuint (data.byte, ==, 'F');
+  g_assert (data.fd >= 0);
+  g_assert (data.fd != pipe_fds[1]);
+
+  /* The received fd is the write end of the same pipe */
+  g_assert (write (data.fd, "hello", 5) == 5);
+  close (data.fd);
+  g_assert (read (pipe_fds[0], buf, 5) == 5);
+  g_assert (memcmp (buf, "hello", 5) == 0);
+  close (pipe_fds[0]);
+
+  g_main_loop_unref (data.loop);
+  g_object_unref (sender);
+  g_object_unref (receiver);
+}
+
+/* More than the socket buffer takes at once */
+#define BIG_FD_PAYLOAD (1024 * 1024)
+
+typedef struct {
+  GMainLoop *loop;
+  GString *received;
+  int fd;
+} ShortWriteData;
+
+static void
+short_write_fd_cb (GibberUnixTransport *transport,
+    GibberBuffer *buffer,
+    int fd,
+    GError *error,
+    gpointer user_data)
+{
+  ShortWriteData *data = user_data;
+
+  g_assert_no_error (error);
+
+  g_string_append_len (data->received, (const gchar *) buffer->data,
+      buffer->length);
+  data->fd = fd;
+  g_main_loop_quit (data->loop);
+}
+
+static void
+short_write_handler (GibberTransport *transport,
+    GibberBuffer *buffer,
+    gpointer user_data)
+{
+  ShortWriteData *data = user_data;
+
+  g_string_append_len (data->received, (const gchar *) buffer->data,
+      buffer->length);
+
+  if (data->received->len >= BIG_FD_PAYLOAD)
+    g_main_loop_quit (data->loop);
+}
+
+/* When sendmsg() only takes part of the payload, the rest still arrives */
+static void
+test_send_fd_short_write (void)
+{
+  GibberUnixTransport *sender, *receiver;
+  ShortWriteData data;
+  guint8 *payload;
+  int sv[2], pipe_fds[2];
+  guint i;
+
+  g_assert (socketpair (AF_UNIX, SOCK_STREAM, 0, sv) == 0);
+  g_assert (pipe (pipe_fds) == 0);
+
+  sender = gibber_unix_transport_new_from_fd (sv[0]);
+  receiver = gibber_unix_transport_new_from_fd (sv[1]);
+
+  data.loop = g_main_loop_new (NULL, FALSE);
+  data.received = g_string_new ("");
+  data.fd = -1;
+
+  payload = g_malloc (BIG_FD_PAYLOAD);
+  for (i = 0; i < BIG_FD_PAYLOAD; i++)
+    payload[i] = i % 251;
+
+  g_assert (gibber_unix_transport_recv_fd (receiver, short_write_fd_cb,
+        &data));
+  g_assert (gibber_unix_transport_send_fd (sender, pipe_fds[1], payload,
+        BIG_FD_PAYLOAD));
+  close (pipe_fds[1]);
+
+  /* The socket didn't take all of it, the rest waits in the queue */
+  g_assert_cmpuint (
+      gibber_transport_get_queued_bytes (GIBBER_TRANSPORT (sender)), >, 0);
+
+  g_main_loop_run (data.loop);
+  g_assert (data.fd >= 0);
+  close (data.fd);
+
+  gibber_transport_set_handler (GIBBER_TRANSPORT (receiver),
+      short_write_handler, &data);
+  gibber_transport_block_receiving (GIBBER_TRANSPORT (receiver), FALSE);
+  if (data.received->len < BIG_FD_PAYLOAD)
+    g_main_loop_run (data.loop);
+
+  g_assert_cmpuint (data.received->len, ==, BIG_FD_PAYLOAD);
+  g_assert (memcmp (data.received->str, payload, BIG_FD_PAYLOAD) == 0);
+
+  close (pipe_fds[0]);
+  g_free (payload);
+  g_string_free (data.received, TRUE);
+  g_main_loop_unref (data.loop);
+  g_object_unref (sender);
+  g_object_unref (receiver);
+}
+
+/* Same as the sendv test, with both ends registered with a reactor */
+static void
+test_reactor (void)
+{
+  GibberReactor *reactor;
+
+  if (!gibber_reactor_is_supported ())
+    return;
+
+  reactor = gibber_reactor_new (NULL, NULL);
+  g_assert (reactor != NULL);
+
+  gibber_reactor_set_default (reactor);
+  test_sendv ();
+  gibber_reactor_set_default (NULL);
+
+  gibber_reactor_unref (reactor);
+}
+
+/* More segments than fit in a single writev */
+#define NR_SEGMENTS 80
+#define SEGMENT_LEN 4096
+
+static gboolean
+long_queue_timeout_cb (gpointer user_data)
+{
+  g_main_loop_quit (user_data);
+  return FALSE;
+}
+
+static void
+long_queue_empty_cb (GibberTransport *transport,
+    gpointer user_data)
+{
+  g_main_loop_quit (user_data);
+}
+
+/* The reactor is edge triggered: once the socket has room for the whole
+ * backlog the transport gets a single wakeup, which has to be enough to
+ * write all of it */
+static void
+test_reactor_long_queue (void)
+{
+  GibberReactor *reactor;
+  GibberUnixTransport *sender;
+  GMainLoop *loop;
+  guint8 *expected, *received;
+  guint8 filler[4096];
+  gsize total = NR_SEGMENTS * SEGMENT_LEN;
+  gsize got = 0;
+  socklen_t len;
+  int sv[2], sndbuf, i;
+  ssize_t ret;
+  guint timeout;
+
+  if (!gibber_reactor_is_supported ())
+    return;
+
+  g_assert (socketpair (AF_UNIX, SOCK_STREAM, 0, sv) == 0);
+
+  /* Room for everything at once, so no further edges are coming */
+  sndbuf = 1024 * 1024;
+  setsockopt (sv[0], SOL_SOCKET, SO_SNDBUF, &sndbuf, sizeof (sndbuf));
+  len = sizeof (sndbuf);
+  g_assert (getsockopt (sv[0], SOL_SOCKET, SO_SNDBUF, &sndbuf, &len) == 0);
+  if ((gsize) sndbuf < total + 64 * 1024)
+    {
+      g_test_message ("socket buffer too small (%d), skipping", sndbuf);
+      close (sv[0]);
+      close (sv[1]);
+      return;
+    }
+
+  reactor = gibber_reactor_new (NULL, NULL);
+  g_assert (reactor != NULL);
+  gibber_reactor_set_default (reactor);
+
+  loop = g_main_loop_new (NULL, FALSE);
+  sender = gibber_unix_transport_new_from_fd (sv[0]);
+  g_signal_connect (sender, "buffer-empty",
+      G_CALLBACK (long_queue_empty_cb), loop);
+
+  /* Fill the socket so everything sent below ends up queued */
+  memset (filler, 0, sizeof (filler));
+  while (write (sv[0], filler, sizeof (filler)) > 0)
+    ;
+  g_assert (errno == EAGAIN);
+
+  expected = g_malloc (total);
+  for (i = 0; i < NR_SEGMENTS; i++)
+    {
+      memset (expected + i * SEGMENT_LEN, i + 1, SEGMENT_LEN);
+      g_assert (gibber_transport_send (GIBBER_TRANSPORT (sender),
+            expected + i * SEGMENT_LEN, SEGMENT_LEN, NULL));
+    }
+  g_assert_cmpuint (
+      gibber_transport_get_queued_bytes (GIBBER_TRANSPORT (sender)), ==,
+      total);
+
+  /* Drain the filler without the main loop running */
+  fcntl (sv[1], F_SETFL, O_NONBLOCK);
+  while (read (sv[1], filler, sizeof (filler)) > 0)
+    ;
+
+  timeout = g_timeout_add_seconds (5, long_queue_timeout_cb, loop);
+  g_main_loop_run (loop);
+  g_source_remove (timeout);
+
+  g_assert (gibber_transport_buffer_is_empty (GIBBER_TRANSPORT (sender)));
+
+  received = g_malloc (total);
+  while (got < total)
+    {
+      ret = read (sv[1], received + got, total - got);
+      g_assert (ret > 0);
+      got += ret;
+    }
+  g_assert (memcmp (received, expected, total) == 0);
+
+  g_free (expected);
+  g_free (received);
+  g_main_loop_unref (loop);
+  g_object_unref (sender);
+  close (sv[1]);
+  gibber_reactor_set_default (NULL);
+  gibber_reactor_unref (reactor);
+}
+
 int
 main (int argc,
       char **argv)
@@ -238,6 +711,14 @@ main (int argc,
       test_send_credentials);
   g_test_add_func ("/gibber/unix-transport/receive-credentials",
       test_receive_credentials);
+  g_test_add_func ("/gibber/unix-transport/sendv", test_sendv);
+  g_test_add_func ("/gibber/unix-transport/batched-read", test_batched_read);
+  g_test_add_func ("/gibber/unix-transport/send-fd", test_send_fd);
+  g_test_add_func ("/gibber/unix-transport/send-fd-short-write",
+      test_send_fd_short_write);
+  g_test_add_func ("/gibber/unix-transport/reactor", test_reactor);
+  g_test_add_func ("/gibber/unix-transport/reactor-long-queue",
+      test_reactor_long_queue);
 
   return g_test_run ();
 }
@@ -0,0 +1,119 @@
+#!/usr/bin/env python
+
+# Compare repair traffic and delivery latency with and without forward error
+# correction on a lossy mesh.
+# Usage: fecmeshtest.py [loss] [fec group size, 0 to disable]
+
+from twisted.internet import reactor
+from mesh import Mesh, MeshNode, REPAIR_REQUEST, REPAIR_RANGE_REQUEST, PARITY
+import random
+import time
+import sys
+
+NUMNODES = 5
+NUMPACKETS = 200
+DELAY = 0.02
+
+LOSS = len(sys.argv) > 1 and float(sys.argv[1]) or 0.03
+FEC = len(sys.argv) > 2 and sys.argv[2] or "4"
+
+# Drop the same packets on every run
+random.seed(42)
+
+nodes = []
+# We're optimists
+success = True
+
+class TestMeshNode(MeshNode):
+  nodes = 1
+
+  def __init__ (self, name, mesh):
+    MeshNode.__init__(self, name, mesh, FEC != "0" and (FEC,) or ())
+
+  def newNode (self, data):
+    MeshNode.newNode (self, data)
+    self.nodes += 1
+    if self.nodes == NUMNODES:
+      print "Everybody joined"
+      for x in xrange(0, NUMPACKETS):
+        reactor.callLater(DELAY * x, self.sendNumber, x)
+
+  def sendNumber (self, x):
+    self.mesh.sent[x] = time.time()
+    self.pushInput(str(x) + "\n")
+
+  def leftNode (self, data):
+    MeshNode.leftNode (self, data)
+    reactor.stop()
+
+class TestMesh(Mesh):
+  expected = {}
+  sent = {}
+  latencies = []
+  done = 0
+
+  def gotOutput(self, node, sender, data):
+    global success
+
+    x = int(data)
+    if self.expected.get(node, 0) != x:
+      print "Got " + data.rstrip() + " instead of " + \
+             str(self.expected[node]) + " from "  + node.name
+      success = False
+      reactor.crash()
+
+    self.latencies.append(time.time() - self.sent[x])
+    self.expected[node] = x + 1
+
+    if self.expected[node] == NUMPACKETS:
+      self.done += 1
+
+    if self.done == NUMNODES - 1:
+      self.report()
+      self.nodes[-1].disconnect()
+
+  def report(self):
+    repairs = 0
+    parities = 0
+    for x in self.nodes:
+      repairs += x.packets.get(REPAIR_REQUEST, 0)
+      repairs += x.packets.get(REPAIR_RANGE_REQUEST, 0)
+      parities += x.packets.get(PARITY, 0)
+
+    self.latencies.sort()
+    print "loss %.2f fec %s" % (LOSS, FEC)
+    print "repair requests:\t%d" % repairs
+    print "parity packets:\t%d" % parities
+    print "latency median:\t%.3f" % \
+      self.latencies[len(self.latencies) / 2]
+    print "latency 99%%:\t%.3f" % \
+      self.latencies[len(self.latencies) * 99 / 100]
+
+m = TestMesh()
+
+n = TestMeshNode("node0", m)
+nodes.append(n)
+m.addMeshNode(n)
+
+for x in xrange(1, NUMNODES):
+  nodes.append(m.addMeshNode(MeshNode("node" + str(x), m,
+    FEC != "0" and (FEC,) or ())))
+
+m.connect_full(1024, 50, LOSS)
+
+def timeout():
+  global success
+  print "TIMEOUT!"
+  success = False
+  reactor.crash()
+
+reactor.callLater(120, timeout)
+
+reactor.run()
+
+
+if not success:
+  print "FAILED"
+  sys.exit(-1)
+
+print "SUCCESS"
@@ -9,6 +9,8 @@ packettypes = {    0: "Whois request",
                    1: "Whois reply",
                    2: "Repair request",
                    3: "Session",
+                   4: "Repair range request",
+                   5: "Parity",
                  0xf: "Data",
                 0x10: "No data",
                 0x11: "Failure",
@@ -21,6 +23,8 @@ WHOIS_REQUEST   = 0x0
 WHOIS_REPLY     = 0x1
 REPAIR_REQUEST  = 0x2
 SESSION         = 0x3
+REPAIR_RANGE_REQUEST = 0x4
+PARITY          = 0x5
 DATA            = 0xf
 NO_DATA         = 0x10
 FAILURE         = 0x11
@@ -47,11 +51,11 @@ class BaseMeshNode(protocol.ProcessProtocol):
   delimiter = '\n'
   __buffer = ''
 
-  def __init__(self, name):
+  def __init__(self, name, args = ()):
     self.name = name
     self.process = reactor.spawnProcess(self,
                     "./test-r-multicast-transport-io",
-                    ("test-r-multicast-transport-io", name), 
+                    ("test-r-multicast-transport-io", name) + tuple(args),
                     None)
     self.peers = []
     self.packets = {}
@@ -156,8 +160,8 @@ class BaseMeshNode(protocol.ProcessProtocol):
       print "process ended: " + str(reason)
 
 class MeshNode(BaseMeshNode):
-  def __init__(self, name, mesh):
-    BaseMeshNode.__init__(self, name)
+  def __init__(self, name, mesh, args = ()):
+    BaseMeshNode.__init__(self, name, args)
     self.mesh = mesh
 
   def sendPacket(self, data):
@@ -0,0 +1,692 @@
+/*
+ * sim-r-multicast - run a group of r-multicast nodes over a simulated
+ * network on a virtual clock
+ *
+ * All nodes live in this process, connected by test transports. Datagrams
+ * are delivered to every other node after a delay plus random jitter, or
+ * dropped because of loss or a partition. Time only advances from one timeout
+ * to the next, so long scenarios run much faster than real time and runs
+ * with the same options and seed are repeatable.
+ *
+ * Partitions split the group into two halves for LENGTH seconds starting
+ * START seconds into the run, --partition can be given more than once.
+ *
+ * Nodes start --join-interval apart. The join latency of a node is the time
+ * from its start until it first sees other members, node 0 is left out as
+ * it has nobody to join.
+ *
+ * Usage: sim-r-multicast [--nodes=N] [--duration=SECS] [--loss=FRACTION]
+ *   [--delay=MS] [--jitter=MS] [--rate=MSGS] [--size=BYTES]
+ *   [--join-interval=MS] [--slow-join] [--partition=START:LENGTH]
+ *   [--seed=SEED]
+ */
+
+#include "config.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <glib.h>
+
+#include <gibber/gibber-r-multicast-clock.h>
+#include <gibber/gibber-r-multicast-packet.h>
+#include <gibber/gibber-r-multicast-transport.h>
+#include <gibber/gibber-util.h>
+#include "test-transport.h"
+
+#define MAX_PACKET_SIZE 1500
+
+/* Latencies are counted in 1 ms buckets, the last one collecting everything
+ * slower */
+#define LATENCY_BUCKETS 60000
+
+typedef struct {
+  guint index;
+  gchar *name;
+  TestTransport *t;
+  GibberRMulticastCausalTransport *rmc;
+  GibberRMulticastTransport *rm;
+  gulong rmc_connected_handler;
+  gboolean connected;
+  gint64 started;
+  /* -1 until the node first sees other members */
+  gint64 joined;
+  /* names of the other members as seen by this node */
+  GHashTable *members;
+} Node;
+
+typedef struct {
+  Node *to;
+  GBytes *datagram;
+} Delivery;
+
+typedef struct {
+  gint64 start;
+  gboolean partitioned;
+  /* -1 until the membership of all nodes matches the network */
+  gint64 converged;
+} Phase;
+
+static gint nodes_count = 50;
+static gint duration = 600;
+static gdouble loss = 0.01;
+static gint delay = 10;
+static gint jitter = 5;
+static gdouble rate = 5;
+static gint size = 200;
+static gint join_interval = 100;
+static gboolean slow_join = FALSE;
+static gint seed = 1;
+static gchar **partition_specs = NULL;
+
+static GOptionEntry entries[] = {
+  { "nodes", 'n', 0, G_OPTION_ARG_INT, &nodes_count, "Number of nodes", "N" },
+  { "duration", 'd', 0, G_OPTION_ARG_INT, &duration,
+    "Simulated time in seconds", "SECS" },
+  { "loss", 'l', 0, G_OPTION_ARG_DOUBLE, &loss,
+    "Fraction of datagrams lost", "FRACTION" },
+  { "delay", 0, 0, G_OPTION_ARG_INT, &delay, "One way delay", "MS" },
+  { "jitter", 'j', 0, G_OPTION_ARG_INT, &jitter,
+    "Maximum random extra delay", "MS" },
+  { "rate", 'r', 0, G_OPTION_ARG_DOUBLE, &rate,
+    "Messages per second sent by the whole group", "MSGS" },
+  { "size", 's', 0, G_OPTION_ARG_INT, &size, "Message size", "BYTES" },
+  { "join-interval", 0, 0, G_OPTION_ARG_INT, &join_interval,
+    "Time between nodes joining", "MS" },
+  { "slow-join", 0, 0, G_OPTION_ARG_NONE, &slow_join,
+    "Always wait the full gathering time before joining", NULL },
+  { "partition", 'p', 0, G_OPTION_ARG_STRING_ARRAY, &partition_specs,
+    "Split the group in two halves", "START:LENGTH" },
+  { "seed", 0, 0, G_OPTION_ARG_INT, &seed, "Random seed", "SEED" },
+  { NULL }
+};
+
+static Node *nodes;
+static GHashTable *nodes_by_name;
+static GRand *sim_rand;
+static gint64 sim_start;
+static gboolean partitioned = FALSE;
+static GArray *phases;
+
+/* statistics */
+static guint64 datagrams_sent = 0;
+static guint64 datagram_bytes_sent = 0;
+static guint64 datagrams_lost = 0;
+static guint64 repair_requests = 0;
+static guint64 retransmissions = 0;
+static guint64 messages_sent = 0;
+static guint64 messages_skipped = 0;
+static guint64 messages_delivered = 0;
+static guint64 latencies[LATENCY_BUCKETS];
+/* sender id -> highest reliable packet id seen */
+static GHashTable *highest_sent;
+
+static gint64
+sim_time (void)
+{
+  return gibber_r_multicast_get_time () - sim_start;
+}
+
+static gboolean
+reachable (Node *from,
+    Node *to)
+{
+  guint half = nodes_count / 2;
+
+  if (!partitioned)
+    return TRUE;
+
+  return (from->index < half) == (to->index < half);
+}
+
+static void
+check_convergence (void)
+{
+  Phase *phase = &g_array_index (phases, Phase, phases->len - 1);
+  gint i;
+
+  if (phase->converged >= 0)
+    return;
+
+  for (i = 0; i < nodes_count; i++)
+    {
+      Node *node = nodes + i;
+      guint expected = 0;
+      GHashTableIter iter;
+      gpointer name;
+      gint j;
+
+      if (!node->connected)
+        return;
+
+      for (j = 0; j < nodes_count; j++)
+        {
+          if (j != i && reachable (node, nodes + j))
+            expected++;
+        }
+
+      if (g_hash_table_size (node->members) != expected)
+        return;
+
+      g_hash_table_iter_init (&iter, node->members);
+      while (g_hash_table_iter_next (&iter, &name, NULL))
+        {
+          Node *member = g_hash_table_lookup (nodes_by_name, name);
+
+          if (member == NULL || !reachable (node, member))
+            return;
+        }
+    }
+
+  phase->converged = sim_time ();
+}
+
+static void
+start_phase (void)
+{
+  Phase phase;
+
+  phase.start = sim_time ();
+  phase.partitioned = partitioned;
+  phase.converged = -1;
+  g_array_append_val (phases, phase);
+
+  check_convergence ();
+}
+
+static void
+count_datagram (const guint8 *data,
+    gsize length)
+{
+  GibberRMulticastPacket *packet;
+  gpointer highest;
+
+  datagrams_sent++;
+  datagram_bytes_sent += length;
+
+  packet = gibber_r_multicast_packet_parse (data, length, NULL);
+  g_assert (packet != NULL);
+
+  switch (packet->type)
+    {
+      case PACKET_TYPE_REPAIR_REQUEST:
+      case PACKET_TYPE_REPAIR_RANGE_REQUEST:
+        repair_requests++;
+        break;
+      default:
+        if (!GIBBER_R_MULTICAST_PACKET_IS_RELIABLE_PACKET (packet))
+          break;
+
+        if (g_hash_table_lookup_extended (highest_sent,
+              GUINT_TO_POINTER (packet->sender), NULL, &highest) &&
+            gibber_r_multicast_packet_diff (GPOINTER_TO_UINT (highest),
+              packet->packet_id) <= 0)
+          {
+            /* Sent before, so this is a repair */
+            retransmissions++;
+            break;
+          }
+
+        g_hash_table_insert (highest_sent, GUINT_TO_POINTER (packet->sender),
+            GUINT_TO_POINTER (packet->packet_id));
+        break;
+    }
+
+  gibber_r_multicast_packet_unref (packet);
+}
+
+static gboolean
+deliver_cb (gpointer data)
+{
+  Delivery *d = data;
+  gsize length;
+  const guint8 *datagram = g_bytes_get_data (d->datagram, &length);
+
+  test_transport_write (d->to->t, datagram, length);
+
+  g_bytes_unref (d->datagram);
+  g_slice_free (Delivery, d);
+
+  return FALSE;
+}
+
+static gboolean
+send_hook (GibberTransport *transport,
+    const guint8 *data,
+    gsize length,
+    GError **error,
+    gpointer user_data)
+{
+  Node *from = user_data;
+  GBytes *datagram;
+  gint i;
+
+  count_datagram (data, length);
+
+  datagram = g_bytes_new (data, length);
+
+  for (i = 0; i < nodes_count; i++)
+    {
+      Node *to = nodes + i;
+      Delivery *d;
+      guint latency;
+
+      if (to == from)
+        continue;
+
+      if (!reachable (from, to) || g_rand_double (sim_rand) < loss)
+        {
+          datagrams_lost++;
+          continue;
+        }
+
+      latency = delay;
+      if (jitter > 0)
+        latency += g_rand_int_range (sim_rand, 0, jitter + 1);
+
+      d = g_slice_new (Delivery);
+      d->to = to;
+      d->datagram = g_bytes_ref (datagram);
+      gibber_r_multicast_timeout_add (latency, deliver_cb, d);
+    }
+
+  g_bytes_unref (datagram);
+
+  return TRUE;
+}
+
+static void
+received_data (GibberTransport *transport,
+    GibberBuffer *buffer,
+    gpointer user_data)
+{
+  GibberRMulticastBuffer *rmbuffer = (GibberRMulticastBuffer *) buffer;
+  Node *node = user_data;
+  gint64 sent;
+  gint64 latency;
+
+  if (!gibber_strdiff (rmbuffer->sender, node->name))
+    return;
+
+  g_assert (buffer->length >= sizeof (sent));
+  memcpy (&sent, buffer->data, sizeof (sent));
+
+  latency = (gibber_r_multicast_get_time () - sent) / 1000;
+  latencies[MIN (latency, LATENCY_BUCKETS - 1)]++;
+  messages_delivered++;
+}
+
+static void
+new_senders_cb (GibberRMulticastTransport *transport,
+    GArray *names,
+    gpointer user_data)
+{
+  Node *node = user_data;
+  guint i;
+
+  for (i = 0; i < names->len; i++)
+    {
+      const gchar *name = g_array_index (names, gchar *, i);
+
+      if (gibber_strdiff (name, node->name))
+        g_hash_table_add (node->members, g_strdup (name));
+    }
+
+  if (node->joined < 0 && g_hash_table_size (node->members) > 0)
+    node->joined = sim_time ();
+
+  check_convergence ();
+}
+
+static void
+lost_senders_cb (GibberRMulticastTransport *transport,
+    GArray *names,
+    gpointer user_data)
+{
+  Node *node = user_data;
+  guint i;
+
+  for (i = 0; i < names->len; i++)
+    g_hash_table_remove (node->members, g_array_index (names, gchar *, i));
+
+  check_convergence ();
+}
+
+static void
+rm_connected (GibberRMulticastTransport *transport,
+    gpointer user_data)
+{
+  Node *node = user_data;
+
+  node->connected = TRUE;
+  check_convergence ();
+}
+
+static void
+rm_disconnected (GibberRMulticastTransport *transport,
+    gpointer user_data)
+{
+  Node *node = user_data;
+
+  node->connected = FALSE;
+  g_hash_table_remove_all (node->members);
+}
+
+static void
+rmc_connected (GibberRMulticastCausalTransport *transport,
+    gpointer user_data)
+{
+  Node *node = user_data;
+
+  g_assert (gibber_r_multicast_transport_connect (node->rm, NULL));
+  g_signal_handler_disconnect (transport, node->rmc_connected_handler);
+}
+
+static gboolean
+start_node_cb (gpointer data)
+{
+  Node *node = data;
+
+  node->started = sim_time ();
+
+  /* test transport starts out connected */
+  g_assert (gibber_r_multicast_causal_transport_connect (node->rmc, FALSE,
+      NULL));
+
+  return FALSE;
+}
+
+static void
+node_init (Node *node,
+    guint index)
+{
+  node->index = index;
+  node->name = g_strdup_printf ("node%03u", index);
+  node->connected = FALSE;
+  node->joined = -1;
+  node->members = g_hash_table_new_full (g_str_hash, g_str_equal, g_free,
+      NULL);
+
+  node->t = test_transport_new (send_hook, node);
+  GIBBER_TRANSPORT (node->t)->max_packet_size = MAX_PACKET_SIZE;
+  test_transport_set_echoing (node->t, TRUE);
+
+  node->rmc = gibber_r_multicast_causal_transport_new (
+      GIBBER_TRANSPORT (node->t), node->name);
+  g_object_unref (node->t);
+
+  node->rm = gibber_r_multicast_transport_new (node->rmc);
+  if (slow_join)
+    g_object_set (node->rm, "fast-join", FALSE, NULL);
+  gibber_transport_set_handler (GIBBER_TRANSPORT (node->rm), received_data,
+      node);
+  g_object_unref (node->rmc);
+
+  g_signal_connect (node->rm, "new-senders", G_CALLBACK (new_senders_cb),
+      node);
+  g_signal_connect (node->rm, "lost-senders", G_CALLBACK (lost_senders_cb),
+      node);
+  g_signal_connect (node->rm, "connected", G_CALLBACK (rm_connected), node);
+  g_signal_connect (node->rm, "disconnected", G_CALLBACK (rm_disconnected),
+      node);
+  node->rmc_connected_handler = g_signal_connect (node->rmc, "connected",
+      G_CALLBACK (rmc_connected), node);
+
+  g_hash_table_insert (nodes_by_name, node->name, node);
+
+  gibber_r_multicast_timeout_add (index * join_interval, start_node_cb,
+      node);
+}
+
+static gboolean
+send_message_cb (gpointer data)
+{
+  Node *node = nodes + g_rand_int_range (sim_rand, 0, nodes_count);
+  guint8 *message;
+  gint64 now = gibber_r_multicast_get_time ();
+
+  if (!node->connected)
+    {
+      messages_skipped++;
+      return TRUE;
+    }
+
+  message = g_malloc0 (size);
+  memcpy (message, &now, sizeof (now));
+
+  if (gibber_transport_send (GIBBER_TRANSPORT (node->rm), message, size,
+        NULL))
+    messages_sent++;
+  else
+    messages_skipped++;
+
+  g_free (message);
+
+  return TRUE;
+}
+
+static gboolean
+partition_cb (gpointer data)
+{
+  partitioned = GPOINTER_TO_INT (data);
+  start_phase ();
+
+  return FALSE;
+}
+
+static gboolean
+add_partition (const gchar *spec)
+{
+  gchar **parts = g_strsplit (spec, ":", 0);
+  gboolean ret = FALSE;
+
+  if (g_strv_length (parts) == 2)
+    {
+      guint start = atoi (parts[0]);
+      guint length = atoi (parts[1]);
+
+      gibber_r_multicast_timeout_add (start * 1000, partition_cb,
+          GINT_TO_POINTER (TRUE));
+      gibber_r_multicast_timeout_add ((start + length) * 1000, partition_cb,
+          GINT_TO_POINTER (FALSE));
+      ret = TRUE;
+    }
+
+  g_strfreev (parts);
+  return ret;
+}
+
+static void
+drain_main_context (void)
+{
+  /* test transports send from idle callbacks */
+  while (g_main_context_iteration (NULL, FALSE))
+    ;
+}
+
+static gint64
+latency_percentile (gdouble p)
+{
+  guint64 total = 0, needed, seen = 0;
+  guint i;
+
+  for (i = 0; i < LATENCY_BUCKETS; i++)
+    total += latencies[i];
+
+  if (total == 0)
+    return -1;
+
+  needed = MAX ((guint64) (p * total + 0.5), 1);
+
+  for (i = 0; i < LATENCY_BUCKETS; i++)
+    {
+      seen += latencies[i];
+      if (seen >= needed)
+        break;
+    }
+
+  return i;
+}
+
+static gint
+compare_gint64 (gconstpointer a,
+    gconstpointer b)
+{
+  gint64 ia = *(const gint64 *) a;
+  gint64 ib = *(const gint64 *) b;
+
+  return ia < ib ? -1 : (ia > ib ? 1 : 0);
+}
+
+static void
+report_join_latency (void)
+{
+  GArray *joins = g_array_new (FALSE, FALSE, sizeof (gint64));
+  gint i;
+
+  for (i = 1; i < nodes_count; i++)
+    {
+      if (nodes[i].joined >= 0)
+        {
+          gint64 latency = nodes[i].joined - nodes[i].started;
+
+          g_array_append_val (joins, latency);
+        }
+    }
+
+  g_array_sort (joins, compare_gint64);
+
+  printf ("nodes joined: %u of %d\n", joins->len, nodes_count - 1);
+
+  if (joins->len > 0)
+    {
+      printf ("join latency p50: %.3f s\n",
+          g_array_index (joins, gint64, joins->len / 2) / 1e6);
+      printf ("join latency max: %.3f s\n",
+          g_array_index (joins, gint64, joins->len - 1) / 1e6);
+    }
+
+  g_array_unref (joins);
+}
+
+static void
+report (gdouble wall)
+{
+  guint i;
+  gdouble secs = duration;
+
+  printf ("nodes: %d\n", nodes_count);
+  printf ("simulated time: %d s\n", duration);
+  printf ("wall clock time: %.3f s\n", wall);
+  printf ("datagrams sent: %" G_GUINT64_FORMAT " (%" G_GUINT64_FORMAT
+      " bytes, %" G_GUINT64_FORMAT " deliveries lost)\n", datagrams_sent,
+      datagram_bytes_sent, datagrams_lost);
+  printf ("messages sent: %" G_GUINT64_FORMAT " (%" G_GUINT64_FORMAT
+      " skipped)\n", messages_sent, messages_skipped);
+  printf ("messages delivered: %" G_GUINT64_FORMAT "\n", messages_delivered);
+  printf ("throughput: %.1f messages/s, %.1f bytes/s\n",
+      messages_delivered / secs, messages_delivered * size / secs);
+  printf ("latency p50: %" G_GINT64_FORMAT " ms\n",
+      latency_percentile (0.50));
+  printf ("latency p90: %" G_GINT64_FORMAT " ms\n",
+      latency_percentile (0.90));
+  printf ("latency p99: %" G_GINT64_FORMAT " ms\n",
+      latency_percentile (0.99));
+  printf ("latency max: %" G_GINT64_FORMAT " ms\n",
+      latency_percentile (1.0));
+  printf ("repair requests: %" G_GUINT64_FORMAT "\n", repair_requests);
+  printf ("retransmissions: %" G_GUINT64_FORMAT "\n", retransmissions);
+
+  report_join_latency ();
+
+  for (i = 0; i < phases->len; i++)
+    {
+      Phase *phase = &g_array_index (phases, Phase, i);
+
+      printf ("membership at %.3f s (%s): ", phase->start / 1e6,
+          phase->partitioned ? "partitioned" : "whole");
+
+      if (phase->converged >= 0)
+        printf ("converged after %.3f s\n",
+            (phase->converged - phase->start) / 1e6);
+      else
+        printf ("did not converge\n");
+    }
+}
+
+int
+main (int argc,
+    char **argv)
+{
+  GOptionContext *context;
+  GError *error = NULL;
+  GTimer *timer;
+  gint64 end;
+  gint i;
+
+  g_type_init ();
+
+  context = g_option_context_new ("- simulate an r-multicast group");
+  g_option_context_add_main_entries (context, entries, NULL);
+
+  if (!g_option_context_parse (context, &argc, &argv, &error))
+    {
+      fprintf (stderr, "%s\n", error->message);
+      g_error_free (error);
+      return 1;
+    }
+
+  g_option_context_free (context);
+
+  if (nodes_count < 2 || duration <= 0 || rate <= 0 || delay < 0 ||
+      jitter < 0 || size < (gint) sizeof (gint64))
+    {
+      fprintf (stderr, "Invalid options\n");
+      return 1;
+    }
+
+  /* Random numbers used by the nodes themselves */
+  g_random_set_seed (seed);
+  sim_rand = g_rand_new_with_seed (seed);
+
+  gibber_r_multicast_clock_use_virtual ();
+  sim_start = gibber_r_multicast_get_time ();
+
+  phases = g_array_new (FALSE, FALSE, sizeof (Phase));
+  highest_sent = g_hash_table_new (g_direct_hash, g_direct_equal);
+  nodes_by_name = g_hash_table_new (g_str_hash, g_str_equal);
+  nodes = g_new0 (Node, nodes_count);
+
+  for (i = 0; partition_specs != NULL && partition_specs[i] != NULL; i++)
+    {
+      if (!add_partition (partition_specs[i]))
+        {
+          fprintf (stderr, "Invalid partition: %s\n", partition_specs[i]);
+          return 1;
+        }
+    }
+
+  for (i = 0; i < nodes_count; i++)
+    node_init (nodes + i, i);
+
+  gibber_r_multicast_timeout_add (MAX (1000 / rate, 1), send_message_cb,
+      NULL);
+
+  start_phase ();
+
+  timer = g_timer_new ();
+  end = sim_start + (gint64) duration * G_USEC_PER_SEC;
+
+  do
+    drain_main_context ();
+  while (gibber_r_multicast_clock_run_next (end));
+
+  drain_main_context ();
+
+  report (g_timer_elapsed (timer, NULL));
+
+  g_timer_destroy (timer);
+
+  return 0;
+}
@@ -184,7 +184,8 @@ main (int argc, char **argv)
 {
   GIOChannel *io;
 
-  g_assert (argc == 2);
+  /* Optionally the FEC group size to use */
+  g_assert (argc == 2 || argc == 3);
 
   g_type_init ();
 
@@ -200,6 +201,9 @@ main (int argc, char **argv)
       argv[1]);
   g_object_unref (t);
 
+  if (argc == 3)
+    g_object_set (rmc, "fec-group-size", atoi (argv[2]), NULL);
+
   rm = gibber_r_multicast_transport_new (rmc);
   gibber_transport_set_handler (GIBBER_TRANSPORT (rm), received_data, argv[1]);
   g_object_unref (rmc);
@@ -39,6 +39,7 @@
 #include <sys/socket.h>
 #include <sys/un.h>
 #include <gio/gunixsocketaddress.h>
+#include <gibber/gibber-unix-transport.h>
 #endif
 
 #define DEBUG_FLAG DEBUG_FT
@@ -65,6 +66,8 @@ G_DEFINE_TYPE_WITH_CODE (SalutFileTransferChannel, salut_file_transfer_channel,
                            file_transfer_iface_init);
     G_IMPLEMENT_INTERFACE (TP_TYPE_SVC_CHANNEL_INTERFACE_FILE_TRANSFER_METADATA,
                            NULL);
+    G_IMPLEMENT_INTERFACE (SALUT_TYPE_SVC_CHANNEL_INTERFACE_FD_PASSING,
+                           NULL);
 );
 
 #define CHECK_STR_EMPTY(x) ((x) == NULL || (x)[0] == '\0')
@@ -91,6 +94,9 @@ enum
   PROP_SERVICE_NAME,
   PROP_METADATA,
 
+  /* Salut.Channel.Interface.FDPassing */
+  PROP_PASS_FILE_DESCRIPTOR,
+
   PROP_CONTACT,
   PROP_CONNECTION,
   LAST_PROPERTY
@@ -106,6 +112,10 @@ struct _SalutFileTransferChannelPrivate {
   GSocket *socket;
   gboolean remote_accepted;
   GIOChannel *channel;
+#ifdef G_OS_UNIX
+  /* client connection we are waiting on for the file descriptor */
+  GibberUnixTransport *fd_transport;
+#endif
 
   /* properties */
   TpFileTransferState state;
@@ -122,6 +132,7 @@ struct _SalutFileTransferChannelPrivate {
   gchar *uri;
   gchar *service_name;
   GHashTable *metadata;
+  gboolean pass_file_descriptor;
 };
 
 static void salut_file_transfer_channel_set_state (
@@ -245,6 +256,9 @@ salut_file_transfer_channel_get_property (GObject *object,
             }
         }
         break;
+      case PROP_PASS_FILE_DESCRIPTOR:
+        g_value_set_boolean (value, self->priv->pass_file_descriptor);
+        break;
       default:
         G_OBJECT_WARN_INVALID_PROPERTY_ID (object, property_id, pspec);
         break;
@@ -386,6 +400,40 @@ salut_file_transfer_channel_dispose (GObject *object);
 static void
 salut_file_transfer_channel_finalize (GObject *object);
 
+static gboolean
+fd_passing_properties_setter (GObject *object,
+    GQuark interface,
+    GQuark name,
+    const GValue *value,
+    gpointer setter_data,
+    GError **error)
+{
+  SalutFileTransferChannel *self = (SalutFileTransferChannel *) object;
+
+  g_return_val_if_fail (
+      interface == SALUT_IFACE_QUARK_CHANNEL_INTERFACE_FD_PASSING, FALSE);
+
+  /* PassFileDescriptor is the only property, TpDBusPropertiesMixin already
+   * checked the name and the type */
+  g_assert (G_VALUE_HOLDS_BOOLEAN (value));
+
+#ifdef G_OS_UNIX
+  if (self->priv->socket != NULL)
+    {
+      g_set_error (error, TP_ERROR, TP_ERROR_NOT_AVAILABLE,
+          "The local socket has already been set up");
+      return FALSE;
+    }
+
+  self->priv->pass_file_descriptor = g_value_get_boolean (value);
+  return TRUE;
+#else
+  g_set_error (error, TP_ERROR, TP_ERROR_NOT_IMPLEMENTED,
+      "File descriptor passing is not supported on this platform");
+  return FALSE;
+#endif
+}
+
 static gboolean
 file_transfer_channel_properties_setter (GObject *object,
     GQuark interface,
@@ -475,6 +523,18 @@ salut_file_transfer_channel_get_object_path_suffix (TpBaseChannel *chan)
   return g_strdup_printf ("FileTransferChannel/%p", chan);
 }
 
+static GPtrArray *
+salut_file_transfer_channel_get_interfaces (TpBaseChannel *chan)
+{
+  GPtrArray *interfaces = TP_BASE_CHANNEL_CLASS (
+      salut_file_transfer_channel_parent_class)->get_interfaces (chan);
+
+#ifdef G_OS_UNIX
+  g_ptr_array_add (interfaces, SALUT_IFACE_CHANNEL_INTERFACE_FD_PASSING);
+#endif
+  return interfaces;
+}
+
 static void
 salut_file_transfer_channel_class_init (
     SalutFileTransferChannelClass *salut_file_transfer_channel_class)
@@ -507,6 +567,11 @@ salut_file_transfer_channel_class_init (
     { NULL }
   };
 
+  static TpDBusPropertiesMixinPropImpl fd_passing_props[] = {
+    { "PassFileDescriptor", "pass-file-descriptor", NULL },
+    { NULL }
+  };
+
   static TpDBusPropertiesMixinIfaceImpl prop_interfaces[] = {
     { TP_IFACE_CHANNEL_TYPE_FILE_TRANSFER,
       tp_dbus_properties_mixin_getter_gobject_properties,
@@ -517,7 +582,13 @@ salut_file_transfer_channel_class_init (
       tp_dbus_properties_mixin_getter_gobject_properties,
       NULL,
       file_metadata_props
-    },    { NULL }
+    },
+    { SALUT_IFACE_CHANNEL_INTERFACE_FD_PASSING,
+      tp_dbus_properties_mixin_getter_gobject_properties,
+      fd_passing_properties_setter,
+      fd_passing_props
+    },
+    { NULL }
   };
 
   g_type_class_add_private (salut_file_transfer_channel_class,
@@ -536,6 +607,7 @@ salut_file_transfer_channel_class_init (
     salut_file_transfer_channel_fill_immutable_properties;
   base_class->get_object_path_suffix =
     salut_file_transfer_channel_get_object_path_suffix;
+  base_class->get_interfaces = salut_file_transfer_channel_get_interfaces;
 
   param_spec = g_param_spec_object ("contact",
       "SalutContact object",
@@ -708,6 +780,14 @@ salut_file_transfer_channel_class_init (
   g_object_class_install_property (object_class, PROP_METADATA,
       param_spec);
 
+  param_spec = g_param_spec_boolean ("pass-file-descriptor",
+      "PassFileDescriptor",
+      "Whether the client hands over the file instead of its contents",
+      FALSE,
+      G_PARAM_READABLE | G_PARAM_STATIC_STRINGS);
+  g_object_class_install_property (object_class, PROP_PASS_FILE_DESCRIPTOR,
+      param_spec);
+
   salut_file_transfer_channel_class->dbus_props_class.interfaces = \
       prop_interfaces;
   tp_dbus_properties_mixin_class_init (object_class,
@@ -750,6 +830,14 @@ salut_file_transfer_channel_dispose (GObject *object)
       self->priv->channel = NULL;
     }
 
+#ifdef G_OS_UNIX
+  if (self->priv->fd_transport != NULL)
+    {
+      g_object_unref (self->priv->fd_transport);
+      self->priv->fd_transport = NULL;
+    }
+#endif
+
   /* release any references held by the object here */
 
   if (G_OBJECT_CLASS (salut_file_transfer_channel_parent_class)->dispose)
@@ -1143,6 +1231,14 @@ check_address_and_access_control (SalutFileTransferChannel *self,
   GArray *access_arr;
   guint i;
 
+  if (self->priv->pass_file_descriptor &&
+      address_type != TP_SOCKET_ADDRESS_TYPE_UNIX)
+    {
+      g_set_error (error, TP_ERROR, TP_ERROR_NOT_IMPLEMENTED,
+          "File descriptors can only be passed over a Unix socket");
+      return FALSE;
+    }
+
   /* Do we support this AddressType? */
   access_arr = g_hash_table_lookup (self->priv->available_socket_types,
       GUINT_TO_POINTER (address_type));
@@ -1455,6 +1551,68 @@ get_socket_channel (SalutFileTransferChannel *self,
   return io_channel;
 }
 
+/*
+ * Start transferring the file through @channel, which is either the
+ * connection to the client or the file it handed over.
+ */
+static void
+use_local_channel (SalutFileTransferChannel *self,
+    GIOChannel *channel)
+{
+  GibberFileTransfer *ft = self->priv->ft;
+
+  g_io_channel_set_close_on_unref (channel, TRUE);
+  g_io_channel_set_encoding (channel, NULL, NULL);
+  if (ft->direction == GIBBER_FILE_TRANSFER_DIRECTION_INCOMING)
+    {
+      gibber_file_transfer_receive (ft, channel);
+      g_io_channel_unref (channel);
+    }
+  else
+    {
+      /* gibber_file_transfer_send needs ::remote-accepted to have
+       * already been fired, so let's wait for that, keeping
+       * around the GIOChannel, if it hasn't already happened. */
+      if (self->priv->remote_accepted)
+        {
+          gibber_file_transfer_send (ft, channel);
+          g_io_channel_unref (channel);
+        }
+      else
+        {
+          self->priv->channel = channel;
+        }
+    }
+}
+
+#ifdef G_OS_UNIX
+static void
+fd_received_cb (GibberUnixTransport *transport,
+    GibberBuffer *buffer,
+    int fd,
+    GError *error,
+    gpointer user_data)
+{
+  SalutFileTransferChannel *self = SALUT_FILE_TRANSFER_CHANNEL (user_data);
+
+  if (error != NULL)
+    {
+      DEBUG ("Client didn't pass a file descriptor: %s", error->message);
+      gibber_file_transfer_cancel (self->priv->ft, 500);
+      salut_file_transfer_channel_set_state (
+          TP_SVC_CHANNEL_TYPE_FILE_TRANSFER (self),
+          TP_FILE_TRANSFER_STATE_CANCELLED,
+          TP_FILE_TRANSFER_STATE_CHANGE_REASON_LOCAL_ERROR);
+      return;
+    }
+
+  DEBUG ("Client passed fd %d", fd);
+  /* The client connection stays around until the channel goes away, the
+   * data goes through the file from now on */
+  use_local_channel (self, g_io_channel_unix_new (fd));
+}
+#endif
+
 /*
  * Some client is connecting to the Unix socket.
  */
@@ -1464,13 +1622,10 @@ accept_local_socket_connection (GIOChannel *source,
                                 gpointer user_data)
 {
   SalutFileTransferChannel *self = SALUT_FILE_TRANSFER_CHANNEL (user_data);
-  GibberFileTransfer *ft;
   int new_fd;
   GIOChannel *channel;
 
-  ft = self->priv->ft;
-
-  g_assert (ft != NULL);
+  g_assert (self->priv->ft != NULL);
 
   if (condition & G_IO_IN)
     {
@@ -1483,33 +1638,26 @@ accept_local_socket_connection (GIOChannel *source,
           DEBUG ("accept() failed");
           return FALSE;
         }
+
+#ifdef G_OS_UNIX
+      if (self->priv->pass_file_descriptor)
+        {
+          g_assert (self->priv->fd_transport == NULL);
+
+          self->priv->fd_transport = gibber_unix_transport_new_from_fd (
+              new_fd);
+          gibber_unix_transport_recv_fd (self->priv->fd_transport,
+              fd_received_cb, self);
+          return FALSE;
+        }
+#endif
+
 #ifdef G_OS_WIN32
       channel = g_io_channel_win32_new_fd (new_fd);
 #else
       channel = g_io_channel_unix_new (new_fd);
 #endif
-      g_io_channel_set_close_on_unref (channel, TRUE);
-      g_io_channel_set_encoding (channel, NULL, NULL);
-      if (ft->direction == GIBBER_FILE_TRANSFER_DIRECTION_INCOMING)
-        {
-          gibber_file_transfer_receive (ft, channel);
-          g_io_channel_unref (channel);
-        }
-      else
-        {
-          /* gibber_file_transfer_send needs ::remote-accepted to have
-           * already been fired, so let's wait for that, keeping
-           * around the GIOChannel, if it hasn't already happened. */
-          if (self->priv->remote_accepted)
-            {
-              gibber_file_transfer_send (ft, channel);
-              g_io_channel_unref (channel);
-            }
-          else
-            {
-              self->priv->channel = channel;
-            }
-        }
+      use_local_channel (self, channel);
     }
 
   return FALSE;
@@ -51,6 +51,7 @@
 #include <gibber/gibber-bytestream-direct.h>
 #include <gibber/gibber-bytestream-iface.h>
 #include <gibber/gibber-bytestream-oob.h>
+#include <gibber/gibber-fd-relay.h>
 #include <gibber/gibber-fd-transport.h>
 #include <gibber/gibber-listener.h>
 #include <gibber/gibber-tcp-transport.h>
@@ -160,6 +161,13 @@ struct _SalutTubeStreamPrivate
 
   /* (GibberTransport *) -> guint */
   GHashTable *transport_to_id;
+
+  /* (GibberTransport *) -> (GibberFdRelay *)
+   *
+   * Connections whose data is moved between the local socket and the
+   * bytestream's socket by the kernel, see maybe_start_relay().
+   */
+  GHashTable *transport_to_relay;
   guint last_connection_id;
 
   gchar *service;
@@ -283,6 +291,7 @@ remove_transport (SalutTubeStream *self,
   SalutTubeStreamPrivate *priv = SALUT_TUBE_STREAM_GET_PRIVATE (self);
 
   DEBUG ("disconnect and remove transport");
+  g_hash_table_remove (priv->transport_to_relay, transport);
   g_signal_handlers_disconnect_matched (transport, G_SIGNAL_MATCH_DATA,
       0, 0, NULL, NULL, self);
 
@@ -315,14 +324,91 @@ transport_buffer_empty_cb (GibberTransport *transport,
     {
       DEBUG ("buffer is now empty. Transport can be removed");
       remove_transport (self, bytestream, transport);
-      return;
     }
+}
+
+static gboolean transport_is_relayed (SalutTubeStream *self,
+    GibberTransport *transport);
 
-  /* Buffer is empty so we can unblock the buffer if it was blocked */
-  DEBUG ("tube buffer is empty. Unblock the bytestream");
+static void
+transport_writable_cb (GibberTransport *transport,
+                       SalutTubeStream *self)
+{
+  SalutTubeStreamPrivate *priv = SALUT_TUBE_STREAM_GET_PRIVATE (self);
+  GibberBytestreamIface *bytestream;
+  GibberBytestreamState state;
+
+  bytestream = g_hash_table_lookup (priv->transport_to_bytestream, transport);
+  g_assert (bytestream != NULL);
+  g_object_get (bytestream, "state", &state, NULL);
+
+  if (state == GIBBER_BYTESTREAM_STATE_CLOSED)
+    return;
+
+  /* The relay reads from the bytestream's socket itself */
+  if (transport_is_relayed (self, transport))
+    return;
+
+  DEBUG ("tube transport is writable. Unblock the bytestream");
   gibber_bytestream_iface_block_reading (bytestream, FALSE);
 }
 
+/* When both ends of a connection are plain sockets, let the kernel move the
+ * data between them with splice () instead of copying it through
+ * transport_handler and data_received_cb. Opt-in with SALUT_TUBE_SPLICE for
+ * now */
+static void
+maybe_start_relay (SalutTubeStream *self,
+                   GibberTransport *transport,
+                   GibberBytestreamIface *bytestream)
+{
+  SalutTubeStreamPrivate *priv = SALUT_TUBE_STREAM_GET_PRIVATE (self);
+  GibberTransport *remote;
+  GibberFdRelay *relay;
+  GError *error = NULL;
+
+  if (g_getenv ("SALUT_TUBE_SPLICE") == NULL ||
+      !gibber_fd_relay_is_supported ())
+    return;
+
+  if (!GIBBER_IS_FD_TRANSPORT (transport) ||
+      !GIBBER_IS_BYTESTREAM_DIRECT (bytestream))
+    return;
+
+  remote = gibber_bytestream_direct_get_transport (
+      GIBBER_BYTESTREAM_DIRECT (bytestream));
+  if (remote == NULL || !GIBBER_IS_FD_TRANSPORT (remote))
+    return;
+
+  relay = gibber_fd_relay_new (GIBBER_FD_TRANSPORT (transport),
+      GIBBER_FD_TRANSPORT (remote));
+
+  if (!gibber_fd_relay_start (relay, &error))
+    {
+      DEBUG ("can't relay the connection, copying the data instead: %s",
+          error->message);
+      g_error_free (error);
+      g_object_unref (relay);
+      return;
+    }
+
+  DEBUG ("relaying the connection with splice");
+  g_hash_table_insert (priv->transport_to_relay, g_object_ref (transport),
+      relay);
+}
+
+static gboolean
+transport_is_relayed (SalutTubeStream *self,
+                      GibberTransport *transport)
+{
+  SalutTubeStreamPrivate *priv = SALUT_TUBE_STREAM_GET_PRIVATE (self);
+  GibberFdRelay *relay;
+
+  relay = g_hash_table_lookup (priv->transport_to_relay, transport);
+
+  return relay != NULL && gibber_fd_relay_is_running (relay);
+}
+
 static void
 add_transport (SalutTubeStream *self,
                GibberTransport *transport,
@@ -332,6 +418,10 @@ add_transport (SalutTubeStream *self,
 
   gibber_transport_set_handler (transport, transport_handler, self);
 
+  if (GIBBER_IS_FD_TRANSPORT (transport))
+    gibber_fd_transport_set_read_mode (GIBBER_FD_TRANSPORT (transport),
+        GIBBER_FD_TRANSPORT_READ_MODE_BATCHED);
+
   g_hash_table_insert (priv->transport_to_bytestream,
       g_object_ref (transport), g_object_ref (bytestream));
 
@@ -339,9 +429,13 @@ add_transport (SalutTubeStream *self,
       G_CALLBACK (transport_disconnected_cb), self);
   g_signal_connect (transport, "buffer-empty",
       G_CALLBACK (transport_buffer_empty_cb), self);
+  g_signal_connect (transport, "writable",
+      G_CALLBACK (transport_writable_cb), self);
 
   /* We can transfer transport's data; unblock it. */
   gibber_transport_block_receiving (transport, FALSE);
+
+  maybe_start_relay (self, transport, bytestream);
 }
 
 static void
@@ -365,6 +459,10 @@ bytestream_write_blocked_cb (GibberBytestreamIface *bytestream,
       DEBUG ("bytestream unblocked, restart to read data from the tube socket");
     }
 
+  /* The relay reads from the socket itself */
+  if (transport_is_relayed (self, transport))
+    return;
+
   gibber_transport_block_receiving (transport, blocked);
 }
 
@@ -935,6 +1033,10 @@ salut_tube_stream_init (SalutTubeStream *self)
 
   priv->transport_to_id = g_hash_table_new_full (g_direct_hash,
       g_direct_equal, NULL, NULL);
+
+  priv->transport_to_relay = g_hash_table_new_full (g_direct_hash,
+      g_direct_equal, (GDestroyNotify) g_object_unref,
+      (GDestroyNotify) g_object_unref);
   priv->last_connection_id = 0;
 
   priv->address_type = TP_SOCKET_ADDRESS_TYPE_UNIX;
@@ -965,6 +1067,7 @@ close_each_extra_bytestream (gpointer key,
   g_signal_handlers_disconnect_matched (transport, G_SIGNAL_MATCH_DATA,
       0, 0, NULL, NULL, self);
 
+  g_hash_table_remove (priv->transport_to_relay, transport);
   gibber_bytestream_iface_close (bytestream, NULL);
   gibber_transport_disconnect (transport);
   fire_connection_closed (self, transport, TP_ERROR_STR_CANCELLED,
@@ -1006,6 +1109,12 @@ salut_tube_stream_dispose (GObject *object)
       g_string_free (path, TRUE);
     }
 
+  if (priv->transport_to_relay != NULL)
+    {
+      g_hash_table_unref (priv->transport_to_relay);
+      priv->transport_to_relay = NULL;
+    }
+
   if (priv->transport_to_bytestream != NULL)
     {
       g_hash_table_unref (priv->transport_to_bytestream);
@@ -1482,7 +1591,7 @@ data_received_cb (GibberBytestreamIface *bytestream,
   /* If something goes wrong when trying to write the data on the transport,
    * it could be disconnected, causing its removal from the hash tables.
    * When removed, the transport would be destroyed as the hash tables keep a
-   * ref on it and so we'll call _buffer_is_empty on a destroyed transport.
+   * ref on it and so we'll call _is_congested on a destroyed transport.
    * We avoid that by reffing the transport between the 2 calls so we keep it
    * artificially alive if needed. */
   g_object_ref (transport);
@@ -1495,10 +1604,11 @@ data_received_cb (GibberBytestreamIface *bytestream,
     return;
   }
 
-  if (!gibber_transport_buffer_is_empty (transport))
+  if (gibber_transport_is_congested (transport)
+      && !transport_is_relayed (tube, transport))
     {
-      /* We don't want to send more data while the buffer isn't empty */
-      DEBUG ("tube buffer isn't empty. Block the bytestream");
+      /* Stop reading until the transport drained below its low watermark */
+      DEBUG ("tube transport is congested. Block the bytestream");
       gibber_bytestream_iface_block_reading (bytestream, TRUE);
     }
   g_object_unref (transport);
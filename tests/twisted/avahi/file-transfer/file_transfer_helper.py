@@ -248,7 +248,7 @@ class ReceiveFileTest(FileTransferTest):
         # check channel properties
         # org.freedesktop.Telepathy.Channel D-Bus properties
         assert props[cs.CHANNEL_TYPE] == cs.CHANNEL_TYPE_FILE_TRANSFER
-        assert props[cs.INTERFACES] == []
+        assert props[cs.INTERFACES] == [cs.CHANNEL_IFACE_FD_PASSING]
         assert props[cs.TARGET_HANDLE] == self.handle
         assert props[cs.TARGET_ID] == self.contact_name
         assert props[cs.TARGET_HANDLE_TYPE] == cs.HT_CONTACT
@@ -412,7 +412,7 @@ class SendFileTest(FileTransferTest):
 
         # org.freedesktop.Telepathy.Channel D-Bus properties
         assert props[cs.CHANNEL_TYPE] == cs.CHANNEL_TYPE_FILE_TRANSFER
-        assert props[cs.INTERFACES] == []
+        assert props[cs.INTERFACES] == [cs.CHANNEL_IFACE_FD_PASSING]
         assert props[cs.TARGET_HANDLE] == self.handle
         assert props[cs.TARGET_ID] == self.contact_name
         assert props[cs.TARGET_HANDLE_TYPE] == cs.HT_CONTACT
@@ -54,6 +54,7 @@ CHANNEL_IFACE_ROOM = CHANNEL + '.Interface.Room2'
 CHANNEL_IFACE_ROOM_CONFIG = CHANNEL + '.Interface.RoomConfig1'
 CHANNEL_IFACE_SUBJECT = CHANNEL + '.Interface.Subject2'
 CHANNEL_IFACE_FILE_TRANSFER_METADATA = CHANNEL + '.Interface.FileTransfer.Metadata'
+CHANNEL_IFACE_FD_PASSING = 'org.freedesktop.Telepathy.Salut.Channel.Interface.FDPassing'
 CHANNEL_IFACE_SMS = CHANNEL + '.Interface.SMS'
 
 CHANNEL_TYPE_CALL = CHANNEL + ".Type.Call1"